@@ -6,159 +6,789 @@
 #include <pthread.h>
 #include <sched.h>
 #include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
 #include "sr_arpcache.h"
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_rt.h"
+#include "sr_snapshot.h"
 
-/* Helper function used to handle ARP requests */
-void handle_arpreq(struct sr_arpreq* req, struct sr_instance* sr) {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-  if(difftime(time(NULL), req->sent) >= 1.0) {
-    if(req->times_sent > 4) {
+/* The counters the control socket reports, and nreqs, are read from its
+   thread without the cache lock, which the event loop never takes. */
+#define sr_arpcache_count(c, n) __atomic_add_fetch(&(c), (n), __ATOMIC_RELAXED)
 
-      struct sr_packet* pkt_i;
-      for(pkt_i = req->packets; pkt_i; pkt_i = pkt_i->next) {
+static void sr_arpcache_arm(struct sr_arpcache *cache, struct sr_timer *timer,
+                            uint64_t expires);
+static void sr_arpreq_unlink(struct sr_arpcache *cache, struct sr_arpreq *req);
+static unsigned int sr_arpcache_hash(uint32_t ip, unsigned int bits);
 
-        size_t len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)
-          + sizeof(sr_icmp_t11_hdr_t);
-        uint8_t* out_pkt = malloc(len);
-    
-        sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*) out_pkt;
-        sr_ip_hdr_t* ip_hdr = 
-          (sr_ip_hdr_t*) (out_pkt+sizeof(sr_ethernet_hdr_t));
-        sr_icmp_t11_hdr_t* icmp_hdr =
-          (sr_icmp_t11_hdr_t*) (out_pkt+sizeof(sr_ethernet_hdr_t)
-          +sizeof(sr_ip_hdr_t));
-      
-        sr_ethernet_hdr_t* tmp_eth = (sr_ethernet_hdr_t*) pkt_i->buf;
-        sr_ip_hdr_t* tmp_ip = (sr_ip_hdr_t*) (pkt_i->buf+sizeof(sr_ethernet_hdr_t));
-      
-        memset(eth_hdr->ether_dhost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
-        memcpy(eth_hdr->ether_dhost, tmp_eth->ether_shost, sizeof(uint8_t)*ETHER_ADDR_LEN);
-        memset(eth_hdr->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
-        memcpy(eth_hdr->ether_shost, tmp_eth->ether_dhost, sizeof(uint8_t)*ETHER_ADDR_LEN);
-      
-        eth_hdr->ether_type = htons(ethertype_ip);
-
-        ip_hdr->ip_v = 4;
-        ip_hdr->ip_hl = 5;
-        ip_hdr->ip_tos = 3;
-        ip_hdr->ip_len = htons(20 + sizeof(sr_icmp_t11_hdr_t));
-        ip_hdr->ip_id = htons(0);
-        ip_hdr->ip_off = htons(0);
-        ip_hdr->ip_ttl = 64;
-        ip_hdr->ip_p = ip_protocol_icmp;
-        ip_hdr->ip_sum = 0x0;
-        ip_hdr->ip_dst = tmp_ip->ip_src;
-
-        struct sr_if* if_i, *if_tmp = NULL;
-        for(if_i = sr->if_list; if_i; if_i = if_i->next) {
-          if(strncmp(if_i->addr, tmp_eth->ether_dhost, ETHER_ADDR_LEN) == 0) {
-            if_tmp = if_i;
-            ip_hdr->ip_src = if_i->ip;
-            break;
-          }  
-        }
+/* How long to wait after the ARP request just sent: req_interval, grown by
+   req_backoff for every request before it. */
+static uint64_t sr_arpreq_interval(struct sr_arpcache *cache,
+                                   struct sr_arpreq *req) {
+    uint64_t interval = cache->req_interval;
+    uint32_t i;
+
+    for (i = 1; i < req->times_sent && interval < SR_ARPREQ_MAX_INTERVAL; i++)
+        interval *= cache->req_backoff;
+    return interval < SR_ARPREQ_MAX_INTERVAL ? interval : SR_ARPREQ_MAX_INTERVAL;
+}
+
+/* Builds and sends an ARP request for ip out of interface ifindex,
+   broadcast or, to refresh a known neighbor, unicast to mac. */
+static void sr_arpreq_send(struct sr_instance* sr, uint32_t ip,
+                           unsigned int ifindex, const unsigned char* mac) {
+  uint8_t out_pkt[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+
+  sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*) out_pkt;
+  sr_arp_hdr_t* arp_hdr = 
+    (sr_arp_hdr_t*) (out_pkt+sizeof(sr_ethernet_hdr_t));
+
+  struct sr_if* iface = sr_get_interface_index(sr, ifindex);
+  if(!iface)
+    return;
+
+  memset(eth_hdr->ether_dhost, 0xff, sizeof(uint8_t)*ETHER_ADDR_LEN);
+  if(mac)
+    memcpy(eth_hdr->ether_dhost, mac, sizeof(uint8_t)*ETHER_ADDR_LEN);
+  memset(eth_hdr->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
+  memcpy(eth_hdr->ether_shost, iface->addr, sizeof(uint8_t)*ETHER_ADDR_LEN);
+  
+  eth_hdr->ether_type = htons(ethertype_arp);
+
+  arp_hdr->ar_hrd = htons(arp_hrd_ethernet);
+  arp_hdr->ar_pro = htons(ethertype_ip);
+  arp_hdr->ar_hln = ETHER_ADDR_LEN;
+  arp_hdr->ar_pln = 4;
+  arp_hdr->ar_op = htons(arp_op_request);
+  
+  memset(arp_hdr->ar_sha, 0, sizeof(unsigned char)*ETHER_ADDR_LEN);
+  memcpy(arp_hdr->ar_sha, iface->addr, sizeof(unsigned char)*ETHER_ADDR_LEN);
+  arp_hdr->ar_sip = iface->ip;
+
+  memset(arp_hdr->ar_tha, 0, sizeof(unsigned char)*ETHER_ADDR_LEN);
+  if(mac)
+    memcpy(arp_hdr->ar_tha, mac, sizeof(unsigned char)*ETHER_ADDR_LEN);
+  arp_hdr->ar_tip = ip;
+
+  sr_send_packet_if(sr, out_pkt, sizeof(out_pkt), iface);
+}
+
+/* Sends icmp host unreachable to the source of every packet waiting on a
+   request that was given up on, back out of the interface it came in on. */
+static void sr_arpreq_bounce(struct sr_instance* sr, struct sr_arpreq* req) {
+
+  struct sr_packet* pkt_i;
+  for(pkt_i = req->packets; pkt_i; pkt_i = pkt_i->next) {
+
+    uint8_t out_pkt[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t)
+      + sizeof(sr_icmp_t11_hdr_t)];
+
+    sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*) out_pkt;
+    sr_ip_hdr_t* ip_hdr = 
+      (sr_ip_hdr_t*) (out_pkt+sizeof(sr_ethernet_hdr_t));
+    sr_icmp_t11_hdr_t* icmp_hdr =
+      (sr_icmp_t11_hdr_t*) (out_pkt+sizeof(sr_ethernet_hdr_t)
+      +sizeof(sr_ip_hdr_t));
+  
+    sr_ethernet_hdr_t* tmp_eth = (sr_ethernet_hdr_t*) pkt_i->buf;
+    sr_ip_hdr_t* tmp_ip = (sr_ip_hdr_t*) (pkt_i->buf+sizeof(sr_ethernet_hdr_t));
+  
+    struct sr_if* if_tmp = sr_get_interface_index(sr, pkt_i->in_ifindex);
+    if(!if_tmp)
+      continue;
+
+    memset(eth_hdr->ether_dhost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
+    memcpy(eth_hdr->ether_dhost, tmp_eth->ether_shost, sizeof(uint8_t)*ETHER_ADDR_LEN);
+    memset(eth_hdr->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
+    memcpy(eth_hdr->ether_shost, if_tmp->addr, sizeof(uint8_t)*ETHER_ADDR_LEN);
+  
+    eth_hdr->ether_type = htons(ethertype_ip);
 
-        ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = 5;
+    ip_hdr->ip_tos = 3;
+    ip_hdr->ip_len = htons(20 + sizeof(sr_icmp_t11_hdr_t));
+    ip_hdr->ip_id = htons(0);
+    ip_hdr->ip_off = htons(0);
+    ip_hdr->ip_ttl = 64;
+    ip_hdr->ip_p = ip_protocol_icmp;
+    ip_hdr->ip_sum = 0x0;
+    ip_hdr->ip_src = if_tmp->ip;
+    ip_hdr->ip_dst = tmp_ip->ip_src;
 
-        icmp_hdr->icmp_type = 0x03;
-        icmp_hdr->icmp_code = 1;
-        icmp_hdr->unused = htonl(0);
+    ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
 
-        memset(icmp_hdr->data, 0, sizeof(uint8_t)*ICMP_DATA_SIZE);
-        memcpy(icmp_hdr->data, tmp_ip, sizeof(uint8_t)*ICMP_DATA_SIZE);
+    icmp_hdr->icmp_type = 0x03;
+    icmp_hdr->icmp_code = 1;
+    icmp_hdr->unused = htonl(0);
 
-        icmp_hdr->icmp_sum = 0x00;
-        icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_t11_hdr_t));
+    memset(icmp_hdr->data, 0, sizeof(uint8_t)*ICMP_DATA_SIZE);
+    memcpy(icmp_hdr->data, tmp_ip, sizeof(uint8_t)*ICMP_DATA_SIZE);
 
-        sr_send_packet(sr, out_pkt, len, if_tmp->name);
-      }
-      sr_arpreq_destroy_nomut(&(sr->cache), req);
+    icmp_hdr->icmp_sum = 0x00;
+    icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_t11_hdr_t));
+
+    sr_send_packet_if(sr, out_pkt, sizeof(out_pkt), if_tmp);
+  }
+}
+
+/* What handle_arpreq() decided under the cache lock, done by
+   sr_arpwork_finish() once the lock is released: the ARP requests to send,
+   and the requests given up on, already off the queue, whose packets are to
+   be bounced.  The cache is saved too if its save timer fired. */
+#define SR_ARPWORK_LOCAL 16
+
+struct sr_arpsend {
+    uint32_t ip;
+    unsigned int ifindex;
+    int unicast;
+    unsigned char mac[ETHER_ADDR_LEN];
+};
+
+struct sr_arpwork {
+    struct sr_instance *sr;
+    struct sr_arpsend *send;
+    unsigned int nsend;
+    unsigned int maxsend;
+    struct sr_arpreq *bounce;
+    int save;
+    struct sr_arpsend local[SR_ARPWORK_LOCAL];
+};
+
+static void sr_arpwork_init(struct sr_arpwork *work, struct sr_instance *sr) {
+    work->sr = sr;
+    work->send = work->local;
+    work->nsend = 0;
+    work->maxsend = SR_ARPWORK_LOCAL;
+    work->bounce = NULL;
+    work->save = 0;
+}
+
+/* -- mac is the neighbor's for a unicast refresh, NULL to broadcast -- */
+static void sr_arpwork_send(struct sr_arpwork *work, uint32_t ip,
+                            unsigned int ifindex, const unsigned char *mac) {
+    if (work->nsend == work->maxsend) {
+        struct sr_arpsend *send = (struct sr_arpsend *)
+            malloc(2 * work->maxsend * sizeof(struct sr_arpsend));
+
+        /* -- the request is sent again on its next try -- */
+        if (!send)
+            return;
+        memcpy(send, work->send, work->nsend * sizeof(struct sr_arpsend));
+        if (work->send != work->local)
+            free(work->send);
+        work->send = send;
+        work->maxsend *= 2;
     }
-    else {
-      /* Create outgoing ARP request */
-      size_t len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-      uint8_t* out_pkt = malloc(len);
-
-      sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*) out_pkt;
-      sr_arp_hdr_t* arp_hdr = 
-        (sr_arp_hdr_t*) (out_pkt+sizeof(sr_ethernet_hdr_t));
-
-      struct sr_if* iface = sr_get_interface(sr, req->packets->iface);
-
-      memset(eth_hdr->ether_dhost, 0xff, sizeof(uint8_t)*ETHER_ADDR_LEN);
-      memset(eth_hdr->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
-      memcpy(eth_hdr->ether_shost, iface->addr, sizeof(uint8_t)*ETHER_ADDR_LEN);
-      
-      eth_hdr->ether_type = htons(ethertype_arp);
-
-      arp_hdr->ar_hrd = htons(arp_hrd_ethernet);
-      arp_hdr->ar_pro = htons(ethertype_ip);
-      arp_hdr->ar_hln = ETHER_ADDR_LEN;
-      arp_hdr->ar_pln = 4;
-      arp_hdr->ar_op = htons(arp_op_request);
-      
-      memset(arp_hdr->ar_sha, 0, sizeof(unsigned char)*ETHER_ADDR_LEN);
-      memcpy(arp_hdr->ar_sha, iface->addr, sizeof(unsigned char)*ETHER_ADDR_LEN);
-      arp_hdr->ar_sip = iface->ip;
-
-      memset(arp_hdr->ar_tha, 0, sizeof(unsigned char)*ETHER_ADDR_LEN);
-      arp_hdr->ar_tip = req->ip;
-
-      sr_send_packet(sr, out_pkt, len, iface->name);
-      req->sent = time(NULL);
-      req->times_sent++;
+    work->send[work->nsend].ip = ip;
+    work->send[work->nsend].ifindex = ifindex;
+    work->send[work->nsend].unicast = mac != NULL;
+    if (mac)
+        memcpy(work->send[work->nsend].mac, mac, ETHER_ADDR_LEN);
+    work->nsend++;
+}
+
+/* Sends what was collected.  Must be called without the cache lock. */
+static void sr_arpwork_finish(struct sr_arpwork *work) {
+    struct sr_arpreq *req, *next;
+    unsigned int i;
+
+    for (i = 0; i < work->nsend; i++)
+        sr_arpreq_send(work->sr, work->send[i].ip, work->send[i].ifindex,
+                       work->send[i].unicast ? work->send[i].mac : NULL);
+    if (work->send != work->local)
+        free(work->send);
+
+    for (req = work->bounce; req; req = req->next)
+        sr_arpreq_bounce(work->sr, req);
+    for (req = work->bounce; req; req = next) {
+        next = req->next;
+        sr_arpreq_destroy(&(work->sr->cache), req);
+    }
+
+    if (work->save && sr_arpcache_save(&(work->sr->cache),
+                                       work->sr->cache.save_file) < 0)
+        fprintf(stderr, "Error saving the ARP cache to %s\n",
+                work->sr->cache.save_file);
+}
+
+/* -- the negative cache slot for ip -- */
+static struct sr_arpneg *sr_arpneg_slot(struct sr_arpcache *cache,
+                                        uint32_t ip) {
+    return &(cache->neg[sr_arpcache_hash(ip, SR_ARPNEG_BITS)]);
+}
+
+/* Takes a token for one ARP request from the bucket, refilled at req_rate
+   a second up to req_burst.  Returns 0 if there is none. */
+static int sr_arpcache_token(struct sr_arpcache *cache) {
+    uint64_t now = sr_clock_ms();
+
+    if (cache->req_rate == 0)
+        return 1;
+    if (now > cache->tokens_at) {
+        cache->tokens += (now - cache->tokens_at) * cache->req_rate;
+        if (cache->tokens > (uint64_t)cache->req_burst * 1000)
+            cache->tokens = (uint64_t)cache->req_burst * 1000;
+        cache->tokens_at = now;
+    }
+    if (cache->tokens < 1000)
+        return 0;
+    cache->tokens -= 1000;
+    return 1;
+}
+
+/* When a request that found no token should try again.  Each waiting
+   request gets a later token than the last, so they do not all wake for
+   the same one. */
+static uint64_t sr_arpcache_token_at(struct sr_arpcache *cache) {
+    uint64_t at = cache->tokens_at +
+        (1000 - cache->tokens + cache->req_rate - 1) / cache->req_rate;
+
+    if (cache->token_next < at)
+        cache->token_next = at;
+    at = cache->token_next;
+    cache->token_next += (1000 + cache->req_rate - 1) / cache->req_rate;
+    return at;
+}
+
+/* Helper function used to handle ARP requests, run by the request's timer
+   with the cache locked.  Only decides; the packets go out in
+   sr_arpwork_finish(). */
+static void handle_arpreq(struct sr_arpreq* req, struct sr_arpwork* work) {
+  struct sr_arpcache* cache = &(work->sr->cache);
+
+  if(req->times_sent >= SR_ARPREQ_TRIES) {
+    struct sr_arpneg* neg = sr_arpneg_slot(cache, req->ip);
+
+    if(cache->neg_ms) {
+      neg->ip = req->ip;
+      neg->until = sr_clock_ms() + cache->neg_ms;
     }
+    sr_arpcache_count(cache->dropped, req->npackets);
+    sr_arpreq_unlink(cache, req);
+    req->next = work->bounce;
+    work->bounce = req;
+  }
+  else if(!sr_arpcache_token(cache)) {
+    sr_arpcache_count(cache->limited, 1);
+    sr_arpcache_arm(cache, &(req->timer), sr_arpcache_token_at(cache));
   }
+  else {
+    sr_arpwork_send(work, req->ip, req->ifindex, NULL);
+    req->sent = sr_clock_ms();
+    req->times_sent++;
+    sr_arpcache_arm(cache, &(req->timer),
+                    req->sent + sr_arpreq_interval(cache, req));
+  }
+}
+
+static void sr_arpreq_retry(struct sr_timer *timer, void *work) {
+    handle_arpreq(sr_timer_owner(timer, struct sr_arpreq, timer),
+                  (struct sr_arpwork *)work);
+}
+
+/* -- cache->lock, unless the event loop is the only thread using it -- */
+static void sr_arpcache_lock(struct sr_arpcache *cache) {
+    if (!cache->single)
+        pthread_mutex_lock(&(cache->lock));
+}
+
+static void sr_arpcache_unlock(struct sr_arpcache *cache) {
+    if (!cache->single)
+        pthread_mutex_unlock(&(cache->lock));
 }
 
 /* 
-  This function gets called every second. For each request sent out, we keep
-  checking whether we should resend an request or destroy the arp request.
-  See the comments in the header file for an idea of what it should look like.
+  Runs the timers that are due: entries that expired and requests to send
+  again or give up on.  Called by the timeout thread, or the event loop,
+  whenever the next timer is due.  The lock is only held to run the
+  timers; the ARP requests and host unreachables they produce are sent
+  after it is released.
 */
 void sr_arpcache_sweepreqs(struct sr_instance *sr) { 
-    /* Fill this in */
-  struct sr_arpreq* req = sr->cache.requests;
+    struct sr_arpwork work;
 
-  pthread_mutex_lock(&sr->cache.lock);
-  while(req) {
-    struct sr_arpreq* cur_req = req;
-    req = req->next;
+    sr_arpwork_init(&work, sr);
+    sr_arpcache_lock(&(sr->cache));
+    sr_timer_run(&(sr->cache.timers), sr_clock_update(), &work);
+    sr_arpcache_unlock(&(sr->cache));
+    sr_arpwork_finish(&work);
+}
 
-    handle_arpreq(cur_req, sr);
-  }
-  pthread_mutex_unlock(&sr->cache.lock);
+/* -- multiplicative hash, top bits depend on every bit of the address -- */
+static unsigned int sr_arpcache_hash(uint32_t ip, unsigned int bits) {
+    return (uint32_t)(ip * 2654435761U) >> (32 - bits);
+}
+
+/* -- writers hold cache->lock; an odd seq makes lookups wait and retry -- */
+static void sr_arpcache_write_begin(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELAXED);
+    __sync_synchronize();
+}
+
+static void sr_arpcache_write_end(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Arm a timer of the cache, waking the timeout thread if it is due before
+   the thread would otherwise wake up.  Called with cache->lock held. */
+static void sr_arpcache_arm(struct sr_arpcache *cache, struct sr_timer *timer,
+                            uint64_t expires) {
+    sr_timer_add(&(cache->timers), timer, expires);
+    if (expires < cache->wake_at)
+        pthread_cond_signal(&(cache->wake));
+}
+
+/* -- 2^bits slots of buckets, 0 if there is no memory for them -- */
+static struct sr_arpbucket *sr_arpcache_buckets(unsigned int bits) {
+    size_t len = ((size_t)1 << bits) / SR_ARPCACHE_GROUP *
+                 sizeof(struct sr_arpbucket);
+    void *buckets;
+
+    if (posix_memalign(&buckets, sizeof(struct sr_arpbucket), len) != 0)
+        return NULL;
+    memset(buckets, 0, len);
+    return (struct sr_arpbucket *)buckets;
+}
+
+/* -- bit k of hits set if bucket b's IP k is ip or 0 -- */
+#ifdef __SSE2__
+#define sr_arpbucket_match(hits, buckets, b)                              \
+    do {                                                                  \
+        __m128i keys = _mm_load_si128((const __m128i *)(buckets)[b].ip); \
+        hits = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(             \
+                   _mm_cmpeq_epi32(keys, want), _mm_cmpeq_epi32(keys, zero)))); \
+    } while (0)
+#else
+#define sr_arpbucket_match(hits, buckets, b)                              \
+    do {                                                                  \
+        unsigned int k;                                                   \
+        for (hits = 0, k = 0; k < SR_ARPCACHE_GROUP; k++) {               \
+            if ((buckets)[b].ip[k] == ip || (buckets)[b].ip[k] == 0)      \
+                hits |= 1U << k;                                          \
+        }                                                                 \
+    } while (0)
+#endif
+
+/*---------------------------------------------------------------------
+ * Method: sr_arpcache_probe(..)
+ * Scope:  Global
+ *
+ * Linear probing a bucket at a time: the first bucket is compared from
+ * slot i on, the following ones whole.  The probe is bounded because a
+ * lookup racing a writer could otherwise keep it going.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_arpcache_probe(const struct sr_arpbucket *buckets,
+                               unsigned int bits, unsigned int i, uint32_t ip) {
+    unsigned int last = (1U << bits) / SR_ARPCACHE_GROUP - 1;
+    unsigned int b = i / SR_ARPCACHE_GROUP;
+    unsigned int hits, n;
+#ifdef __SSE2__
+    __m128i want = _mm_set1_epi32(ip);
+    __m128i zero = _mm_setzero_si128();
+#endif
+
+    sr_arpbucket_match(hits, buckets, b);
+    hits &= ~0U << (i % SR_ARPCACHE_GROUP);
+    for (n = 0; hits == 0; n++) {
+        if (n > last)
+            return 1U << bits;
+        b = (b + 1) & last;
+        sr_arpbucket_match(hits, buckets, b);
+    }
+    return b * SR_ARPCACHE_GROUP + __builtin_ctz(hits);
+} /* -- sr_arpcache_probe -- */
+
+/* Returns the slot holding ip, or the empty slot ending its probe run. */
+static unsigned int sr_arpcache_slot(struct sr_arpcache *cache, uint32_t ip) {
+    return sr_arpcache_probe(cache->buckets, cache->bits,
+                             sr_arpcache_hash(ip, cache->bits), ip);
+}
+
+/* -- copy the lookup fields of slot from in src to slot to in dst -- */
+static void sr_arpslot_copy(struct sr_arpbucket *dst, unsigned int to,
+                            const struct sr_arpbucket *src, unsigned int from) {
+    sr_arpslot_ip(dst, to) = sr_arpslot_ip(src, from);
+    memcpy(sr_arpslot_mac(dst, to), sr_arpslot_mac(src, from), ETHER_ADDR_LEN);
+    sr_arpslot_referenced(dst, to) = sr_arpslot_referenced(src, from);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_arpcache_remove(..)
+ * Scope:  Local
+ *
+ * Empty slot i and shift back the entries after it that probed past it,
+ * so lookups can stop at the first empty slot.  An entry may move into
+ * the hole if the hole lies between its home slot and where it is now.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_arpcache_remove(struct sr_arpcache *cache, unsigned int i) {
+    unsigned int mask = (1U << cache->bits) - 1;
+    unsigned int j = i;
+
+    sr_timer_del(&(cache->timers), &(cache->entries[i].timer));
+
+    while (1) {
+        unsigned int home;
+
+        j = (j + 1) & mask;
+        if (!cache->entries[j].valid)
+            break;
+        home = sr_arpcache_hash(cache->entries[j].ip, cache->bits);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            cache->entries[i] = cache->entries[j];
+            sr_arpslot_copy(cache->buckets, i, cache->buckets, j);
+            sr_timer_moved(&(cache->entries[i].timer));
+            i = j;
+        }
+    }
+
+    sr_arpslot_ip(cache->buckets, i) = 0;
+    cache->entries[i].valid = 0;
+    cache->entries[i].timer.next = NULL;
+    cache->count--;
+} /* -- sr_arpcache_remove -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_arpcache_grow(..)
+ * Scope:  Local
+ *
+ * Double the entry table.  The new buckets are filled before they are
+ * published, and published before bits: a lookup that sees the new bits
+ * is sure to probe the new buckets.  The old ones are retired, not freed;
+ * the old entries only writers use.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_arpcache_grow(struct sr_arpcache *cache) {
+    struct sr_arpentry *old = cache->entries;
+    struct sr_arpbucket *old_buckets = cache->buckets;
+    struct sr_arpentry *entries;
+    struct sr_arpbucket *buckets;
+    unsigned int slots = 1U << cache->bits;
+    unsigned int i, j;
+
+    entries = (struct sr_arpentry *)calloc(2 * slots,
+                                           sizeof(struct sr_arpentry));
+    buckets = sr_arpcache_buckets(cache->bits + 1);
+    assert(entries && buckets);
+    assert(cache->nretired < sizeof(cache->retired) / sizeof(cache->retired[0]));
+
+    for (i = 0; i < slots; i++) {
+        if (old[i].valid) {
+            j = sr_arpcache_probe(buckets, cache->bits + 1,
+                                  sr_arpcache_hash(old[i].ip, cache->bits + 1),
+                                  old[i].ip);
+            entries[j] = old[i];
+            sr_arpslot_copy(buckets, j, old_buckets, i);
+            sr_timer_moved(&(entries[j].timer));
+        }
+    }
+
+    cache->entries = entries;
+    __atomic_store_n(&(cache->buckets), buckets, __ATOMIC_RELEASE);
+    __atomic_store_n(&(cache->bits), cache->bits + 1, __ATOMIC_RELEASE);
+    cache->retired[cache->nretired++] = old_buckets;
+    free(old);
+    cache->hand = 0;
+} /* -- sr_arpcache_grow -- */
+
+/* Evict the first entry under the CLOCK hand that has not been looked up
+   since the hand last passed it. */
+static void sr_arpcache_evict(struct sr_arpcache *cache) {
+    unsigned int mask = (1U << cache->bits) - 1;
+
+    while (1) {
+        if (cache->entries[cache->hand].valid) {
+            if (!sr_arpslot_referenced(cache->buckets, cache->hand)) {
+                sr_arpcache_remove(cache, cache->hand);
+                cache->evicted++;
+                return;
+            }
+            sr_arpslot_referenced(cache->buckets, cache->hand) = 0;
+        }
+        cache->hand = (cache->hand + 1) & mask;
+    }
+} /* -- sr_arpcache_evict -- */
+
+/* Entry timer: first SR_ARPCACHE_REFRESH ms before the entry times out,
+   when a neighbor still in use is asked again directly so its reply renews
+   the entry before traffic has to wait, then at the timeout itself. */
+static void sr_arpentry_expire(struct sr_timer *timer, void *work_ptr) {
+    struct sr_arpwork *work = (struct sr_arpwork *)work_ptr;
+    struct sr_arpcache *cache = &(work->sr->cache);
+    struct sr_arpentry *entry =
+        sr_timer_owner(timer, struct sr_arpentry, timer);
+    unsigned int i = entry - cache->entries;
+    unsigned char *referenced = &sr_arpslot_referenced(cache->buckets, i);
+    uint64_t expires = entry->added + (uint64_t)(SR_ARPCACHE_TO * 1000);
+
+    if (timer->expires < expires) {
+        if (*referenced && entry->iface && !sr_arpcache_token(cache)) {
+            uint64_t at = sr_arpcache_token_at(cache);
+
+            /* -- wait for a token, or let the entry be resolved again if
+                  it is still used -- */
+            sr_arpcache_count(cache->limited, 1);
+            if (at < expires) {
+                sr_arpcache_arm(cache, timer, at);
+                return;
+            }
+        }
+        else if (*referenced && entry->iface) {
+            *referenced = 0;
+            sr_arpwork_send(work, entry->ip, entry->iface->index,
+                            sr_arpslot_mac(cache->buckets, i));
+            sr_arpcache_count(cache->refreshed, 1);
+        }
+        sr_arpcache_arm(cache, timer, expires);
+        return;
+    }
+
+    sr_arpcache_write_begin(cache);
+    sr_arpcache_remove(cache, i);
+    sr_arpcache_write_end(cache);
 }
 
-/* You should not need to touch the rest of this code. */
+/* -- save timer: the file is written by sr_arpwork_finish() -- */
+static void sr_arpcache_save_due(struct sr_timer *timer, void *work_ptr) {
+    struct sr_arpwork *work = (struct sr_arpwork *)work_ptr;
+    struct sr_arpcache *cache = &(work->sr->cache);
+
+    work->save = 1;
+    sr_arpcache_arm(cache, timer, sr_clock_ms() + cache->save_ms);
+}
+
+/* Writes the mapping into the entry table, making room for a new one, and
+   arms its timer for a refresh before it times out at added +
+   SR_ARPCACHE_TO.  Called with cache->lock held. */
+static struct sr_arpentry *sr_arpcache_put(struct sr_arpcache *cache,
+                                           unsigned char *mac, uint32_t ip,
+                                           struct sr_if *iface,
+                                           uint64_t added) {
+    struct sr_arpentry *entry;
+    unsigned int i;
+
+    sr_arpcache_write_begin(cache);
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+    i = sr_arpcache_slot(cache, ip);
+    if (!cache->entries[i].valid) {
+        if (cache->count >= cache->max)
+            sr_arpcache_evict(cache);
+        if (2 * (cache->count + 1) > (1U << cache->bits))
+            sr_arpcache_grow(cache);
+        i = sr_arpcache_slot(cache, ip);
+        sr_arpslot_ip(cache->buckets, i) = ip;
+        sr_arpslot_referenced(cache->buckets, i) = 0;
+        cache->entries[i].timer.fn = sr_arpentry_expire;
+        cache->count++;
+    }
     
-    struct sr_arpentry *entry = NULL, *copy = NULL;
+    entry = &(cache->entries[i]);
+    memcpy(sr_arpslot_mac(cache->buckets, i), mac, 6);
+    entry->ip = ip;
+    entry->added = added;
+    entry->valid = 1;
+    entry->iface = iface;
+    sr_arpcache_arm(cache, &(entry->timer),
+                    added + (uint64_t)(SR_ARPCACHE_TO * 1000) -
+                    SR_ARPCACHE_REFRESH);
     
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
+    sr_arpcache_write_end(cache);
+    return entry;
+}
+
+/* Returns the slot of the request index holding a request for ip, or the
+   empty slot ending its probe run. */
+static unsigned int sr_arpreq_slot(struct sr_arpcache *cache, uint32_t ip) {
+    unsigned int mask = (1U << cache->req_bits) - 1;
+    unsigned int i = sr_arpcache_hash(ip, cache->req_bits);
+
+    while (cache->reqs[i] && cache->reqs[i]->ip != ip)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static void sr_arpreq_grow(struct sr_arpcache *cache) {
+    struct sr_arpreq **old = cache->reqs;
+    unsigned int slots = 1U << cache->req_bits;
+    unsigned int i;
+
+    cache->req_bits++;
+    cache->reqs = (struct sr_arpreq **)calloc(2 * slots,
+                                              sizeof(struct sr_arpreq *));
+    assert(cache->reqs);
+
+    for (i = 0; i < slots; i++) {
+        if (old[i])
+            cache->reqs[sr_arpreq_slot(cache, old[i]->ip)] = old[i];
+    }
+    free(old);
+} /* -- sr_arpreq_grow -- */
+
+/* Take req off the request queue and out of the request index, if it is
+   still there.  Same back shift as sr_arpcache_remove(). */
+static void sr_arpreq_unlink(struct sr_arpcache *cache, struct sr_arpreq *req) {
+    unsigned int mask = (1U << cache->req_bits) - 1;
+    unsigned int i = sr_arpreq_slot(cache, req->ip);
+    unsigned int j = i;
+
+    if (cache->reqs[i] != req)
+        return;
+
+    while (1) {
+        unsigned int home;
+
+        j = (j + 1) & mask;
+        if (!cache->reqs[j])
+            break;
+        home = sr_arpcache_hash(cache->reqs[j]->ip, cache->req_bits);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            cache->reqs[i] = cache->reqs[j];
+            i = j;
         }
     }
-    
-    /* Must return a copy b/c another thread could jump in and modify
-       table after we return. */
-    if (entry) {
-        copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+    cache->reqs[i] = NULL;
+    __atomic_sub_fetch(&(cache->nreqs), 1, __ATOMIC_RELAXED);
+    sr_timer_del(&(cache->timers), &(req->timer));
+
+    if (req->prev)
+        req->prev->next = req->next;
+    else
+        cache->requests = req->next;
+    if (req->next)
+        req->next->prev = req->prev;
+    req->next = req->prev = NULL;
+} /* -- sr_arpreq_unlink -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_arpcache_lookup(..)
+ * Scope:  Global
+ *
+ * Checks if an IP->MAC mapping is in the cache. IP is in network byte
+ * order.  Copies the MAC to mac and returns 1 if it is, returns 0
+ * otherwise.
+ *
+ * No lock is taken: the probe is repeated if a writer was moving entries
+ * while it ran, so a lookup never sees an entry half written.  The probe
+ * only reads buckets: usually the one cache line that holds both the IP
+ * and the MAC.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                       unsigned char *mac) {
+    struct sr_arpbucket *buckets;
+    unsigned char copy[ETHER_ADDR_LEN];
+    unsigned int seq, bits, i;
+    int found;
+
+    /* -- 0 marks an empty slot -- */
+    if (ip == 0)
+        return 0;
+
+    while (1) {
+        seq = __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        bits = __atomic_load_n(&(cache->bits), __ATOMIC_ACQUIRE);
+        buckets = __atomic_load_n(&(cache->buckets), __ATOMIC_ACQUIRE);
+
+        i = sr_arpcache_probe(buckets, bits, sr_arpcache_hash(ip, bits), ip);
+        found = i < (1U << bits) && sr_arpslot_ip(buckets, i) == ip;
+        if (found)
+            memcpy(copy, sr_arpslot_mac(buckets, i), ETHER_ADDR_LEN);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(cache->seq), __ATOMIC_RELAXED) == seq)
+            break;
     }
-        
-    pthread_mutex_unlock(&(cache->lock));
-    
-    return copy;
+
+    if (!found)
+        return 0;
+
+    /* -- for the CLOCK hand; only written when it changes -- */
+    if (!sr_arpslot_referenced(buckets, i))
+        sr_arpslot_referenced(buckets, i) = 1;
+    memcpy(mac, copy, ETHER_ADDR_LEN);
+    return 1;
+}
+
+/* -- return a packet slot to the pool -- */
+static void sr_arpq_free(struct sr_arpcache *cache, struct sr_packet *pkt) {
+    pkt->next = cache->pool_free;
+    cache->pool_free = pkt;
+    cache->queued--;
+}
+
+/* -- drop the oldest packet waiting on req -- */
+static void sr_arpreq_drop_head(struct sr_arpcache *cache,
+                                struct sr_arpreq *req) {
+    struct sr_packet *pkt = req->packets;
+
+    req->packets = pkt->next;
+    if (!req->packets)
+        req->tail = NULL;
+    req->npackets--;
+    req->bytes -= pkt->len;
+    sr_arpq_free(cache, pkt);
+    sr_arpcache_count(cache->dropped, 1);
+}
+
+/* Copies the packet into a pool slot at the end of req's list, within the
+   request's budget and the pool's.  Packets that do not fit are dropped
+   according to the cache's drop policy. */
+static void sr_arpreq_hold(struct sr_arpcache *cache, struct sr_arpreq *req,
+                           uint8_t *packet, unsigned int packet_len,
+                           unsigned int out, unsigned int in) {
+    struct sr_packet *pkt;
+
+    if (packet_len > SR_ARPQ_FRAME || packet_len > cache->req_bytes) {
+        sr_arpcache_count(cache->dropped, 1);
+        return;
+    }
+
+    if (cache->drop_policy == SR_ARPQ_DROP_HEAD) {
+        while (req->packets && (req->bytes + packet_len > cache->req_bytes ||
+                                !cache->pool_free))
+            sr_arpreq_drop_head(cache, req);
+    }
+    if (req->bytes + packet_len > cache->req_bytes || !cache->pool_free) {
+        sr_arpcache_count(cache->dropped, 1);
+        return;
+    }
+
+    pkt = cache->pool_free;
+    cache->pool_free = pkt->next;
+    cache->queued++;
+
+    memcpy(pkt->buf, packet, packet_len);
+    pkt->len = packet_len;
+    pkt->ifindex = out;
+    pkt->in_ifindex = in;
+    pkt->next = NULL;
+    if (req->tail)
+        req->tail->next = pkt;
+    else
+        req->packets = pkt;
+    req->tail = pkt;
+    req->npackets++;
+    req->bytes += packet_len;
+    sr_arpcache_count(cache->held, 1);
 }
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
@@ -171,116 +801,188 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       unsigned int out,
+                                       unsigned int in)
 {
-    pthread_mutex_lock(&(cache->lock));
-    
     struct sr_arpreq *req;
-    for (req = cache->requests; req != NULL; req = req->next) {
-        if (req->ip == ip) {
-            break;
-        }
-    }
+    unsigned int i;
+
+    sr_arpcache_lock(cache);
     
-    /* If the IP wasn't found, add it */
+    i = sr_arpreq_slot(cache, ip);
+    req = cache->reqs[i];
+    
+    /* If the IP wasn't found, add it, unless it just failed or too many
+       are being resolved already */
     if (!req) {
+        struct sr_arpneg *neg = sr_arpneg_slot(cache, ip);
+        unsigned long *drop = NULL;
+
+        if (neg->ip == ip && neg->until > sr_clock_ms())
+            drop = &(cache->negative);
+        else if (cache->nreqs >= cache->req_max)
+            drop = &(cache->refused);
+        if (drop) {
+            if (packet && packet_len) {
+                sr_arpcache_count(*drop, 1);
+                sr_arpcache_count(cache->dropped, 1);
+            }
+            sr_arpcache_unlock(cache);
+            return NULL;
+        }
+
+        if (2 * (cache->nreqs + 1) > (1U << cache->req_bits)) {
+            sr_arpreq_grow(cache);
+            i = sr_arpreq_slot(cache, ip);
+        }
         req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
         req->ip = ip;
+        req->ifindex = out;
+        req->timer.fn = sr_arpreq_retry;
+        sr_arpcache_arm(cache, &(req->timer), sr_clock_ms());
         req->next = cache->requests;
+        if (req->next)
+            req->next->prev = req;
         cache->requests = req;
+        cache->reqs[i] = req;
+        sr_arpcache_count(cache->nreqs, 1);
     }
     
-    /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
-        
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
-        memcpy(new_pkt->buf, packet, packet_len);
-        new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-        new_pkt->next = req->packets;
-        req->packets = new_pkt;
-    }
+    /* Add the packet to the end of the list of packets for this request */
+    if (packet && packet_len)
+        sr_arpreq_hold(cache, req, packet, packet_len, out, in);
     
-    pthread_mutex_unlock(&(cache->lock));
+    sr_arpcache_unlock(cache);
     
     return req;
 }
 
+/* Queues the packet like sr_arpcache_queuereq() and, if that started a new
+   request, sends its first ARP request before returning instead of leaving
+   it to the timeout thread.  The request is counted as sent under the lock,
+   so the timer cannot send it a second time; the frame goes out after. */
+void sr_arpcache_resolve(struct sr_instance *sr, uint32_t ip,
+                         uint8_t *packet,               /* borrowed */
+                         unsigned int packet_len,
+                         unsigned int out,
+                         unsigned int in)
+{
+    struct sr_arpwork work;
+    struct sr_arpreq *req;
+
+    sr_arpwork_init(&work, sr);
+    sr_arpcache_lock(&(sr->cache));
+    
+    req = sr_arpcache_queuereq(&(sr->cache), ip, packet, packet_len, out,
+                               in);
+    if (req && req->times_sent == 0)
+        handle_arpreq(req, &work);
+    
+    sr_arpcache_unlock(&(sr->cache));
+    sr_arpwork_finish(&work);
+}
+
+/* Sends an ARP request for every gateway in the routing table that is not
+   cached or being resolved yet, so the first packets to them need not wait.
+   The requests carry no packets and are retried like any other.
+
+   Restored entries learn their interfaces here, and the ones that were in
+   use get their refresh now: their timers run the unicast ARP requests
+   from the timeout thread, within the rate limit. */
+void sr_arpcache_warm(struct sr_instance *sr)
+{
+    struct sr_arpwork work;
+    struct sr_rt *rt;
+    unsigned int i, verify = 0, restored = sr->cache.nrestored;
+
+    sr_arpwork_init(&work, sr);
+    pthread_mutex_lock(&(sr->rt_lock));
+    sr_arpcache_lock(&(sr->cache));
+    
+    for (rt = sr->routing_table; rt; rt = rt->next) {
+        for (i = 0; i < rt->nhops; i++) {
+            uint32_t gw = rt->hops ? rt->hops[i].gw.s_addr : rt->gw.s_addr;
+            unsigned int out = rt->hops ? rt->hops[i].ifindex : rt->ifindex;
+            struct sr_arpreq *req;
+
+            if (gw == 0 ||
+                sr->cache.entries[sr_arpcache_slot(&(sr->cache), gw)].valid)
+                continue;
+            req = sr_arpcache_queuereq(&(sr->cache), gw, NULL, 0, out,
+                                       SR_IF_NONE);
+            if (req && req->times_sent == 0)
+                handle_arpreq(req, &work);
+        }
+    }
+    
+    for (i = 0; i < sr->cache.nrestored; i++) {
+        struct sr_arpsnap_rec *rec = &(sr->cache.restored[i]);
+        unsigned int slot = sr_arpcache_slot(&(sr->cache), rec->ip);
+        struct sr_arpentry *entry = &(sr->cache.entries[slot]);
+
+        if (!entry->valid || entry->iface)
+            continue;
+        entry->iface = sr_get_interface(sr, rec->iface);
+        if (entry->iface && sr_arpslot_referenced(sr->cache.buckets, slot)) {
+            sr_arpcache_arm(&(sr->cache), &(entry->timer), sr_clock_ms());
+            verify++;
+        }
+    }
+    free(sr->cache.restored);
+    sr->cache.restored = NULL;
+    sr->cache.nrestored = 0;
+    
+    sr_arpcache_unlock(&(sr->cache));
+    pthread_mutex_unlock(&(sr->rt_lock));
+    
+    printf("Resolving %u gateways\n", work.nsend);
+    if (restored)
+        printf("Verifying %u of %u restored ARP entries\n", verify, restored);
+    sr_arpwork_finish(&work);
+}
+
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
+   2) Inserts this IP to MAC mapping in the cache, and marks it valid.  A
+      mapping already in the cache is refreshed; if the cache is full the
+      CLOCK hand makes room.  A new entry counts as used once it is looked
+      up. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
-                                     uint32_t ip)
+                                     uint32_t ip,
+                                     struct sr_if *iface)
 {
-    pthread_mutex_lock(&(cache->lock));
+    struct sr_arpreq *req;
+
+    sr_arpcache_lock(cache);
     
-    struct sr_arpreq *req, *prev = NULL, *next = NULL; 
-    for (req = cache->requests; req != NULL; req = req->next) {
-        if (req->ip == ip) {            
-            if (prev) {
-                next = req->next;
-                prev->next = next;
-            } 
-            else {
-                next = req->next;
-                cache->requests = next;
-            }
-            
-            break;
-        }
-        prev = req;
+    req = cache->reqs[sr_arpreq_slot(cache, ip)];
+    if (req) {
+        sr_arpreq_unlink(cache, req);
+        sr_arpcache_count(cache->released, req->npackets);
     }
+    if (sr_arpneg_slot(cache, ip)->ip == ip)
+        sr_arpneg_slot(cache, ip)->ip = 0;
     
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
-            break;
-    }
+    /* -- 0 marks an empty slot, it is never cached -- */
+    if (ip != 0)
+        sr_arpcache_put(cache, mac, ip, iface, sr_clock_ms());
     
-    if (i != SR_ARPCACHE_SZ) {
-        memcpy(cache->entries[i].mac, mac, 6);
-        cache->entries[i].ip = ip;
-        cache->entries[i].added = time(NULL);
-        cache->entries[i].valid = 1;
-    }
-    
-    pthread_mutex_unlock(&(cache->lock));
+    sr_arpcache_unlock(cache);
     
     return req;
 }
 
 void sr_arpreq_destroy_nomut(struct sr_arpcache *cache, struct sr_arpreq *entry) {
     if (entry) {
-        struct sr_arpreq *req, *prev = NULL, *next = NULL; 
-        for (req = cache->requests; req != NULL; req = req->next) {
-            if (req == entry) {                
-                if (prev) {
-                    next = req->next;
-                    prev->next = next;
-                } 
-                else {
-                    next = req->next;
-                    cache->requests = next;
-                }
-                
-                break;
-            }
-            prev = req;
-        }
-        
         struct sr_packet *pkt, *nxt;
         
+        sr_arpreq_unlink(cache, entry);
+        
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
+            sr_arpq_free(cache, pkt);
         }
         
         free(entry);
@@ -290,105 +992,352 @@ void sr_arpreq_destroy_nomut(struct sr_arpcache *cache, struct sr_arpreq *entry)
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
-    pthread_mutex_lock(&(cache->lock));
+    sr_arpcache_lock(cache);
+    sr_arpreq_destroy_nomut(cache, entry);
+    sr_arpcache_unlock(cache);
+}
+
+/* Sets the pending packet budgets.  The pool is only replaced while no
+   packet is queued, which is how the router calls this at startup. */
+int sr_arpcache_set_queue(struct sr_arpcache *cache, unsigned int bytes,
+                          unsigned int req_bytes, int drop_policy) {
+    unsigned int i, n = bytes / sizeof(struct sr_packet);
+    struct sr_packet *pool = NULL;
+
+    if (n > 0) {
+        pool = (struct sr_packet *)calloc(n, sizeof(struct sr_packet));
+        if (!pool)
+            return -1;
+    }
     
-    if (entry) {
-        struct sr_arpreq *req, *prev = NULL, *next = NULL; 
-        for (req = cache->requests; req != NULL; req = req->next) {
-            if (req == entry) {                
-                if (prev) {
-                    next = req->next;
-                    prev->next = next;
-                } 
-                else {
-                    next = req->next;
-                    cache->requests = next;
-                }
-                
-                break;
-            }
-            prev = req;
-        }
-        
-        struct sr_packet *pkt, *nxt;
-        
-        for (pkt = entry->packets; pkt; pkt = nxt) {
-            nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
-            free(pkt);
-        }
-        
-        free(entry);
+    sr_arpcache_lock(cache);
+    
+    if (cache->queued) {
+        sr_arpcache_unlock(cache);
+        free(pool);
+        return -1;
     }
     
-    pthread_mutex_unlock(&(cache->lock));
+    free(cache->pool);
+    cache->pool = pool;
+    cache->pool_free = NULL;
+    cache->npool = n;
+    for (i = n; i > 0; i--) {
+        pool[i - 1].buf = pool[i - 1].frame;
+        pool[i - 1].next = cache->pool_free;
+        cache->pool_free = &pool[i - 1];
+    }
+    cache->req_bytes = req_bytes;
+    cache->drop_policy = drop_policy;
+    
+    sr_arpcache_unlock(cache);
+    return 0;
+}
+
+/* -- wall clock ms, for the time between saving and restoring -- */
+static uint64_t sr_arpsnap_now(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_arpcache_save(..)
+ * Scope:  Global
+ *
+ * Copy the valid entries out under the lock, then write them next to
+ * file and rename the copy into place, so a crash never leaves a half
+ * written file behind.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_arpcache_save(struct sr_arpcache *cache, const char *file) {
+    struct sr_arpsnap_hdr hdr;
+    struct sr_arpsnap_rec *recs;
+    char tmp[1024];
+    FILE *fp;
+    uint64_t now;
+    unsigned int i, n = 0;
+    int err = 0;
+
+    if (strlen(file) + 5 > sizeof(tmp)) {
+        fprintf(stderr, "ARP cache file name %s is too long\n", file);
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", file);
+
+    sr_arpcache_lock(cache);
+
+    recs = (struct sr_arpsnap_rec *)calloc(cache->count + 1,
+                                           sizeof(struct sr_arpsnap_rec));
+    if (!recs) {
+        sr_arpcache_unlock(cache);
+        return -1;
+    }
+    now = sr_clock_update();
+    for (i = 0; i < (1U << cache->bits); i++) {
+        struct sr_arpentry *entry = &(cache->entries[i]);
+        uint64_t expires = entry->added + (uint64_t)(SR_ARPCACHE_TO * 1000);
+
+        if (!entry->valid || expires <= now)
+            continue;
+        recs[n].ip = entry->ip;
+        recs[n].left = expires - now;
+        memcpy(recs[n].mac, sr_arpslot_mac(cache->buckets, i), ETHER_ADDR_LEN);
+        recs[n].used = sr_arpslot_referenced(cache->buckets, i) != 0;
+        if (entry->iface)
+            strncpy(recs[n].iface, entry->iface->name, sr_IFACE_NAMELEN - 1);
+        n++;
+    }
+
+    sr_arpcache_unlock(cache);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SR_ARPSNAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = SR_ARPSNAP_VERSION;
+    hdr.count = n;
+    hdr.saved = sr_arpsnap_now();
+    sr_snapshot_sum(recs, n * sizeof(struct sr_arpsnap_rec), &(hdr.sum_a),
+                    &(hdr.sum_b));
+
+    if ((fp = fopen(tmp, "wb")) == NULL) {
+        perror(tmp);
+        free(recs);
+        return -1;
+    }
+    err |= fwrite(&hdr, sizeof(hdr), 1, fp) != 1;
+    err |= n > 0 && fwrite(recs, sizeof(struct sr_arpsnap_rec), n, fp) != n;
+    err |= fflush(fp) != 0;
+    err |= fsync(fileno(fp)) != 0;
+    err |= fclose(fp) != 0;
+    free(recs);
+
+    if (err || rename(tmp, file) != 0) {
+        perror(file);
+        unlink(tmp);
+        return -1;
+    }
+    return n;
+} /* -- sr_arpcache_save -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_arpcache_restore(..)
+ * Scope:  Global
+ *
+ * Add the saved entries that have time left once the time the router was
+ * down is taken off.  They keep the interface names they were saved with
+ * until sr_arpcache_warm() binds them.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_arpcache_restore(struct sr_arpcache *cache, const char *file) {
+    struct sr_arpsnap_hdr hdr;
+    struct sr_arpsnap_rec *recs = NULL;
+    uint32_t sum_a = 0, sum_b = 0;
+    uint64_t now, down;
+    const char *why = NULL;
+    unsigned int i, n = 0;
+    FILE *fp;
+
+    if ((fp = fopen(file, "rb")) == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        perror(file);
+        return -1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, SR_ARPSNAP_MAGIC, sizeof(hdr.magic)) != 0)
+        why = "not an ARP cache file";
+    else if (hdr.version != SR_ARPSNAP_VERSION)
+        why = "unsupported version";
+    else if (hdr.count > SR_ARPCACHE_SZ)
+        why = "too many entries";
+    else if ((recs = (struct sr_arpsnap_rec *)calloc(hdr.count + 1,
+                                sizeof(struct sr_arpsnap_rec))) == NULL)
+        why = "out of memory";
+    else if (fread(recs, sizeof(struct sr_arpsnap_rec), hdr.count, fp) !=
+             hdr.count || fgetc(fp) != EOF)
+        why = "truncated";
+    else {
+        sr_snapshot_sum(recs, hdr.count * sizeof(struct sr_arpsnap_rec),
+                        &sum_a, &sum_b);
+        if (sum_a != hdr.sum_a || sum_b != hdr.sum_b)
+            why = "checksum mismatch";
+    }
+    fclose(fp);
+
+    if (why) {
+        fprintf(stderr, "ARP cache %s: %s\n", file, why);
+        free(recs);
+        return -1;
+    }
+
+    down = sr_arpsnap_now();
+    down = down > hdr.saved ? down - hdr.saved : 0;
+    now = sr_clock_update();
+
+    sr_arpcache_lock(cache);
+
+    for (i = 0; i < hdr.count; i++) {
+        struct sr_arpsnap_rec *rec = &(recs[i]);
+        struct sr_arpentry *entry;
+
+        if (rec->ip == 0 || rec->left <= down ||
+            rec->left > (uint32_t)(SR_ARPCACHE_TO * 1000))
+            continue;
+        rec->iface[sr_IFACE_NAMELEN - 1] = 0;
+
+        /* -- added so that it times out when it would have -- */
+        entry = sr_arpcache_put(cache, rec->mac, rec->ip, NULL,
+                                now + (rec->left - down) -
+                                (uint64_t)(SR_ARPCACHE_TO * 1000));
+        sr_arpslot_referenced(cache->buckets,
+                              entry - cache->entries) = rec->used;
+        recs[n++] = *rec;
+    }
+    free(cache->restored);
+    cache->restored = recs;
+    cache->nrestored = n;
+
+    sr_arpcache_unlock(cache);
+    return n;
+} /* -- sr_arpcache_restore -- */
+
+void sr_arpcache_autosave(struct sr_arpcache *cache, const char *file,
+                          unsigned int ms) {
+    sr_arpcache_lock(cache);
+    cache->save_file = file;
+    cache->save_ms = ms;
+    cache->save_timer.fn = sr_arpcache_save_due;
+    if (file && ms)
+        sr_arpcache_arm(cache, &(cache->save_timer), sr_clock_ms() + ms);
+    else
+        sr_timer_del(&(cache->timers), &(cache->save_timer));
+    sr_arpcache_unlock(cache);
 }
 
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache) {
-    fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
+    unsigned int i;
+
+    sr_arpcache_lock(cache);
+
+    fprintf(stderr, "\nMAC            IP         AGE (ms)                   VALID\n");
     fprintf(stderr, "-----------------------------------------------------------\n");
     
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    for (i = 0; i < (1U << cache->bits); i++) {
         struct sr_arpentry *cur = &(cache->entries[i]);
-        unsigned char *mac = cur->mac;
-        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
+        unsigned char *mac = sr_arpslot_mac(cache->buckets, i);
+        if (!cur->valid)
+            continue;
+        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %-24lu   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), (unsigned long)(sr_clock_ms() - cur->added), cur->valid);
     }
     
-    fprintf(stderr, "\n");
+    fprintf(stderr, "%u entries in %u slots, %lu evicted, %u requests pending\n",
+            cache->count, 1U << cache->bits, cache->evicted, cache->nreqs);
+    fprintf(stderr, "%u of %u packet slots queued, %lu held, %lu released, %lu dropped\n",
+            cache->queued, cache->npool, cache->held, cache->released,
+            cache->dropped);
+    fprintf(stderr, "%lu entries refreshed before they timed out\n",
+            cache->refreshed);
+    fprintf(stderr, "%lu packets to failed IPs, %lu over the request cap, "
+            "%lu ARP requests rate limited\n\n", cache->negative,
+            cache->refused, cache->limited);
+
+    sr_arpcache_unlock(cache);
 }
 
 /* Initialize table + table lock. Returns 0 on success. */
 int sr_arpcache_init(struct sr_arpcache *cache) {  
-    /* Seed RNG to kick out a random entry if all entries full. */
-    srand(time(NULL));
-    
-    /* Invalidate all entries */
-    memset(cache->entries, 0, sizeof(cache->entries));
-    cache->requests = NULL;
+    pthread_condattr_t cond_attr;
+    int success;
+
+    /* Start small, the tables double as neighbors are learned */
+    memset(cache, 0, sizeof(struct sr_arpcache));
+    cache->bits = SR_ARPCACHE_BITS;
+    cache->max = SR_ARPCACHE_SZ;
+    cache->req_interval = SR_ARPREQ_INTERVAL;
+    cache->req_backoff = 1;
+    cache->neg_ms = SR_ARPNEG_TO;
+    cache->req_max = SR_ARPREQ_MAX;
+    cache->req_rate = SR_ARPREQ_RATE;
+    cache->req_burst = SR_ARPREQ_BURST;
+    cache->tokens = (uint64_t)SR_ARPREQ_BURST * 1000;
+    cache->entries = (struct sr_arpentry *)calloc(1U << cache->bits,
+                                                  sizeof(struct sr_arpentry));
+    cache->buckets = sr_arpcache_buckets(cache->bits);
+    cache->req_bits = SR_ARPCACHE_BITS;
+    cache->reqs = (struct sr_arpreq **)calloc(1U << cache->req_bits,
+                                              sizeof(struct sr_arpreq *));
+    if (!cache->entries || !cache->buckets || !cache->reqs)
+        return -1;
+    sr_timer_init(&(cache->timers), sr_clock_update());
+    cache->tokens_at = sr_clock_ms();
+
+    /* Timer deadlines are on the monotonic clock */
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(cache->wake), &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
     
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
     pthread_mutexattr_settype(&(cache->attr), PTHREAD_MUTEX_RECURSIVE);
-    int success = pthread_mutex_init(&(cache->lock), &(cache->attr));
+    success = pthread_mutex_init(&(cache->lock), &(cache->attr));
+    if (success == 0 && sr_arpcache_set_queue(cache, SR_ARPQ_BYTES,
+                                              SR_ARPREQ_BYTES,
+                                              SR_ARPQ_DROP_TAIL) != 0)
+        return -1;
     
     return success;
 }
 
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
+    while (cache->requests)
+        sr_arpreq_destroy_nomut(cache, cache->requests);
+    while (cache->nretired > 0)
+        free(cache->retired[--cache->nretired]);
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache->reqs);
+    free(cache->pool);
+    free(cache->restored);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+    cache->reqs = NULL;
+    cache->pool = NULL;
+    pthread_cond_destroy(&(cache->wake));
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
+/* Thread which runs the cache's timers: it sleeps until the next one is due,
+   or until a timer due earlier is armed.  It holds the lock only to run the
+   timers and to go to sleep. */
 void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
     struct sr_arpcache *cache = &(sr->cache);
     
     while (1) {
-        sleep(1.0);
-        
-        pthread_mutex_lock(&(cache->lock));
-    
-        time_t curtime = time(NULL);
-        
-        int i;    
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
-        }
-        
+        struct timespec ts;
+        uint64_t next;
+
         sr_arpcache_sweepreqs(sr);
 
+        pthread_mutex_lock(&(cache->lock));
+        next = sr_timer_next(&(cache->timers));
+        if (next > sr_clock_ms() + SR_ARPCACHE_IDLE)
+            next = sr_clock_ms() + SR_ARPCACHE_IDLE;
+        cache->wake_at = next;
+
+        ts.tv_sec = next / 1000;
+        ts.tv_nsec = (next % 1000) * 1000000;
+        pthread_cond_timedwait(&(cache->wake), &(cache->lock), &ts);
+        cache->wake_at = 0;
         pthread_mutex_unlock(&(cache->lock));
     }
     
     return NULL;
 }
-
@@ -2,45 +2,51 @@
    request queue, and ARP cache entries. The ARP request queue holds data about
    an outgoing ARP cache request and the packets that are waiting on a reply
    to that ARP cache request. The ARP cache entries hold IP->MAC mappings and
-   are timed out every SR_ARPCACHE_TO seconds.
+   are timed out SR_ARPCACHE_TO seconds after they were added.  Every entry
+   and request has its own timer on the cache's timing wheel.
+
+   Entries are renewed before traffic has to wait for them: gateways in the
+   routing table are resolved at startup, senders of ARP requests for the
+   router are learned, and an entry looked up since its last refresh is
+   asked for again with a unicast ARP request SR_ARPCACHE_REFRESH ms before
+   it times out.
 
    Pseudocode for use of these structures follows.
 
    --
 
    # When sending packet to next_hop_ip
-   entry = arpcache_lookup(next_hop_ip)
-
-   if entry:
-       use next_hop_ip->mac mapping in entry to send the packet
-       free entry
+   if arpcache_lookup(next_hop_ip, mac):
+       use next_hop_ip->mac mapping to send the packet
    else:
-       req = arpcache_queuereq(next_hop_ip, packet, len)
-       handle_arpreq(req)
+       arpcache_resolve(next_hop_ip, packet, len)
 
    --
 
-   The handle_arpreq() function is a function you should write, and it should
-   handle sending ARP requests if necessary:
+   arpcache_resolve() queues the packet and, for a new request, runs
+   handle_arpreq() right away so the first ARP request goes out with the
+   packet that needed it.  After that the request's timer runs it again
+   req_interval ms later, multiplied by req_backoff for every further try:
 
    function handle_arpreq(req):
-       if difftime(now, req->sent) > 1.0
-           if req->times_sent >= 5:
-               send icmp host unreachable to source addr of all pkts waiting
-                 on this request
-               arpreq_destroy(req)
-           else:
-               send arp request
-               req->sent = now
-               req->times_sent++
+       if req->times_sent >= SR_ARPREQ_TRIES:
+           send icmp host unreachable to source addr of all pkts waiting
+             on this request
+           arpreq_destroy(req)
+       else:
+           send arp request
+           req->sent = now
+           req->times_sent++
+           rearm req->timer for the next try
 
    --
 
    The ARP reply processing code should move entries from the ARP request
    queue to the ARP cache:
 
-   # When servicing an arp reply that gives us an IP->MAC mapping
-   req = arpcache_insert(ip, mac)
+   # When servicing an arp reply that gives us an IP->MAC mapping, or an arp
+   # request for us from a neighbor
+   req = arpcache_insert(ip, mac, iface)
 
    if req:
        send all packets on the req->packets linked list
@@ -48,19 +54,48 @@
 
    --
 
-   To meet the guidelines in the assignment (ARP requests are sent every second
-   until we send 5 ARP requests, then we send ICMP host unreachable back to
-   all packets waiting on this ARP request), you must fill out the following
-   function that is called every second and is defined in sr_arpcache.c:
+   Packets waiting on a request are copied into slots from a pool allocated
+   up front, so holding a packet costs no malloc, and go out in the order
+   they came.  A request holds at most req_bytes of frames and the pool
+   bounds the memory held for all of them; a packet over either budget is
+   dropped, or with SR_ARPQ_DROP_HEAD the request's oldest packets are
+   dropped to make room for it.
+
+   --
+
+   Resolution is bounded so a scan of a connected subnet cannot make the
+   router flood it: an IP that failed to resolve is remembered for
+   neg_ms and packets to it are dropped at once, at most req_max requests
+   are outstanding, and ARP requests are sent from a token bucket of
+   req_rate per second with bursts of req_burst.  A request without a token
+   waits for one, in turn with the others waiting.
+
+   --
+
+   The cache can be kept in a file across restarts.  Valid entries are
+   written with the time they have left, every save_ms and when the router
+   stops, and read back by sr_init().  A restored entry is used at once for
+   the rest of its lifetime; once the interfaces are known, the ones that
+   were in use are asked for again with a unicast ARP request, like a
+   refresh, so the neighbors confirm them before they time out.
 
-   void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-       for each request on sr->cache.requests:
-           handle_arpreq(request)
-   }
+     header | records
 
-   Since handle_arpreq as defined in the comments above could destroy your
-   current request, make sure to save the next pointer before calling
-   handle_arpreq when traversing through the ARP requests linked list.
+   The file is machine specific, and the checksum covers the records.
+
+   --
+
+   The timeout thread sleeps until the next timer is due, then calls
+   sr_arpcache_sweepreqs(), which runs the timers of expired entries and of
+   requests to retransmit.  Its cost depends on how many timers fired, not on
+   the size of the cache.  Under the lock the timers only decide what to
+   send; the ARP requests and host unreachables are built and sent once the
+   lock is released, so forwarding never waits on the socket.
+
+   In the event loop (sr -E) there is no timeout thread: the loop calls
+   sr_arpcache_sweepreqs() when a timerfd set to the next timer fires.
+   Everything that touches the cache then runs on that one thread, so
+   single is set and the lock is never taken.
  */
 
 #ifndef SR_ARPCACHE_H
@@ -70,45 +105,191 @@
 #include <time.h>
 #include <pthread.h>
 #include "sr_if.h"
+#include "sr_timer.h"
 
-#define SR_ARPCACHE_SZ    100  
+#define SR_ARPCACHE_SZ    262144  /* entries held before CLOCK eviction */
+#define SR_ARPCACHE_BITS  6       /* initial table size, 64 slots */
+#define SR_ARPCACHE_GROUP 4       /* slots per bucket, one SSE2 compare */
 #define SR_ARPCACHE_TO    15.0
+#define SR_ARPCACHE_REFRESH 3000  /* ms before timeout used entries are renewed */
+#define SR_ARPREQ_TRIES   5
+#define SR_ARPREQ_INTERVAL 1000   /* default ms before the second try */
+#define SR_ARPREQ_MAX_INTERVAL 60000
+#define SR_ARPCACHE_IDLE  1000    /* ms the timeout thread sleeps at most */
+#define SR_ARPQ_FRAME     1518    /* largest frame that can be queued */
+#define SR_ARPQ_BYTES     (1 << 20)   /* pool memory for queued packets */
+#define SR_ARPREQ_BYTES   (1 << 16)   /* frame bytes queued per request */
+
+#define SR_ARPREQ_MAX     512     /* outstanding requests */
+#define SR_ARPREQ_RATE    100     /* ARP requests a second, 0 for no limit */
+#define SR_ARPREQ_BURST   100
+#define SR_ARPNEG_TO      10000   /* ms an IP that failed is not asked for */
+#define SR_ARPNEG_BITS    10      /* negative cache size, 1024 slots */
+#define SR_ARPCACHE_SAVE  10000   /* default ms between saves of the cache */
+
+#define SR_ARPSNAP_MAGIC   "srarpsnp"
+#define SR_ARPSNAP_VERSION 1
+
+/* -- what to drop when a packet does not fit -- */
+#define SR_ARPQ_DROP_TAIL 0       /* the new packet */
+#define SR_ARPQ_DROP_HEAD 1       /* the request's oldest packets */
 
 struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    unsigned int ifindex;       /* The outgoing interface */
+    unsigned int in_ifindex;    /* Where it came in, for the bounce */
     struct sr_packet *next;
+    uint8_t frame[SR_ARPQ_FRAME];   /* buf points here */
 };
 
+/* What a lookup reads of SR_ARPCACHE_GROUP consecutive slots, in one
+   cache line */
+struct sr_arpbucket {
+    uint32_t ip[SR_ARPCACHE_GROUP];     /* network byte order, 0 if empty */
+    unsigned char mac[SR_ARPCACHE_GROUP][6];
+    unsigned char referenced[SR_ARPCACHE_GROUP];    /* used since the CLOCK
+                                   hand or the last refresh passed */
+} __attribute__((aligned(64)));
+
+/* The rest of a slot, only used under the lock */
 struct sr_arpentry {
-    unsigned char mac[6]; 
     uint32_t ip;                /* IP addr in network byte order */
-    time_t added;         
+    uint64_t added;             /* sr_clock_ms() */
     int valid;
+    struct sr_if *iface;        /* where the mapping was learned */
+    struct sr_timer timer;      /* refresh, then expiry */
 };
 
+/* The lookup fields of slot i */
+#define sr_arpslot_ip(buckets, i) \
+    ((buckets)[(i) / SR_ARPCACHE_GROUP].ip[(i) % SR_ARPCACHE_GROUP])
+#define sr_arpslot_mac(buckets, i) \
+    ((buckets)[(i) / SR_ARPCACHE_GROUP].mac[(i) % SR_ARPCACHE_GROUP])
+#define sr_arpslot_referenced(buckets, i) \
+    ((buckets)[(i) / SR_ARPCACHE_GROUP].referenced[(i) % SR_ARPCACHE_GROUP])
+
 struct sr_arpreq {
     uint32_t ip;
-    time_t sent;                /* Last time this ARP request was sent. You 
-                                   should update this. If the ARP request was 
-                                   never sent, will be 0. */
+    uint64_t sent;              /* sr_clock_ms() when this ARP request was
+                                   last sent, 0 if it never was. */
     uint32_t times_sent;        /* Number of times this request was sent. You 
                                    should update this. */
     struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
+    struct sr_packet *tail;     /* oldest first, new packets go here */
+    unsigned int npackets;
+    unsigned int bytes;         /* frame bytes in packets */
+    unsigned int ifindex;       /* where the ARP requests go out */
     struct sr_arpreq *next;
+    struct sr_arpreq *prev;
+    struct sr_timer timer;      /* next transmission */
+};
+
+struct sr_arpsnap_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t saved;             /* wall clock ms */
+    uint32_t sum_a, sum_b;      /* checksum of the records */
 };
 
+struct sr_arpsnap_rec {
+    uint32_t ip;
+    uint32_t left;              /* ms before the entry times out */
+    unsigned char mac[6];
+    unsigned char used;         /* referenced when saved */
+    unsigned char pad;
+    char iface[sr_IFACE_NAMELEN];
+};
+
+/* An IP that failed to resolve, until when */
+struct sr_arpneg {
+    uint32_t ip;
+    uint64_t until;
+};
+
+/* Entries and requests are both kept in open addressing hash tables keyed
+   by IP, with linear probing and no tombstones: a removed slot is refilled
+   by shifting the rest of its probe run back.  The entry table doubles
+   until it holds max entries at half load, after which the CLOCK hand
+   evicts an entry that was not looked up since the hand last passed.
+
+   A slot of the entry table is split in two.  The IP, MAC and referenced
+   bit are kept in buckets of SR_ARPCACHE_GROUP slots, IPs together, so a
+   probe compares a bucket's IPs at once with SSE2 and finds the MAC in
+   the same cache line.  Timers and the rest live in a parallel array of
+   struct sr_arpentry that lookups never touch.
+
+   Everything is changed under lock.  Lookups take no lock: writers make
+   seq odd while they move entries, and a lookup that saw seq change
+   retries.  Buckets replaced by bigger ones are kept until the cache is
+   destroyed so a lookup still probing them reads valid memory; together
+   the retired buckets are smaller than the current ones.
+
+   The negative cache is direct mapped: a failure overwrites whatever
+   failure shared its slot. */
 struct sr_arpcache {
-    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    struct sr_arpbucket *buckets;   /* 2^bits slots */
+    struct sr_arpentry *entries;    /* 2^bits slots */
+    unsigned int bits;
+    unsigned int count;
+    unsigned int max;
+    unsigned int hand;
+    unsigned long evicted;
+    unsigned int seq;
+    struct sr_arpbucket *retired[32];
+    unsigned int nretired;
+    struct sr_arpreq **reqs;        /* 2^req_bits slots indexing requests */
+    unsigned int req_bits;
+    unsigned int nreqs;             /* it and the counters below are updated
+                                       atomically, for the control socket */
     struct sr_arpreq *requests;
+    unsigned int req_interval;      /* ms from the first ARP request on */
+    unsigned int req_backoff;       /* interval multiplier, 1 for none */
+    struct sr_packet *pool;         /* packet slots, npool of them */
+    struct sr_packet *pool_free;
+    unsigned int npool;
+    unsigned int queued;            /* slots in use */
+    unsigned int req_bytes;
+    int drop_policy;                /* SR_ARPQ_DROP_* */
+    unsigned long held;             /* packets queued on a request */
+    unsigned long released;         /* handed back by sr_arpcache_insert() */
+    unsigned long dropped;          /* over budget or never resolved */
+    unsigned long refreshed;        /* unicast ARP requests for used entries */
+    struct sr_arpneg neg[1 << SR_ARPNEG_BITS];
+    unsigned int neg_ms;
+    unsigned int req_max;
+    unsigned int req_rate;
+    unsigned int req_burst;
+    uint64_t tokens;                /* thousandths of an ARP request */
+    uint64_t tokens_at;
+    uint64_t token_next;            /* promised to the last request waiting */
+    unsigned long negative;         /* packets to IPs that failed recently */
+    unsigned long refused;          /* packets over the request cap */
+    unsigned long limited;          /* ARP requests that waited for a token */
+    struct sr_arpsnap_rec *restored;    /* entries to bind to interfaces */
+    unsigned int nrestored;
+    const char *save_file;
+    unsigned int save_ms;
+    struct sr_timer save_timer;
+    struct sr_timer_wheel timers;
+    uint64_t wake_at;               /* when the timeout thread wakes, or 0 */
+    pthread_cond_t wake;            /* for timers due before that */
+    int single;                     /* one thread does it all, no locking */
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
 };
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order. 
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
+/* The first slot from i on, in the 2^bits slots of buckets, whose IP is
+   ip or 0; 2^bits if there is none. */
+unsigned int sr_arpcache_probe(const struct sr_arpbucket *buckets,
+                               unsigned int bits, unsigned int i, uint32_t ip);
+
+/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
+   Copies the MAC to mac and returns 1 if it is, returns 0 otherwise.  Does
+   not lock, safe to call while another thread changes the cache. */
+int sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                       unsigned char *mac);
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
@@ -116,20 +297,41 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
    freed by the caller.
 
    A pointer to the ARP request is returned; it should be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
+   can remove the ARP request from the queue by calling sr_arpreq_destroy.
+   NULL is returned, and the packet dropped, if the IP failed to resolve
+   recently or req_max requests are outstanding.  out and in are the
+   indices of the interface the packet goes out of and the one it came in
+   on. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         unsigned int out,
+                         unsigned int in);
+
+/* Queues the packet like sr_arpcache_queuereq() and, if that started a new
+   request, sends its first ARP request before returning. */
+void sr_arpcache_resolve(struct sr_instance *sr, uint32_t ip,
+                         uint8_t *packet,               /* borrowed */
+                         unsigned int packet_len,
+                         unsigned int out,
+                         unsigned int in);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
+   2) Inserts this IP to MAC mapping in the cache, and marks it valid.  iface
+      is where the mapping was learned and refreshes go out; 0 if unknown,
+      then the entry is not refreshed. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
-                                     uint32_t ip);
+                                     uint32_t ip,
+                                     struct sr_if *iface);
+
+/* Sends an ARP request for every gateway in the routing table that is not
+   in the cache yet, and verifies the restored entries that were in use.
+   Called once the interfaces are known. */
+void sr_arpcache_warm(struct sr_instance *sr);
 
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
@@ -137,6 +339,25 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 
 void sr_arpreq_destroy_nomut(struct sr_arpcache *cache, struct sr_arpreq *entry);
 
+/* Sets the pending packet budgets: bytes of pool memory for all requests,
+   req_bytes of frames per request, and the SR_ARPQ_DROP_* policy.  Returns
+   0, or -1 if packets are queued and the pool cannot be replaced. */
+int sr_arpcache_set_queue(struct sr_arpcache *cache, unsigned int bytes,
+                          unsigned int req_bytes, int drop_policy);
+
+/* Writes the valid entries to file, replacing it.  Returns the number
+   written, or -1 on error. */
+int sr_arpcache_save(struct sr_arpcache *cache, const char *file);
+
+/* Adds the entries saved in file that have not timed out yet.  Returns the
+   number restored, 0 if there is no file, or -1 if it cannot be used. */
+int sr_arpcache_restore(struct sr_arpcache *cache, const char *file);
+
+/* Saves the cache to file every ms from the timeout thread, never if ms
+   is 0. */
+void sr_arpcache_autosave(struct sr_arpcache *cache, const char *file,
+                          unsigned int ms);
+
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
 
@@ -149,4 +370,8 @@ int   sr_arpcache_init(struct sr_arpcache *cache);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
 
+/* Runs the timers that are due; the event loop calls it in place of the
+   timeout thread. */
+void  sr_arpcache_sweepreqs(struct sr_instance *sr);
+
 #endif
@@ -0,0 +1,2487 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench.c
+ *
+ * Description:
+ *
+ * Microbenchmarks for the data structures on the forwarding path, built
+ * into a binary of their own, sr_bench, so the router does not carry
+ * them.  Run sr_bench <name>[:arg] ...; each benchmark builds its own
+ * scratch sr_instance, so none of them need a topology or a VNS server.
+ *
+ *   fib[:routes]   per-address vs burst route lookups, for both FIB types
+ *   load[:routes]  routing table file, snapshot and MRT import throughput
+ *   arp[:entries]  ARP cache insert and lookup cost as the table grows,
+ *                  and CLOCK eviction once it is full
+ *   arpsoa[:entries] ARP probes at 100, 1k and 4k neighbors: the slots as
+ *                  they were, one struct each, against the buckets
+ *                  compared with SSE2 and a flat scan of the same buckets
+ *   arpmt[:threads] ARP lookups from several threads while a writer keeps
+ *                  refreshing entries and sweeping the table, lock-free
+ *                  vs the old locked copy
+ *   timer[:timers] timing wheel add and expiry cost, against walking every
+ *                  ARP entry once a second
+ *   arpfirst[:trials] time from a packet to an unresolved next hop until
+ *                  its ARP request is on the wire, sent inline vs left to
+ *                  the timeout thread
+ *   arpsweep[:requests] forwarding latency while the timeout thread gives
+ *                  up on requests and bounces their packets
+ *   arpscan[:targets] ARP requests sent and requests outstanding while a
+ *                  connected subnet is scanned, with and without limits
+ *   arprestart[:neighbors] packets held and ARP requests sent when a router
+ *                  starts forwarding to known neighbors, cold vs with the
+ *                  ARP cache restored from the file it saved
+ *   ifs[:interfaces] interface lookups by name against by index, and the
+ *                  is-it-for-me test walking the list against the set of
+ *                  local addresses, at 4, 16 and 64 interfaces
+ *   vnsrx[:packets] packets read from the VNS stream, a recv() for the
+ *                  length, a malloc and a read() each vs drained from the
+ *                  receive ring: syscalls per packet and packets/s
+ *   vnstx[:packets] packets forwarded from one VNS stream to another, every
+ *                  frame written as it is sent vs batched per receive
+ *                  burst: syscalls per forwarded packet and packets/s
+ *   loop[:packets] the vnstx stream with some packets to next hops that
+ *                  never answer, so ARP timers keep firing: the reading
+ *                  thread plus the timeout thread vs the epoll event loop
+ *   arpq[:packets] holding and releasing packets for unresolved next hops
+ *                  from the slot pool vs three mallocs a packet, and what
+ *                  each drop policy keeps of a flood
+ *   ring[:packets] 64 and 1500 byte frames forwarded between two veth
+ *                  pairs in a network namespace of its own, through the
+ *                  AF_PACKET rings: offered and forwarded packets/s.
+ *                  Needs root and ip(8)
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <sched.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <linux/if_link.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#endif /* _LINUX_ */
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_mrt.h"
+#include "sr_snapshot.h"
+#include "sr_timer.h"
+#include "sr_if.h"
+#include "sr_utils.h"
+#include "sr_loop.h"
+#include "sr_io.h"
+#include "sr_ring.h"
+#include "vnscommand.h"
+
+#define SR_BENCH_FIB_ROUTES  100000
+#define SR_BENCH_FIB_ADDRS   (1 << 20)
+#define SR_BENCH_FIB_ROUNDS  8
+#define SR_BENCH_LOAD_ROUTES 1000000
+#define SR_BENCH_ARP_ENTRIES 262144
+#define SR_BENCH_ARP_LOOKUPS (1 << 21)
+#define SR_BENCH_ARPSOA_LOOKUPS (1 << 20)
+#define SR_BENCH_ARPMT_NEIGH 1024
+#define SR_BENCH_ARPMT_TIME  0.5      /* seconds per run */
+#define SR_BENCH_TIMERS      262144
+#define SR_BENCH_TIMER_SPAN  15000    /* ms, SR_ARPCACHE_TO */
+#define SR_BENCH_ARPFIRST_TRIALS 1000
+#define SR_BENCH_ARPQ_PACKETS (1 << 20)
+#define SR_BENCH_ARPQ_HOPS   64
+#define SR_BENCH_ARPQ_DEPTH  8        /* packets a hop holds until resolved */
+#define SR_BENCH_ARPQ_LEN    512
+#define SR_BENCH_ARPQ_FLOOD  100
+#define SR_BENCH_ARPSWEEP_REQS  4096
+#define SR_BENCH_ARPSWEEP_DEPTH 4     /* packets bounced per request */
+#define SR_BENCH_ARPSWEEP_PKTS  (1 << 20)
+#define SR_BENCH_ARPSWEEP_TIME  0.3   /* seconds per run */
+#define SR_BENCH_ARPSCAN_TARGETS 4096
+#define SR_BENCH_ARPSCAN_WAIT   300   /* ms after each scan */
+#define SR_BENCH_ARPRESTART_NEIGH 1000
+#define SR_BENCH_ARPRESTART_WAIT  200 /* ms for the ARP requests to drain */
+#define SR_BENCH_IFS_LOOKUPS (1 << 20)
+#define SR_BENCH_VNSRX_PACKETS (1 << 19)
+#define SR_BENCH_VNSRX_LEN   64       /* Ethernet frame bytes */
+#define SR_BENCH_VNSTX_HOSTS 64
+#define SR_BENCH_LOOP_MISS   16       /* one packet in this many goes to a
+                                         next hop that never answers */
+#define SR_BENCH_LOOP_RETRY  2        /* ms between its ARP requests */
+#define SR_BENCH_RING_PACKETS (1 << 20)
+#define SR_BENCH_RING_BATCH  64       /* frames per sendmmsg() */
+#define SR_BENCH_RING_IDLE   0.2      /* seconds without a frame out = done */
+
+static uint32_t sr_bench_seed = 0x5eed;
+
+static uint32_t sr_bench_rand(void)
+{
+    sr_bench_seed = sr_bench_seed * 1103515245 + 12345;
+    return (sr_bench_seed >> 16) | (sr_bench_seed << 16);
+}
+
+static double sr_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_fib_table(..)
+ * Scope:  Local
+ *
+ * Fill a scratch instance with a synthetic table shaped roughly like a
+ * full Internet table: mostly /24s, then /16-/23, a few short and a few
+ * host routes, plus a default route.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_bench_fib_table(struct sr_instance* sr, unsigned int routes)
+{
+    struct in_addr dest, gw, mask;
+    unsigned int i;
+
+    dest.s_addr = 0;
+    gw.s_addr = htonl(0x0a000001);
+    mask.s_addr = 0;
+    sr_add_rt_entry(sr, dest, gw, mask, "eth0");
+
+    for(i = 1; i < routes; i++)
+    {
+        uint32_t r = sr_bench_rand() % 100;
+        unsigned int plen;
+
+        if(r < 55)      { plen = 24; }
+        else if(r < 90) { plen = 16 + sr_bench_rand() % 8; }
+        else if(r < 95) { plen = 8 + sr_bench_rand() % 8; }
+        else            { plen = 25 + sr_bench_rand() % 8; }
+
+        mask.s_addr = htonl(0xffffffffU << (32 - plen));
+        dest.s_addr = htonl(sr_bench_rand()) & mask.s_addr;
+        if(sr_fib_find(sr->fib, dest.s_addr, mask.s_addr))
+        {
+            i--;
+            continue;
+        }
+        gw.s_addr = htonl(0x0a000000 | (i & 0xffff));
+        sr_add_rt_entry(sr, dest, gw, mask, (i & 1) ? "eth1" : "eth2");
+    }
+} /* -- sr_bench_fib_table -- */
+
+static int sr_bench_fib(const char* arg)
+{
+    struct sr_instance sr;
+    struct sr_rt** rts;
+    struct sr_rt** single;
+    struct sr_rt** burst;
+    uint32_t* addrs;
+    unsigned int routes = arg ? (unsigned int)atoi(arg) : SR_BENCH_FIB_ROUTES;
+    unsigned int n = 0, i, round;
+    struct sr_rt* rt_walker;
+    int mode, bad = 0;
+
+    memset(&sr, 0, sizeof(sr));
+    sr_bench_fib_table(&sr, routes);
+
+    for(rt_walker = sr.routing_table; rt_walker; rt_walker = rt_walker->next)
+    { n++; }
+    rts = (struct sr_rt**)malloc(n * sizeof(struct sr_rt*));
+    n = 0;
+    for(rt_walker = sr.routing_table; rt_walker; rt_walker = rt_walker->next)
+    { rts[n++] = rt_walker; }
+
+    /* -- half the addresses fall inside routed prefixes, half are random -- */
+    addrs  = (uint32_t*)malloc(SR_BENCH_FIB_ADDRS * sizeof(uint32_t));
+    single = (struct sr_rt**)malloc(SR_BENCH_FIB_ADDRS * sizeof(struct sr_rt*));
+    burst  = (struct sr_rt**)malloc(SR_BENCH_FIB_ADDRS * sizeof(struct sr_rt*));
+    assert(rts && addrs && single && burst);
+    for(i = 0; i < SR_BENCH_FIB_ADDRS; i++)
+    {
+        addrs[i] = sr_bench_rand();
+        if(i & 1)
+        {
+            rt_walker = rts[sr_bench_rand() % n];
+            addrs[i] = (rt_walker->dest.s_addr & rt_walker->mask.s_addr) |
+                       (htonl(addrs[i]) & ~rt_walker->mask.s_addr);
+        }
+    }
+
+    for(mode = SR_FIB_TRIE; mode <= SR_FIB_DIR248; mode++)
+    {
+        double t0, t1, t2;
+
+        sr.fib->mode = mode;
+        sr_fib_commit(sr.fib, sr.routing_table);
+
+        t0 = sr_bench_now();
+        for(round = 0; round < SR_BENCH_FIB_ROUNDS; round++)
+        {
+            for(i = 0; i < SR_BENCH_FIB_ADDRS; i++)
+            { single[i] = sr_fib_lookup(sr.fib, addrs[i]); }
+        }
+        t1 = sr_bench_now();
+        for(round = 0; round < SR_BENCH_FIB_ROUNDS; round++)
+        { sr_fib_lookup_burst(sr.fib, addrs, burst, SR_BENCH_FIB_ADDRS); }
+        t2 = sr_bench_now();
+
+        for(i = 0; i < SR_BENCH_FIB_ADDRS; i++)
+        { bad += (single[i] != burst[i]); }
+
+        printf("fib %-6s %u routes: per-address %.1f ns/lookup, "
+               "burst %.1f ns/lookup\n",
+               mode == SR_FIB_TRIE ? "trie" : "dir248", n,
+               (t1 - t0) * 1e9 / ((double)SR_BENCH_FIB_ADDRS * SR_BENCH_FIB_ROUNDS),
+               (t2 - t1) * 1e9 / ((double)SR_BENCH_FIB_ADDRS * SR_BENCH_FIB_ROUNDS));
+        sr_fib_print_stats(sr.fib);
+    }
+
+    if(bad)
+    { fprintf(stderr, "fib: %d burst lookups disagree\n", bad); }
+
+    free(rts);
+    free(addrs);
+    free(single);
+    free(burst);
+
+    return bad != 0;
+} /* -- sr_bench_fib -- */
+
+static void sr_bench_put(unsigned char** p, uint32_t v, int bytes)
+{
+    while(bytes-- > 0)
+    { *(*p)++ = (v >> (8 * bytes)) & 0xff; }
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_load_files(..)
+ * Scope:  Local
+ *
+ * Write the routes of a scratch instance as a routing table file, and as
+ * an MRT TABLE_DUMP_V2 file whose next hops all fall in 10.0.0.0/8.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_load_files(struct sr_instance* gen, char* text, char* mrt)
+{
+    FILE* fp_text;
+    FILE* fp_mrt;
+    struct sr_rt* rt;
+    unsigned int i = 0;
+    int fd_text = mkstemp(text), fd_mrt = mkstemp(mrt);
+
+    if(fd_text < 0 || fd_mrt < 0)
+    {
+        perror("mkstemp");
+        return -1;
+    }
+    fp_text = fdopen(fd_text, "w");
+    fp_mrt = fdopen(fd_mrt, "w");
+    assert(fp_text && fp_mrt);
+
+    for(rt = gen->routing_table; rt; rt = rt->next, i++)
+    {
+        unsigned char rec[64];
+        unsigned char* p = rec;
+        int plen = sr_rt_prefix_len(rt->mask);
+        int nbytes = (plen + 7) / 8;
+
+        fprintf(fp_text, "%s ", inet_ntoa(rt->dest));
+        fprintf(fp_text, "%s ", inet_ntoa(rt->gw));
+        fprintf(fp_text, "%s %s\n", inet_ntoa(rt->mask), rt->interface);
+
+        /* -- header, then one RIB entry with ORIGIN and NEXT_HOP -- */
+        sr_bench_put(&p, 0, 4);
+        sr_bench_put(&p, SR_MRT_TABLE_DUMP_V2, 2);
+        sr_bench_put(&p, SR_MRT_RIB_IPV4_UNICAST, 2);
+        sr_bench_put(&p, 4 + 1 + nbytes + 2 + 8 + 11, 4);
+        sr_bench_put(&p, i, 4);
+        sr_bench_put(&p, plen, 1);
+        if(nbytes)
+        { sr_bench_put(&p, ntohl(rt->dest.s_addr) >> (32 - 8 * nbytes), nbytes); }
+        sr_bench_put(&p, 1, 2);
+        sr_bench_put(&p, 0, 2);
+        sr_bench_put(&p, 0, 4);
+        sr_bench_put(&p, 11, 2);
+        sr_bench_put(&p, 0x400101, 3);
+        sr_bench_put(&p, 0, 1);
+        sr_bench_put(&p, 0x400304, 3);
+        sr_bench_put(&p, 0x0a000000 | (i & 0xffffff), 4);
+        fwrite(rec, 1, p - rec, fp_mrt);
+    }
+
+    fclose(fp_text);
+    fclose(fp_mrt);
+
+    return 0;
+} /* -- sr_bench_load_files -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_load_snapshot(..)
+ * Scope:  Local
+ *
+ * Compile the table just loaded into sr and time starting from that
+ * snapshot instead.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_load_snapshot(struct sr_instance* sr, char* text)
+{
+    struct sr_instance snap;
+    char file[] = "/tmp/sr_bench_snapXXXXXX";
+    int fd = mkstemp(file), bad = 0;
+    double t0, t1;
+
+    if(fd < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    sr->rtable = text;
+    bad |= sr_snapshot_write(sr, file) != 0;
+
+    memset(&snap, 0, sizeof(snap));
+    pthread_mutex_init(&(snap.rt_lock), 0);
+    sr_rcu_init(&(snap.rcu));
+    snap.fib_mode = sr->fib_mode;
+    snap.rtable = text;
+
+    t0 = sr_bench_now();
+    bad |= sr_snapshot_load(&snap, file) != 0;
+    t1 = sr_bench_now();
+    unlink(file);
+
+    printf("load snap-%-6s %u routes in %.1f ms, %.0f routes/s\n",
+           sr->fib_mode == SR_FIB_TRIE ? "trie" : "dir248",
+           snap.fib ? snap.fib->routes : 0, (t1 - t0) * 1e3,
+           (snap.fib ? snap.fib->routes : 0) / (t1 - t0));
+
+    if(snap.fib == 0 || snap.fib->routes != sr->fib->routes ||
+       sr_fib_verify(&snap, -1) != 0)
+    { bad = 1; }
+
+    return bad;
+} /* -- sr_bench_load_snapshot -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_load(..)
+ * Scope:  Local
+ *
+ * Load a table of routes from a text file with each FIB type, from the
+ * snapshot of it, and from an MRT file.  Each time covers the whole load
+ * up to and including the publish, which is what a start or a reload
+ * costs.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_load(const char* arg)
+{
+    struct sr_instance gen, sr;
+    struct in_addr dest, gw, mask;
+    char text[] = "/tmp/sr_bench_rtXXXXXX";
+    char mrt[] = "/tmp/sr_bench_mrtXXXXXX";
+    unsigned int routes = arg ? (unsigned int)atoi(arg) : SR_BENCH_LOAD_ROUTES;
+    int mode, bad = 0;
+    double t0, t1;
+
+    memset(&gen, 0, sizeof(gen));
+    sr_bench_fib_table(&gen, routes);
+    if(sr_bench_load_files(&gen, text, mrt) != 0)
+    { return 1; }
+
+    for(mode = SR_FIB_TRIE; mode <= SR_FIB_DIR248 + 1; mode++)
+    {
+        memset(&sr, 0, sizeof(sr));
+        pthread_mutex_init(&(sr.rt_lock), 0);
+        sr_rcu_init(&(sr.rcu));
+
+        t0 = sr_bench_now();
+        if(mode <= SR_FIB_DIR248)
+        {
+            sr.fib_mode = mode;
+            bad |= sr_load_rt(&sr, text) != 0;
+        }
+        else
+        {
+            /* -- MRT next hops resolve through 10.0.0.0/8 -- */
+            dest.s_addr = htonl(0x0a000000);
+            gw.s_addr = 0;
+            mask.s_addr = htonl(0xff000000);
+            sr_add_rt_entry(&sr, dest, gw, mask, "eth1");
+            t0 = sr_bench_now();
+            bad |= sr_load_mrt(&sr, mrt) != 0;
+        }
+        t1 = sr_bench_now();
+
+        printf("load %-6s %u routes in %.1f ms, %.0f routes/s\n",
+               mode == SR_FIB_TRIE ? "text" :
+               mode == SR_FIB_DIR248 ? "dir248" : "mrt",
+               sr.fib ? sr.fib->routes : 0, (t1 - t0) * 1e3,
+               (sr.fib ? sr.fib->routes : 0) / (t1 - t0));
+
+        if(sr_fib_verify(&sr, -1) != 0)
+        { bad = 1; }
+        if(mode <= SR_FIB_DIR248)
+        { bad |= sr_bench_load_snapshot(&sr, text); }
+    }
+
+    unlink(text);
+    unlink(mrt);
+
+    if(bad)
+    { fprintf(stderr, "load: failed\n"); }
+
+    return bad != 0;
+} /* -- sr_bench_load -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_arp_fill(..)
+ * Scope:  Local
+ *
+ * Insert n neighbors, ips[i] being the i-th, into a fresh cache holding
+ * at most max.  Returns the time taken.
+ *
+ *---------------------------------------------------------------------*/
+
+static double sr_bench_arp_fill(struct sr_arpcache* cache, const uint32_t* ips,
+                                unsigned int n, unsigned int max)
+{
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned int i;
+    double t0;
+
+    sr_arpcache_init(cache);
+    cache->max = max;
+
+    t0 = sr_bench_now();
+    for(i = 0; i < n; i++)
+    {
+        memcpy(mac, &ips[i], 4);
+        sr_arpcache_insert(cache, mac, ips[i], 0);
+    }
+    return sr_bench_now() - t0;
+} /* -- sr_bench_arp_fill -- */
+
+static int sr_bench_arp(const char* arg)
+{
+    static const unsigned int sizes[] = { 100, 1000, 16384, 65536, 0 };
+    struct sr_arpcache cache;
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned int entries = arg ? (unsigned int)atoi(arg) : SR_BENCH_ARP_ENTRIES;
+    unsigned int n, i, s, hit = 0, hot = 0;
+    uint32_t* ips;
+    double fill, t0, t1;
+    int bad = 0;
+
+    /* -- distinct neighbors, spread over the address space -- */
+    ips = (uint32_t*)malloc(entries * sizeof(uint32_t));
+    assert(ips);
+    for(i = 0; i < entries; i++)
+    { ips[i] = htonl(0x0a000000 + (i + 1) * 2654435761U); }
+
+    for(s = 0, n = 0; n < entries; s++)
+    {
+        n = sizes[s] && sizes[s] < entries ? sizes[s] : entries;
+        fill = sr_bench_arp_fill(&cache, ips, n, n);
+
+        t0 = sr_bench_now();
+        for(i = 0; i < SR_BENCH_ARP_LOOKUPS; i++)
+        {
+            /* -- every other lookup misses -- */
+            uint32_t ip = (i & 1) ? ips[sr_bench_rand() % n] : sr_bench_rand();
+
+            if(sr_arpcache_lookup(&cache, ip, mac))
+            { hit += memcmp(mac, &ip, 4) == 0; }
+        }
+        t1 = sr_bench_now();
+
+        printf("arp %7u entries in %7u slots: insert %.1f ns, "
+               "lookup %.1f ns\n", cache.count, 1U << cache.bits,
+               fill * 1e9 / n, (t1 - t0) * 1e9 / SR_BENCH_ARP_LOOKUPS);
+        bad |= cache.count != n;
+        sr_arpcache_destroy(&cache);
+    }
+
+    /* -- half the room: a looked-up quarter must survive the churn -- */
+    n = entries / 2;
+    sr_bench_arp_fill(&cache, ips, n, n);
+    for(i = 0; i < n / 2; i++)
+    { sr_arpcache_lookup(&cache, ips[i], mac); }
+    fill = 0;
+    for(i = n; i < entries; i += n / 4)
+    {
+        unsigned int j, end = i + n / 4 < entries ? i + n / 4 : entries;
+
+        t0 = sr_bench_now();
+        for(j = i; j < end; j++)
+        {
+            memcpy(mac, &ips[j], 4);
+            sr_arpcache_insert(&cache, mac, ips[j], 0);
+        }
+        fill += sr_bench_now() - t0;
+        for(j = 0; j < n / 4; j++)
+        { sr_arpcache_lookup(&cache, ips[j], mac); }
+    }
+    for(i = 0; i < n / 4; i++)
+    { hot += sr_arpcache_lookup(&cache, ips[i], mac); }
+
+    printf("arp evict %u into %u entries: insert %.1f ns, %lu evicted, "
+           "%u/%u hot entries kept\n", entries - n, n,
+           fill * 1e9 / (entries - n), cache.evicted, hot, n / 4);
+    bad |= cache.count != n || cache.evicted != entries - n || hot != n / 4;
+    sr_arpcache_destroy(&cache);
+
+    if(hit == 0)
+    { bad = 1; }
+    if(bad)
+    { fprintf(stderr, "arp: cache contents are wrong\n"); }
+
+    free(ips);
+    return bad;
+} /* -- sr_bench_arp -- */
+
+/* -- a slot as it was before the entry table was split: lookups walked
+      these one at a time -- */
+struct sr_bench_arpslot
+{
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint32_t ip;
+    uint64_t added;
+    int valid;
+    int referenced;
+    struct sr_if* iface;
+    struct sr_timer timer;
+};
+
+static unsigned int sr_bench_arpsoa_hash(uint32_t ip, unsigned int bits)
+{ return (uint32_t)(ip * 2654435761U) >> (32 - bits); }
+
+static int sr_bench_arpsoa_walk(const struct sr_bench_arpslot* slots,
+                                unsigned int bits, uint32_t ip,
+                                unsigned char* mac)
+{
+    unsigned int mask = (1U << bits) - 1;
+    unsigned int i = sr_bench_arpsoa_hash(ip, bits);
+
+    while(slots[i].valid)
+    {
+        if(slots[i].ip == ip)
+        {
+            memcpy(mac, slots[i].mac, ETHER_ADDR_LEN);
+            return 1;
+        }
+        i = (i + 1) & mask;
+    }
+    return 0;
+}
+
+static int sr_bench_arpsoa_probe(const struct sr_arpbucket* buckets,
+                                 unsigned int bits, unsigned int i,
+                                 uint32_t ip, unsigned char* mac)
+{
+    unsigned int slot = sr_arpcache_probe(buckets, bits, i, ip);
+
+    if(slot >= (1U << bits) || sr_arpslot_ip(buckets, slot) != ip)
+    { return 0; }
+    memcpy(mac, sr_arpslot_mac(buckets, slot), ETHER_ADDR_LEN);
+    return 1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_arpsoa(..)
+ * Scope:  Local
+ *
+ * Time the probe alone, hits and misses apart, over the same neighbors
+ * in three layouts: the old slots, the cache's buckets, and the buckets
+ * packed into a flat table scanned from the start.  Lookups add the same
+ * sequence check to the first two.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_arpsoa(const char* arg)
+{
+    static const unsigned int sizes[] = { 100, 1000, 4096, 0 };
+    struct sr_arpcache cache;
+    struct sr_bench_arpslot* slots;
+    struct sr_arpbucket* flat;
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint32_t *ips, *hits, *misses;
+    unsigned int n, i, s, bits, flat_bits, found[3][2];
+    double t[3][2], t0;
+    int layout, miss, bad = 0;
+
+    ips = (uint32_t*)malloc(65536 * sizeof(uint32_t));
+    hits = (uint32_t*)malloc(SR_BENCH_ARPSOA_LOOKUPS * sizeof(uint32_t));
+    misses = (uint32_t*)malloc(SR_BENCH_ARPSOA_LOOKUPS * sizeof(uint32_t));
+    assert(ips && hits && misses);
+    for(i = 0; i < 65536; i++)
+    { ips[i] = htonl(0x0a000000 + (i + 1) * 2654435761U); }
+
+    for(s = 0; sizes[s]; s++)
+    {
+        n = arg ? (unsigned int)atoi(arg) : sizes[s];
+        if(n < 1 || n > 65536)
+        { n = sizes[s]; }
+
+        /* -- the cache's buckets, and the old slots at the same size -- */
+        sr_bench_arp_fill(&cache, ips, n, n);
+        bits = cache.bits;
+        slots = (struct sr_bench_arpslot*)calloc(1U << bits,
+                                                 sizeof(*slots));
+        for(flat_bits = 2; (1U << flat_bits) <= n; flat_bits++);
+        if(posix_memalign((void**)&flat, sizeof(struct sr_arpbucket),
+                          (1U << flat_bits) / SR_ARPCACHE_GROUP *
+                          sizeof(struct sr_arpbucket)) != 0)
+        { flat = 0; }
+        assert(slots && flat);
+        memset(flat, 0, (1U << flat_bits) / SR_ARPCACHE_GROUP *
+               sizeof(struct sr_arpbucket));
+        for(i = 0; i < n; i++)
+        {
+            unsigned int j = sr_bench_arpsoa_hash(ips[i], bits);
+
+            while(slots[j].valid)
+            { j = (j + 1) & ((1U << bits) - 1); }
+            slots[j].valid = 1;
+            slots[j].ip = ips[i];
+            memcpy(slots[j].mac, &ips[i], 4);
+            sr_arpslot_ip(flat, i) = ips[i];
+            memcpy(sr_arpslot_mac(flat, i), &ips[i], 4);
+        }
+
+        for(i = 0; i < SR_BENCH_ARPSOA_LOOKUPS; i++)
+        {
+            hits[i] = ips[sr_bench_rand() % n];
+            misses[i] = htonl(0xc0000000 | (sr_bench_rand() & 0x3fffffff));
+        }
+
+        for(layout = 0; layout < 3; layout++)
+        {
+            for(miss = 0; miss <= 1; miss++)
+            {
+                const uint32_t* keys = miss ? misses : hits;
+                unsigned int got = 0;
+
+                t0 = sr_bench_now();
+                for(i = 0; i < SR_BENCH_ARPSOA_LOOKUPS; i++)
+                {
+                    if(layout == 0)
+                    { got += sr_bench_arpsoa_walk(slots, bits, keys[i], mac); }
+                    else if(layout == 1)
+                    {
+                        got += sr_bench_arpsoa_probe(cache.buckets, bits,
+                                   sr_bench_arpsoa_hash(keys[i], bits),
+                                   keys[i], mac);
+                    }
+                    else
+                    {
+                        got += sr_bench_arpsoa_probe(flat, flat_bits, 0,
+                                                     keys[i], mac);
+                    }
+                }
+                t[layout][miss] = (sr_bench_now() - t0) * 1e9 /
+                                  SR_BENCH_ARPSOA_LOOKUPS;
+                found[layout][miss] = got;
+            }
+            bad |= found[layout][0] != SR_BENCH_ARPSOA_LOOKUPS ||
+                   found[layout][1] != found[0][1];
+        }
+
+        printf("arpsoa %5u entries: slots hit %.1f ns miss %.1f ns, "
+               "buckets hit %.1f ns miss %.1f ns, flat scan hit %.1f ns "
+               "miss %.1f ns\n", n, t[0][0], t[0][1], t[1][0], t[1][1],
+               t[2][0], t[2][1]);
+
+        sr_arpcache_destroy(&cache);
+        free(slots);
+        free(flat);
+        if(arg)
+        { break; }
+    }
+
+    free(ips);
+    free(hits);
+    free(misses);
+
+    if(bad)
+    { fprintf(stderr, "arpsoa: the layouts disagree\n"); }
+    return bad;
+} /* -- sr_bench_arpsoa -- */
+
+struct sr_bench_arpmt
+{
+    struct sr_arpcache* cache;
+    const uint32_t* ips;
+    int locked;                       /* lookups as before: lock, malloc */
+    volatile int stop;
+    unsigned long lookups;
+    unsigned long wrong;              /* hits whose MAC is not the IP's */
+};
+
+static void* sr_bench_arpmt_reader(void* arg)
+{
+    struct sr_bench_arpmt* run = (struct sr_bench_arpmt*)arg;
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint32_t seed = (uint32_t)(size_t)&mac;
+    unsigned long n = 0, wrong = 0;
+
+    while(!run->stop)
+    {
+        uint32_t ip;
+
+        seed = seed * 1103515245 + 12345;
+        ip = run->ips[(seed >> 16) % SR_BENCH_ARPMT_NEIGH];
+        if(run->locked)
+        {
+            /* -- the lookup as it was: the lock, then a copy to free -- */
+            unsigned char* copy;
+
+            pthread_mutex_lock(&(run->cache->lock));
+            copy = (unsigned char*)malloc(sizeof(struct sr_arpentry));
+            if(sr_arpcache_lookup(run->cache, ip, mac))
+            { memcpy(copy, mac, ETHER_ADDR_LEN); }
+            pthread_mutex_unlock(&(run->cache->lock));
+            free(copy);
+        }
+        else if(sr_arpcache_lookup(run->cache, ip, mac))
+        { wrong += memcmp(mac, &ip, 4) != 0; }
+        n++;
+    }
+
+    __sync_fetch_and_add(&(run->lookups), n);
+    __sync_fetch_and_add(&(run->wrong), wrong);
+    return 0;
+} /* -- sr_bench_arpmt_reader -- */
+
+/* -- ARP replies for neighbors beyond the cache's room, evicting and
+      moving entries, and a table walk under the lock every millisecond
+      standing in for the sweeper -- */
+static void* sr_bench_arpmt_writer(void* arg)
+{
+    struct sr_bench_arpmt* run = (struct sr_bench_arpmt*)arg;
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned int i = 0, slot;
+    volatile int live;
+
+    while(!run->stop)
+    {
+        uint32_t ip = run->ips[i % (2 * SR_BENCH_ARPMT_NEIGH)];
+
+        memcpy(mac, &ip, 4);
+        sr_arpcache_insert(run->cache, mac, ip, 0);
+
+        pthread_mutex_lock(&(run->cache->lock));
+        for(slot = 0, live = 0; slot < (1U << run->cache->bits); slot++)
+        { live += run->cache->entries[slot].valid; }
+        pthread_mutex_unlock(&(run->cache->lock));
+
+        i++;
+        usleep(1000);
+    }
+
+    return 0;
+} /* -- sr_bench_arpmt_writer -- */
+
+static int sr_bench_arpmt(const char* arg)
+{
+    struct sr_arpcache cache;
+    struct sr_bench_arpmt run;
+    pthread_t threads[65];
+    uint32_t ips[2 * SR_BENCH_ARPMT_NEIGH];
+    unsigned int max = arg ? (unsigned int)atoi(arg) : 4;
+    unsigned int nthreads, i;
+    unsigned long wrong = 0;
+    double t0, t1;
+
+    if(max < 1 || max > 64)
+    { max = 4; }
+    for(i = 0; i < 2 * SR_BENCH_ARPMT_NEIGH; i++)
+    { ips[i] = htonl(0x0a000000 + (i + 1) * 2654435761U); }
+    sr_bench_arp_fill(&cache, ips, SR_BENCH_ARPMT_NEIGH, SR_BENCH_ARPMT_NEIGH);
+
+    for(nthreads = 1; nthreads <= max; nthreads *= 2)
+    {
+        double rate[2];
+
+        for(run.locked = 1; run.locked >= 0; run.locked--)
+        {
+            run.cache = &cache;
+            run.ips = ips;
+            run.stop = 0;
+            run.lookups = 0;
+            run.wrong = 0;
+
+            t0 = sr_bench_now();
+            pthread_create(&threads[0], 0, sr_bench_arpmt_writer, &run);
+            for(i = 1; i <= nthreads; i++)
+            { pthread_create(&threads[i], 0, sr_bench_arpmt_reader, &run); }
+            usleep(SR_BENCH_ARPMT_TIME * 1e6);
+            run.stop = 1;
+            for(i = 0; i <= nthreads; i++)
+            { pthread_join(threads[i], 0); }
+            t1 = sr_bench_now();
+
+            rate[run.locked] = run.lookups / (t1 - t0);
+            wrong += run.wrong;
+        }
+
+        printf("arpmt %2u threads: locked copy %.2f M lookups/s, "
+               "lock-free %.2f M lookups/s (x%.1f)\n", nthreads,
+               rate[1] / 1e6, rate[0] / 1e6, rate[0] / rate[1]);
+    }
+
+    sr_arpcache_destroy(&cache);
+
+    if(wrong)
+    { fprintf(stderr, "arpmt: %lu lookups returned a wrong MAC\n", wrong); }
+    return wrong != 0;
+} /* -- sr_bench_arpmt -- */
+
+static void sr_bench_timer_fire(struct sr_timer* t, void* arg)
+{ (*(unsigned long*)arg)++; }
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_timer(..)
+ * Scope:  Local
+ *
+ * Arm one timer per neighbor, spread over an ARP entry lifetime, and run
+ * the wheel through it a millisecond at a time.  The old timeout thread
+ * instead looked at every entry once a second for the same 15 seconds.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_timer(const char* arg)
+{
+    struct sr_timer_wheel* w;
+    struct sr_timer* timers;
+    struct sr_arpentry* entries;
+    unsigned int n = arg ? (unsigned int)atoi(arg) : SR_BENCH_TIMERS;
+    unsigned long fired = 0, expired = 0;
+    uint64_t start = 1000000, tick;
+    unsigned int i, sweep;
+    double t0, t1, t2, t3;
+    time_t now;
+
+    w = (struct sr_timer_wheel*)malloc(sizeof(struct sr_timer_wheel));
+    timers = (struct sr_timer*)calloc(n, sizeof(struct sr_timer));
+    entries = (struct sr_arpentry*)calloc(n, sizeof(struct sr_arpentry));
+    assert(w && timers && entries);
+    sr_timer_init(w, start);
+
+    t0 = sr_bench_now();
+    for(i = 0; i < n; i++)
+    {
+        timers[i].fn = sr_bench_timer_fire;
+        sr_timer_add(w, &timers[i],
+                     start + 1 + sr_bench_rand() % SR_BENCH_TIMER_SPAN);
+    }
+    t1 = sr_bench_now();
+    for(tick = start; tick <= start + SR_BENCH_TIMER_SPAN; tick++)
+    { sr_timer_run(w, tick, &fired); }
+    t2 = sr_bench_now();
+
+    /* -- the old sweep: every entry checked once a second -- */
+    now = time(0);
+    for(i = 0; i < n; i++)
+    {
+        entries[i].valid = 1;
+        entries[i].ip = sr_bench_rand();
+    }
+    for(sweep = 0; sweep < SR_BENCH_TIMER_SPAN / 1000; sweep++)
+    {
+        for(i = 0; i < n; i++)
+        {
+            if(entries[i].valid && difftime(now, (time_t)entries[i].added) >
+               SR_ARPCACHE_TO + sweep)
+            { expired++; }
+        }
+    }
+    t3 = sr_bench_now();
+
+    printf("timer %u timers over %u ms: add %.1f ns/timer, run %.1f ns/timer "
+           "(%.2f ms total)\n", n, SR_BENCH_TIMER_SPAN, (t1 - t0) * 1e9 / n,
+           (t2 - t1) * 1e9 / n, (t2 - t1) * 1e3);
+    printf("timer per-second sweeps of %u entries: %.2f ms total, "
+           "%.2f ms a sweep\n", n, (t3 - t2) * 1e3,
+           (t3 - t2) * 1e3 / (SR_BENCH_TIMER_SPAN / 1000));
+
+    free(w);
+    free(timers);
+    free(entries);
+
+    if(fired != n || expired == 0)
+    {
+        fprintf(stderr, "timer: %lu of %u timers fired\n", fired, n);
+        return 1;
+    }
+    return 0;
+} /* -- sr_bench_timer -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_router(..)
+ * Scope:  Local
+ *
+ * A scratch router with eth1 on 10.1.0.1/16 and eth2 on 10.2.0.1/16 and
+ * no routes yet, talking to fds[1] in place of the VNS server.
+ *
+ *---------------------------------------------------------------------*/
+
+static const unsigned char sr_bench_mac1[ETHER_ADDR_LEN] = {2, 0, 0, 0, 0, 1};
+static const unsigned char sr_bench_mac2[ETHER_ADDR_LEN] = {2, 0, 0, 0, 0, 2};
+
+/* -- their interface indices -- */
+#define SR_BENCH_ETH1 0
+#define SR_BENCH_ETH2 1
+
+static int sr_bench_router(struct sr_instance* sr, int fds[2])
+{
+    memset(sr, 0, sizeof(*sr));
+    pthread_mutex_init(&(sr->rt_lock), 0);
+    sr_rcu_init(&(sr->rcu));
+    sr_dstcache_init(&(sr->dstcache));
+    sr_add_interface(sr, "eth1");
+    sr_set_ether_addr(sr, sr_bench_mac1);
+    sr_set_ether_ip(sr, htonl(0x0a010001));
+    sr_add_interface(sr, "eth2");
+    sr_set_ether_addr(sr, sr_bench_mac2);
+    sr_set_ether_ip(sr, htonl(0x0a020001));
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+    {
+        perror("socketpair");
+        return -1;
+    }
+    sr->io = &sr_io_vns;
+    sr->sockfd = fds[0];
+    return 0;
+} /* -- sr_bench_router -- */
+
+/* -- a small IP packet from 10.1.0.2 arriving on eth1 -- */
+static void sr_bench_ip_packet(uint8_t* packet, unsigned int len, uint32_t dst)
+{
+    sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*)packet;
+    sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+
+    memset(packet, 0, len);
+    memcpy(eth_hdr->ether_dhost, sr_bench_mac1, ETHER_ADDR_LEN);
+    eth_hdr->ether_shost[0] = 2;
+    eth_hdr->ether_type = htons(ethertype_ip);
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = 5;
+    ip_hdr->ip_len = htons(len - sizeof(sr_ethernet_hdr_t));
+    ip_hdr->ip_ttl = 64;
+    ip_hdr->ip_p = ip_protocol_icmp;
+    ip_hdr->ip_src = htonl(0x0a010002);
+    ip_hdr->ip_dst = dst;
+    ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+}
+
+/* -- sr_handlepacket() prints every packet it gets, hide that -- */
+static int sr_bench_stdout = -1;
+
+static void sr_bench_quiet(int quiet)
+{
+    fflush(stdout);
+    if(quiet)
+    {
+        int null = open("/dev/null", O_WRONLY);
+
+        sr_bench_stdout = dup(1);
+        dup2(null, 1);
+        close(null);
+    }
+    else
+    {
+        dup2(sr_bench_stdout, 1);
+        close(sr_bench_stdout);
+    }
+}
+
+/* -- wait for the next frame the router sends, 1 if it is an ARP request -- */
+static int sr_bench_arpfirst_wait(int fd)
+{
+    uint8_t buf[2048];
+    ssize_t len = read(fd, buf, sizeof(buf));
+
+    return len >= (ssize_t)(sizeof(c_packet_header) +
+                            sizeof(sr_ethernet_hdr_t)) &&
+           ethertype(buf + sizeof(c_packet_header)) == ethertype_arp;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_arpfirst(..)
+ * Scope:  Local
+ *
+ * Forward one packet to each of trials destinations behind next hops the
+ * router has never resolved, and time how long it takes until the ARP
+ * request for the next hop reaches the VNS socket.  Then do the same with
+ * the packet only queued, leaving the request to the timeout thread.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_arpfirst(const char* arg)
+{
+    struct sr_instance sr;
+    struct in_addr dest, gw, mask;
+    uint8_t packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8];
+    unsigned int trials = arg ? (unsigned int)atoi(arg) : SR_BENCH_ARPFIRST_TRIALS;
+    unsigned int i, missing = 0;
+    double total[2] = { 0, 0 }, worst[2] = { 0, 0 };
+    int fds[2], deferred;
+
+    if(trials < 1 || trials > 32768)
+    { trials = SR_BENCH_ARPFIRST_TRIALS; }
+    if(sr_bench_router(&sr, fds) != 0)
+    { return 1; }
+
+    /* -- a /24 per trial and run, each behind a next hop of its own -- */
+    mask.s_addr = htonl(0xffffff00);
+    for(i = 0; i < 2 * trials; i++)
+    {
+        dest.s_addr = htonl(0x14000000 | (i << 8));
+        gw.s_addr = htonl(0x0a020000 | (i + 2));
+        sr_add_rt_entry(&sr, dest, gw, mask, "eth2");
+    }
+
+    sr_init(&sr);
+    /* -- no retries or limits while the bench runs -- */
+    sr.cache.req_interval = SR_ARPREQ_MAX_INTERVAL;
+    sr.cache.req_max = 2 * trials;
+    sr.cache.req_rate = 0;
+
+    sr_bench_quiet(1);
+    for(deferred = 0; deferred <= 1; deferred++)
+    {
+        for(i = 0; i < trials; i++)
+        {
+            unsigned int k = deferred * trials + i;
+            double t0, t;
+
+            sr_bench_ip_packet(packet, sizeof(packet),
+                               htonl(0x14000000 | (k << 8) | 1));
+
+            t0 = sr_bench_now();
+            if(deferred == 0)
+            { sr_handlepacket(&sr, packet, sizeof(packet), "eth1"); }
+            else
+            {
+                pthread_mutex_lock(&(sr.cache.lock));
+                sr_clock_update();
+                sr_arpcache_queuereq(&(sr.cache), htonl(0x0a020000 | (k + 2)),
+                                     packet, sizeof(packet), SR_BENCH_ETH2,
+                                     SR_BENCH_ETH1);
+                pthread_mutex_unlock(&(sr.cache.lock));
+            }
+            if(sr_bench_arpfirst_wait(fds[1]) == 0)
+            { missing++; }
+            t = sr_bench_now() - t0;
+
+            total[deferred] += t;
+            if(t > worst[deferred])
+            { worst[deferred] = t; }
+        }
+    }
+    sr_bench_quiet(0);
+
+    printf("arpfirst %u misses: inline %.1f us mean, %.1f us worst\n",
+           trials, total[0] * 1e6 / trials, worst[0] * 1e6);
+    printf("arpfirst %u misses: timeout thread %.1f us mean, %.1f us worst\n",
+           trials, total[1] * 1e6 / trials, worst[1] * 1e6);
+
+    if(missing)
+    {
+        fprintf(stderr, "arpfirst: %u packets sent no ARP request\n", missing);
+        return 1;
+    }
+    return 0;
+} /* -- sr_bench_arpfirst -- */
+
+/* -- drain the router's side of the socket, counting the ARP and the IP
+      frames; the router forwards nothing in these benches, so the IP
+      frames are all bounces -- */
+static volatile unsigned long sr_bench_bounced;
+static volatile unsigned long sr_bench_arps;
+
+static void* sr_bench_arpsweep_drain(void* arg)
+{
+    int fd = *(int*)arg;
+    uint8_t buf[2048];
+    ssize_t len;
+
+    while((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        if(len >= (ssize_t)(sizeof(c_packet_header) +
+                            sizeof(sr_ethernet_hdr_t)) &&
+           ethertype(buf + sizeof(c_packet_header)) == ethertype_ip)
+        { sr_bench_bounced++; }
+        else
+        { sr_bench_arps++; }
+    }
+    return 0;
+}
+
+static int sr_bench_cmp_double(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* -- forward to a next hop still being resolved, which takes the cache
+      lock every packet; latencies of the first n in us -- */
+static unsigned int sr_bench_arpsweep_forward(struct sr_instance* sr,
+                                              double* lat, unsigned int n,
+                                              double seconds)
+{
+    uint8_t packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8];
+    double start = sr_bench_now(), t0, t1 = start;
+    unsigned int i;
+
+    for(i = 0; i < n && t1 - start < seconds; i++)
+    {
+        sr_bench_ip_packet(packet, sizeof(packet), htonl(0x14000001));
+        t0 = sr_bench_now();
+        sr_handlepacket(sr, packet, sizeof(packet), "eth1");
+        t1 = sr_bench_now();
+        lat[i] = (t1 - t0) * 1e6;
+    }
+
+    qsort(lat, i, sizeof(double), sr_bench_cmp_double);
+    return i;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_arpsweep(..)
+ * Scope:  Local
+ *
+ * Forwarding latency while the timeout thread gives up on requests
+ * unresolved next hops, each with packets to bounce as host unreachable,
+ * against the same forwarding with nothing timing out.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_arpsweep(const char* arg)
+{
+    struct sr_instance sr;
+    struct in_addr dest, gw, mask;
+    uint8_t packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8];
+    unsigned int requests = arg ? (unsigned int)atoi(arg) : SR_BENCH_ARPSWEEP_REQS;
+    unsigned int i, j, n[2], slow;
+    double* lat[2];
+    pthread_t drain;
+    int fds[2], run;
+
+    if(requests < 1)
+    { requests = SR_BENCH_ARPSWEEP_REQS; }
+    if(sr_bench_router(&sr, fds) != 0)
+    { return 1; }
+
+    dest.s_addr = htonl(0x14000000);
+    gw.s_addr = htonl(0x0a020002);
+    mask.s_addr = htonl(0xffffff00);
+    sr_add_rt_entry(&sr, dest, gw, mask, "eth2");
+
+    sr_init(&sr);
+    sr.cache.req_interval = SR_ARPREQ_MAX_INTERVAL;
+    sr.cache.req_max = requests + 1;
+    sr.cache.req_rate = 0;
+    sr_arpcache_set_queue(&(sr.cache), SR_ARPQ_BYTES * 32, SR_ARPREQ_BYTES,
+                          SR_ARPQ_DROP_TAIL);
+    pthread_create(&drain, 0, sr_bench_arpsweep_drain, &fds[1]);
+
+    lat[0] = (double*)malloc(SR_BENCH_ARPSWEEP_PKTS * sizeof(double));
+    lat[1] = (double*)malloc(SR_BENCH_ARPSWEEP_PKTS * sizeof(double));
+    assert(lat[0] && lat[1]);
+
+    sr_bench_quiet(1);
+    for(run = 0; run <= 1; run++)
+    {
+        if(run == 1)
+        {
+            /* -- requests on their last try, all due in 20 ms -- */
+            pthread_mutex_lock(&(sr.cache.lock));
+            for(i = 0; i < requests; i++)
+            {
+                struct sr_arpreq* req = 0;
+
+                sr_bench_ip_packet(packet, sizeof(packet),
+                                   htonl(0x1e000000 + i));
+                for(j = 0; j < SR_BENCH_ARPSWEEP_DEPTH; j++)
+                {
+                    req = sr_arpcache_queuereq(&(sr.cache),
+                                               htonl(0x0a030000 + i), packet,
+                                               sizeof(packet), SR_BENCH_ETH2,
+                                               SR_BENCH_ETH1);
+                }
+                req->times_sent = SR_ARPREQ_TRIES;
+                sr_timer_add(&(sr.cache.timers), &(req->timer),
+                             sr_clock_update() + 20);
+            }
+            pthread_cond_signal(&(sr.cache.wake));
+            pthread_mutex_unlock(&(sr.cache.lock));
+        }
+        n[run] = sr_bench_arpsweep_forward(&sr, lat[run],
+                                           SR_BENCH_ARPSWEEP_PKTS,
+                                           SR_BENCH_ARPSWEEP_TIME);
+    }
+    sr_bench_quiet(0);
+
+    for(run = 0; run <= 1; run++)
+    {
+        for(slow = 0; slow < n[run] && lat[run][n[run] - 1 - slow] > 100;
+            slow++)
+        { }
+        printf("arpsweep %s: %u packets, p50 %.1f us, p99.9 %.1f us, "
+               "max %.1f us, %u over 100 us\n",
+               run ? "during the sweep" : "idle", n[run],
+               lat[run][n[run] / 2], lat[run][n[run] * 999 / 1000],
+               lat[run][n[run] - 1], slow);
+    }
+    printf("arpsweep %u requests given up, %lu packets bounced\n",
+           requests, sr_bench_bounced);
+
+    free(lat[0]);
+    free(lat[1]);
+    return sr_bench_bounced != (unsigned long)requests * SR_BENCH_ARPSWEEP_DEPTH;
+} /* -- sr_bench_arpsweep -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_arpscan(..)
+ * Scope:  Local
+ *
+ * Scan targets addresses of a connected /16 twice, the second time after
+ * the first scan's requests have failed, and count the ARP requests the
+ * router sends and how many requests it keeps outstanding: first with no
+ * limits, then with the default rate, request cap and negative cache.
+ * Retries are 20 ms apart so requests fail within the run.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_arpscan(const char* arg)
+{
+    struct sr_instance sr[2];
+    struct in_addr dest, gw, mask;
+    uint8_t packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8];
+    unsigned int targets = arg ? (unsigned int)atoi(arg) : SR_BENCH_ARPSCAN_TARGETS;
+    unsigned int i, scan, peak, slots;
+    unsigned long arps;
+    pthread_t drain;
+    int fds[2][2], run;
+
+    if(targets < 1 || targets > 65000)
+    { targets = SR_BENCH_ARPSCAN_TARGETS; }
+
+    for(run = 0; run <= 1; run++)
+    {
+        struct sr_arpcache* cache = &(sr[run].cache);
+
+        if(sr_bench_router(&sr[run], fds[run]) != 0)
+        { return 1; }
+        dest.s_addr = htonl(0x0a030000);
+        gw.s_addr = 0;
+        mask.s_addr = htonl(0xffff0000);
+        sr_add_rt_entry(&sr[run], dest, gw, mask, "eth2");
+        sr_init(&sr[run]);
+        cache->req_interval = 20;
+        if(run == 0)
+        {
+            cache->req_max = 2 * targets;
+            cache->req_rate = 0;
+            cache->neg_ms = 0;
+        }
+        pthread_create(&drain, 0, sr_bench_arpsweep_drain, &fds[run][1]);
+
+        sr_bench_arps = 0;
+        peak = slots = 0;
+        sr_bench_quiet(1);
+        for(scan = 0; scan < 2; scan++)
+        {
+            for(i = 0; i < targets; i++)
+            {
+                sr_bench_ip_packet(packet, sizeof(packet),
+                                   htonl(0x0a030000 + 1 + i));
+                sr_handlepacket(&sr[run], packet, sizeof(packet), "eth1");
+            }
+            pthread_mutex_lock(&(cache->lock));
+            if(cache->nreqs > peak)
+            { peak = cache->nreqs; }
+            if(cache->queued > slots)
+            { slots = cache->queued; }
+            pthread_mutex_unlock(&(cache->lock));
+            usleep(SR_BENCH_ARPSCAN_WAIT * 1000);
+        }
+        sr_bench_quiet(0);
+        arps = sr_bench_arps;
+
+        pthread_mutex_lock(&(cache->lock));
+        printf("arpscan %s: 2 scans of %u targets sent %lu ARP requests, "
+               "at most %u outstanding, peak %u packet slots\n",
+               run ? "limited" : "unlimited", targets, arps, peak, slots);
+        printf("arpscan %s: %lu packets to failed IPs, %lu over the cap, "
+               "%lu requests rate limited, %lu dropped in all\n",
+               run ? "limited" : "unlimited", cache->negative, cache->refused,
+               cache->limited, cache->dropped);
+        pthread_mutex_unlock(&(cache->lock));
+    }
+
+    return 0;
+} /* -- sr_bench_arpscan -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_arprestart(..)
+ * Scope:  Local
+ *
+ * Learn neighbors on a connected subnet and save the ARP cache, then
+ * start two fresh routers and send a packet to every neighbor: one cold,
+ * one with the cache restored from the file and verified.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_arprestart(const char* arg)
+{
+    struct sr_instance sr[3];
+    struct in_addr dest, gw, mask;
+    uint8_t packet[sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + 8];
+    unsigned char mac[ETHER_ADDR_LEN];
+    char file[] = "/tmp/sr_bench_arp.XXXXXX";
+    unsigned int neighbors = arg ? (unsigned int)atoi(arg) : SR_BENCH_ARPRESTART_NEIGH;
+    unsigned int i;
+    unsigned long verified = 0;
+    double t0, saved_ms = 0, restored_ms = 0;
+    pthread_t drain;
+    int fds[3][2], run, saved = 0, restored = 0, fd, err = 0;
+
+    if(neighbors < 1 || neighbors > 65000)
+    { neighbors = SR_BENCH_ARPRESTART_NEIGH; }
+    if((fd = mkstemp(file)) < 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    dest.s_addr = htonl(0x0a020000);
+    gw.s_addr = 0;
+    mask.s_addr = htonl(0xffff0000);
+
+    for(run = 0; run <= 2; run++)
+    {
+        struct sr_arpcache* cache = &(sr[run].cache);
+
+        if(sr_bench_router(&sr[run], fds[run]) != 0)
+        { return 1; }
+        sr_add_rt_entry(&sr[run], dest, gw, mask, "eth2");
+        sr_init(&sr[run]);
+        cache->req_max = neighbors;
+        cache->req_rate = 0;
+        pthread_create(&drain, 0, sr_bench_arpsweep_drain, &fds[run][1]);
+
+        /* -- the router that was running: learn, use, save -- */
+        if(run == 0)
+        {
+            memcpy(mac, sr_bench_mac2, ETHER_ADDR_LEN);
+            for(i = 0; i < neighbors; i++)
+            {
+                mac[4] = i >> 8;
+                mac[5] = i;
+                sr_arpcache_insert(cache, mac, htonl(0x0a020002 + i),
+                                   sr_get_interface(&sr[run], "eth2"));
+                sr_arpcache_lookup(cache, htonl(0x0a020002 + i), mac);
+            }
+            t0 = sr_bench_now();
+            saved = sr_arpcache_save(cache, file);
+            saved_ms = (sr_bench_now() - t0) * 1e3;
+            continue;
+        }
+
+        /* -- restarted with the file: restore, then verify once the
+              interfaces are known -- */
+        if(run == 2)
+        {
+            t0 = sr_bench_now();
+            restored = sr_arpcache_restore(cache, file);
+            restored_ms = (sr_bench_now() - t0) * 1e3;
+            sr_bench_arps = 0;
+            sr_bench_quiet(1);
+            sr_arpcache_warm(&sr[run]);
+            sr_bench_quiet(0);
+            usleep(SR_BENCH_ARPRESTART_WAIT * 1000);
+            verified = sr_bench_arps;
+        }
+
+        sr_bench_arps = 0;
+        sr_bench_quiet(1);
+        for(i = 0; i < neighbors; i++)
+        {
+            sr_bench_ip_packet(packet, sizeof(packet), htonl(0x0a020002 + i));
+            sr_handlepacket(&sr[run], packet, sizeof(packet), "eth1");
+        }
+        sr_bench_quiet(0);
+        usleep(SR_BENCH_ARPRESTART_WAIT * 1000);
+
+        pthread_mutex_lock(&(cache->lock));
+        printf("arprestart %s: %u packets to known neighbors, %lu held for "
+               "ARP, %lu ARP requests sent\n", run == 1 ? "cold" : "warm",
+               neighbors, cache->held, sr_bench_arps);
+        if(run == 2 && cache->held)
+        { err = 1; }
+        pthread_mutex_unlock(&(cache->lock));
+    }
+
+    printf("arprestart: saved %d entries in %.2f ms, restored %d in %.2f ms, "
+           "%lu verified with unicast ARP requests\n", saved, saved_ms,
+           restored, restored_ms, verified);
+    unlink(file);
+
+    if(err || restored != (int)neighbors)
+    {
+        fprintf(stderr, "arprestart: the restored cache missed neighbors\n");
+        return 1;
+    }
+    return 0;
+} /* -- sr_bench_arprestart -- */
+
+/* -- the sequence numbers the bench writes behind the Ethernet header -- */
+static uint32_t sr_bench_arpq_seq(const uint8_t* frame)
+{
+    uint32_t seq;
+
+    memcpy(&seq, frame + sizeof(sr_ethernet_hdr_t), sizeof(seq));
+    return seq;
+}
+
+/* -- how the queue held packets before the pool -- */
+struct sr_bench_arpq_old
+{
+    uint8_t* buf;
+    unsigned int len;
+    char* iface;
+    struct sr_bench_arpq_old* next;
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_arpq_flood(..)
+ * Scope:  Local
+ *
+ * Queue SR_BENCH_ARPQ_FLOOD full size frames on one next hop with room
+ * for a few, and check that the policy kept the first or the last ones.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_arpq_flood(int policy)
+{
+    static unsigned char mac[ETHER_ADDR_LEN] = {2, 0, 0, 0, 0, 9};
+    struct sr_arpcache cache;
+    struct sr_arpreq* req;
+    struct sr_packet* pkt;
+    uint8_t frame[1500];
+    uint32_t seq, expect;
+    unsigned int kept = 0;
+    int bad = 0;
+
+    sr_arpcache_init(&cache);
+    sr_arpcache_set_queue(&cache, SR_ARPQ_BYTES, 16 * sizeof(frame), policy);
+
+    memset(frame, 0, sizeof(frame));
+    for(seq = 0; seq < SR_BENCH_ARPQ_FLOOD; seq++)
+    {
+        memcpy(frame + sizeof(sr_ethernet_hdr_t), &seq, sizeof(seq));
+        sr_arpcache_queuereq(&cache, htonl(0x0a020002), frame, sizeof(frame),
+                             SR_BENCH_ETH2, SR_BENCH_ETH1);
+    }
+
+    req = sr_arpcache_insert(&cache, mac, htonl(0x0a020002), 0);
+    expect = policy == SR_ARPQ_DROP_HEAD ? SR_BENCH_ARPQ_FLOOD - 16 : 0;
+    for(pkt = req->packets; pkt; pkt = pkt->next, kept++)
+    {
+        if(sr_bench_arpq_seq(pkt->buf) != expect + kept)
+        { bad = 1; }
+    }
+    sr_arpreq_destroy(&cache, req);
+
+    printf("arpq %s drop: %u packets for one hop with room for 16, "
+           "kept %u-%u, held %lu released %lu dropped %lu\n",
+           policy == SR_ARPQ_DROP_HEAD ? "head" : "tail", SR_BENCH_ARPQ_FLOOD,
+           expect, expect + kept - 1, cache.held, cache.released,
+           cache.dropped);
+    bad |= kept != 16 || cache.queued != 0 ||
+           cache.released + cache.dropped != SR_BENCH_ARPQ_FLOOD;
+    sr_arpcache_destroy(&cache);
+
+    return bad;
+} /* -- sr_bench_arpq_flood -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_arpq(..)
+ * Scope:  Local
+ *
+ * Hold SR_BENCH_ARPQ_DEPTH packets on each of SR_BENCH_ARPQ_HOPS next
+ * hops, resolve them all and release the packets, until packets went
+ * through.  The old queue's three mallocs and frees a packet are timed on
+ * their own for comparison.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_arpq(const char* arg)
+{
+    static unsigned char mac[ETHER_ADDR_LEN] = {2, 0, 0, 0, 0, 9};
+    struct sr_arpcache cache;
+    struct sr_bench_arpq_old* old[SR_BENCH_ARPQ_HOPS];
+    uint8_t frame[SR_BENCH_ARPQ_LEN];
+    unsigned int packets = arg ? (unsigned int)atoi(arg) : SR_BENCH_ARPQ_PACKETS;
+    unsigned int rounds, round, d, h;
+    uint32_t seq = 0;
+    int bad = 0;
+    double t0, t1, t2;
+
+    rounds = packets / (SR_BENCH_ARPQ_HOPS * SR_BENCH_ARPQ_DEPTH);
+    if(rounds < 1)
+    { rounds = 1; }
+    packets = rounds * SR_BENCH_ARPQ_HOPS * SR_BENCH_ARPQ_DEPTH;
+    memset(frame, 0, sizeof(frame));
+    sr_arpcache_init(&cache);
+
+    t0 = sr_bench_now();
+    for(round = 0; round < rounds; round++)
+    {
+        for(d = 0; d < SR_BENCH_ARPQ_DEPTH; d++)
+        {
+            for(h = 0; h < SR_BENCH_ARPQ_HOPS; h++, seq++)
+            {
+                memcpy(frame + sizeof(sr_ethernet_hdr_t), &seq, sizeof(seq));
+                sr_arpcache_queuereq(&cache, htonl(0x0a020002 + h), frame,
+                                     sizeof(frame), SR_BENCH_ETH2,
+                                     SR_BENCH_ETH1);
+            }
+        }
+        for(h = 0; h < SR_BENCH_ARPQ_HOPS; h++)
+        {
+            struct sr_arpreq* req =
+                sr_arpcache_insert(&cache, mac, htonl(0x0a020002 + h), 0);
+            struct sr_packet* pkt;
+            uint32_t prev = 0;
+
+            /* -- released oldest first -- */
+            for(pkt = req->packets, d = 0; pkt; pkt = pkt->next, d++)
+            {
+                if(d > 0 && sr_bench_arpq_seq(pkt->buf) <= prev)
+                { bad = 1; }
+                prev = sr_bench_arpq_seq(pkt->buf);
+            }
+            if(d != SR_BENCH_ARPQ_DEPTH)
+            { bad = 1; }
+            sr_arpreq_destroy(&cache, req);
+        }
+    }
+    t1 = sr_bench_now();
+
+    for(round = 0; round < rounds; round++)
+    {
+        memset(old, 0, sizeof(old));
+        for(d = 0; d < SR_BENCH_ARPQ_DEPTH; d++)
+        {
+            for(h = 0; h < SR_BENCH_ARPQ_HOPS; h++)
+            {
+                struct sr_bench_arpq_old* pkt = (struct sr_bench_arpq_old*)
+                    malloc(sizeof(struct sr_bench_arpq_old));
+
+                pkt->buf = (uint8_t*)malloc(sizeof(frame));
+                memcpy(pkt->buf, frame, sizeof(frame));
+                pkt->len = sizeof(frame);
+                pkt->iface = (char*)malloc(sr_IFACE_NAMELEN);
+                strncpy(pkt->iface, "eth2", sr_IFACE_NAMELEN);
+                pkt->next = old[h];
+                old[h] = pkt;
+            }
+        }
+        for(h = 0; h < SR_BENCH_ARPQ_HOPS; h++)
+        {
+            while(old[h])
+            {
+                struct sr_bench_arpq_old* next = old[h]->next;
+
+                free(old[h]->buf);
+                free(old[h]->iface);
+                free(old[h]);
+                old[h] = next;
+            }
+        }
+    }
+    t2 = sr_bench_now();
+
+    printf("arpq %u packets of %d bytes on %d hops: queue and release "
+           "%.1f ns/packet\n", packets, SR_BENCH_ARPQ_LEN, SR_BENCH_ARPQ_HOPS,
+           (t1 - t0) * 1e9 / packets);
+    printf("arpq old allocation alone (3 mallocs and frees): "
+           "%.1f ns/packet\n", (t2 - t1) * 1e9 / packets);
+    printf("arpq %u of %u slots free, held %lu released %lu dropped %lu\n",
+           cache.npool - cache.queued, cache.npool, cache.held,
+           cache.released, cache.dropped);
+    bad |= cache.held != packets || cache.released != packets ||
+           cache.queued != 0;
+    sr_arpcache_destroy(&cache);
+
+    bad |= sr_bench_arpq_flood(SR_ARPQ_DROP_TAIL);
+    bad |= sr_bench_arpq_flood(SR_ARPQ_DROP_HEAD);
+
+    if(bad)
+    { fprintf(stderr, "arpq: packets lost, reordered or miscounted\n"); }
+    return bad;
+} /* -- sr_bench_arpq -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_ifs(..)
+ * Scope:  Local
+ *
+ * Interfaces as the forwarding path used to find them, by name and by
+ * walking the list from the receiving interface for the packet's
+ * destination, against the index table and the local address set.  The
+ * walk misses the addresses of interfaces ahead of the receiving one in
+ * the list; the found counts show how many.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_ifs(const char* arg)
+{
+    static const unsigned int sizes[] = { 4, 16, 64, 0 };
+    struct sr_instance sr;
+    unsigned int* keys;
+    uint32_t* dsts;
+    unsigned int n, i, s, found[2];
+    double t[4], t0;
+    volatile struct sr_if* sink = 0;
+    int bad = 0;
+
+    keys = (unsigned int*)malloc(SR_BENCH_IFS_LOOKUPS * sizeof(unsigned int));
+    dsts = (uint32_t*)malloc(SR_BENCH_IFS_LOOKUPS * sizeof(uint32_t));
+    assert(keys && dsts);
+
+    for(s = 0; sizes[s]; s++)
+    {
+        char name[sr_IFACE_NAMELEN];
+
+        n = arg ? (unsigned int)atoi(arg) : sizes[s];
+        if(n < 1 || n > 4096)
+        { n = sizes[s]; }
+
+        memset(&sr, 0, sizeof(sr));
+        for(i = 0; i < n; i++)
+        {
+            snprintf(name, sizeof(name), "eth%u", i);
+            sr_add_interface(&sr, name);
+            sr_set_ether_ip(&sr, htonl(0x0a000001 + (i << 16)));
+        }
+        for(i = 0; i < SR_BENCH_IFS_LOOKUPS; i++)
+        {
+            keys[i] = sr_bench_rand() % n;
+            dsts[i] = sr.ifs[sr_bench_rand() % n]->ip;
+        }
+
+        /* -- what the packet came in on -- */
+        t0 = sr_bench_now();
+        for(i = 0; i < SR_BENCH_IFS_LOOKUPS; i++)
+        { sink = sr_get_interface(&sr, sr.ifs[keys[i]]->name); }
+        t[0] = sr_bench_now() - t0;
+
+        t0 = sr_bench_now();
+        for(i = 0; i < SR_BENCH_IFS_LOOKUPS; i++)
+        { sink = sr_get_interface_index(&sr, keys[i]); }
+        t[1] = sr_bench_now() - t0;
+
+        /* -- and whether it is for the router -- */
+        found[0] = found[1] = 0;
+        t0 = sr_bench_now();
+        for(i = 0; i < SR_BENCH_IFS_LOOKUPS; i++)
+        {
+            struct sr_if* if_i;
+
+            for(if_i = sr_get_interface(&sr, sr.ifs[keys[i]]->name); if_i;
+                if_i = if_i->next)
+            {
+                if(if_i->ip == dsts[i])
+                {
+                    found[0]++;
+                    break;
+                }
+            }
+        }
+        t[2] = sr_bench_now() - t0;
+
+        t0 = sr_bench_now();
+        for(i = 0; i < SR_BENCH_IFS_LOOKUPS; i++)
+        { found[1] += sr_get_interface_ip(&sr, dsts[i]) != 0; }
+        t[3] = sr_bench_now() - t0;
+
+        printf("ifs %4u interfaces: by name %.1f ns, by index %.1f ns; "
+               "for me by walk %.1f ns (%u%% found), by set %.1f ns "
+               "(%u%% found)\n", n,
+               t[0] * 1e9 / SR_BENCH_IFS_LOOKUPS,
+               t[1] * 1e9 / SR_BENCH_IFS_LOOKUPS,
+               t[2] * 1e9 / SR_BENCH_IFS_LOOKUPS,
+               (unsigned int)(100.0 * found[0] / SR_BENCH_IFS_LOOKUPS),
+               t[3] * 1e9 / SR_BENCH_IFS_LOOKUPS,
+               (unsigned int)(100.0 * found[1] / SR_BENCH_IFS_LOOKUPS));
+        bad |= found[1] != SR_BENCH_IFS_LOOKUPS;
+
+        while(sr.if_list)
+        {
+            struct sr_if* next = sr.if_list->next;
+
+            free(sr.if_list);
+            sr.if_list = next;
+        }
+        free(sr.ifs);
+        free(sr.local);
+        if(arg)
+        { break; }
+    }
+
+    (void)sink;
+    free(keys);
+    free(dsts);
+
+    if(bad)
+    { fprintf(stderr, "ifs: a local address was not found\n"); }
+    return bad;
+} /* -- sr_bench_ifs -- */
+
+struct sr_bench_vnsrx
+{
+    int fd;
+    const unsigned char* stream;
+    size_t len;
+};
+
+/* -- the server's side: the whole stream, as fast as it is taken -- */
+static void* sr_bench_vnsrx_feed(void* arg)
+{
+    struct sr_bench_vnsrx* feed = (struct sr_bench_vnsrx*)arg;
+    size_t off = 0;
+    ssize_t ret;
+
+    while(off < feed->len)
+    {
+        ret = write(feed->fd, feed->stream + off, feed->len - off < 65536 ?
+                    feed->len - off : 65536);
+        if(ret <= 0)
+        { break; }
+        off += ret;
+    }
+    return 0;
+}
+
+/* -- how sr_read_from_server() took one packet before the ring: recv()
+      the length, malloc, read() the rest, free -- */
+static int sr_bench_vnsrx_old(struct sr_instance* sr, unsigned long* calls)
+{
+    uint32_t len = 0;
+    unsigned char* buf;
+    int got = 0, ret;
+
+    while(got < 4)
+    {
+        ret = recv(sr->sockfd, ((uint8_t*)&len) + got, 4 - got, 0);
+        (*calls)++;
+        if(ret <= 0)
+        { return -1; }
+        got += ret;
+    }
+    len = ntohl(len);
+    buf = (unsigned char*)malloc(len);
+    assert(buf);
+    *((uint32_t*)buf) = htonl(len);
+
+    for(got = 0; got < (int)len - 4; got += ret)
+    {
+        ret = read(sr->sockfd, buf + 4 + got, len - 4 - got);
+        (*calls)++;
+        if(ret <= 0)
+        {
+            free(buf);
+            return -1;
+        }
+    }
+
+    sr_get_interface(sr, (char*)(buf + sizeof(c_base)));
+    sr_handlepacket(sr, buf + sizeof(c_packet_header),
+                    len - sizeof(c_packet_ethernet_header) +
+                    sizeof(struct sr_ethernet_hdr), (char*)(buf + sizeof(c_base)));
+    free(buf);
+    return 1;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_vnsrx(..)
+ * Scope:  Local
+ *
+ * Feed a stream of VNSPACKET commands through a socket pair and take them
+ * the old way, then through sr_read_from_server().  The frames have an
+ * ethertype the router ignores, so what is timed is the receive path.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_vnsrx(const char* arg)
+{
+    struct sr_instance sr;
+    struct sr_bench_vnsrx feed;
+    unsigned int n = arg ? (unsigned int)atoi(arg) : SR_BENCH_VNSRX_PACKETS;
+    unsigned int cmd_len = sizeof(c_packet_header) + SR_BENCH_VNSRX_LEN;
+    unsigned char* stream;
+    unsigned long calls[2];
+    unsigned int i;
+    double t[2], t0;
+    pthread_t thread;
+    int fds[2], run, bad = 0;
+
+    if(n < 1)
+    { n = SR_BENCH_VNSRX_PACKETS; }
+
+    /* -- n commands back to back, as the server would send them -- */
+    feed.len = (size_t)n * cmd_len;
+    stream = (unsigned char*)calloc(1, feed.len);
+    assert(stream);
+    for(i = 0; i < n; i++)
+    {
+        c_packet_ethernet_header* pkt = (c_packet_ethernet_header*)
+                                        (stream + (size_t)i * cmd_len);
+
+        pkt->mLen = htonl(cmd_len);
+        pkt->mType = htonl(VNSPACKET);
+        strcpy(pkt->mInterfaceName, "eth1");
+        memcpy(pkt->ether_dhost, sr_bench_mac1, ETHER_ADDR_LEN);
+        pkt->ether_type = htons(0x88b5);
+    }
+    feed.stream = stream;
+
+    if(sr_bench_router(&sr, fds) != 0)
+    { return 1; }
+    close(fds[0]);
+    close(fds[1]);
+
+    sr_bench_quiet(1);
+    for(run = 0; run < 2; run++)
+    {
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        {
+            perror("socketpair");
+            bad = 1;
+            break;
+        }
+        sr.sockfd = fds[0];
+        feed.fd = fds[1];
+        pthread_create(&thread, 0, sr_bench_vnsrx_feed, &feed);
+
+        calls[run] = 0;
+        t0 = sr_bench_now();
+        if(run == 0)
+        {
+            for(i = 0; i < n; i++)
+            {
+                if(sr_bench_vnsrx_old(&sr, &calls[run]) != 1)
+                { break; }
+            }
+        }
+        else
+        {
+            while(sr.rx.cmds < n)
+            {
+                if(sr_read_from_server(&sr) != 1)
+                { break; }
+            }
+            calls[run] = sr.rx.reads;
+            i = sr.rx.cmds;
+        }
+        t[run] = sr_bench_now() - t0;
+        bad |= i != n;
+
+        pthread_join(thread, 0);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    sr_bench_quiet(0);
+
+    if(bad == 0)
+    {
+        printf("vnsrx %u packets: per packet %.2f syscalls/packet, %.2f Mpps; "
+               "ring %.3f syscalls/packet, %.2f Mpps\n", n,
+               (double)calls[0] / n, n / t[0] / 1e6,
+               (double)calls[1] / n, n / t[1] / 1e6);
+    }
+    else
+    { fprintf(stderr, "vnsrx: the router did not get every packet\n"); }
+
+    free(sr.rx.buf);
+    free(stream);
+    return bad;
+} /* -- sr_bench_vnsrx -- */
+
+/* -- the server's side of the forwarded frames: count the bytes -- */
+static void* sr_bench_vnstx_drain(void* arg)
+{
+    struct sr_bench_vnsrx* feed = (struct sr_bench_vnsrx*)arg;
+    uint8_t buf[65536];
+    ssize_t ret;
+
+    feed->len = 0;
+    while((ret = read(feed->fd, buf, sizeof(buf))) > 0)
+    { feed->len += ret; }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_vnstx(..)
+ * Scope:  Local
+ *
+ * Forward a stream of packets to resolved neighbors on eth2, with every
+ * frame written as it is sent and then batched per receive burst.  The
+ * syscall counts are the router's own recv() and sendmsg() calls.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_vnstx(const char* arg)
+{
+    struct sr_instance sr;
+    struct sr_bench_vnsrx feed, out;
+    struct in_addr dest, gw, mask;
+    unsigned int n = arg ? (unsigned int)atoi(arg) : SR_BENCH_VNSRX_PACKETS;
+    unsigned int frame_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                             8;
+    unsigned int cmd_len = sizeof(c_packet_header) + frame_len;
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned char* stream;
+    unsigned long syscalls[2], sent[2];
+    unsigned int i;
+    double t[2], t0;
+    pthread_t feeder, drain;
+    int fds[2], run, bad = 0;
+
+    if(n < 1)
+    { n = SR_BENCH_VNSRX_PACKETS; }
+
+    feed.len = (size_t)n * cmd_len;
+    stream = (unsigned char*)calloc(1, feed.len);
+    assert(stream);
+    for(i = 0; i < n; i++)
+    {
+        c_packet_header* pkt = (c_packet_header*)(stream + (size_t)i * cmd_len);
+
+        pkt->mLen = htonl(cmd_len);
+        pkt->mType = htonl(VNSPACKET);
+        strcpy(pkt->mInterfaceName, "eth1");
+        sr_bench_ip_packet((uint8_t*)(pkt + 1), frame_len,
+                           htonl(0x0a020002 + i % SR_BENCH_VNSTX_HOSTS));
+    }
+    feed.stream = stream;
+
+    for(run = 0; run < 2; run++)
+    {
+        if(sr_bench_router(&sr, fds) != 0)
+        { return 1; }
+        close(fds[0]);
+        close(fds[1]);
+        dest.s_addr = htonl(0x0a020000);
+        gw.s_addr = 0;
+        mask.s_addr = htonl(0xffff0000);
+        sr_add_rt_entry(&sr, dest, gw, mask, "eth2");
+        sr_arpcache_init(&(sr.cache));
+        memcpy(mac, sr_bench_mac2, ETHER_ADDR_LEN);
+        for(i = 0; i < SR_BENCH_VNSTX_HOSTS; i++)
+        {
+            mac[5] = 0x10 + i;
+            sr_arpcache_insert(&(sr.cache), mac, htonl(0x0a020002 + i),
+                               sr_get_interface(&sr, "eth2"));
+        }
+        sr.tx.batch = run;
+
+        /* -- the server writes the stream and reads the forwarded frames
+              on its end, from two threads -- */
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        {
+            perror("socketpair");
+            return 1;
+        }
+        feed.fd = out.fd = fds[1];
+        sr.sockfd = fds[0];
+        pthread_create(&feeder, 0, sr_bench_vnsrx_feed, &feed);
+        pthread_create(&drain, 0, sr_bench_vnstx_drain, &out);
+
+        sr_bench_quiet(1);
+        t0 = sr_bench_now();
+        while(sr.rx.cmds < n)
+        {
+            if(sr_read_from_server(&sr) != 1)
+            { break; }
+        }
+        t[run] = sr_bench_now() - t0;
+        sr_bench_quiet(0);
+
+        pthread_join(feeder, 0);
+        shutdown(fds[0], SHUT_WR);
+        pthread_join(drain, 0);
+        close(fds[0]);
+        close(fds[1]);
+
+        syscalls[run] = sr.rx.reads + sr.tx.writes;
+        sent[run] = sr.tx.frames;
+        bad |= sr.rx.cmds != n || sent[run] != n ||
+               out.len != (size_t)n * cmd_len;
+
+        sr_arpcache_destroy(&(sr.cache));
+        free(sr.rx.buf);
+        free(sr.tx.data);
+    }
+
+    if(bad == 0)
+    {
+        printf("vnstx %u packets: written one by one %.3f syscalls/packet, "
+               "%.2f Mpps; batched %.3f syscalls/packet, %.2f Mpps\n", n,
+               (double)syscalls[0] / n, n / t[0] / 1e6,
+               (double)syscalls[1] / n, n / t[1] / 1e6);
+    }
+    else
+    { fprintf(stderr, "vnstx: not every packet was forwarded\n"); }
+
+    free(stream);
+    return bad;
+} /* -- sr_bench_vnstx -- */
+
+/* -- the instances outlive sr_bench_loop(), the timeout thread of the
+      second is never stopped -- */
+static struct sr_instance sr_bench_loop_sr[2];
+
+/* -- the stream, then the end of it, which stops the event loop -- */
+static void* sr_bench_loop_feed(void* arg)
+{
+    struct sr_bench_vnsrx* feed = (struct sr_bench_vnsrx*)arg;
+
+    sr_bench_vnsrx_feed(feed);
+    shutdown(feed->fd, SHUT_WR);
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_loop(..)
+ * Scope:  Local
+ *
+ * Forward the vnstx stream, except that one packet in SR_BENCH_LOOP_MISS
+ * goes to one of 64 next hops that never answer ARP, retried every
+ * SR_BENCH_LOOP_RETRY ms.  First through sr_loop_run(), with the cache
+ * unlocked and its timers on a timerfd, then as sr_init() sets it up:
+ * sr_read_from_server() on this thread, the timeout thread beside it.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_loop(const char* arg)
+{
+    struct sr_instance* sr;
+    struct sr_bench_vnsrx feed, out;
+    struct in_addr dest, gw, mask;
+    unsigned int n = arg ? (unsigned int)atoi(arg) : SR_BENCH_VNSRX_PACKETS;
+    unsigned int frame_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                             8;
+    unsigned int cmd_len = sizeof(c_packet_header) + frame_len;
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned char* stream;
+    unsigned long sent[2];
+    unsigned int i;
+    double t[2], t0;
+    pthread_t feeder, drain;
+    int fds[2], run, err, bad = 0;
+
+    if(n < 1)
+    { n = SR_BENCH_VNSRX_PACKETS; }
+
+    feed.len = (size_t)n * cmd_len;
+    stream = (unsigned char*)calloc(1, feed.len);
+    assert(stream);
+    for(i = 0; i < n; i++)
+    {
+        c_packet_header* pkt = (c_packet_header*)(stream + (size_t)i * cmd_len);
+        uint32_t dst = 0x0a020002 + i % SR_BENCH_VNSTX_HOSTS;
+
+        if(i % SR_BENCH_LOOP_MISS == SR_BENCH_LOOP_MISS - 1)
+        { dst = 0x0a020100 + (i / SR_BENCH_LOOP_MISS) % 64; }
+        pkt->mLen = htonl(cmd_len);
+        pkt->mType = htonl(VNSPACKET);
+        strcpy(pkt->mInterfaceName, "eth1");
+        sr_bench_ip_packet((uint8_t*)(pkt + 1), frame_len, htonl(dst));
+    }
+    feed.stream = stream;
+
+    for(run = 0; run < 2; run++)
+    {
+        sr = &sr_bench_loop_sr[run];
+        if(sr_bench_router(sr, fds) != 0)
+        { return 1; }
+        close(fds[0]);
+        close(fds[1]);
+        dest.s_addr = htonl(0x0a020000);
+        gw.s_addr = 0;
+        mask.s_addr = htonl(0xffff0000);
+        sr_add_rt_entry(sr, dest, gw, mask, "eth2");
+        sr->event_loop = run == 0;
+        sr->tx.batch = 1;
+        sr_init(sr);
+        sr->cache.req_interval = SR_BENCH_LOOP_RETRY;
+        sr->cache.req_rate = 0;
+        memcpy(mac, sr_bench_mac2, ETHER_ADDR_LEN);
+        for(i = 0; i < SR_BENCH_VNSTX_HOSTS; i++)
+        {
+            mac[5] = 0x10 + i;
+            sr_arpcache_insert(&(sr->cache), mac, htonl(0x0a020002 + i),
+                               sr_get_interface(sr, "eth2"));
+        }
+
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        {
+            perror("socketpair");
+            return 1;
+        }
+        feed.fd = out.fd = fds[1];
+        sr->sockfd = fds[0];
+        pthread_create(&feeder, 0, sr_bench_loop_feed, &feed);
+        pthread_create(&drain, 0, sr_bench_vnstx_drain, &out);
+
+        sr_bench_quiet(1);
+        t0 = sr_bench_now();
+        if(run == 0)
+        {
+            /* -- it takes the end of the stream for a lost server -- */
+            err = dup(2);
+            dup2(1, 2);
+            sr_loop_run(sr);
+            while(sr->tx.held_len > 0 && sr_write_held(sr) == 0)
+            { }
+            dup2(err, 2);
+            close(err);
+        }
+        else
+        {
+            while(sr->rx.cmds < n)
+            {
+                if(sr_read_from_server(sr) != 1)
+                { break; }
+            }
+        }
+        t[run] = sr_bench_now() - t0;
+        sr_bench_quiet(0);
+
+        pthread_join(feeder, 0);
+        sent[run] = sr->tx.frames;
+        bad |= sr->rx.cmds != n || sr->tx.dropped != 0;
+        if(run == 0)
+        {
+            shutdown(fds[0], SHUT_WR);
+            pthread_join(drain, 0);
+            close(fds[0]);
+            close(fds[1]);
+            sr_arpcache_destroy(&(sr->cache));
+            free(sr->rx.buf);
+            free(sr->tx.data);
+            free(sr->tx.held);
+        }
+    }
+
+    if(bad == 0)
+    {
+        printf("loop %u packets, 1 in %d unanswered: event loop %.2f Mpps, "
+               "%lu frames out; threads %.2f Mpps, %lu frames out\n", n,
+               SR_BENCH_LOOP_MISS, n / t[0] / 1e6, sent[0],
+               n / t[1] / 1e6, sent[1]);
+    }
+    else
+    { fprintf(stderr, "loop: not every packet was handled\n"); }
+
+    free(stream);
+    return bad;
+} /* -- sr_bench_loop -- */
+
+#ifdef _LINUX_
+
+/* -- the router outlives sr_bench_ring(), its threads are never stopped -- */
+static struct sr_instance sr_bench_ring_sr;
+
+static void* sr_bench_ring_router(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+
+    while(sr->io->read(sr) == 1)
+    { }
+    return 0;
+}
+
+/* -- frames the kernel has counted in on device dev -- */
+static unsigned long sr_bench_ring_rx(const char* dev)
+{
+    struct ifaddrs *ifa, *p;
+    unsigned long rx = 0;
+
+    if(getifaddrs(&ifa) != 0)
+    { return 0; }
+    for(p = ifa; p; p = p->ifa_next)
+    {
+        if(p->ifa_addr && p->ifa_addr->sa_family == AF_PACKET &&
+           p->ifa_data && strcmp(p->ifa_name, dev) == 0)
+        { rx = ((struct rtnl_link_stats*)p->ifa_data)->rx_packets; }
+    }
+    freeifaddrs(ifa);
+    return rx;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_ring(..)
+ * Scope:  Local
+ *
+ * In a new network namespace, srb0 - srb1 and srb2 - srb3 are veth
+ * pairs; the router runs on srb1 and srb2 with sr_ring_open() and its
+ * reading thread.  Frames for a host behind eth2 are written on srb0 with
+ * sendmmsg() as fast as the kernel takes them, and counted as they come
+ * out on srb3.  Frames the router could not keep up with are lost in the
+ * kernel, so the forwarded rate is what the router managed.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_ring(const char* arg)
+{
+    static const unsigned int sizes[2] = { 64, 1500 };
+    struct sr_instance* sr = &sr_bench_ring_sr;
+    struct mmsghdr msgs[SR_BENCH_RING_BATCH];
+    struct sockaddr_ll ll;
+    struct in_addr dest, gw, mask;
+    struct iovec iov;
+    unsigned char mac[ETHER_ADDR_LEN];
+    unsigned int n = arg ? (unsigned int)atoi(arg) : SR_BENCH_RING_PACKETS;
+    unsigned long rx0, rx, last;
+    unsigned int sent, s, i;
+    uint8_t frame[1500];
+    char file[] = "/tmp/sr_bench_ringXXXXXX";
+    double t0, t_sent, t_last;
+    pthread_t thread;
+    FILE* fp;
+    int fd, one = 1, k;
+
+    if(n < 1)
+    { n = SR_BENCH_RING_PACKETS; }
+
+    if(unshare(CLONE_NEWNET) != 0)
+    {
+        perror("ring: unshare(CLONE_NEWNET), run it as root");
+        return 1;
+    }
+    if(system("ip link add srb0 type veth peer name srb1 && "
+              "ip link add srb2 type veth peer name srb3 && "
+              "for d in srb0 srb1 srb2 srb3; do ip link set $d up || exit 1; "
+              "done") != 0)
+    {
+        fprintf(stderr, "ring: could not set up the veth pairs\n");
+        return 1;
+    }
+
+    if((fd = mkstemp(file)) < 0 || (fp = fdopen(fd, "w")) == 0)
+    {
+        perror("mkstemp");
+        return 1;
+    }
+    fprintf(fp, "eth1 10.1.0.1 02:00:00:00:00:01 srb1\n"
+                "eth2 10.2.0.1 02:00:00:00:00:02 srb2\n");
+    fclose(fp);
+
+    memset(sr, 0, sizeof(*sr));
+    pthread_mutex_init(&(sr->rt_lock), 0);
+    sr_rcu_init(&(sr->rcu));
+    sr_dstcache_init(&(sr->dstcache));
+    sr->sockfd = -1;
+    sr_bench_quiet(1);
+    k = sr_ring_open(sr, file);
+    sr_bench_quiet(0);
+    unlink(file);
+    if(k != 0)
+    { return 1; }
+
+    dest.s_addr = htonl(0x0a020000);
+    gw.s_addr = 0;
+    mask.s_addr = htonl(0xffff0000);
+    sr_add_rt_entry(sr, dest, gw, mask, "eth2");
+    sr_init(sr);
+    memcpy(mac, sr_bench_mac2, ETHER_ADDR_LEN);
+    mac[5] = 0x10;
+    sr_arpcache_insert(&(sr->cache), mac, htonl(0x0a020002),
+                       sr_get_interface(sr, "eth2"));
+
+    /* -- the generator only sends, protocol 0 keeps frames out of it -- */
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_ifindex = if_nametoindex("srb0");
+    if((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0 ||
+       bind(fd, (struct sockaddr*)&ll, sizeof(ll)) < 0)
+    {
+        perror("ring: generator socket");
+        return 1;
+    }
+    setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+    sr_bench_quiet(1);
+    pthread_create(&thread, 0, sr_bench_ring_router, sr);
+
+    for(s = 0; s < 2; s++)
+    {
+        sr_bench_ip_packet(frame, sizes[s], htonl(0x0a020002));
+        iov.iov_base = frame;
+        iov.iov_len = sizes[s];
+        memset(msgs, 0, sizeof(msgs));
+        for(i = 0; i < SR_BENCH_RING_BATCH; i++)
+        {
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        rx0 = sr_bench_ring_rx("srb3");
+        t0 = sr_bench_now();
+        for(sent = 0; sent < n; sent += k)
+        {
+            k = sendmmsg(fd, msgs, n - sent < SR_BENCH_RING_BATCH ?
+                         n - sent : SR_BENCH_RING_BATCH, 0);
+            if(k < 0)
+            {
+                if(errno != ENOBUFS && errno != EAGAIN && errno != EINTR)
+                { break; }
+                k = 0;
+            }
+        }
+        t_sent = sr_bench_now() - t0;
+
+        /* -- done once nothing more comes out for a while -- */
+        last = sr_bench_ring_rx("srb3");
+        t_last = sr_bench_now();
+        while(sr_bench_now() - t_last < SR_BENCH_RING_IDLE)
+        {
+            usleep(1000);
+            if((rx = sr_bench_ring_rx("srb3")) != last)
+            {
+                last = rx;
+                t_last = sr_bench_now();
+            }
+        }
+        rx = last - rx0;
+
+        sr_bench_quiet(0);
+        printf("ring %4u-byte frames: offered %u at %.2f Mpps, forwarded "
+               "%lu at %.2f Mpps (%.2f Gbit/s)\n", sizes[s], sent,
+               sent / t_sent / 1e6, rx, rx / (t_last - t0) / 1e6,
+               rx * sizes[s] * 8.0 / (t_last - t0) / 1e9);
+        sr_bench_quiet(1);
+    }
+    sr_bench_quiet(0);
+
+    close(fd);
+    return 0;
+} /* -- sr_bench_ring -- */
+
+#else
+
+static int sr_bench_ring(const char* arg)
+{
+    fprintf(stderr, "ring: AF_PACKET rings are only supported on Linux\n");
+    return 1;
+} /* -- sr_bench_ring -- */
+
+#endif /* _LINUX_ */
+
+/*---------------------------------------------------------------------
+ * Method: sr_bench_run(..)
+ * Scope:  Local
+ *
+ * Run the benchmark named by spec ("name" or "name:arg").  Returns the
+ * process exit status.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_bench_run(const char* spec)
+{
+    char name[32];
+    const char* arg = strchr(spec, ':');
+    size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+
+    if(len >= sizeof(name))
+    { len = sizeof(name) - 1; }
+    memcpy(name, spec, len);
+    name[len] = 0;
+    if(arg)
+    { arg++; }
+
+    if(strcmp(name, "fib") == 0)
+    { return sr_bench_fib(arg); }
+    if(strcmp(name, "load") == 0)
+    { return sr_bench_load(arg); }
+    if(strcmp(name, "arp") == 0)
+    { return sr_bench_arp(arg); }
+    if(strcmp(name, "arpsoa") == 0)
+    { return sr_bench_arpsoa(arg); }
+    if(strcmp(name, "arpmt") == 0)
+    { return sr_bench_arpmt(arg); }
+    if(strcmp(name, "timer") == 0)
+    { return sr_bench_timer(arg); }
+    if(strcmp(name, "arpfirst") == 0)
+    { return sr_bench_arpfirst(arg); }
+    if(strcmp(name, "arpsweep") == 0)
+    { return sr_bench_arpsweep(arg); }
+    if(strcmp(name, "arpscan") == 0)
+    { return sr_bench_arpscan(arg); }
+    if(strcmp(name, "arprestart") == 0)
+    { return sr_bench_arprestart(arg); }
+    if(strcmp(name, "arpq") == 0)
+    { return sr_bench_arpq(arg); }
+    if(strcmp(name, "ifs") == 0)
+    { return sr_bench_ifs(arg); }
+    if(strcmp(name, "vnsrx") == 0)
+    { return sr_bench_vnsrx(arg); }
+    if(strcmp(name, "vnstx") == 0)
+    { return sr_bench_vnstx(arg); }
+    if(strcmp(name, "loop") == 0)
+    { return sr_bench_loop(arg); }
+    if(strcmp(name, "ring") == 0)
+    { return sr_bench_ring(arg); }
+
+    fprintf(stderr, "Unknown benchmark %s\n", name);
+    return 1;
+} /* -- sr_bench_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: main(..)
+ * Scope:  Global
+ *
+ * Run each benchmark named on the command line in turn, stopping at the
+ * first that fails.
+ *
+ *---------------------------------------------------------------------*/
+
+int main(int argc, char** argv)
+{
+    int i, ret = 0;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "Format: %s benchmark[:arg] ...\n", argv[0]);
+        return 1;
+    }
+
+    for(i = 1; i < argc && ret == 0; i++)
+    { ret = sr_bench_run(argv[i]); }
+
+    return ret;
+} /* -- main -- */
@@ -0,0 +1,411 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.c
+ *
+ * Description:
+ *
+ * Control socket thread.  Clients are served one at a time; the updates
+ * themselves are applied by sr_rt_apply() so the forwarding path never
+ * waits for the control socket.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_ctl.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_if.h"
+#include "sr_fib.h"
+
+#define SR_CTL_BUFSIZ 4096
+
+struct sr_ctl
+{
+    struct sr_instance* sr;
+    int listen_fd;
+    int fd;                         /* client being served */
+    int in_batch;
+    unsigned int bad;               /* malformed updates in the batch */
+    struct sr_rt_update* updates;
+    unsigned int n, max;
+    int rcu_slot;                   /* for reading the FIB in verify */
+};
+
+static void sr_ctl_reply(struct sr_ctl* ctl, const char* fmt, ...)
+{
+    char msg[256];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(msg, sizeof(msg) - 1, fmt, ap);
+    va_end(ap);
+    if(len < 0 || len > (int)sizeof(msg) - 2)
+    { len = sizeof(msg) - 2; }
+    msg[len++] = '\n';
+
+    /* -- a client that went away must not take the router with it -- */
+    send(ctl->fd, msg, len, MSG_NOSIGNAL);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_parse(..)
+ * Scope:  Local
+ *
+ * Parse an add, replace or del line into *u.  Returns 0, or -1 after
+ * pointing *why at the reason the line was rejected.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_ctl_parse(struct sr_ctl* ctl, const char* line,
+                        struct sr_rt_update* u, const char** why)
+{
+    char cmd[16], dest[32], gw[32], mask[32], iface[32];
+    int args;
+
+    args = sscanf(line, "%15s %31s %31s %31s %31s", cmd, dest, gw, mask, iface);
+
+    if(strcmp(cmd, "add") == 0)
+    { u->op = SR_RT_ADD; }
+    else if(strcmp(cmd, "replace") == 0)
+    { u->op = SR_RT_REPLACE; }
+    else if(strcmp(cmd, "del") == 0)
+    { u->op = SR_RT_DEL; }
+    else
+    {
+        *why = "unknown command";
+        return -1;
+    }
+
+    if(args != (u->op == SR_RT_DEL ? 3 : 5))
+    {
+        *why = "wrong number of arguments";
+        return -1;
+    }
+
+    if(u->op == SR_RT_DEL)
+    {
+        /* -- del <dest> <mask> -- */
+        strcpy(mask, gw);
+        strcpy(gw, "0.0.0.0");
+        iface[0] = 0;
+    }
+
+    if(inet_aton(dest, &(u->dest)) == 0 || inet_aton(gw, &(u->gw)) == 0 ||
+       inet_aton(mask, &(u->mask)) == 0)
+    {
+        *why = "invalid address";
+        return -1;
+    }
+
+    if(sr_rt_prefix_len(u->mask) < 0)
+    {
+        *why = "non-contiguous mask";
+        return -1;
+    }
+    u->dest.s_addr &= u->mask.s_addr;
+
+    memset(u->interface, 0, sr_IFACE_NAMELEN);
+    if(u->op != SR_RT_DEL)
+    {
+        if(strlen(iface) >= sr_IFACE_NAMELEN ||
+           sr_get_interface(ctl->sr, iface) == 0)
+        {
+            *why = "no such interface";
+            return -1;
+        }
+        strcpy(u->interface, iface);
+    }
+
+    return 0;
+} /* -- sr_ctl_parse -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_commit(..)
+ * Scope:  Local
+ *
+ * Apply the queued updates and report how fast that went.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ctl_commit(struct sr_ctl* ctl)
+{
+    struct timeval start, end;
+    unsigned int done;
+    double usec;
+
+    gettimeofday(&start, 0);
+    done = sr_rt_apply(ctl->sr, ctl->updates, ctl->n);
+    gettimeofday(&end, 0);
+
+    usec = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec);
+    if(usec < 1)
+    { usec = 1; }
+
+    if(done < ctl->n)
+    {
+        const struct sr_rt_update* u = &(ctl->updates[done]);
+
+        sr_ctl_reply(ctl, "error update %u: %s %s%s", done + 1,
+                     inet_ntoa(u->dest), u->op == SR_RT_ADD ?
+                     "already has a route" : "has no route",
+                     ctl->in_batch ? ", batch discarded" : "");
+    }
+    else
+    {
+        sr_ctl_reply(ctl, "ok %u updates in %.2f ms, %.0f routes/s",
+                     ctl->n, usec / 1000.0, ctl->n * 1e6 / usec);
+        printf("Control: applied %u route updates in %.2f ms "
+               "(%.0f routes/s)\n", ctl->n, usec / 1000.0,
+               ctl->n * 1e6 / usec);
+    }
+
+    ctl->n = 0;
+} /* -- sr_ctl_commit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_command(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ctl_command(struct sr_ctl* ctl, const char* line)
+{
+    struct sr_instance* sr = ctl->sr;
+    const char* why = 0;
+    char cmd[16];
+
+    if(sscanf(line, "%15s", cmd) != 1)
+    { return; }
+
+    if(strcmp(cmd, "begin") == 0)
+    {
+        if(ctl->in_batch)
+        { sr_ctl_reply(ctl, "error already in a batch"); }
+        else
+        {
+            ctl->in_batch = 1;
+            ctl->bad = 0;
+            ctl->n = 0;
+            sr_ctl_reply(ctl, "ok");
+        }
+    }
+    else if(strcmp(cmd, "commit") == 0 || strcmp(cmd, "abort") == 0)
+    {
+        if(ctl->in_batch == 0)
+        { sr_ctl_reply(ctl, "error not in a batch"); }
+        else if(cmd[0] == 'a')
+        { sr_ctl_reply(ctl, "ok %u updates discarded", ctl->n); }
+        else if(ctl->bad)
+        {
+            sr_ctl_reply(ctl, "error %u malformed updates, batch discarded",
+                         ctl->bad);
+        }
+        else
+        { sr_ctl_commit(ctl); }
+        ctl->in_batch = 0;
+        ctl->n = 0;
+    }
+    else if(strcmp(cmd, "reload") == 0)
+    {
+        if(sr_rt_reload(sr) != 0)
+        { sr_ctl_reply(ctl, "error reload failed"); }
+        else
+        { sr_ctl_reply(ctl, "ok"); }
+    }
+    else if(strcmp(cmd, "verify") == 0)
+    {
+        int bad = sr_fib_verify(sr, ctl->rcu_slot);
+
+        if(bad)
+        { sr_ctl_reply(ctl, "error %d mismatching addresses", bad); }
+        else
+        { sr_ctl_reply(ctl, "ok"); }
+    }
+    else if(strcmp(cmd, "arp") == 0)
+    {
+        struct sr_arpcache* cache = &(sr->cache);
+
+        /* -- in -E the loop owns the cache and never takes its lock -- */
+        sr_ctl_reply(ctl, "ok requests %u held %lu released %lu dropped %lu "
+                     "negative %lu refused %lu limited %lu refreshed %lu",
+                     __atomic_load_n(&(cache->nreqs), __ATOMIC_RELAXED),
+                     __atomic_load_n(&(cache->held), __ATOMIC_RELAXED),
+                     __atomic_load_n(&(cache->released), __ATOMIC_RELAXED),
+                     __atomic_load_n(&(cache->dropped), __ATOMIC_RELAXED),
+                     __atomic_load_n(&(cache->negative), __ATOMIC_RELAXED),
+                     __atomic_load_n(&(cache->refused), __ATOMIC_RELAXED),
+                     __atomic_load_n(&(cache->limited), __ATOMIC_RELAXED),
+                     __atomic_load_n(&(cache->refreshed), __ATOMIC_RELAXED));
+    }
+    else
+    {
+        if(ctl->n == ctl->max)
+        {
+            ctl->max = ctl->max ? 2 * ctl->max : 256;
+            ctl->updates = (struct sr_rt_update*)realloc(ctl->updates,
+                                ctl->max * sizeof(struct sr_rt_update));
+            assert(ctl->updates);
+        }
+
+        if(sr_ctl_parse(ctl, line, &(ctl->updates[ctl->n]), &why) != 0)
+        {
+            if(ctl->in_batch)
+            {
+                ctl->bad++;
+                sr_ctl_reply(ctl, "error update %u: %s", ctl->n + ctl->bad,
+                             why);
+            }
+            else
+            { sr_ctl_reply(ctl, "error %s", why); }
+            return;
+        }
+
+        ctl->n++;
+        if(ctl->in_batch == 0)
+        { sr_ctl_commit(ctl); }
+    }
+} /* -- sr_ctl_command -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_serve(..)
+ * Scope:  Local
+ *
+ * Run commands from one client until it disconnects.  An unfinished
+ * batch is dropped.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ctl_serve(struct sr_ctl* ctl)
+{
+    char buf[SR_CTL_BUFSIZ];
+    size_t len = 0;
+    ssize_t got;
+
+    ctl->in_batch = 0;
+    ctl->n = 0;
+
+    while((got = read(ctl->fd, buf + len, sizeof(buf) - 1 - len)) > 0)
+    {
+        char* line = buf;
+        char* nl;
+
+        len += got;
+        while((nl = memchr(line, '\n', buf + len - line)) != 0)
+        {
+            *nl = 0;
+            sr_ctl_command(ctl, line);
+            line = nl + 1;
+        }
+
+        len -= line - buf;
+        memmove(buf, line, len);
+        if(len == sizeof(buf) - 1)
+        {
+            sr_ctl_reply(ctl, "error line too long");
+            len = 0;
+        }
+    }
+} /* -- sr_ctl_serve -- */
+
+static void* sr_ctl_thread(void* ctl_ptr)
+{
+    struct sr_ctl* ctl = (struct sr_ctl*)ctl_ptr;
+
+    while(1)
+    {
+        ctl->fd = accept(ctl->listen_fd, 0, 0);
+        if(ctl->fd < 0)
+        {
+            if(errno != EINTR)
+            { perror("accept"); }
+            continue;
+        }
+
+        sr_ctl_serve(ctl);
+        close(ctl->fd);
+    }
+
+    return 0;
+} /* -- sr_ctl_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ctl_start(..)
+ * Scope:  Global
+ *
+ * Listen on a Unix socket at path, replacing any stale socket there, and
+ * start the thread serving it.  Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ctl_start(struct sr_instance* sr, const char* path)
+{
+    struct sockaddr_un addr;
+    struct sr_ctl* ctl;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int fd;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(path);
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Control socket path %s is too long\n", path);
+        return -1;
+    }
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+       listen(fd, 4) < 0)
+    {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+
+    ctl = (struct sr_ctl*)calloc(1, sizeof(struct sr_ctl));
+    assert(ctl);
+    ctl->sr = sr;
+    ctl->listen_fd = fd;
+    if((ctl->rcu_slot = sr_rcu_register(&(sr->rcu))) < 0)
+    {
+        fprintf(stderr, "No RCU reader slot left for the control socket\n");
+        close(fd);
+        free(ctl);
+        return -1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_create(&thread, &attr, sr_ctl_thread, ctl);
+    pthread_attr_destroy(&attr);
+
+    printf("Accepting route updates on %s\n", path);
+
+    return 0;
+} /* -- sr_ctl_start -- */
@@ -0,0 +1,32 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctl.h
+ *
+ * Description:
+ *
+ * Local control socket for changing routes without reloading the whole
+ * routing table file.  sr -c path listens on a Unix stream socket at path
+ * and accepts one command per line:
+ *
+ *   add <dest> <gateway> <mask> <iface>
+ *   replace <dest> <gateway> <mask> <iface>
+ *   del <dest> <mask>
+ *   begin | commit | abort     group updates into one atomic batch
+ *   reload                     reload the routing table file
+ *   verify                     check the FIB against the routing table
+ *   arp                        ARP request and queue counters
+ *
+ * Outside a batch every update is applied on its own and answered with
+ * "ok" or "error <reason>".  Inside a batch updates are only checked for
+ * syntax and answered only if they are malformed, so a client can stream
+ * thousands of them without reading; commit answers with the throughput.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_CTL_H
+#define sr_CTL_H
+
+struct sr_instance;
+
+int sr_ctl_start(struct sr_instance*, const char* path);
+
+#endif  /* --  sr_CTL_H -- */
@@ -0,0 +1,267 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_dir248.c
+ *
+ * Description:
+ *
+ * Builds DIR-24-8 tables from a routing table list.  Routes are painted
+ * shortest prefix first so that longer prefixes overwrite the slots they
+ * cover; the table is rebuilt as a whole whenever the routing table is
+ * (re)loaded.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <netinet/in.h>
+
+#include "sr_dir248.h"
+#include "sr_rt.h"
+
+struct sr_dir248_route
+{
+    struct sr_rt* rt;
+    unsigned int plen;
+    unsigned int order;     /* position in the list, keeps the sort stable */
+};
+
+static int sr_dir248_cmp(const void* a, const void* b)
+{
+    const struct sr_dir248_route* ra = (const struct sr_dir248_route*)a;
+    const struct sr_dir248_route* rb = (const struct sr_dir248_route*)b;
+
+    if(ra->plen != rb->plen)
+    { return ra->plen < rb->plen ? -1 : 1; }
+
+    return ra->order < rb->order ? -1 : (ra->order > rb->order);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir248_block(..)
+ * Scope:  Local
+ *
+ * Return the tbllong block for a /24 slot, creating it from the slot's
+ * current entry if the slot does not have one yet.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t* sr_dir248_block(struct sr_dir248* dir, uint32_t slot)
+{
+    uint32_t entry = dir->tbl24[slot];
+    uint32_t* block;
+    int i;
+
+    if(entry & SR_DIR248_LONG)
+    { return dir->tbllong + (entry & ~SR_DIR248_LONG) * SR_DIR248_BLOCK_SZ; }
+
+    if(dir->blocks == dir->blocks_max)
+    {
+        dir->blocks_max = dir->blocks_max ? dir->blocks_max * 2 : 64;
+        dir->tbllong = (uint32_t*)realloc(dir->tbllong,
+                dir->blocks_max * SR_DIR248_BLOCK_SZ * sizeof(uint32_t));
+        assert(dir->tbllong);
+    }
+
+    block = dir->tbllong + dir->blocks * SR_DIR248_BLOCK_SZ;
+    for(i = 0; i < SR_DIR248_BLOCK_SZ; i++)
+    { block[i] = entry; }
+
+    dir->tbl24[slot] = SR_DIR248_LONG | dir->blocks;
+    dir->blocks++;
+
+    return block;
+} /* -- sr_dir248_block -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir248_build(..)
+ * Scope:  Global
+ *
+ * Build the tables for every entry of a routing table list.  Entries with
+ * non-contiguous masks are skipped, and as in the trie a later entry for
+ * the same prefix replaces an earlier one.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_dir248* sr_dir248_build(struct sr_rt* rt_list)
+{
+    struct sr_dir248* dir;
+    struct sr_dir248_route* sorted;
+    struct sr_rt* rt_walker = 0;
+    unsigned int n = 0;
+    unsigned int i;
+
+    dir = (struct sr_dir248*)calloc(1, sizeof(struct sr_dir248));
+    assert(dir);
+    dir->tbl24 = (uint32_t*)calloc(SR_DIR248_TBL24_SZ, sizeof(uint32_t));
+    assert(dir->tbl24);
+
+    for(rt_walker = rt_list; rt_walker; rt_walker = rt_walker->next)
+    { n++; }
+
+    sorted = (struct sr_dir248_route*)malloc((n ? n : 1) *
+                                             sizeof(struct sr_dir248_route));
+    dir->rts = (struct sr_rt**)malloc((n ? n : 1) * sizeof(struct sr_rt*));
+    assert(sorted && dir->rts);
+
+    n = 0;
+    for(rt_walker = rt_list; rt_walker; rt_walker = rt_walker->next)
+    {
+        int plen = sr_rt_prefix_len(rt_walker->mask);
+
+        if(plen < 0)
+        { continue; }
+        sorted[n].rt = rt_walker;
+        sorted[n].plen = plen;
+        sorted[n].order = n;
+        n++;
+    }
+    qsort(sorted, n, sizeof(struct sr_dir248_route), sr_dir248_cmp);
+
+    for(i = 0; i < n; i++)
+    {
+        uint32_t prefix = ntohl(sorted[i].rt->dest.s_addr);
+        uint32_t entry;
+        uint32_t j, first, count;
+
+        if(sorted[i].plen == 0)
+        {
+            dir->default_rt = sorted[i].rt;
+            continue;
+        }
+
+        dir->rts[dir->nrts] = sorted[i].rt;
+        entry = ++dir->nrts;
+
+        if(sorted[i].plen <= 24)
+        {
+            /* -- no tbllong blocks exist yet, all shorter routes come first -- */
+            first = (prefix >> 8) & ~((1U << (24 - sorted[i].plen)) - 1);
+            count = 1U << (24 - sorted[i].plen);
+            for(j = first; j < first + count; j++)
+            { dir->tbl24[j] = entry; }
+        }
+        else
+        {
+            uint32_t* block = sr_dir248_block(dir, prefix >> 8);
+
+            first = prefix & 0xff & ~((1U << (32 - sorted[i].plen)) - 1);
+            count = 1U << (32 - sorted[i].plen);
+            for(j = first; j < first + count; j++)
+            { block[j] = entry; }
+        }
+    }
+
+    free(sorted);
+
+    return dir;
+} /* -- sr_dir248_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir248_destroy(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dir248_destroy(struct sr_dir248* dir)
+{
+    if(dir == 0)
+    { return; }
+
+    if(dir->mapped == 0)
+    {
+        free(dir->tbl24);
+        free(dir->tbllong);
+        free(dir->rts);
+    }
+    free(dir);
+} /* -- sr_dir248_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir248_lookup(..)
+ * Scope:  Global
+ *
+ * Longest prefix match for an IP address in network byte order.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_dir248_lookup(const struct sr_dir248* dir, uint32_t ip_nbo)
+{
+    uint32_t addr = ntohl(ip_nbo);
+    uint32_t entry = dir->tbl24[addr >> 8];
+
+    if(entry & SR_DIR248_LONG)
+    {
+        entry = dir->tbllong[(entry & ~SR_DIR248_LONG) * SR_DIR248_BLOCK_SZ +
+                             (addr & 0xff)];
+    }
+
+    return entry ? dir->rts[entry - 1] : dir->default_rt;
+} /* -- sr_dir248_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir248_lookup_burst(..)
+ * Scope:  Global
+ *
+ * Longest prefix match for n addresses.  Works in groups: prefetch every
+ * tbl24 slot of the group, then read them and prefetch the tbllong
+ * entries the long prefixes need, then resolve.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dir248_lookup_burst(const struct sr_dir248* dir, const uint32_t* ip_nbo,
+                            struct sr_rt** out, unsigned int n)
+{
+    uint32_t addr[SR_DIR248_BURST];
+    uint32_t entry[SR_DIR248_BURST];
+    unsigned int base, i, cnt;
+
+    for(base = 0; base < n; base += SR_DIR248_BURST)
+    {
+        cnt = n - base < SR_DIR248_BURST ? n - base : SR_DIR248_BURST;
+
+        for(i = 0; i < cnt; i++)
+        {
+            addr[i] = ntohl(ip_nbo[base + i]);
+            __builtin_prefetch(&dir->tbl24[addr[i] >> 8]);
+        }
+
+        for(i = 0; i < cnt; i++)
+        {
+            entry[i] = dir->tbl24[addr[i] >> 8];
+            if(entry[i] & SR_DIR248_LONG)
+            {
+                entry[i] = (entry[i] & ~SR_DIR248_LONG) * SR_DIR248_BLOCK_SZ +
+                           (addr[i] & 0xff);
+                __builtin_prefetch(&dir->tbllong[entry[i]]);
+                entry[i] |= SR_DIR248_LONG;
+            }
+        }
+
+        for(i = 0; i < cnt; i++)
+        {
+            uint32_t e = entry[i];
+
+            if(e & SR_DIR248_LONG)
+            { e = dir->tbllong[e & ~SR_DIR248_LONG]; }
+            out[base + i] = e ? dir->rts[e - 1] : dir->default_rt;
+        }
+    }
+} /* -- sr_dir248_lookup_burst -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir248_memory(..)
+ * Scope:  Global
+ *
+ * Bytes held by the lookup tables.
+ *
+ *---------------------------------------------------------------------*/
+
+size_t sr_dir248_memory(const struct sr_dir248* dir)
+{
+    return sizeof(struct sr_dir248) +
+           (size_t)SR_DIR248_TBL24_SZ * sizeof(uint32_t) +
+           (size_t)dir->blocks_max * SR_DIR248_BLOCK_SZ * sizeof(uint32_t) +
+           (size_t)dir->nrts * sizeof(struct sr_rt*);
+} /* -- sr_dir248_memory -- */
@@ -0,0 +1,63 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_dir248.h
+ *
+ * Description:
+ *
+ * DIR-24-8 direct-indexed lookup table.  The top 24 bits of an address
+ * index a 16M entry table; prefixes longer than /24 hang 256 entry blocks
+ * off the slots they fall in.  Most lookups take a single memory access at
+ * the price of a fixed 64MB table, so this is meant for very large routing
+ * tables where the trie gets deep and wide.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_DIR248_H
+#define sr_DIR248_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#include "sr_rt.h"
+
+#define SR_DIR248_TBL24_SZ (1 << 24)
+#define SR_DIR248_BLOCK_SZ 256
+#define SR_DIR248_LONG     0x80000000U  /* tbl24 entry is a tbllong block */
+#define SR_DIR248_BURST    32           /* lookups interleaved per group */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_dir248
+ *
+ * Table entries are 0 for "no route longer than /0", the index + 1 of a
+ * route in rts[], or SR_DIR248_LONG | block number in tbl24.  Tables
+ * mapped from a snapshot belong to the mapping rather than the heap, and
+ * rts[] to the FIB's mapped trie.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_dir248
+{
+    uint32_t* tbl24;
+    uint32_t* tbllong;
+    unsigned int blocks;
+    unsigned int blocks_max;
+    struct sr_rt** rts;
+    unsigned int nrts;
+    struct sr_rt* default_rt;
+    int mapped;                       /* tables and rts belong to a snapshot */
+};
+
+struct sr_dir248* sr_dir248_build(struct sr_rt* rt_list);
+void sr_dir248_destroy(struct sr_dir248*);
+struct sr_rt* sr_dir248_lookup(const struct sr_dir248*, uint32_t ip_nbo);
+void sr_dir248_lookup_burst(const struct sr_dir248*, const uint32_t* ip_nbo,
+                            struct sr_rt** out, unsigned int n);
+size_t sr_dir248_memory(const struct sr_dir248*);
+
+#endif  /* --  sr_DIR248_H -- */
@@ -0,0 +1,159 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_dstcache.c
+ *
+ * Description:
+ *
+ * Destination cache used by sr_handlepacket() before falling back to a
+ * full longest prefix match.  Only the forwarding thread touches it, so it
+ * takes no locks.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "sr_dstcache.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_if.h"
+#include "sr_fib.h"
+
+/* -- multiplicative hash, top bits depend on every bit of the address -- */
+static unsigned int sr_dstcache_hash(uint32_t ip)
+{
+    return (uint32_t)(ip * 2654435761U) >> (32 - SR_DSTCACHE_BITS);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_dstcache_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dstcache_init(struct sr_dstcache* cache)
+{
+    memset(cache, 0, sizeof(struct sr_dstcache));
+} /* -- sr_dstcache_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dstcache_hop(..)
+ * Scope:  Local
+ *
+ * Next hop of a multipath route for a flow.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_rt* sr_dstcache_hop(struct sr_instance* sr, struct sr_rt* rt,
+                                     uint32_t flow, struct sr_if** iface,
+                                     uint32_t* gw_nbo)
+{
+    const struct sr_rt_hop* hop = sr_rt_select(rt, flow);
+
+    *gw_nbo = hop->gw.s_addr;
+    *iface = sr_get_interface_index(sr, hop->ifindex);
+
+    return rt;
+} /* -- sr_dstcache_hop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dstcache_route(..)
+ * Scope:  Global
+ *
+ * Route an IP address in network byte order.  Returns the routing table
+ * entry and sets *iface and *gw_nbo to the next hop, chosen by the flow
+ * hash if the route is multipath, or returns 0 if there is no route.
+ * Misses go to the FIB and are cached if a route exists.  Must be called
+ * inside an rcu read section.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_dstcache_route(struct sr_instance* sr, uint32_t ip_nbo,
+                                uint32_t flow, struct sr_if** iface,
+                                uint32_t* gw_nbo)
+{
+    struct sr_dstcache* cache = &(sr->dstcache);
+    struct sr_dstcache_entry* set;
+    struct sr_dstcache_entry* slot;
+    struct sr_fib* fib;
+    unsigned long gen;
+    unsigned int s, i;
+    struct sr_rt* rt;
+
+    /* -- REQUIRES -- */
+    assert(iface);
+    assert(gw_nbo);
+
+    fib = sr_rcu_deref(sr->fib);
+    if(fib == 0)
+    { return 0; }
+
+    gen = fib->generation;
+    s = sr_dstcache_hash(ip_nbo);
+    set = cache->set[s];
+
+    for(i = 0; i < SR_DSTCACHE_WAYS; i++)
+    {
+        if(set[i].ip == ip_nbo && set[i].gen == gen)
+        {
+            cache->hits++;
+            if(set[i].iface == 0)
+            { return sr_dstcache_hop(sr, set[i].rt, flow, iface, gw_nbo); }
+            *iface = set[i].iface;
+            *gw_nbo = set[i].rt->gw.s_addr;
+            return set[i].rt;
+        }
+    }
+
+    cache->misses++;
+
+    rt = sr_fib_lookup(fib, ip_nbo);
+    if(rt == 0)
+    { return 0; }
+
+    if(rt->hops)
+    { sr_dstcache_hop(sr, rt, flow, iface, gw_nbo); }
+    else
+    {
+        *iface = sr_get_interface_index(sr, rt->ifindex);
+        *gw_nbo = rt->gw.s_addr;
+        if(*iface == 0)
+        { return rt; }
+    }
+
+    /* -- prefer a slot left over from an older generation -- */
+    slot = 0;
+    for(i = 0; i < SR_DSTCACHE_WAYS && slot == 0; i++)
+    {
+        if(set[i].gen != gen)
+        { slot = &set[i]; }
+    }
+    if(slot == 0)
+    {
+        slot = &set[cache->victim[s]];
+        cache->victim[s] = (cache->victim[s] + 1) % SR_DSTCACHE_WAYS;
+    }
+
+    slot->ip = ip_nbo;
+    slot->gen = gen;
+    slot->rt = rt;
+    slot->iface = rt->hops ? 0 : *iface;
+
+    return rt;
+} /* -- sr_dstcache_route -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dstcache_print_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_dstcache_print_stats(const struct sr_dstcache* cache)
+{
+    unsigned long total = cache->hits + cache->misses;
+
+    printf("Destination cache: %lu hits, %lu misses (%.1f%% hit rate), "
+           "%d entries\n", cache->hits, cache->misses,
+           total ? 100.0 * cache->hits / total : 0.0,
+           SR_DSTCACHE_SETS * SR_DSTCACHE_WAYS);
+} /* -- sr_dstcache_print_stats -- */
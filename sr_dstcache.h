@@ -0,0 +1,57 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_dstcache.h
+ *
+ * Description:
+ *
+ * Small set-associative cache in front of the FIB, keyed by destination
+ * IP.  A hit returns the routing table entry and outgoing interface the
+ * last full lookup chose for that address.  Multipath routes are cached
+ * without an interface, their next hop is picked per flow on every hit.
+ * Entries are stamped with the FIB generation they were filled under, so
+ * any routing table change invalidates the whole cache without touching
+ * it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_DSTCACHE_H
+#define sr_DSTCACHE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_DSTCACHE_BITS 10
+#define SR_DSTCACHE_SETS (1 << SR_DSTCACHE_BITS)
+#define SR_DSTCACHE_WAYS 4
+
+struct sr_instance;
+struct sr_rt;
+struct sr_if;
+
+struct sr_dstcache_entry
+{
+    uint32_t ip;                /* network byte order */
+    unsigned long gen;          /* FIB generation, 0 if unused */
+    struct sr_rt* rt;
+    struct sr_if* iface;        /* 0 for multipath routes */
+};
+
+struct sr_dstcache
+{
+    struct sr_dstcache_entry set[SR_DSTCACHE_SETS][SR_DSTCACHE_WAYS];
+    unsigned char victim[SR_DSTCACHE_SETS];   /* round-robin replacement */
+    unsigned long hits;
+    unsigned long misses;
+};
+
+void sr_dstcache_init(struct sr_dstcache*);
+struct sr_rt* sr_dstcache_route(struct sr_instance*, uint32_t ip_nbo,
+                                uint32_t flow, struct sr_if** iface,
+                                uint32_t* gw_nbo);
+void sr_dstcache_print_stats(const struct sr_dstcache*);
+
+#endif  /* --  sr_DSTCACHE_H -- */
@@ -0,0 +1,1289 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.c
+ *
+ * Description:
+ *
+ * Path-compressed multibit trie used for longest prefix match on the
+ * forwarding path.  Every route in sr->routing_table is also inserted here
+ * by sr_add_rt_entry(); the list remains the authoritative copy used for
+ * printing and verification.
+ *
+ * Incremental updates to a FIB that the forwarding path is using go
+ * through a clone: only the nodes on the path to each changed prefix are
+ * copied, so a batch costs a few nodes per route and the clone can be
+ * published with a single pointer store.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_fib.h"
+#include "sr_dir248.h"
+#include "sr_rt.h"
+#include "sr_router.h"
+#include "sr_slab.h"
+
+#define SR_FIB_INDEX(addr,pos) \
+    (((addr) >> (32 - SR_FIB_STRIDE - (pos))) & (SR_FIB_FANOUT - 1))
+
+#define SR_FIB_VERIFY_RANDOM 1024
+
+static unsigned long sr_fib_generation = 0;
+
+static uint32_t sr_fib_mask(unsigned int len)
+{
+    return len ? 0xffffffffU << (32 - len) : 0;
+}
+
+static unsigned int sr_fib_first_diff(uint32_t diff)
+{
+    return diff ? (unsigned int)__builtin_clz(diff) : 32;
+}
+
+static void* sr_fib_push(void* array, unsigned int* n, unsigned int* max,
+                         void* item)
+{
+    void** items = (void**)array;
+
+    if(*n == *max)
+    {
+        *max = *max ? 2 * *max : 64;
+        items = (void**)realloc(items, *max * sizeof(void*));
+        assert(items);
+    }
+    items[(*n)++] = item;
+
+    return items;
+}
+
+static struct sr_fib_node* sr_fib_node_new(struct sr_fib* fib,
+                                           uint32_t prefix, unsigned int pos)
+{
+    struct sr_fib_node* node;
+
+    if(fib->node_slab)
+    {
+        node = (struct sr_fib_node*)sr_slab_alloc(fib->node_slab);
+        node->slab = fib->node_slab;
+    }
+    else
+    { node = (struct sr_fib_node*)calloc(1, sizeof(struct sr_fib_node)); }
+    assert(node);
+    node->mask = sr_fib_mask(pos);
+    node->key  = prefix & node->mask;
+    node->pos  = pos;
+    node->txn  = fib->txn;
+    fib->nodes++;
+
+    return node;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_node_own(..)
+ * Scope:  Local
+ *
+ * Return a node of fib that may be modified in place: the node *link
+ * points to if fib allocated it, otherwise a private copy that replaces
+ * it in *link.  The parent holding link must already be private.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_fib_node* sr_fib_node_own(struct sr_fib* fib,
+                                           struct sr_fib_node** link)
+{
+    struct sr_fib_node* node = *link;
+    struct sr_fib_node* copy;
+
+    if(node->txn == fib->txn)
+    { return node; }
+
+    copy = (struct sr_fib_node*)malloc(sizeof(struct sr_fib_node));
+    assert(copy);
+    memcpy(copy, node, sizeof(struct sr_fib_node));
+    copy->txn = fib->txn;
+    copy->slab = copy->native_slab = 0;
+    if(node->native)
+    {
+        copy->native = (struct sr_rt**)malloc(SR_FIB_NATIVE *
+                                              sizeof(struct sr_rt*));
+        assert(copy->native);
+        memcpy(copy->native, node->native,
+               SR_FIB_NATIVE * sizeof(struct sr_rt*));
+    }
+
+    fib->retired = (struct sr_fib_node**)sr_fib_push(fib->retired,
+                        &(fib->nretired), &(fib->maxretired), node);
+    *link = copy;
+
+    return copy;
+} /* -- sr_fib_node_own -- */
+
+/* -- give a node and its native[] back to the heap or their slabs -- */
+static void sr_fib_node_release(struct sr_fib_node* node)
+{
+    if(node->native_slab)
+    { sr_slab_put(node->native_slab); }
+    else
+    { free(node->native); }
+
+    if(node->slab)
+    { sr_slab_put(node->slab); }
+    else
+    { free(node); }
+}
+
+/* -- free a private node that has just been unlinked from the trie -- */
+static void sr_fib_node_drop(struct sr_fib* fib, struct sr_fib_node* node)
+{
+    if(node->native)
+    { fib->natives--; }
+    sr_fib_node_release(node);
+    fib->nodes--;
+}
+
+/* -- free the subtrees allocated by transaction txn -- */
+static void sr_fib_node_free_txn(struct sr_fib_node* node, unsigned long txn)
+{
+    int i;
+
+    if(node == 0 || node->txn != txn)
+    { return; }
+
+    for(i = 0; i < SR_FIB_FANOUT; i++)
+    { sr_fib_node_free_txn(node->e[i].child, txn); }
+
+    sr_fib_node_release(node);
+}
+
+static void sr_fib_node_free(struct sr_fib_node* node)
+{
+    int i;
+
+    if(node == 0)
+    { return; }
+
+    for(i = 0; i < SR_FIB_FANOUT; i++)
+    { sr_fib_node_free(node->e[i].child); }
+
+    sr_fib_node_release(node);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_node_refresh(..)
+ * Scope:  Local
+ *
+ * Recompute the expanded slots [first, first+count) of a node from its
+ * native prefixes, preferring the longest one that covers each slot.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_fib_node_refresh(struct sr_fib_node* node,
+                                unsigned int first, unsigned int count)
+{
+    unsigned int i, l;
+
+    for(i = first; i < first + count; i++)
+    {
+        struct sr_rt* best = 0;
+
+        for(l = SR_FIB_STRIDE; l > 0 && node->native; l--)
+        {
+            best = node->native[(1 << l) - 2 + (i >> (SR_FIB_STRIDE - l))];
+            if(best)
+            { break; }
+        }
+        node->e[i].rt = best;
+    }
+} /* -- sr_fib_node_refresh -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_create(..)
+ * Scope:  Global
+ *
+ * Allocate an empty FIB using one of the SR_FIB_* lookup structures.  The
+ * root node always exists and covers the first stride of the address.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fib* sr_fib_create(int mode)
+{
+    struct sr_fib* fib;
+
+    fib = (struct sr_fib*)calloc(1, sizeof(struct sr_fib));
+    assert(fib);
+    fib->mode = mode;
+    fib->generation = fib->txn = ++sr_fib_generation;
+    fib->root = sr_fib_node_new(fib, 0, 0);
+
+    return fib;
+} /* -- sr_fib_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_reserve(..) / sr_fib_seal(..)
+ * Scope:  Global / Local
+ *
+ * Allocate the nodes and native arrays of a bulk load of about routes
+ * routes from slabs instead of one malloc each.  Routes inserted in
+ * address order make about one node and one native array per route, so
+ * the first chunk of each slab normally holds the whole trie.  The slabs
+ * take new objects until the FIB is committed or freed; after that, and
+ * in clones, nodes come from malloc again.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_reserve(struct sr_fib* fib, unsigned int routes)
+{
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(fib->node_slab == 0);
+
+    fib->node_slab = sr_slab_create(sizeof(struct sr_fib_node), routes + 1);
+    fib->native_slab = sr_slab_create(SR_FIB_NATIVE * sizeof(struct sr_rt*),
+                                      routes + 1);
+} /* -- sr_fib_reserve -- */
+
+static void sr_fib_seal(struct sr_fib* fib)
+{
+    sr_slab_seal(fib->node_slab);
+    sr_slab_seal(fib->native_slab);
+    fib->node_slab = fib->native_slab = 0;
+} /* -- sr_fib_seal -- */
+
+/* -- unmap a mapped trie; the entries in rts[] belong to the list -- */
+static void sr_fib_map_free(struct sr_fib_map* map)
+{
+    if(map == 0)
+    { return; }
+
+    munmap(map->base, map->len);
+    free(map->rts);
+    free(map);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_thaw(..)
+ * Scope:  Local
+ *
+ * Give fib, a clone of a mapped FIB, a heap copy of the mapped trie that
+ * it owns outright.  Nodes and native arrays come from slabs sized from
+ * the map.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_fib_thaw(struct sr_fib* fib, const struct sr_fib_map* map)
+{
+    struct sr_fib_node** nodes;
+    unsigned int i, j;
+
+    nodes = (struct sr_fib_node**)malloc(map->nnodes *
+                                         sizeof(struct sr_fib_node*));
+    assert(nodes);
+
+    fib->nodes = fib->natives = 0;
+    sr_fib_reserve(fib, map->nnodes);
+    for(i = 0; i < map->nnodes; i++)
+    { nodes[i] = sr_fib_node_new(fib, map->nodes[i].key, map->nodes[i].pos); }
+
+    for(i = 0; i < map->nnodes; i++)
+    {
+        const struct sr_fib_inode* in = &(map->nodes[i]);
+        struct sr_fib_node* node = nodes[i];
+
+        for(j = 0; j < SR_FIB_FANOUT; j++)
+        {
+            node->e[j].rt = in->e[j].rt ? map->rts[in->e[j].rt - 1] : 0;
+            node->e[j].child = in->e[j].child ? nodes[in->e[j].child] : 0;
+        }
+
+        if(in->native)
+        {
+            const uint32_t* native = map->natives +
+                                     (size_t)(in->native - 1) * SR_FIB_NATIVE;
+
+            node->native = (struct sr_rt**)sr_slab_alloc(fib->native_slab);
+            node->native_slab = fib->native_slab;
+            fib->natives++;
+            for(j = 0; j < SR_FIB_NATIVE; j++)
+            { node->native[j] = native[j] ? map->rts[native[j] - 1] : 0; }
+        }
+    }
+
+    fib->root = nodes[0];
+    sr_fib_seal(fib);
+    free(nodes);
+} /* -- sr_fib_thaw -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_map_find(..) / sr_fib_map_lookup(..)
+ * Scope:  Local
+ *
+ * sr_fib_find() and sr_fib_lookup() on a mapped trie, prefix and addr
+ * in host byte order.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_rt* sr_fib_map_find(const struct sr_fib_map* map,
+                                     uint32_t prefix, int plen)
+{
+    const struct sr_fib_inode* node = map->nodes;
+    unsigned int l, rt;
+
+    while(plen > node->pos + SR_FIB_STRIDE)
+    {
+        unsigned int child = node->e[SR_FIB_INDEX(prefix,node->pos)].child;
+
+        if(((prefix ^ node->key) & node->mask) || child == 0)
+        { return 0; }
+        node = &(map->nodes[child]);
+    }
+
+    if(plen <= node->pos || node->native == 0 ||
+       ((prefix ^ node->key) & node->mask))
+    { return 0; }
+
+    l = plen - node->pos;
+    rt = map->natives[(size_t)(node->native - 1) * SR_FIB_NATIVE +
+                      (1 << l) - 2 + ((prefix >> (32 - plen)) & ((1 << l) - 1))];
+    return rt ? map->rts[rt - 1] : 0;
+} /* -- sr_fib_map_find -- */
+
+static struct sr_rt* sr_fib_map_lookup(const struct sr_fib* fib, uint32_t addr)
+{
+    const struct sr_fib_map* map = fib->map;
+    const struct sr_fib_inode* node = map->nodes;
+    struct sr_rt* best = fib->default_rt;
+
+    while(((addr ^ node->key) & node->mask) == 0)
+    {
+        const struct sr_fib_ientry* e = &node->e[SR_FIB_INDEX(addr,node->pos)];
+
+        if(e->rt)
+        { best = map->rts[e->rt - 1]; }
+        if(e->child == 0)
+        { break; }
+        node = &(map->nodes[e->child]);
+    }
+
+    return best;
+} /* -- sr_fib_map_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_map_lookup_burst(..)
+ * Scope:  Local
+ *
+ * sr_fib_lookup_burst() on a mapped trie, with the same lock step walks
+ * and prefetches.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_fib_map_lookup_burst(const struct sr_fib* fib,
+                                    const uint32_t* ip_nbo,
+                                    struct sr_rt** out, unsigned int n)
+{
+    const struct sr_fib_map* map = fib->map;
+    const struct sr_fib_inode* node[SR_FIB_BURST];
+    uint32_t addr[SR_FIB_BURST];
+    unsigned int base, i, cnt, active;
+
+    for(base = 0; base < n; base += SR_FIB_BURST)
+    {
+        cnt = n - base < SR_FIB_BURST ? n - base : SR_FIB_BURST;
+
+        for(i = 0; i < cnt; i++)
+        {
+            addr[i] = ntohl(ip_nbo[base + i]);
+            node[i] = map->nodes;
+            out[base + i] = fib->default_rt;
+        }
+
+        do
+        {
+            active = 0;
+            for(i = 0; i < cnt; i++)
+            {
+                const struct sr_fib_ientry* e;
+
+                if(node[i] == 0)
+                { continue; }
+
+                if((addr[i] ^ node[i]->key) & node[i]->mask)
+                {
+                    node[i] = 0;
+                    continue;
+                }
+
+                e = &node[i]->e[SR_FIB_INDEX(addr[i],node[i]->pos)];
+                if(e->rt)
+                { out[base + i] = map->rts[e->rt - 1]; }
+
+                if(e->child == 0)
+                {
+                    node[i] = 0;
+                    continue;
+                }
+
+                {
+                    const struct sr_fib_inode* child = &(map->nodes[e->child]);
+                    unsigned int pos = node[i]->pos + SR_FIB_STRIDE;
+
+                    __builtin_prefetch(child);
+                    if(pos <= 32 - SR_FIB_STRIDE)
+                    { __builtin_prefetch(&child->e[SR_FIB_INDEX(addr[i],pos)]); }
+                    node[i] = child;
+                    active++;
+                }
+            }
+        } while(active);
+    }
+} /* -- sr_fib_map_lookup_burst -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_destroy(..)
+ * Scope:  Global
+ *
+ * Free the trie.  The sr_rt entries it points to belong to the routing
+ * table and are left alone.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_destroy(struct sr_fib* fib)
+{
+    if(fib == 0)
+    { return; }
+
+    sr_fib_node_free(fib->root);
+    sr_fib_seal(fib);
+    sr_dir248_destroy(fib->dir);
+    sr_fib_map_free(fib->map);
+    free(fib->retired);
+    free(fib->dead);
+    free(fib);
+} /* -- sr_fib_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_clone(..)
+ * Scope:  Global
+ *
+ * Start an update of a FIB readers may be using.  The clone shares the
+ * whole trie with fib, which is never modified through it.  Changes are
+ * made to the clone, which is then either published and passed to
+ * sr_fib_reclaim() or thrown away with sr_fib_abort().  The compiled
+ * DIR-24-8 tables are not shared; sr_fib_commit() rebuilds them.  A
+ * mapped trie is not shared either: the clone gets a heap copy.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_fib* sr_fib_clone(const struct sr_fib* fib)
+{
+    struct sr_fib* clone;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+
+    clone = (struct sr_fib*)malloc(sizeof(struct sr_fib));
+    assert(clone);
+    memcpy(clone, fib, sizeof(struct sr_fib));
+    clone->dir = 0;
+    clone->generation = clone->txn = ++sr_fib_generation;
+    clone->retired = 0;
+    clone->nretired = clone->maxretired = 0;
+    clone->dead = 0;
+    clone->ndead = clone->maxdead = 0;
+    clone->node_slab = clone->native_slab = 0;
+    clone->map = 0;
+    if(fib->map)
+    { sr_fib_thaw(clone, fib->map); }
+
+    return clone;
+} /* -- sr_fib_clone -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_abort(..)
+ * Scope:  Global
+ *
+ * Throw away an unpublished clone, leaving the FIB it came from intact.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_abort(struct sr_fib* fib)
+{
+    if(fib == 0)
+    { return; }
+
+    sr_fib_node_free_txn(fib->root, fib->txn);
+    sr_fib_seal(fib);
+    sr_dir248_destroy(fib->dir);
+    free(fib->retired);
+    free(fib->dead);
+    free(fib);
+} /* -- sr_fib_abort -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_reclaim(..)
+ * Scope:  Global
+ *
+ * Called once fib has replaced old, the FIB it was cloned from, and no
+ * reader can still be using old.  Frees what old does not share with fib
+ * and the entries fib deferred.  fib then owns its whole trie.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_reclaim(struct sr_fib* old, struct sr_fib* fib)
+{
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(old);
+    assert(fib);
+
+    for(i = 0; i < fib->nretired; i++)
+    { sr_fib_node_release(fib->retired[i]); }
+    for(i = 0; i < fib->ndead; i++)
+    { sr_rt_free(fib->dead[i]); }
+
+    free(fib->retired);
+    free(fib->dead);
+    fib->retired = 0;
+    fib->nretired = fib->maxretired = 0;
+    fib->dead = 0;
+    fib->ndead = fib->maxdead = 0;
+
+    sr_dir248_destroy(old->dir);
+    sr_fib_map_free(old->map);
+    free(old->retired);
+    free(old->dead);
+    free(old);
+} /* -- sr_fib_reclaim -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_defer_free(..)
+ * Scope:  Global
+ *
+ * Free a routing table entry removed from fib in sr_fib_reclaim(), when
+ * readers of the FIB fib was cloned from are done with it.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_defer_free(struct sr_fib* fib, struct sr_rt* rt)
+{
+    fib->dead = (struct sr_rt**)sr_fib_push(fib->dead, &(fib->ndead),
+                                            &(fib->maxdead), rt);
+} /* -- sr_fib_defer_free -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_insert(..)
+ * Scope:  Global
+ *
+ * Index a routing table entry.  A later entry for the same prefix
+ * replaces an earlier one, which is returned in *replaced if replaced is
+ * not 0.  Returns 0 on success, -1 if the entry has a non-contiguous
+ * netmask.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_insert(struct sr_fib* fib, struct sr_rt* rt,
+                  struct sr_rt** replaced)
+{
+    struct sr_fib_node* node;
+    struct sr_rt* old;
+    uint32_t prefix;
+    int plen;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(rt);
+    assert(fib->map == 0);
+
+    if(replaced)
+    { *replaced = 0; }
+
+    plen = sr_rt_prefix_len(rt->mask);
+    if(plen < 0)
+    { return -1; }
+
+    fib->generation = ++sr_fib_generation;
+
+    /* -- compiled tables no longer match, fall back to the trie -- */
+    if(fib->dir)
+    {
+        sr_dir248_destroy(fib->dir);
+        fib->dir = 0;
+    }
+
+    if(plen == 0)
+    {
+        if(fib->default_rt == 0)
+        { fib->routes++; }
+        if(replaced)
+        { *replaced = fib->default_rt; }
+        fib->default_rt = rt;
+        return 0;
+    }
+
+    prefix = ntohl(rt->dest.s_addr) & sr_fib_mask(plen);
+    node = sr_fib_node_own(fib, &(fib->root));
+
+    /* -- descend until we reach the node whose stride holds the prefix -- */
+    while(plen > node->pos + SR_FIB_STRIDE)
+    {
+        struct sr_fib_node** link = &node->e[SR_FIB_INDEX(prefix,node->pos)].child;
+        struct sr_fib_node* child = *link;
+        struct sr_fib_node* split;
+        unsigned int lim;
+
+        if(child == 0)
+        {
+            /* -- nothing below: hang a compressed leaf straight off -- */
+            *link = sr_fib_node_new(fib, prefix,
+                        ((plen - 1) / SR_FIB_STRIDE) * SR_FIB_STRIDE);
+            node = *link;
+            continue;
+        }
+
+        lim = sr_fib_first_diff((prefix ^ child->key) & child->mask);
+        if(lim > child->pos)
+        { lim = child->pos; }
+        if(lim > (unsigned int)plen - 1)
+        { lim = plen - 1; }
+
+        if(lim >= child->pos)
+        {
+            node = sr_fib_node_own(fib, link);
+            continue;
+        }
+
+        /* -- prefix leaves the compressed path: split it -- */
+        split = sr_fib_node_new(fib, prefix,
+                    (lim / SR_FIB_STRIDE) * SR_FIB_STRIDE);
+        split->e[SR_FIB_INDEX(child->key,split->pos)].child = child;
+        *link = split;
+        node = split;
+    }
+
+    {
+        unsigned int l = plen - node->pos;
+        unsigned int bits = (prefix >> (32 - plen)) & ((1 << l) - 1);
+
+        if(node->native == 0 && fib->native_slab)
+        {
+            node->native = (struct sr_rt**)sr_slab_alloc(fib->native_slab);
+            node->native_slab = fib->native_slab;
+            fib->natives++;
+        }
+        else if(node->native == 0)
+        {
+            node->native = (struct sr_rt**)calloc(SR_FIB_NATIVE,
+                                                  sizeof(struct sr_rt*));
+            assert(node->native);
+            fib->natives++;
+        }
+        old = node->native[(1 << l) - 2 + bits];
+        if(old == 0)
+        { fib->routes++; }
+        if(replaced)
+        { *replaced = old; }
+        node->native[(1 << l) - 2 + bits] = rt;
+        sr_fib_node_refresh(node, bits << (SR_FIB_STRIDE - l),
+                            1 << (SR_FIB_STRIDE - l));
+    }
+
+    return 0;
+} /* -- sr_fib_insert -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_find(..)
+ * Scope:  Global
+ *
+ * Exact match: the entry indexed for dest/mask, or 0 if there is none.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_find(const struct sr_fib* fib, uint32_t dest_nbo,
+                          uint32_t mask_nbo)
+{
+    const struct sr_fib_node* node;
+    struct in_addr mask;
+    uint32_t prefix;
+    unsigned int l;
+    int plen;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+
+    mask.s_addr = mask_nbo;
+    plen = sr_rt_prefix_len(mask);
+    if(plen <= 0)
+    { return plen == 0 ? fib->default_rt : 0; }
+
+    prefix = ntohl(dest_nbo) & sr_fib_mask(plen);
+    if(fib->map)
+    { return sr_fib_map_find(fib->map, prefix, plen); }
+    node = fib->root;
+
+    while(node && plen > node->pos + SR_FIB_STRIDE)
+    {
+        if((prefix ^ node->key) & node->mask)
+        { return 0; }
+        node = node->e[SR_FIB_INDEX(prefix,node->pos)].child;
+    }
+
+    if(node == 0 || plen <= node->pos || node->native == 0 ||
+       ((prefix ^ node->key) & node->mask))
+    { return 0; }
+
+    l = plen - node->pos;
+    return node->native[(1 << l) - 2 + ((prefix >> (32 - plen)) & ((1 << l) - 1))];
+} /* -- sr_fib_find -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_remove(..)
+ * Scope:  Global
+ *
+ * Withdraw the route for dest/mask.  Nodes left without routes are freed
+ * and nodes left with a single child are bypassed, so the trie stays the
+ * same shape it would have if the route had never been inserted.  Returns
+ * the entry that was removed, which the caller now owns, or 0.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_remove(struct sr_fib* fib, uint32_t dest_nbo,
+                            uint32_t mask_nbo)
+{
+    struct sr_fib_node* path[32 / SR_FIB_STRIDE + 1];
+    struct sr_fib_node** link[32 / SR_FIB_STRIDE + 1];
+    struct sr_fib_node* node;
+    struct sr_rt* rt;
+    struct in_addr mask;
+    uint32_t prefix;
+    unsigned int l, bits, i;
+    int plen, depth = 0;
+
+    /* -- REQUIRES -- */
+    assert(fib->map == 0);
+
+    rt = sr_fib_find(fib, dest_nbo, mask_nbo);
+    if(rt == 0)
+    { return 0; }
+
+    fib->generation = ++sr_fib_generation;
+    fib->routes--;
+
+    if(fib->dir)
+    {
+        sr_dir248_destroy(fib->dir);
+        fib->dir = 0;
+    }
+
+    mask.s_addr = mask_nbo;
+    plen = sr_rt_prefix_len(mask);
+    if(plen == 0)
+    {
+        fib->default_rt = 0;
+        return rt;
+    }
+
+    /* -- sr_fib_find() succeeded, so this walks an existing path -- */
+    prefix = ntohl(dest_nbo) & sr_fib_mask(plen);
+    link[0] = &(fib->root);
+    node = path[0] = sr_fib_node_own(fib, link[0]);
+    while(plen > node->pos + SR_FIB_STRIDE)
+    {
+        depth++;
+        link[depth] = &(node->e[SR_FIB_INDEX(prefix,node->pos)].child);
+        node = path[depth] = sr_fib_node_own(fib, link[depth]);
+    }
+
+    l = plen - node->pos;
+    bits = (prefix >> (32 - plen)) & ((1 << l) - 1);
+    node->native[(1 << l) - 2 + bits] = 0;
+    sr_fib_node_refresh(node, bits << (SR_FIB_STRIDE - l),
+                        1 << (SR_FIB_STRIDE - l));
+
+    for(; depth > 0; depth--)
+    {
+        struct sr_fib_node* child = 0;
+        unsigned int children = 0;
+
+        node = path[depth];
+        for(i = 0; node->native && i < SR_FIB_NATIVE; i++)
+        {
+            if(node->native[i])
+            { return rt; }
+        }
+        for(i = 0; i < SR_FIB_FANOUT; i++)
+        {
+            if(node->e[i].child)
+            {
+                child = node->e[i].child;
+                children++;
+            }
+        }
+        if(children > 1)
+        { break; }
+
+        *link[depth] = child;
+        sr_fib_node_drop(fib, node);
+        if(child)
+        { break; }
+    }
+
+    return rt;
+} /* -- sr_fib_remove -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_commit(..)
+ * Scope:  Global
+ *
+ * Called once a batch of sr_fib_insert() calls is complete, with the
+ * routing table list those entries came from.  Builds the DIR-24-8 tables
+ * when the FIB is in that mode.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_commit(struct sr_fib* fib, struct sr_rt* rt_list)
+{
+    struct timeval start, end;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+
+    sr_fib_seal(fib);
+    sr_dir248_destroy(fib->dir);
+    fib->dir = 0;
+    fib->generation = ++sr_fib_generation;
+
+    if(fib->mode != SR_FIB_DIR248)
+    { return; }
+
+    gettimeofday(&start, 0);
+    fib->dir = sr_dir248_build(rt_list);
+    gettimeofday(&end, 0);
+
+    fib->build_usec = (end.tv_sec - start.tv_sec) * 1000000 +
+                      (end.tv_usec - start.tv_usec);
+} /* -- sr_fib_commit -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_commit_dir(..)
+ * Scope:  Global
+ *
+ * Like sr_fib_commit() in SR_FIB_DIR248 mode, with tables that were built
+ * elsewhere from the same routes.  The FIB takes them over.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_commit_dir(struct sr_fib* fib, struct sr_dir248* dir)
+{
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(dir);
+
+    sr_fib_seal(fib);
+    sr_dir248_destroy(fib->dir);
+    fib->dir = dir;
+    fib->generation = ++sr_fib_generation;
+    fib->build_usec = 0;
+} /* -- sr_fib_commit_dir -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_commit_map(..)
+ * Scope:  Global
+ *
+ * Replace the trie of a FIB nothing has been inserted into with a mapped
+ * one built elsewhere.  The FIB takes over the map and its mapping.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_commit_map(struct sr_fib* fib, struct sr_fib_map* map)
+{
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(map && map->nnodes > 0);
+    assert(fib->routes == 0 && fib->map == 0);
+
+    sr_fib_seal(fib);
+    sr_fib_node_free(fib->root);
+    fib->root = 0;
+    fib->map = map;
+    fib->default_rt = map->default_rt;
+    fib->routes = map->routes;
+    fib->nodes = map->nnodes;
+    fib->natives = map->nnatives;
+    fib->generation = ++sr_fib_generation;
+} /* -- sr_fib_commit_map -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup(..)
+ * Scope:  Global
+ *
+ * Longest prefix match for an IP address in network byte order.  Returns
+ * the matching routing table entry or 0 if no route covers the address.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip_nbo)
+{
+    const struct sr_fib_node* node;
+    struct sr_rt* best;
+    uint32_t addr = ntohl(ip_nbo);
+
+    if(fib == 0)
+    { return 0; }
+
+    if(fib->dir)
+    { return sr_dir248_lookup(fib->dir, ip_nbo); }
+
+    if(fib->map)
+    { return sr_fib_map_lookup(fib, addr); }
+
+    best = fib->default_rt;
+    node = fib->root;
+
+    while(node && ((addr ^ node->key) & node->mask) == 0)
+    {
+        const struct sr_fib_entry* e = &node->e[SR_FIB_INDEX(addr,node->pos)];
+
+        if(e->rt)
+        { best = e->rt; }
+        node = e->child;
+    }
+
+    return best;
+} /* -- sr_fib_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup_burst(..)
+ * Scope:  Global
+ *
+ * Longest prefix match for n addresses at once.  The walks down the trie
+ * advance in lock step, SR_FIB_BURST addresses at a time, and each level
+ * prefetches the next node of every walk before any of them is touched,
+ * so the cache misses of independent lookups overlap instead of adding up.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_lookup_burst(const struct sr_fib* fib, const uint32_t* ip_nbo,
+                         struct sr_rt** out, unsigned int n)
+{
+    const struct sr_fib_node* node[SR_FIB_BURST];
+    uint32_t addr[SR_FIB_BURST];
+    unsigned int base, i, cnt, active;
+
+    if(fib == 0)
+    {
+        for(i = 0; i < n; i++)
+        { out[i] = 0; }
+        return;
+    }
+
+    if(fib->dir)
+    {
+        sr_dir248_lookup_burst(fib->dir, ip_nbo, out, n);
+        return;
+    }
+
+    if(fib->map)
+    {
+        sr_fib_map_lookup_burst(fib, ip_nbo, out, n);
+        return;
+    }
+
+    for(base = 0; base < n; base += SR_FIB_BURST)
+    {
+        cnt = n - base < SR_FIB_BURST ? n - base : SR_FIB_BURST;
+
+        for(i = 0; i < cnt; i++)
+        {
+            addr[i] = ntohl(ip_nbo[base + i]);
+            node[i] = fib->root;
+            out[base + i] = fib->default_rt;
+        }
+
+        do
+        {
+            active = 0;
+            for(i = 0; i < cnt; i++)
+            {
+                const struct sr_fib_entry* e;
+
+                if(node[i] == 0)
+                { continue; }
+
+                if((addr[i] ^ node[i]->key) & node[i]->mask)
+                {
+                    node[i] = 0;
+                    continue;
+                }
+
+                e = &node[i]->e[SR_FIB_INDEX(addr[i],node[i]->pos)];
+                if(e->rt)
+                { out[base + i] = e->rt; }
+
+                if(e->child)
+                {
+                    /* -- header, and the entry used if no bits were skipped -- */
+                    unsigned int pos = node[i]->pos + SR_FIB_STRIDE;
+
+                    __builtin_prefetch(e->child);
+                    if(pos <= 32 - SR_FIB_STRIDE)
+                    { __builtin_prefetch(&e->child->e[SR_FIB_INDEX(addr[i],pos)]); }
+                    active++;
+                }
+                node[i] = e->child;
+            }
+        } while(active);
+    }
+} /* -- sr_fib_lookup_burst -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_parse_mode(..)
+ * Scope:  Global
+ *
+ * Map a lookup structure name from the command line to SR_FIB_*, or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_parse_mode(const char* name)
+{
+    if(strcmp(name, "trie") == 0)
+    { return SR_FIB_TRIE; }
+    if(strcmp(name, "dir248") == 0)
+    { return SR_FIB_DIR248; }
+
+    return -1;
+} /* -- sr_fib_parse_mode -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_memory(..)
+ * Scope:  Global
+ *
+ * Bytes held by the FIB's lookup structures (not the sr_rt entries).
+ *
+ *---------------------------------------------------------------------*/
+
+size_t sr_fib_memory(const struct sr_fib* fib)
+{
+    size_t bytes = sizeof(struct sr_fib) +
+        (size_t)fib->nodes * sizeof(struct sr_fib_node) +
+        (size_t)fib->natives * SR_FIB_NATIVE * sizeof(struct sr_rt*);
+
+    if(fib->map)
+    {
+        bytes = sizeof(struct sr_fib) + sizeof(struct sr_fib_map) +
+            (size_t)fib->nodes * sizeof(struct sr_fib_inode) +
+            (size_t)fib->natives * SR_FIB_NATIVE * sizeof(uint32_t) +
+            (size_t)fib->map->nrts * sizeof(struct sr_rt*);
+    }
+
+    if(fib->dir)
+    { bytes += sr_dir248_memory(fib->dir); }
+
+    return bytes;
+} /* -- sr_fib_memory -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_print_stats(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_print_stats(const struct sr_fib* fib)
+{
+    if(fib == 0)
+    { return; }
+
+    printf("FIB: %u routes, %strie %u nodes",fib->routes,
+           fib->map ? "mapped " : "",fib->nodes);
+    if(fib->dir)
+    {
+        printf(", DIR-24-8 %u long blocks, built in %.1f ms",
+               fib->dir->blocks, fib->build_usec / 1000.0);
+    }
+    printf(", %.1f KB\n", sr_fib_memory(fib) / 1024.0);
+} /* -- sr_fib_print_stats -- */
+
+/* -- a route as sr_fib_verify() knows it, copied from the list -- */
+struct sr_fib_ref
+{
+    uint32_t first;                   /* host byte order */
+    uint32_t last;
+    int plen;
+    unsigned int seq;                 /* position in the list */
+    const struct sr_rt* rt;
+};
+
+static int sr_fib_ref_cmp(const void* a, const void* b)
+{
+    const struct sr_fib_ref* x = (const struct sr_fib_ref*)a;
+    const struct sr_fib_ref* y = (const struct sr_fib_ref*)b;
+
+    if(x->first != y->first)
+    { return x->first < y->first ? -1 : 1; }
+    if(x->plen != y->plen)
+    { return x->plen < y->plen ? -1 : 1; }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int sr_fib_addr_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_verify_refs(..)
+ * Scope:  Local
+ *
+ * Compare fib against the n routes of refs at the edges of every route
+ * and at a fixed set of pseudo-random addresses.  The reference answer
+ * comes from one sweep over the routes sorted by prefix: prefixes either
+ * nest or do not overlap, so the routes covering the current address
+ * form a stack whose top is the longest match.  O(n log n) in all.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_fib_verify_refs(const struct sr_fib* fib,
+                              struct sr_fib_ref* refs, unsigned int n)
+{
+    const struct sr_fib_ref* stack[33];
+    uint32_t* addrs;
+    uint32_t seed = 0x5eed;
+    unsigned int naddrs = 0, i, j, depth = 0;
+    int ret = 0;
+
+    addrs = (uint32_t*)malloc((4 * n + SR_FIB_VERIFY_RANDOM) *
+                              sizeof(uint32_t));
+    assert(addrs);
+    for(i = 0; i < n; i++)
+    {
+        addrs[naddrs++] = refs[i].first;
+        addrs[naddrs++] = refs[i].last;
+        addrs[naddrs++] = refs[i].first - 1;
+        addrs[naddrs++] = refs[i].last + 1;
+    }
+    for(i = 0; i < SR_FIB_VERIFY_RANDOM; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        addrs[naddrs++] = seed;
+    }
+
+    qsort(refs, n, sizeof(struct sr_fib_ref), sr_fib_ref_cmp);
+    qsort(addrs, naddrs, sizeof(uint32_t), sr_fib_addr_cmp);
+
+    for(i = 0, j = 0; i < naddrs; i++)
+    {
+        const struct sr_rt* want;
+        const struct sr_rt* got;
+        struct in_addr a;
+
+        if(i > 0 && addrs[i] == addrs[i - 1])
+        { continue; }
+
+        for(; j < n && refs[j].first <= addrs[i]; j++)
+        {
+            /* -- of several entries for one prefix the last one wins -- */
+            if(j + 1 < n && refs[j + 1].first == refs[j].first &&
+               refs[j + 1].plen == refs[j].plen)
+            { continue; }
+            while(depth > 0 && stack[depth - 1]->last < refs[j].first)
+            { depth--; }
+            stack[depth++] = &(refs[j]);
+        }
+        while(depth > 0 && stack[depth - 1]->last < addrs[i])
+        { depth--; }
+
+        want = depth > 0 ? stack[depth - 1]->rt : 0;
+        got = fib ? sr_fib_lookup(fib, htonl(addrs[i])) : 0;
+        if(want == got)
+        { continue; }
+
+        ret++;
+        a.s_addr = htonl(addrs[i]);
+        fprintf(stderr, "FIB mismatch for %s: ", inet_ntoa(a));
+        a.s_addr = depth > 0 ? htonl(stack[depth - 1]->first) : 0;
+        fprintf(stderr, "table %s, ", want ? inet_ntoa(a) : "none");
+        fprintf(stderr, "trie %s\n", got ? inet_ntoa(got->dest) : "none");
+    }
+
+    free(addrs);
+
+    return ret;
+} /* -- sr_fib_verify_refs -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_verify(..)
+ * Scope:  Global
+ *
+ * Check the FIB against the routing table list, see sr_fib_verify_refs().
+ * Routes with non-contiguous masks are left out, as in the FIB.
+ *
+ * rt_lock is only held while the list is copied.  With slot >= 0 the
+ * check then runs under the RCU in that reader slot, so updates go on
+ * meanwhile; with slot < 0 the caller keeps other writers away.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  the number of mismatching addresses otherwise
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_verify(struct sr_instance* sr, int slot)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_fib_ref* refs;
+    const struct sr_fib* fib;
+    unsigned int n = 0, max = 1024;
+    int ret;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    refs = (struct sr_fib_ref*)malloc(max * sizeof(struct sr_fib_ref));
+    assert(refs);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    for(rt_walker = sr->routing_table; rt_walker; rt_walker = rt_walker->next)
+    {
+        int plen = sr_rt_prefix_len(rt_walker->mask);
+
+        if(plen < 0)
+        { continue; }
+        if(n == max)
+        {
+            max *= 2;
+            refs = (struct sr_fib_ref*)realloc(refs,
+                                               max * sizeof(struct sr_fib_ref));
+            assert(refs);
+        }
+        refs[n].first = ntohl(rt_walker->dest.s_addr) & sr_fib_mask(plen);
+        refs[n].last = refs[n].first | ~sr_fib_mask(plen);
+        refs[n].plen = plen;
+        refs[n].seq = n;
+        refs[n].rt = rt_walker;
+        n++;
+    }
+    if(slot >= 0)
+    { sr_rcu_read_lock(&(sr->rcu), slot); }
+    fib = sr_rcu_deref(sr->fib);
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    ret = sr_fib_verify_refs(fib, refs, n);
+
+    if(slot >= 0)
+    { sr_rcu_read_unlock(&(sr->rcu), slot); }
+    free(refs);
+
+    return ret;
+} /* -- sr_fib_verify -- */
@@ -0,0 +1,176 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.h
+ *
+ * Description:
+ *
+ * Forwarding information base built from the routing table.  Routes are
+ * indexed by a path-compressed multibit trie so a longest prefix match
+ * visits at most one node per SR_FIB_STRIDE bits of the matched prefix
+ * instead of every entry of the sr_rt list.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_FIB_H
+#define sr_FIB_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#include "sr_rt.h"
+
+/* -- lookup structures selectable with sr -F -- */
+#define SR_FIB_TRIE   0
+#define SR_FIB_DIR248 1
+
+#define SR_FIB_STRIDE 4                       /* bits consumed per node */
+#define SR_FIB_FANOUT (1 << SR_FIB_STRIDE)
+#define SR_FIB_NATIVE (2*SR_FIB_FANOUT - 2)   /* prefixes of length 1..STRIDE */
+#define SR_FIB_BURST  16                      /* lookups interleaved per pass */
+
+struct sr_instance;
+struct sr_dir248;
+struct sr_slab;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib_node
+ *
+ * One trie node covers address bits [pos, pos+SR_FIB_STRIDE).  Nodes whose
+ * path would only lead to a single child are skipped, so a child may start
+ * several strides below its parent; key/mask record the bits above pos that
+ * an address must match to use the node.  Nodes and native arrays built
+ * by a bulk load come from the FIB's slabs, see sr_fib_reserve().
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib_entry
+{
+    struct sr_rt* rt;                 /* best native route covering slot */
+    struct sr_fib_node* child;
+};
+
+struct sr_fib_node
+{
+    uint32_t key;                     /* host byte order, bits above pos */
+    uint32_t mask;                    /* netmask of length pos */
+    unsigned int pos;
+    unsigned long txn;                /* sr_fib txn that allocated the node */
+    struct sr_fib_entry e[SR_FIB_FANOUT];
+    struct sr_rt** native;            /* routes ending in this stride, or 0 */
+    struct sr_slab* slab;             /* the node's, 0 if malloc'd */
+    struct sr_slab* native_slab;      /* native[]'s, 0 if malloc'd */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib_inode / struct sr_fib_map
+ *
+ * The trie in index form, as a snapshot stores it; sr_fib_commit_map()
+ * answers lookups from it in place, read-only.  Node 0 is the root and
+ * every child follows its parent, so child 0 means none.  rt entries and
+ * native array entries are 1 + an index into rts[], 0 for none; native is
+ * 1 + the index of the node's SR_FIB_NATIVE entries in natives, or 0.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib_ientry
+{
+    uint32_t rt;
+    uint32_t child;
+};
+
+struct sr_fib_inode
+{
+    uint32_t key;
+    uint32_t mask;
+    uint32_t pos;
+    uint32_t native;
+    struct sr_fib_ientry e[SR_FIB_FANOUT];
+};
+
+struct sr_fib_map
+{
+    const struct sr_fib_inode* nodes;
+    unsigned int nnodes;
+    const uint32_t* natives;
+    unsigned int nnatives;
+    struct sr_rt** rts;               /* freed with the map */
+    unsigned int nrts;
+    struct sr_rt* default_rt;
+    unsigned int routes;
+    void* base;                       /* mapping holding nodes and natives */
+    size_t len;
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib
+ *
+ * The trie is always kept up to date by sr_fib_insert().  In SR_FIB_DIR248
+ * mode sr_fib_commit() additionally compiles the routing table into DIR-24-8
+ * tables which then answer lookups; inserting after a commit drops those
+ * tables and lookups fall back to the trie until the next commit.
+ *
+ * generation is unique across all FIBs and bumped on every change, so
+ * anything derived from lookups can be validated by comparing it.
+ *
+ * sr_fib_clone() starts an update transaction that shares every node with
+ * the FIB it was cloned from.  Nodes whose txn differs from the FIB's are
+ * shared and copied before they are modified; the originals go on the
+ * retired list, together with entries handed to sr_fib_defer_free(), and
+ * are released by sr_fib_reclaim() once the old FIB has no readers left.
+ *
+ * A FIB with a map has no nodes of its own until it is cloned: the clone
+ * copies the mapped trie to the heap, once, and updates go on from there.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib
+{
+    int mode;
+    struct sr_fib_node* root;
+    struct sr_rt* default_rt;         /* 0.0.0.0/0, kept out of the trie */
+    struct sr_dir248* dir;
+    unsigned int routes;
+    unsigned int nodes;
+    unsigned int natives;             /* nodes with a native[] array */
+    unsigned long build_usec;         /* time spent in the last commit */
+    unsigned long generation;         /* changes whenever the FIB does */
+    unsigned long txn;                /* nodes stamped with this are private */
+    struct sr_fib_node** retired;     /* nodes replaced since the clone */
+    unsigned int nretired, maxretired;
+    struct sr_rt** dead;              /* entries removed since the clone */
+    unsigned int ndead, maxdead;
+    struct sr_slab* node_slab;        /* bulk load allocation, until commit */
+    struct sr_slab* native_slab;
+    struct sr_fib_map* map;           /* mapped trie used instead of root */
+};
+
+struct sr_fib* sr_fib_create(int mode);
+void sr_fib_destroy(struct sr_fib*);
+void sr_fib_reserve(struct sr_fib*, unsigned int routes);
+struct sr_fib* sr_fib_clone(const struct sr_fib*);
+void sr_fib_abort(struct sr_fib*);
+void sr_fib_reclaim(struct sr_fib* old, struct sr_fib* fib);
+int sr_fib_insert(struct sr_fib*, struct sr_rt*, struct sr_rt** replaced);
+struct sr_rt* sr_fib_find(const struct sr_fib*, uint32_t dest_nbo,
+                          uint32_t mask_nbo);
+struct sr_rt* sr_fib_remove(struct sr_fib*, uint32_t dest_nbo,
+                            uint32_t mask_nbo);
+void sr_fib_defer_free(struct sr_fib*, struct sr_rt*);
+void sr_fib_commit(struct sr_fib*, struct sr_rt* rt_list);
+void sr_fib_commit_dir(struct sr_fib*, struct sr_dir248*);
+void sr_fib_commit_map(struct sr_fib*, struct sr_fib_map*);
+struct sr_rt* sr_fib_lookup(const struct sr_fib*, uint32_t ip_nbo);
+void sr_fib_lookup_burst(const struct sr_fib*, const uint32_t* ip_nbo,
+                         struct sr_rt** out, unsigned int n);
+int sr_fib_parse_mode(const char*);
+size_t sr_fib_memory(const struct sr_fib*);
+void sr_fib_print_stats(const struct sr_fib*);
+int sr_fib_verify(struct sr_instance*, int slot);
+
+#endif  /* --  sr_FIB_H -- */
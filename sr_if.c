@@ -54,6 +54,93 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
     return 0;
 } /* -- sr_get_interface -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_get_interface_index(..)
+ * Scope: Global
+ *
+ * Given an interface index return the interface record or 0 if it doesn't
+ * exist.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_index(struct sr_instance* sr,
+                                     unsigned int index)
+{
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    return index < sr->nifs ? sr->ifs[index] : 0;
+} /* -- sr_get_interface_index -- */
+
+static unsigned int sr_if_hash(uint32_t ip, unsigned int bits)
+{ return (uint32_t)(ip * 2654435761U) >> (32 - bits); }
+
+/*---------------------------------------------------------------------
+ * Method: sr_get_interface_ip(..)
+ * Scope: Global
+ *
+ * Return the interface that has the IP address ip_nbo, or 0 if none of
+ * the router's interfaces does: the test for packets addressed to the
+ * router itself, whichever interface they came in on.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_ip(struct sr_instance* sr, uint32_t ip_nbo)
+{
+    unsigned int mask, i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if(sr->local == 0 || ip_nbo == 0)
+    { return 0; }
+
+    mask = (1U << sr->local_bits) - 1;
+    for(i = sr_if_hash(ip_nbo, sr->local_bits); sr->local[i];
+        i = (i + 1) & mask)
+    {
+        if(sr->local[i]->ip == ip_nbo)
+        { return sr->local[i]; }
+    }
+
+    return 0;
+} /* -- sr_get_interface_ip -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_if_index_ips(..)
+ * Scope: Local
+ *
+ * Rebuild the set of local addresses, at most half full, from the
+ * interfaces that have one.  An address held by two interfaces maps to the
+ * first.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_if_index_ips(struct sr_instance* sr)
+{
+    unsigned int bits = 1, mask, i, j;
+
+    while((1U << bits) < 2 * sr->nifs)
+    { bits++; }
+
+    free(sr->local);
+    sr->local = (struct sr_if**)calloc(1U << bits, sizeof(struct sr_if*));
+    assert(sr->local);
+    sr->local_bits = bits;
+    mask = (1U << bits) - 1;
+
+    for(i = 0; i < sr->nifs; i++)
+    {
+        uint32_t ip = sr->ifs[i]->ip;
+
+        if(ip == 0 || sr_get_interface_ip(sr, ip))
+        { continue; }
+        for(j = sr_if_hash(ip, bits); sr->local[j]; j = (j + 1) & mask)
+            ;
+        sr->local[j] = sr->ifs[i];
+    }
+} /* -- sr_if_index_ips -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_add_interface(..)
  * Scope: Global
@@ -70,13 +157,22 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     assert(name);
     assert(sr);
 
+    /* -- the next index, its slot in the table -- */
+    sr->ifs = (struct sr_if**)realloc(sr->ifs,
+                                      (sr->nifs + 1) * sizeof(struct sr_if*));
+    assert(sr->ifs);
+
     /* -- empty list special case -- */
     if(sr->if_list == 0)
     {
         sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
+        sr->if_list->speed = 0;
+        sr->if_list->ip = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr->if_list->index = sr->nifs;
+        sr->ifs[sr->nifs++] = sr->if_list;
         return;
     }
 
@@ -89,7 +185,11 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     assert(if_walker->next);
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
+    if_walker->speed = 0;
+    if_walker->ip = 0;
     if_walker->next = 0;
+    if_walker->index = sr->nifs;
+    sr->ifs[sr->nifs++] = if_walker;
 } /* -- sr_add_interface -- */ 
 
 /*--------------------------------------------------------------------- 
@@ -120,7 +220,8 @@ void sr_set_ether_addr(struct sr_instance* sr, const unsigned char* addr)
  * Method: sr_set_ether_ip(..)
  * Scope: Global
  *
- * set the IP address of the LAST interface in the interface list
+ * set the IP address of the LAST interface in the interface list and
+ * index the local addresses again
  *
  *---------------------------------------------------------------------*/
 
@@ -137,9 +238,33 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
+    sr_if_index_ips(sr);
 
 } /* -- sr_set_ether_ip -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_set_ether_speed(..)
+ * Scope: Global
+ *
+ * set the link speed of the LAST interface in the interface list
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_set_ether_speed(struct sr_instance* sr, uint32_t speed)
+{
+    struct sr_if* if_walker = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr->if_list);
+
+    if_walker = sr->if_list;
+    while(if_walker->next)
+    {if_walker = if_walker->next; }
+
+    if_walker->speed = speed;
+
+} /* -- sr_set_ether_speed -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_print_if_list(..)
  * Scope: Global
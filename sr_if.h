@@ -26,12 +26,16 @@
 
 #include "sr_protocol.h"
 
+#define SR_IF_NONE ((unsigned int)-1)     /* index of no interface */
+
 struct sr_instance;
 
 /* ----------------------------------------------------------------------------
  * struct sr_if
  *
- * Node in the interface list for each router
+ * Node in the interface list for each router.  index is the interface's
+ * position in the list and in sr->ifs, fixed once it is added; routes and
+ * held packets refer to interfaces by it.
  *
  * -------------------------------------------------------------------------- */
 
@@ -41,13 +45,18 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  unsigned int index;
   struct sr_if* next;
 };
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
+struct sr_if* sr_get_interface_index(struct sr_instance* sr,
+                                     unsigned int index);
+struct sr_if* sr_get_interface_ip(struct sr_instance* sr, uint32_t ip_nbo);
 void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
+void sr_set_ether_speed(struct sr_instance*, uint32_t speed);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
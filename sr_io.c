@@ -0,0 +1,343 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io.c
+ *
+ * Description:
+ *
+ * The backend independent half of packet I/O: the checks and logging
+ * every frame goes through on its way in or out, whichever backend
+ * carries it.  See sr_io.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include "sr_io.h"
+#include "sr_dumper.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ether_addrs_match_interface(..)
+ * Scope: Local
+ *
+ * Make sure ethernet addresses are sane so we don't muck uo the system.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int
+sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
+                                uint8_t* buf, /* borrowed */
+                                const struct sr_if* iface /* borrowed */ )
+{
+    struct sr_ethernet_hdr* ether_hdr = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(buf);
+    assert(iface);
+
+    ether_hdr = (struct sr_ethernet_hdr*)buf;
+
+    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
+        fprintf( stderr, "** Error, source address does not match interface\n");
+        return 0;
+    }
+
+    /* TODO */
+    /* Check destination, hardware address.  If it is private (i.e. destined
+     * to a virtual interface) ensure it is going to the correct topology
+     * Note: This check should really be done server side ...
+     */
+
+    return 1;
+
+} /* -- sr_ether_addrs_match_interface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet(..) / sr_send_packet_if(..)
+ * Scope: Global
+ *
+ * Send a packet (ethernet header included!) of length 'len' out of an
+ * interface, through whichever backend the router runs on.  The
+ * forwarding path already has the interface record and calls
+ * sr_send_packet_if() to skip the name lookup.  The backend may hold the
+ * frame until sr_flush_packets(); it copies what it keeps.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len,
+                         const char* name /* borrowed */)
+{
+    struct sr_if* iface;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(name);
+
+    iface = sr_get_interface(sr, name);
+    if ( iface == 0 ){
+        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
+        return -1;
+    }
+
+    return sr_send_packet_if(sr, buf, len, iface);
+} /* -- sr_send_packet -- */
+
+int sr_send_packet_if(struct sr_instance* sr /* borrowed */,
+                      uint8_t* buf /* borrowed */ ,
+                      unsigned int len,
+                      struct sr_if* iface /* borrowed */)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(buf);
+    assert(iface);
+
+    /* don't waste my time ... */
+    if ( len < sizeof(struct sr_ethernet_hdr) ){
+        fprintf(stderr , "** Error: packet is wayy to short \n");
+        return -1;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr,buf,len);
+
+    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
+        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
+        return -1;
+    }
+
+    return sr->io->send(sr, buf, len, iface);
+} /* -- sr_send_packet_if -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flush_packets(..)
+ * Scope: Global
+ *
+ * Write out whatever frames the backend still holds.  more is set if
+ * further frames are coming at once.  Returns 0, or -1 if a write failed.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flush_packets(struct sr_instance* sr, int more)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    return sr->io->flush ? sr->io->flush(sr, more) : 0;
+} /* -- sr_flush_packets -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_req_not_for_us()
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_arp_req_not_for_us(struct sr_instance* sr,
+                                 uint8_t * packet /* lent */,
+                                 unsigned int len,
+                                 const struct sr_if* iface /* lent */)
+{
+    struct sr_ethernet_hdr* e_hdr = 0;
+    struct sr_arp_hdr*       a_hdr = 0;
+
+    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+    { return 0; }
+
+    e_hdr = (struct sr_ethernet_hdr*)packet;
+    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+
+    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
+            (a_hdr->ar_op      == htons(arp_op_request))   &&
+            (a_hdr->ar_tip     != iface->ip ) )
+    { return 1; }
+
+    return 0;
+} /* -- sr_arp_req_not_for_us -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_frame_for_us(..)
+ * Scope: Global
+ *
+ * Whether a frame seen on a local device is for the router: sent to the
+ * interface's MAC, or broadcast.  The backends on shared segments drop
+ * the rest before sr_receive_packet().
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_frame_for_us(const struct sr_if* iface, const uint8_t* frame,
+                    unsigned int len)
+{
+    static const unsigned char bcast[ETHER_ADDR_LEN] =
+    { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+    const struct sr_ethernet_hdr* e_hdr = (const struct sr_ethernet_hdr*)frame;
+
+    if(len < sizeof(struct sr_ethernet_hdr))
+    { return 0; }
+
+    return memcmp(e_hdr->ether_dhost, iface->addr, ETHER_ADDR_LEN) == 0 ||
+           memcmp(e_hdr->ether_dhost, bcast, ETHER_ADDR_LEN) == 0;
+} /* -- sr_frame_for_us -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_receive_packet(..)
+ * Scope: Global
+ *
+ * Called by the backends with every frame that arrives on an interface.
+ * ARP requests for other hosts are dropped here, the rest is logged and
+ * handed to the router.  The frame is only lent.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_receive_packet(struct sr_instance* sr /* borrowed */,
+                       uint8_t* frame /* lent */,
+                       unsigned int len,
+                       struct sr_if* iface /* borrowed */)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(frame);
+    assert(iface);
+
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if ( sr_arp_req_not_for_us(sr, frame, len, iface) )
+    { return; }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, frame, len);
+
+    /* -- pass to router, student's code should take over here -- */
+    sr_handlepacket(sr, frame, len, iface->name);
+} /* -- sr_receive_packet -- */
+
+/* -- aa:bb:cc:dd:ee:ff into addr, 0 on success -- */
+static int sr_io_mac(const char* text, unsigned char* addr)
+{
+    unsigned int b[ETHER_ADDR_LEN];
+    int i, end = 0;
+
+    if(sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x%n", &b[0], &b[1], &b[2], &b[3],
+              &b[4], &b[5], &end) != ETHER_ADDR_LEN || text[end] != 0)
+    { return -1; }
+
+    for(i = 0; i < ETHER_ADDR_LEN; i++)
+    { addr[i] = (unsigned char)b[i]; }
+    return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_io_config(..)
+ * Scope: Global
+ *
+ * Add the interfaces listed in file, in the format of sr_io.h, and hand
+ * each to attach with the device it runs on.  Returns 0, or -1 if the
+ * file is bad, lists no interface or attach failed.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_io_config(struct sr_instance* sr, const char* file,
+                 int (*attach)(struct sr_instance*, struct sr_if*,
+                               const char* dev))
+{
+    char line[256], name[64], ip[64], mac[64], dev[64];
+    unsigned char addr[ETHER_ADDR_LEN];
+    struct in_addr in;
+    const char* why;
+    char* hash;
+    FILE* fp;
+    int lineno = 0, args, ret = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(file);
+    assert(attach);
+
+    if((fp = fopen(file, "r")) == 0)
+    {
+        fprintf(stderr, "Error opening interface config %s: %s\n", file,
+                strerror(errno));
+        return -1;
+    }
+
+    while(ret == 0 && fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if((hash = strchr(line, '#')) != 0)
+        { *hash = 0; }
+        if((args = sscanf(line, "%63s %63s %63s %63s", name, ip, mac, dev)) <= 0)
+        { continue; }
+        if(args == 3)
+        { strcpy(dev, name); }
+
+        why = 0;
+        if(args < 3)
+        { why = "expected <interface> <ip> <mac> [<device>]"; }
+        else if(strlen(name) >= sr_IFACE_NAMELEN || strlen(dev) >= IFNAMSIZ)
+        { why = "name too long"; }
+        else if(inet_aton(ip, &in) == 0)
+        { why = "invalid address"; }
+        else if(sr_io_mac(mac, addr) != 0)
+        { why = "invalid MAC address"; }
+        else if(sr_get_interface(sr, name) != 0)
+        { why = "interface listed twice"; }
+        if(why)
+        {
+            fprintf(stderr, "%s:%d: %s\n", file, lineno, why);
+            ret = -1;
+            break;
+        }
+
+        sr_add_interface(sr, name);
+        sr_set_ether_addr(sr, addr);
+        sr_set_ether_ip(sr, in.s_addr);
+        ret = attach(sr, sr->ifs[sr->nifs - 1], dev);
+    }
+    fclose(fp);
+
+    if(ret == 0 && sr->nifs == 0)
+    {
+        fprintf(stderr, "No interfaces in %s\n", file);
+        ret = -1;
+    }
+
+    return ret;
+} /* -- sr_io_config -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packet()
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+{
+    struct pcap_pkthdr h;
+    int size;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if(!sr->logfile)
+    {return; }
+
+    size = min(PACKET_DUMP_SIZE, len);
+
+    gettimeofday(&h.ts, 0);
+    h.caplen = size;
+    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+
+    sr_dump(sr->logfile, &h, buf);
+    fflush(sr->logfile);
+} /* -- sr_log_packet -- */
@@ -0,0 +1,76 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io.h
+ *
+ * Description:
+ *
+ * Packet I/O backends.  The router only sees Ethernet frames: it sends
+ * them with sr_send_packet() / sr_send_packet_if(), which check them and
+ * pass them to the backend, and the backend hands the frames it receives
+ * to sr_receive_packet().  The main loop calls the backend's read; the
+ * event loop watches its fds and calls its poll when one is readable.
+ *
+ *   sr_io_vns   the VNS server's TCP stream, the interfaces come in its
+ *               hwinfo (sr_vns_comm.c)
+ *   sr_io_tap   a Linux TAP device per interface, the interfaces come from
+ *               a config file (sr_tap.c)
+ *   sr_io_ring  AF_PACKET sockets with mapped rings on existing devices,
+ *               the interfaces come from a config file (sr_ring.c)
+ *
+ * The backends on local devices take their interfaces from a file read
+ * by sr_io_config(), one per line:
+ *
+ *   <interface> <ip> <mac> [<device>]
+ *
+ *   eth1  10.1.0.1  02:00:00:00:01:01  tap1
+ *
+ * The device defaults to the interface name.  Blank lines and anything
+ * after a '#' are ignored.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_IO_H
+#define sr_IO_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_if;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_io
+ *
+ * read and poll return 1 to go on, 0 if the other side closed the session
+ * and -1 on error.  send gets frames that passed the checks; flush may be
+ * 0 for a backend that writes every frame at once.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_io
+{
+    const char* name;
+    int (*read)(struct sr_instance*);           /* wait for and handle a burst */
+    int (*poll)(struct sr_instance*, int fd);   /* fd is readable, don't wait */
+    int (*fds)(struct sr_instance*, int* fds, int max);   /* to watch */
+    int (*send)(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*);
+    int (*flush)(struct sr_instance*, int more);
+};
+
+extern const struct sr_io sr_io_vns;
+extern const struct sr_io sr_io_tap;
+extern const struct sr_io sr_io_ring;
+
+int  sr_io_config(struct sr_instance*, const char* file,
+                  int (*attach)(struct sr_instance*, struct sr_if*,
+                                const char* dev));
+int  sr_frame_for_us(const struct sr_if*, const uint8_t*, unsigned int);
+void sr_receive_packet(struct sr_instance*, uint8_t*, unsigned int,
+                       struct sr_if*);
+void sr_log_packet(struct sr_instance*, uint8_t*, int);
+
+#endif  /* --  sr_IO_H -- */
@@ -0,0 +1,191 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_loop.c
+ *
+ * Description:
+ *
+ * The event loop of sr -E, see sr_loop.h.  Each wakeup handles what is
+ * ready in the order epoll reports it; before going back to sleep the
+ * timerfd is moved if the first ARP timer changed, and the VNS socket is
+ * watched for room only while frames are held for it.  Whatever else the
+ * backend's fds have is left to its poll.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+
+#ifdef _LINUX_
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#endif /* _LINUX_ */
+
+#include "sr_loop.h"
+#include "sr_io.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_timer.h"
+
+#ifdef _LINUX_
+
+static int sr_loop_watch(int ep, int op, int fd, uint32_t events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(ep, op, fd, &ev);
+}
+
+/* -- make the timerfd go off at tick next of sr_clock_ms(), which is in
+      milliseconds on the monotonic clock, or never if next is -1 -- */
+static void sr_loop_arm(int tfd, uint64_t next)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if(next != (uint64_t)-1)
+    {
+        its.it_value.tv_sec = next / 1000;
+        its.it_value.tv_nsec = (next % 1000) * 1000000;
+    }
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, 0);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_loop_run(..)
+ * Scope:  Global
+ *
+ * Run the router on this thread until the server closes the session or
+ * the connection fails.  Returns 0 or -1 like sr_read_from_server().
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_loop_run(struct sr_instance* sr)
+{
+    struct epoll_event events[SR_LOOP_EVENTS];
+    struct signalfd_siginfo si;
+    unsigned long wakeups = 0, sweeps = 0;
+    uint64_t armed = (uint64_t)-1, next, expired;
+    sigset_t sigs;
+    int* fds;
+    int ep, tfd, sfd, flags, nfds, n, i;
+    int ret = 1, writing = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    /* -- a signalfd only sees signals that are blocked -- */
+    sr_rt_signals(sr, &sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, 0);
+
+    ep = epoll_create1(EPOLL_CLOEXEC);
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(ep < 0 || tfd < 0 || sfd < 0 ||
+       sr_loop_watch(ep, EPOLL_CTL_ADD, tfd, EPOLLIN) < 0 ||
+       sr_loop_watch(ep, EPOLL_CTL_ADD, sfd, EPOLLIN) < 0)
+    {
+        perror("sr_loop_run");
+        ret = -1;
+    }
+
+    /* -- the backend's fds, all of them non-blocking -- */
+    fds = (int*)malloc((sr->nifs + 1) * sizeof(int));
+    assert(fds);
+    nfds = sr->io->fds(sr, fds, sr->nifs + 1);
+    for(i = 0; i < nfds && ret == 1; i++)
+    {
+        flags = fcntl(fds[i], F_GETFL);
+        if(flags < 0 || fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) < 0 ||
+           sr_loop_watch(ep, EPOLL_CTL_ADD, fds[i], EPOLLIN) < 0)
+        {
+            perror("sr_loop_run");
+            ret = -1;
+        }
+    }
+    free(fds);
+
+    while(ret == 1)
+    {
+        /* -- timers armed while handling the last events are only in the
+              wheel; the timerfd follows the first of them -- */
+        next = sr_timer_next(&(sr->cache.timers));
+        if(next != armed)
+        {
+            sr_loop_arm(tfd, next);
+            armed = next;
+        }
+
+        if(sr->sockfd >= 0 && (sr->tx.held_len > 0) != writing)
+        {
+            writing = !writing;
+            sr_loop_watch(ep, EPOLL_CTL_MOD, sr->sockfd,
+                          writing ? EPOLLIN | EPOLLOUT : EPOLLIN);
+        }
+
+        n = epoll_wait(ep, events, SR_LOOP_EVENTS, -1);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("epoll_wait");
+            ret = -1;
+            break;
+        }
+        wakeups++;
+
+        for(i = 0; i < n && ret == 1; i++)
+        {
+            if(events[i].data.fd == tfd)
+            {
+                /* -- it went off and is disarmed until set again -- */
+                if(read(tfd, &expired, sizeof(expired)) < 0)
+                { continue; }
+                armed = (uint64_t)-1;
+                sr_arpcache_sweepreqs(sr);
+                sweeps++;
+            }
+            else if(events[i].data.fd == sfd)
+            {
+                /* -- a reload goes to a worker, see sr_rt_signal() -- */
+                while(read(sfd, &si, sizeof(si)) == sizeof(si))
+                { sr_rt_signal(sr, si.ssi_signo); }
+            }
+            else if(events[i].data.fd == sr->sockfd &&
+                    (events[i].events & EPOLLOUT) && sr_write_held(sr) != 0)
+            { ret = -1; }
+            else if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            { ret = sr->io->poll(sr, events[i].data.fd); }
+        }
+    }
+
+    printf("Event loop: %lu wakeups, %lu timer runs\n", wakeups, sweeps);
+
+    if(ep >= 0)
+    { close(ep); }
+    if(tfd >= 0)
+    { close(tfd); }
+    if(sfd >= 0)
+    { close(sfd); }
+
+    return ret;
+} /* -- sr_loop_run -- */
+
+#else
+
+int sr_loop_run(struct sr_instance* sr)
+{
+    fprintf(stderr, "The event loop needs epoll, run without -E\n");
+    return -1;
+} /* -- sr_loop_run -- */
+
+#endif /* _LINUX_ */
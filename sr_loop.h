@@ -0,0 +1,34 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_loop.h
+ *
+ * Description:
+ *
+ * Single threaded event loop, sr -E.  One epoll set watches the I/O
+ * backend's fds, a timerfd armed for the ARP cache's next timer and a
+ * signalfd for the signals sr_rt_signals() names, so reading, forwarding,
+ * sending, ARP retransmits and expiry, and signal handling all run on the
+ * thread that calls sr_loop_run().  There is no timeout or reload thread,
+ * and the ARP cache is used without its lock.  A SIGHUP only starts a
+ * worker thread that reloads the routing table and publishes it like the
+ * control socket's reload does, so forwarding is not held up by the parse.
+ *
+ * The fds are non-blocking.  On the VNS socket a burst is whatever one
+ * recv() brings, and frames the socket will not take are held until it
+ * is writable again.  The control socket, if any, keeps its own thread;
+ * it only changes the routing table, which the forwarding path reads
+ * under RCU.
+ *
+ * Linux only.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_LOOP_H
+#define sr_LOOP_H
+
+#define SR_LOOP_EVENTS 8          /* epoll events taken per wakeup */
+
+struct sr_instance;
+
+int sr_loop_run(struct sr_instance*);
+
+#endif  /* --  sr_LOOP_H -- */
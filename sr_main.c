@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <sys/types.h>
+#include <sys/time.h>
 
 #ifdef _LINUX_
 #include <getopt.h>
@@ -32,6 +33,14 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_ctl.h"
+#include "sr_mrt.h"
+#include "sr_snapshot.h"
+#include "sr_loop.h"
+#include "sr_io.h"
+#include "sr_tap.h"
+#include "sr_ring.h"
 
 extern char* optarg;
 
@@ -44,6 +53,7 @@ extern char* optarg;
 #define DEFAULT_SERVER "localhost"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define PRINT_RTABLE_MAX 64
 
 static void usage(char* );
 static void sr_init_instance(struct sr_instance* );
@@ -65,11 +75,32 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    char *ctl_path = 0;
+    char *mrt = 0;
+    char *snapshot = 0;
+    char *arp_file = 0;
+    char *tap_conf = 0;
+    char *ring_conf = 0;
+    unsigned int arp_save_ms = SR_ARPCACHE_SAVE;
+    int compile = 0;
+    int event_loop = 0;
+    unsigned int arp_interval = SR_ARPREQ_INTERVAL;
+    unsigned int arp_backoff = 1;
+    unsigned int queue_bytes = SR_ARPQ_BYTES;
+    unsigned int queue_req_bytes = SR_ARPREQ_BYTES;
+    int queue_drop = SR_ARPQ_DROP_TAIL;
+    unsigned int arp_rate = SR_ARPREQ_RATE;
+    unsigned int arp_burst = SR_ARPREQ_BURST;
+    unsigned int arp_max = SR_ARPREQ_MAX;
+    unsigned int arp_neg = SR_ARPNEG_TO;
+    char drop[8];
+    char *colon;
+    int fib_mode = SR_FIB_TRIE;
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:F:c:m:S:WEA:Q:L:N:i:P:")) != EOF)
     {
         switch (c)
         {
@@ -101,20 +132,106 @@ int main(int argc, char **argv)
             case 'T':
                 template = optarg;
                 break;
+            case 'F':
+                if((fib_mode = sr_fib_parse_mode(optarg)) < 0)
+                {
+                    fprintf(stderr,"Unknown FIB type %s\n",optarg);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'c':
+                ctl_path = optarg;
+                break;
+            case 'm':
+                mrt = optarg;
+                break;
+            case 'S':
+                snapshot = optarg;
+                break;
+            case 'W':
+                compile = 1;
+                break;
+            case 'E':
+                event_loop = 1;
+                break;
+            case 'A':
+                if(sscanf(optarg, "%u:%u", &arp_interval, &arp_backoff) < 1 ||
+                   arp_interval == 0 || arp_backoff == 0)
+                {
+                    fprintf(stderr,"Bad ARP retry interval %s\n",optarg);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'Q':
+                drop[0] = 0;
+                if(sscanf(optarg, "%u:%u:%7s", &queue_bytes, &queue_req_bytes,
+                          drop) < 1 ||
+                   (drop[0] && strcmp(drop, "head") && strcmp(drop, "tail")))
+                {
+                    fprintf(stderr,"Bad ARP queue budget %s\n",optarg);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                if(strcmp(drop, "head") == 0)
+                { queue_drop = SR_ARPQ_DROP_HEAD; }
+                break;
+            case 'i':
+                tap_conf = optarg;
+                break;
+            case 'P':
+                ring_conf = optarg;
+                break;
+            case 'N':
+                arp_file = optarg;
+                if((colon = strrchr(optarg, ':')) != 0 && colon[1] &&
+                   strspn(colon + 1, "0123456789") == strlen(colon + 1))
+                {
+                    *colon = 0;
+                    arp_save_ms = atoi(colon + 1);
+                }
+                break;
+            case 'L':
+                if(sscanf(optarg, "%u:%u:%u:%u", &arp_rate, &arp_burst,
+                          &arp_max, &arp_neg) < 1 ||
+                   arp_burst == 0 || arp_max == 0)
+                {
+                    fprintf(stderr,"Bad ARP request limits %s\n",optarg);
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
         } /* switch */
     } /* -- while -- */
 
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
-
-    /* -- set up routing table from file -- */
-    if(template == NULL) {
+    sr.fib_mode = fib_mode;
+    sr.mrt = mrt;
+    sr.snapshot = snapshot;
+    sr.arp_file = arp_file;
+    sr.arp_save_ms = arp_save_ms;
+    sr.event_loop = event_loop;
+
+    if(template == NULL)
         sr.template[0] = '\0';
-        sr_load_rt_wrap(&sr, rtable);
-    }
     else
         strncpy(sr.template, template, 30);
 
+    /* -- compile the routing table into a snapshot and stop -- */
+    if(compile)
+    {
+        if(snapshot == 0)
+        {
+            fprintf(stderr,"-W needs a snapshot file given with -S\n");
+            usage(argv[0]);
+            exit(1);
+        }
+        sr_load_rt_wrap(&sr, rtable);
+        return sr_snapshot_write(&sr, snapshot) != 0;
+    }
+
     sr.topo_id = topo;
     strncpy(sr.host,host,32);
 
@@ -135,32 +252,70 @@ int main(int argc, char **argv)
         }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    if(tap_conf || ring_conf)
     {
-        return 1;
+        /* -- the interfaces are local devices, no server involved -- */
+        if(tap_conf ? sr_tap_open(&sr, tap_conf) != 0 :
+                      sr_ring_open(&sr, ring_conf) != 0)
+        { return 1; }
     }
+    else
+    {
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(&sr,port,server) == -1)
+        {
+            return 1;
+        }
 
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
-    }
-    else {
-      /* Read from specified routing table */
-      sr_load_rt_wrap(&sr, rtable);
+        if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", template);
+        }
     }
 
+    /* -- load the routing table once, from the snapshot if it is still
+     *    current; it is checked against the hardware when hwinfo comes -- */
+    sr.rtable = rtable;
+    if(snapshot == 0 || sr_snapshot_load(&sr, snapshot) != 0)
+        sr_load_rt_wrap(&sr, rtable);
+
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
+    sr.cache.req_interval = arp_interval;
+    sr.cache.req_backoff = arp_backoff;
+    sr.cache.req_rate = arp_rate;
+    sr.cache.req_burst = arp_burst;
+    sr.cache.tokens = arp_burst * 1000;
+    sr.cache.req_max = arp_max;
+    sr.cache.neg_ms = arp_neg;
+    if(sr_arpcache_set_queue(&(sr.cache), queue_bytes, queue_req_bytes,
+                             queue_drop) != 0)
+    {
+        fprintf(stderr,"Error allocating %u bytes for the ARP queue\n",
+                queue_bytes);
+        exit(1);
+    }
+
+    if(ctl_path != 0 && sr_ctl_start(&sr, ctl_path) != 0)
+    {
+        fprintf(stderr,"Error opening control socket %s\n", ctl_path);
+        exit(1);
+    }
+
+    /* -- with TAP devices the hardware is known already -- */
+    if((tap_conf || ring_conf) && sr_interfaces_ready(&sr) != 0)
+    { exit(1); }
 
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    if(sr.event_loop)
+    { sr_loop_run(&sr); }
+    else
+    { while( sr.io->read(&sr) == 1); }
 
     sr_destroy_instance(&sr);
 
@@ -178,7 +333,30 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-F trie|dir248] [-c control socket] \n");
+    printf("           [-m MRT TABLE_DUMP_V2 file] [-S snapshot [-W]] \n");
+    printf("           [-A ms[:backoff]] [-Q bytes[:req_bytes[:head|tail]]] \n");
+    printf("           [-L rate[:burst[:max[:neg_ms]]]] [-N file[:ms]] [-E] \n");
+    printf("           [-i interface config] [-P interface config] \n");
+    printf("   -S starts from a compiled routing table snapshot and keeps it\n");
+    printf("      up to date, -W only compiles the routing table into it\n");
+    printf("   -A waits ms after the first ARP request, multiplied by backoff\n");
+    printf("      for each further one (default %d:1)\n", SR_ARPREQ_INTERVAL);
+    printf("   -Q bounds the packets held for unresolved next hops: bytes of\n");
+    printf("      memory in all, req_bytes per next hop (default %d:%d:tail)\n",
+           SR_ARPQ_BYTES, SR_ARPREQ_BYTES);
+    printf("   -L sends at most rate ARP requests a second in bursts of burst\n");
+    printf("      (0 for no limit), resolves at most max next hops at once and\n");
+    printf("      refuses one that failed for neg_ms (default %d:%d:%d:%d)\n",
+           SR_ARPREQ_RATE, SR_ARPREQ_BURST, SR_ARPREQ_MAX, SR_ARPNEG_TO);
+    printf("   -N keeps the ARP cache in file across restarts, saved every ms\n");
+    printf("      and on exit (default %d, 0 only on exit)\n", SR_ARPCACHE_SAVE);
+    printf("   -E runs everything on one thread, in an epoll event loop\n");
+    printf("   -i runs on local TAP devices instead of the VNS server, with\n");
+    printf("      lines of <interface> <ip> <mac> [<tap device>] in the config\n");
+    printf("   -P runs on existing interfaces through AF_PACKET rings, with\n");
+    printf("      lines of <interface> <ip> <mac> [<device>] in the config\n");
+    printf("   send SIGHUP to reload the routing table\n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -225,6 +403,26 @@ static void sr_destroy_instance(struct sr_instance* sr)
         sr_dump_close(sr->logfile);
     }
 
+    sr_dstcache_print_stats(&(sr->dstcache));
+    if(sr->rx.reads)
+    {
+        printf("VNS: %lu commands in %lu reads, %lu frames in %lu writes\n",
+               sr->rx.cmds, sr->rx.reads, sr->tx.frames, sr->tx.writes);
+    }
+    if(sr->tx.dropped)
+    {
+        printf("VNS: %lu frames dropped with the socket full\n",
+               sr->tx.dropped);
+    }
+    free(sr->rx.buf);
+    free(sr->tx.data);
+    free(sr->tx.held);
+    sr_tap_close(sr);
+    sr_ring_close(sr);
+
+    if(sr->arp_file)
+    { sr_save_arpcache(sr); }
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -242,76 +440,71 @@ static void sr_init_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
+    sr->io = &sr_io_vns;
     sr->sockfd = -1;
+    sr->tap = 0;
+    sr->ring = 0;
     sr->user[0] = 0;
     sr->host[0] = 0;
     sr->topo_id = 0;
+    memset(&(sr->rx), 0, sizeof(sr->rx));
+    memset(&(sr->tx), 0, sizeof(sr->tx));
+    sr->tx.batch = 1;
     sr->if_list = 0;
+    sr->ifs = 0;
+    sr->nifs = 0;
+    sr->local = 0;
+    sr->local_bits = 0;
     sr->routing_table = 0;
+    sr->fib = 0;
+    sr->fib_mode = SR_FIB_TRIE;
+    sr->event_loop = 0;
+    pthread_mutex_init(&(sr->rt_lock), 0);
+    sr_rcu_init(&(sr->rcu));
+    sr->rtable = 0;
+    sr->reloads = 0;
+    sr->mrt = 0;
+    sr->snapshot = 0;
+    sr->snap = 0;
+    sr->arp_file = 0;
+    sr->arp_save_ms = 0;
+    sr_dstcache_init(&(sr->dstcache));
     sr->logfile = 0;
 } /* -- sr_init_instance -- */
 
-/*-----------------------------------------------------------------------------
- * Method: sr_verify_routing_table()
- * Scope: Global
- *
- * make sure the routing table is consistent with the interface list by
- * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
- *
- * RETURN VALUES:
- *
- *  0 on success
- *  something other than zero on error
- *
- *---------------------------------------------------------------------------*/
-
-int sr_verify_routing_table(struct sr_instance* sr)
-{
-    struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
-    int ret = 0;
-
-    /* -- REQUIRES --*/
-    assert(sr);
-
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
-    {
-        return 999; /* doh! */
-    }
-
-    rt_walker = sr->routing_table;
-
-    while(rt_walker)
-    {
-        /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
-        { ret++; } /* -- interface not found! -- */
-
-        rt_walker = rt_walker->next;
-    } /* -- while -- */
-
-    return ret;
-} /* -- sr_verify_routing_table -- */
-
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
+    struct timeval start, end;
+
+    gettimeofday(&start, 0);
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
                 rtable);
         exit(1);
     }
+    gettimeofday(&end, 0);
+    sr->rtable = rtable;
 
+    if(sr->mrt && sr_load_mrt(sr, sr->mrt) != 0) {
+        fprintf(stderr,"Error importing routes from MRT file %s\n",
+                sr->mrt);
+        exit(1);
+    }
 
     printf("Loading routing table\n");
     printf("---------------------------------------------\n");
-    sr_print_routing_table(sr);
+    if(sr->fib && sr->fib->routes > PRINT_RTABLE_MAX)
+        printf(" %u routes, not shown\n", sr->fib->routes);
+    else
+        sr_print_routing_table(sr);
     printf("---------------------------------------------\n");
+
+    printf("Loaded in %.1f ms\n", ((end.tv_sec - start.tv_sec) * 1000000 +
+           (end.tv_usec - start.tv_usec)) / 1000.0);
+    sr_fib_print_stats(sr->fib);
+
+    if(sr_fib_verify(sr, -1) != 0)
+    {
+        fprintf(stderr,"Warning: FIB does not agree with routing table %s\n",
+                rtable);
+    }
 }
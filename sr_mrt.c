@@ -0,0 +1,339 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mrt.c
+ *
+ * Description:
+ *
+ * MRT TABLE_DUMP_V2 import.  BGP next hops are usually not directly
+ * connected, so each one is resolved through the routing table loaded
+ * before the import: the imported route uses the outgoing interface of
+ * the route covering its next hop, and that route's gateway unless it is
+ * a connected one.  Prefixes already in the routing table keep their
+ * entry, and of a prefix the dump holds more than once the first record
+ * wins.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_mrt.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_fib.h"
+
+#define SR_MRT_HDRLEN 12
+
+static uint32_t sr_mrt_get32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static unsigned int sr_mrt_get16(const unsigned char* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_mrt_next_hop(..)
+ * Scope:  Local
+ *
+ * Find the NEXT_HOP attribute of the first of count RIB entries at p that
+ * has one.  Returns 0 and sets *nh_nbo, or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_mrt_next_hop(const unsigned char* p, const unsigned char* end,
+                           unsigned int count, uint32_t* nh_nbo)
+{
+    while(count-- > 0)
+    {
+        const unsigned char* attr;
+        const unsigned char* attr_end;
+
+        /* -- peer index (2), originated time (4), attribute length (2) -- */
+        if(end - p < 8)
+        { return -1; }
+        attr = p + 8;
+        attr_end = attr + sr_mrt_get16(p + 6);
+        if(attr_end > end)
+        { return -1; }
+
+        while(attr_end - attr >= 3)
+        {
+            unsigned int hdr = 3, len = attr[2];
+
+            if(attr[0] & SR_MRT_ATTR_EXTENDED)
+            {
+                if(attr_end - attr < 4)
+                { return -1; }
+                hdr = 4;
+                len = sr_mrt_get16(attr + 2);
+            }
+            if(attr + hdr + len > attr_end)
+            { return -1; }
+
+            if(attr[1] == SR_MRT_ATTR_NEXT_HOP && len == 4)
+            {
+                memcpy(nh_nbo, attr + hdr, 4);
+                return 0;
+            }
+            attr += hdr + len;
+        }
+
+        p = attr_end;
+    }
+
+    return -1;
+} /* -- sr_mrt_next_hop -- */
+
+/* -- a route and the number of its record, qsort() is not stable -- */
+struct sr_mrt_route
+{
+    struct sr_rt_update u;
+    unsigned int seq;
+};
+
+/* -- by address, then mask, then record -- */
+static int sr_mrt_cmp(const void* a, const void* b)
+{
+    const struct sr_mrt_route* x = (const struct sr_mrt_route*)a;
+    const struct sr_mrt_route* y = (const struct sr_mrt_route*)b;
+    uint32_t xd = ntohl(x->u.dest.s_addr), yd = ntohl(y->u.dest.s_addr);
+
+    if(xd != yd)
+    { return xd < yd ? -1 : 1; }
+    if(x->u.mask.s_addr != y->u.mask.s_addr)
+    { return ntohl(x->u.mask.s_addr) < ntohl(y->u.mask.s_addr) ? -1 : 1; }
+    if(x->seq != y->seq)
+    { return x->seq < y->seq ? -1 : 1; }
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_mrt_read(..)
+ * Scope:  Global
+ *
+ * Turn the IPv4 unicast routes of an MRT file into SR_RT_ADD updates,
+ * next hops resolved through fib, in address order and one per prefix.
+ * fib may be one that is still being built; the caller keeps it from
+ * changing.  A malformed record is reported with its offset and -1
+ * returned; otherwise *updates is a malloc'd array of *n.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_mrt_read(struct sr_instance* sr, const char* filename,
+                const struct sr_fib* fib, struct sr_rt_update** updates,
+                unsigned int* n_out)
+{
+    const unsigned char* base;
+    const unsigned char* end;
+    const unsigned char* p;
+    const unsigned char* body;
+    struct sr_mrt_route* routes = 0;
+    struct timeval start, now;
+    unsigned int n = 0, max = 0, i, j;
+    unsigned int records = 0, nonexthop = 0, unresolved = 0, present = 0;
+    uint32_t len = 0;
+    struct stat st;
+    int fd, err = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    *updates = 0;
+    *n_out = 0;
+    gettimeofday(&start, 0);
+
+    if((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+    {
+        perror(filename);
+        if(fd >= 0)
+        { close(fd); }
+        return -1;
+    }
+    if(st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    base = (const unsigned char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE,
+                                      fd, 0);
+    close(fd);
+    if(base == (const unsigned char*)MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    madvise((void*)base, st.st_size, MADV_SEQUENTIAL);
+    end = base + st.st_size;
+
+    for(p = base; p < end; p = body + len)
+    {
+        struct sr_mrt_route* r;
+        struct sr_rt_update* u;
+        struct sr_rt* via;
+        unsigned int plen, nbytes;
+        uint32_t prefix = 0, nh;
+
+        /* -- timestamp (4), type (2), subtype (2), length (4) -- */
+        if(end - p < SR_MRT_HDRLEN ||
+           (uint32_t)(end - p - SR_MRT_HDRLEN) < sr_mrt_get32(p + 8))
+        {
+            fprintf(stderr, "Error loading MRT file %s, offset %lu: "
+                    "truncated record\n", filename, (unsigned long)(p - base));
+            err = 1;
+            break;
+        }
+        body = p + SR_MRT_HDRLEN;
+        len = sr_mrt_get32(p + 8);
+
+        if(sr_mrt_get16(p + 4) != SR_MRT_TABLE_DUMP_V2 ||
+           sr_mrt_get16(p + 6) != SR_MRT_RIB_IPV4_UNICAST)
+        { continue; }
+        records++;
+
+        /* -- sequence (4), prefix length (1), prefix, entry count (2) -- */
+        plen = len > 4 ? body[4] : 0;
+        nbytes = (plen + 7) / 8;
+        if(len < 7 + nbytes || plen > 32)
+        {
+            fprintf(stderr, "Error loading MRT file %s, offset %lu: "
+                    "malformed RIB record\n", filename,
+                    (unsigned long)(p - base));
+            err = 1;
+            break;
+        }
+
+        if(sr_mrt_next_hop(body + 7 + nbytes, body + len,
+                           sr_mrt_get16(body + 5 + nbytes), &nh) != 0)
+        {
+            nonexthop++;
+            continue;
+        }
+
+        via = fib ? sr_fib_lookup(fib, nh) : 0;
+        if(via == 0)
+        {
+            unresolved++;
+            continue;
+        }
+
+        if(n == max)
+        {
+            max = max ? 2 * max : 4096;
+            routes = (struct sr_mrt_route*)realloc(routes,
+                         max * sizeof(struct sr_mrt_route));
+            assert(routes);
+        }
+        r = &routes[n];
+        r->seq = records;
+        u = &(r->u);
+
+        memcpy(&prefix, body + 5, nbytes);
+        u->op = SR_RT_ADD;
+        u->mask.s_addr = htonl(plen ? 0xffffffffU << (32 - plen) : 0);
+        u->dest.s_addr = prefix & u->mask.s_addr;
+        if(sr_fib_find(fib, u->dest.s_addr, u->mask.s_addr))
+        {
+            present++;
+            continue;
+        }
+        u->gw.s_addr = via->gw.s_addr ? via->gw.s_addr : nh;
+        memcpy(u->interface, via->interface, sr_IFACE_NAMELEN);
+        n++;
+    }
+
+    munmap((void*)base, st.st_size);
+
+    if(err)
+    {
+        free(routes);
+        return -1;
+    }
+
+    /* -- a dump can hold the same prefix more than once, keep the first -- */
+    if(n > 0)
+    {
+        qsort(routes, n, sizeof(struct sr_mrt_route), sr_mrt_cmp);
+        *updates = (struct sr_rt_update*)malloc(n * sizeof(struct sr_rt_update));
+        assert(*updates);
+        (*updates)[0] = routes[0].u;
+        for(i = 1, j = 1; i < n; i++)
+        {
+            if(routes[i].u.dest.s_addr != (*updates)[j - 1].dest.s_addr ||
+               routes[i].u.mask.s_addr != (*updates)[j - 1].mask.s_addr)
+            { (*updates)[j++] = routes[i].u; }
+        }
+        n = j;
+    }
+    free(routes);
+    *n_out = n;
+
+    gettimeofday(&now, 0);
+    printf("Read %u routes from %s in %.1f ms (%u RIB records, "
+           "%u without next hop, %u unresolved, %u already present)\n",
+           n, filename, ((now.tv_sec - start.tv_sec) * 1000000 +
+           (now.tv_usec - start.tv_usec)) / 1000.0, records, nonexthop,
+           unresolved, present);
+
+    return 0;
+} /* -- sr_mrt_read -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_load_mrt(..)
+ * Scope:  Global
+ *
+ * Add the IPv4 unicast routes of an MRT file to the current routing table
+ * as one atomic batch.  A malformed record is reported with its offset
+ * and nothing is imported.  sr_rt_reload() merges them into the table it
+ * reloads instead.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_mrt(struct sr_instance* sr, const char* filename)
+{
+    struct sr_rt_update* updates;
+    unsigned int n;
+    int err;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    /* -- next hops are resolved against the table as it is now -- */
+    pthread_mutex_lock(&(sr->rt_lock));
+    err = sr_mrt_read(sr, filename, sr->fib, &updates, &n);
+    pthread_mutex_unlock(&(sr->rt_lock));
+    if(err)
+    { return -1; }
+
+    if(sr_rt_apply(sr, updates, n) != n)
+    {
+        fprintf(stderr, "Error loading MRT file %s: routing table changed "
+                "during import\n", filename);
+        free(updates);
+        return -1;
+    }
+    free(updates);
+
+    return 0;
+} /* -- sr_load_mrt -- */
@@ -0,0 +1,29 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mrt.h
+ *
+ * Description:
+ *
+ * Import of IPv4 routes from MRT routing information export files
+ * (RFC 6396), as written by BGP route collectors and daemons.  Only
+ * TABLE_DUMP_V2 RIB_IPV4_UNICAST records are used; everything else in
+ * the file is skipped.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_MRT_H
+#define sr_MRT_H
+
+#define SR_MRT_TABLE_DUMP_V2     13
+#define SR_MRT_RIB_IPV4_UNICAST  2
+#define SR_MRT_ATTR_NEXT_HOP     3
+#define SR_MRT_ATTR_EXTENDED     0x10    /* attribute flag: 2 byte length */
+
+struct sr_instance;
+struct sr_fib;
+struct sr_rt_update;
+
+int sr_mrt_read(struct sr_instance*, const char*, const struct sr_fib*,
+                struct sr_rt_update**, unsigned int*);
+int sr_load_mrt(struct sr_instance*, const char*);
+
+#endif  /* --  sr_MRT_H -- */
@@ -0,0 +1,101 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.c
+ *
+ * Description:
+ *
+ * Epoch based RCU.  A reader slot holds the global epoch observed when the
+ * reader entered its critical section, or 0 when it is outside of one.  A
+ * writer that has already published a new pointer bumps the epoch and
+ * waits for every slot to be 0 or at least the new epoch; readers that
+ * entered after the bump are guaranteed to see the new pointer.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <string.h>
+#include <sched.h>
+
+#include "sr_rcu.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_init(..)
+ * Scope:  Global
+ *
+ * Slot SR_RCU_FORWARDER is reserved for the forwarding thread.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_init(struct sr_rcu* rcu)
+{
+    memset((void*)rcu->reader, 0, sizeof(rcu->reader));
+    rcu->epoch = 1;
+    rcu->nreaders = SR_RCU_FORWARDER + 1;
+    pthread_mutex_init(&(rcu->lock), 0);
+} /* -- sr_rcu_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_register(..)
+ * Scope:  Global
+ *
+ * Claim a reader slot for an additional reader thread.  Returns the slot,
+ * or -1 if all are taken.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rcu_register(struct sr_rcu* rcu)
+{
+    int slot = -1;
+
+    pthread_mutex_lock(&(rcu->lock));
+    if(rcu->nreaders < SR_RCU_READERS)
+    { slot = rcu->nreaders++; }
+    pthread_mutex_unlock(&(rcu->lock));
+
+    return slot;
+} /* -- sr_rcu_register -- */
+
+void sr_rcu_read_lock(struct sr_rcu* rcu, int slot)
+{
+    rcu->reader[slot] = rcu->epoch;
+    /* -- the slot must be visible before any protected pointer is read -- */
+    __sync_synchronize();
+}
+
+void sr_rcu_read_unlock(struct sr_rcu* rcu, int slot)
+{
+    __atomic_store_n(&(rcu->reader[slot]), 0, __ATOMIC_RELEASE);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_synchronize(..)
+ * Scope:  Global
+ *
+ * Wait until no reader can still hold a pointer that was replaced before
+ * this call.  Only ever blocks the writer.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_synchronize(struct sr_rcu* rcu)
+{
+    unsigned long target;
+    int i;
+
+    pthread_mutex_lock(&(rcu->lock));
+
+    __sync_synchronize();
+    target = __sync_add_and_fetch(&(rcu->epoch), 1);
+
+    for(i = 0; i < rcu->nreaders; i++)
+    {
+        for(;;)
+        {
+            unsigned long seen = __atomic_load_n(&(rcu->reader[i]),
+                                                 __ATOMIC_ACQUIRE);
+            if(seen == 0 || seen >= target)
+            { break; }
+            sched_yield();
+        }
+    }
+
+    pthread_mutex_unlock(&(rcu->lock));
+} /* -- sr_rcu_synchronize -- */
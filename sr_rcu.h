@@ -0,0 +1,41 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.h
+ *
+ * Description:
+ *
+ * Minimal epoch based read-copy-update.  Readers (the forwarding path)
+ * announce the epoch they entered in with a single store and never block
+ * or lock.  Writers publish a new version of a structure with an atomic
+ * pointer store, then call sr_rcu_synchronize() which waits until every
+ * reader that could still see the old version has left, after which the
+ * old version can be freed.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_RCU_H
+#define sr_RCU_H
+
+#include <pthread.h>
+
+#define SR_RCU_READERS   8
+#define SR_RCU_FORWARDER 0      /* slot of the thread calling sr_handlepacket */
+
+struct sr_rcu
+{
+    volatile unsigned long epoch;
+    volatile unsigned long reader[SR_RCU_READERS];  /* 0 while quiescent */
+    int nreaders;
+    pthread_mutex_t lock;       /* serializes writers and registration */
+};
+
+/* -- publish / read a pointer that readers dereference under the rcu -- */
+#define sr_rcu_assign(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define sr_rcu_deref(p)     __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+void sr_rcu_init(struct sr_rcu*);
+int  sr_rcu_register(struct sr_rcu*);
+void sr_rcu_read_lock(struct sr_rcu*, int slot);
+void sr_rcu_read_unlock(struct sr_rcu*, int slot);
+void sr_rcu_synchronize(struct sr_rcu*);
+
+#endif  /* --  sr_RCU_H -- */
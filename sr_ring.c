@@ -0,0 +1,499 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.c
+ *
+ * Description:
+ *
+ * AF_PACKET backend, see sr_ring.h.  Each interface has one socket and
+ * one mapping: SR_RING_BLOCKS receive blocks, then SR_RING_SLOTS transmit
+ * slots.  A block or slot belongs to whoever its status word says; the
+ * status is read with acquire and written with release ordering, so the
+ * frame in it is complete when ownership changes hands.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef _LINUX_
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#endif /* _LINUX_ */
+
+#include "sr_ring.h"
+#include "sr_io.h"
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+
+#ifdef _LINUX_
+
+/* -- where a frame starts in a transmit slot -- */
+#define SR_RING_DATA     TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+#define SR_RING_RXBYTES  ((size_t)SR_RING_BLOCK * SR_RING_BLOCKS)
+#define SR_RING_TXBYTES  ((size_t)SR_RING_FRAME * SR_RING_SLOTS)
+
+struct sr_ring_if
+{
+    int fd;
+    unsigned char* map;         /* receive blocks, then transmit slots */
+    unsigned int rx_next;       /* next block to look at */
+    unsigned long frames_in;
+    unsigned long blocks;
+
+    pthread_mutex_t tx_lock;    /* the transmit slots and what follows */
+    unsigned int tx_next;       /* next slot to fill */
+    unsigned int tx_waiting;    /* filled since the last send() */
+    unsigned long frames_out;
+    unsigned long sends;
+    unsigned long dropped;      /* no free slot */
+};
+
+struct sr_ring
+{
+    struct sr_ring_if** ifs;    /* by interface index, allocated one by one
+                                   so a tx_lock never moves */
+    struct pollfd* pfds;        /* their sockets, for poll() */
+    unsigned int n;
+    int batching;               /* a receive burst is being handled */
+    pthread_t owner;            /* by this thread */
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_add(..)
+ * Scope:  Local
+ *
+ * Open a TPACKET_V3 socket on device dev for iface, map its rings and
+ * bind it.  Returns 0, or -1 if the device does not exist or the kernel
+ * refused the rings.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_ring_add(struct sr_instance* sr, struct sr_if* iface,
+                       const char* dev)
+{
+    struct sr_ring* ring = sr->ring;
+    struct sr_ring_if* rif;
+    struct tpacket_req3 rx, tx;
+    struct sockaddr_ll ll;
+    struct packet_mreq mr;
+    struct ifreq ifr;
+    void* map;
+    int version = TPACKET_V3, one = 1, ifindex;
+
+    ring->ifs = (struct sr_ring_if**)realloc(ring->ifs,
+                                             sr->nifs * sizeof(struct sr_ring_if*));
+    assert(ring->ifs);
+    rif = (struct sr_ring_if*)calloc(1, sizeof(struct sr_ring_if));
+    assert(rif);
+    ring->ifs[iface->index] = rif;
+    rif->fd = -1;
+    pthread_mutex_init(&(rif->tx_lock), 0);
+    ring->n = sr->nifs;
+
+    if((ifindex = if_nametoindex(dev)) == 0)
+    {
+        fprintf(stderr, "Error: no network interface %s\n", dev);
+        return -1;
+    }
+
+    /* -- protocol 0 until bind(), or frames of every device come in -- */
+    if((rif->fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0)
+    {
+        perror("socket(..):sr_ring.c::sr_ring_add(..)");
+        return -1;
+    }
+
+    memset(&rx, 0, sizeof(rx));
+    rx.tp_block_size = SR_RING_BLOCK;
+    rx.tp_block_nr = SR_RING_BLOCKS;
+    rx.tp_frame_size = SR_RING_FRAME;
+    rx.tp_frame_nr = SR_RING_BLOCK / SR_RING_FRAME * SR_RING_BLOCKS;
+    rx.tp_retire_blk_tov = SR_RING_TIMEOUT;
+
+    memset(&tx, 0, sizeof(tx));
+    tx.tp_block_size = SR_RING_BLOCK;
+    tx.tp_block_nr = SR_RING_TXBYTES / SR_RING_BLOCK;
+    tx.tp_frame_size = SR_RING_FRAME;
+    tx.tp_frame_nr = SR_RING_SLOTS;
+
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_ALL);
+    ll.sll_ifindex = ifindex;
+
+    map = MAP_FAILED;
+    if(setsockopt(rif->fd, SOL_PACKET, PACKET_VERSION, &version,
+                  sizeof(version)) < 0 ||
+       setsockopt(rif->fd, SOL_PACKET, PACKET_RX_RING, &rx, sizeof(rx)) < 0 ||
+       setsockopt(rif->fd, SOL_PACKET, PACKET_TX_RING, &tx, sizeof(tx)) < 0 ||
+       (map = mmap(0, SR_RING_RXBYTES + SR_RING_TXBYTES,
+                   PROT_READ | PROT_WRITE, MAP_SHARED, rif->fd, 0)) ==
+       MAP_FAILED ||
+       bind(rif->fd, (struct sockaddr*)&ll, sizeof(ll)) < 0)
+    {
+        fprintf(stderr, "Error setting up the rings on %s: %s\n", dev,
+                strerror(errno));
+        if(map != MAP_FAILED)
+        { munmap(map, SR_RING_RXBYTES + SR_RING_TXBYTES); }
+        return -1;
+    }
+    rif->map = (unsigned char*)map;
+
+    /* -- nice to have: sent frames skip the qdisc and do not come back
+          in through the receive ring -- */
+    setsockopt(rif->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+    setsockopt(rif->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+    /* -- the router answers to its own MAC, the device may not -- */
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+    if(ioctl(rif->fd, SIOCGIFHWADDR, &ifr) < 0 ||
+       memcmp(ifr.ifr_hwaddr.sa_data, iface->addr, ETHER_ADDR_LEN) != 0)
+    {
+        memset(&mr, 0, sizeof(mr));
+        mr.mr_ifindex = ifindex;
+        mr.mr_type = PACKET_MR_PROMISC;
+        if(setsockopt(rif->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr,
+                      sizeof(mr)) < 0)
+        { fprintf(stderr, "Warning: could not put %s in promiscuous mode\n", dev); }
+    }
+
+    return 0;
+} /* -- sr_ring_add -- */
+
+/* -- tell the kernel about the frames waiting in the transmit ring of
+      rif, with its tx_lock held -- */
+static void sr_ring_kick(struct sr_ring_if* rif)
+{
+    if(rif->tx_waiting == 0)
+    { return; }
+
+    /* -- a frame the device would not take stays requested, the next
+          send() tries it again -- */
+    if(send(rif->fd, 0, 0, MSG_DONTWAIT) < 0 && errno != EAGAIN &&
+       errno != ENOBUFS && errno != EINTR)
+    { perror("send(..):sr_ring.c::sr_ring_kick(..)"); }
+
+    rif->tx_waiting = 0;
+    rif->sends++;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_drain(..)
+ * Scope:  Local
+ *
+ * Handle the frames of every block the kernel has handed over on the
+ * interface at index, and give the blocks back.  The frames are passed
+ * to the router where they lie; it may rewrite them in place.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_ring_drain(struct sr_instance* sr, unsigned int index)
+{
+    struct sr_ring_if* rif = sr->ring->ifs[index];
+    struct sr_if* iface = sr->ifs[index];
+    struct tpacket_block_desc* bd;
+    struct tpacket3_hdr* ph;
+    const struct sockaddr_ll* ll;
+    uint8_t* frame;
+    uint32_t k;
+    int n;
+
+    for(n = 0; n < SR_RING_BLOCKS; n++)
+    {
+        bd = (struct tpacket_block_desc*)
+             (rif->map + (size_t)rif->rx_next * SR_RING_BLOCK);
+        if(!(__atomic_load_n(&(bd->hdr.bh1.block_status), __ATOMIC_ACQUIRE) &
+             TP_STATUS_USER))
+        { break; }
+
+        ph = (struct tpacket3_hdr*)((uint8_t*)bd +
+                                    bd->hdr.bh1.offset_to_first_pkt);
+        for(k = 0; k < bd->hdr.bh1.num_pkts; k++)
+        {
+            ll = (const struct sockaddr_ll*)((uint8_t*)ph + SR_RING_DATA);
+            frame = (uint8_t*)ph + ph->tp_mac;
+            if(ll->sll_pkttype != PACKET_OUTGOING &&
+               sr_frame_for_us(iface, frame, ph->tp_snaplen))
+            { sr_receive_packet(sr, frame, ph->tp_snaplen, iface); }
+            ph = (struct tpacket3_hdr*)((uint8_t*)ph + ph->tp_next_offset);
+        }
+        rif->frames_in += bd->hdr.bh1.num_pkts;
+        rif->blocks++;
+
+        __atomic_store_n(&(bd->hdr.bh1.block_status), TP_STATUS_KERNEL,
+                         __ATOMIC_RELEASE);
+        rif->rx_next = (rif->rx_next + 1) % SR_RING_BLOCKS;
+    }
+} /* -- sr_ring_drain -- */
+
+static int sr_ring_flush(struct sr_instance* sr, int more)
+{
+    struct sr_ring* ring = sr->ring;
+    unsigned int i;
+
+    for(i = 0; i < ring->n; i++)
+    {
+        pthread_mutex_lock(&(ring->ifs[i]->tx_lock));
+        sr_ring_kick(ring->ifs[i]);
+        pthread_mutex_unlock(&(ring->ifs[i]->tx_lock));
+    }
+
+    return 0;
+} /* -- sr_ring_flush -- */
+
+/* -- frames sent while handling a burst wait for its end -- */
+static void sr_ring_burst(struct sr_instance* sr, int on)
+{
+    if(on)
+    {
+        sr->ring->owner = pthread_self();
+        sr->ring->batching = 1;
+    }
+    else
+    {
+        sr->ring->batching = 0;
+        sr_ring_flush(sr, 0);
+    }
+}
+
+/* -- wait until a ring has blocks, then handle all of them -- */
+static int sr_ring_read(struct sr_instance* sr)
+{
+    struct sr_ring* ring = sr->ring;
+    unsigned int i;
+    int ret = 1;
+
+    if(poll(ring->pfds, ring->n, -1) < 0)
+    {
+        if(errno == EINTR)
+        { return 1; }
+        perror("poll(..):sr_ring.c::sr_ring_read(..)");
+        return -1;
+    }
+
+    sr_ring_burst(sr, 1);
+    for(i = 0; i < ring->n; i++)
+    {
+        if(ring->pfds[i].revents & (POLLERR | POLLNVAL))
+        {
+            fprintf(stderr, "Error: socket of %s failed\n", sr->ifs[i]->name);
+            ret = -1;
+            break;
+        }
+        if(ring->pfds[i].revents & POLLIN)
+        { sr_ring_drain(sr, i); }
+    }
+    sr_ring_burst(sr, 0);
+
+    return ret;
+} /* -- sr_ring_read -- */
+
+static int sr_ring_poll(struct sr_instance* sr, int fd)
+{
+    struct sr_ring* ring = sr->ring;
+    unsigned int i;
+
+    for(i = 0; i < ring->n; i++)
+    {
+        if(ring->ifs[i]->fd == fd)
+        {
+            sr_ring_burst(sr, 1);
+            sr_ring_drain(sr, i);
+            sr_ring_burst(sr, 0);
+        }
+    }
+
+    return 1;
+} /* -- sr_ring_poll -- */
+
+static int sr_ring_fds(struct sr_instance* sr, int* fds, int max)
+{
+    struct sr_ring* ring = sr->ring;
+    int i;
+
+    for(i = 0; i < (int)ring->n && i < max; i++)
+    { fds[i] = ring->ifs[i]->fd; }
+    return i;
+} /* -- sr_ring_fds -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_send(..)
+ * Scope:  Local
+ *
+ * Copy a frame into the next transmit slot of iface.  If that slot is
+ * still taken, the kernel is told about the frames before it first, which
+ * may free it; if it stays taken the frame is dropped.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_ring_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                        struct sr_if* iface)
+{
+    struct sr_ring* ring = sr->ring;
+    struct sr_ring_if* rif = ring->ifs[iface->index];
+    struct tpacket3_hdr* ph;
+    uint32_t status;
+    int ret = 0;
+
+    if(len > SR_RING_FRAME - SR_RING_DATA)
+    {
+        fprintf(stderr, "** Error: %u byte frame does not fit a transmit slot\n",
+                len);
+        return -1;
+    }
+
+    pthread_mutex_lock(&(rif->tx_lock));
+
+    ph = (struct tpacket3_hdr*)(rif->map + SR_RING_RXBYTES +
+                                (size_t)rif->tx_next * SR_RING_FRAME);
+    status = __atomic_load_n(&(ph->tp_status), __ATOMIC_ACQUIRE);
+    if(status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT)
+    {
+        sr_ring_kick(rif);
+        status = __atomic_load_n(&(ph->tp_status), __ATOMIC_ACQUIRE);
+    }
+
+    if(status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT)
+    {
+        rif->dropped++;
+        ret = -1;
+    }
+    else
+    {
+        memcpy((uint8_t*)ph + SR_RING_DATA, buf, len);
+        ph->tp_len = len;
+        ph->tp_next_offset = 0;
+        __atomic_store_n(&(ph->tp_status), TP_STATUS_SEND_REQUEST,
+                         __ATOMIC_RELEASE);
+        rif->tx_next = (rif->tx_next + 1) % SR_RING_SLOTS;
+        rif->frames_out++;
+
+        if(++rif->tx_waiting >= SR_RING_TXBATCH || !ring->batching ||
+           !pthread_equal(ring->owner, pthread_self()))
+        { sr_ring_kick(rif); }
+    }
+
+    pthread_mutex_unlock(&(rif->tx_lock));
+    return ret;
+} /* -- sr_ring_send -- */
+
+const struct sr_io sr_io_ring =
+{
+    "packet",
+    sr_ring_read,
+    sr_ring_poll,
+    sr_ring_fds,
+    sr_ring_send,
+    sr_ring_flush
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_open(..)
+ * Scope:  Global
+ *
+ * Add the interfaces listed in file, set up the rings on each device
+ * and make the router do its I/O through them.  Returns 0, or -1 if the
+ * file is bad or a device could not be set up.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ring_open(struct sr_instance* sr, const char* file)
+{
+    struct sr_ring* ring;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(file);
+
+    ring = (struct sr_ring*)calloc(1, sizeof(struct sr_ring));
+    assert(ring);
+    sr->ring = ring;
+
+    if(sr_io_config(sr, file, sr_ring_add) != 0)
+    { return -1; }
+
+    ring->pfds = (struct pollfd*)calloc(ring->n, sizeof(struct pollfd));
+    assert(ring->pfds);
+    for(i = 0; i < ring->n; i++)
+    {
+        ring->pfds[i].fd = ring->ifs[i]->fd;
+        ring->pfds[i].events = POLLIN;
+    }
+
+    sr->io = &sr_io_ring;
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return 0;
+} /* -- sr_ring_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_ring_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_ring_close(struct sr_instance* sr)
+{
+    struct sr_ring* ring = sr->ring;
+    struct sr_ring_if* rif;
+    struct tpacket_stats_v3 st;
+    socklen_t st_len;
+    unsigned int i;
+
+    if(ring == 0)
+    { return; }
+
+    for(i = 0; i < ring->n; i++)
+    {
+        rif = ring->ifs[i];
+        if(rif->fd >= 0)
+        {
+            memset(&st, 0, sizeof(st));
+            st_len = sizeof(st);
+            getsockopt(rif->fd, SOL_PACKET, PACKET_STATISTICS, &st, &st_len);
+            printf("AF_PACKET %s: %lu frames in %lu blocks, %u lost with the "
+                   "ring full; %lu out in %lu sends, %lu dropped with the ring "
+                   "full\n", sr->ifs[i]->name, rif->frames_in, rif->blocks,
+                   st.tp_drops, rif->frames_out, rif->sends, rif->dropped);
+
+            if(rif->map)
+            { munmap(rif->map, SR_RING_RXBYTES + SR_RING_TXBYTES); }
+            close(rif->fd);
+        }
+        pthread_mutex_destroy(&(rif->tx_lock));
+        free(rif);
+    }
+    free(ring->ifs);
+    free(ring->pfds);
+    free(ring);
+    sr->ring = 0;
+} /* -- sr_ring_close -- */
+
+#else
+
+int sr_ring_open(struct sr_instance* sr, const char* file)
+{
+    fprintf(stderr, "AF_PACKET rings are only supported on Linux\n");
+    return -1;
+} /* -- sr_ring_open -- */
+
+void sr_ring_close(struct sr_instance* sr)
+{ }
+
+#endif /* _LINUX_ */
@@ -0,0 +1,43 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ring.h
+ *
+ * Description:
+ *
+ * AF_PACKET backend, sr -P file.  Each interface of the router is an
+ * existing Linux interface (a NIC, or a veth in a network namespace)
+ * that it reads and writes through a TPACKET_V3 socket, with receive and
+ * transmit rings mapped into the process.  The interfaces come from the
+ * config file, in the format of sr_io.h; the device is the interface to
+ * open and should have no addresses of its own, or the kernel will answer
+ * for them too.  If the router's MAC is not the device's, the device is
+ * put in promiscuous mode while the router runs.
+ *
+ * The kernel fills receive blocks of SR_RING_BLOCK bytes and hands each
+ * over when it is full or SR_RING_TIMEOUT ms old.  Frames are handed to
+ * sr_receive_packet() where they lie in the block, which is given back
+ * once all of them have been handled.  Frames are sent by copying them
+ * into a slot of the transmit ring; the kernel is told about them with
+ * one send() per interface after each receive burst, or straight away
+ * for frames sent from another thread or when SR_RING_TXBATCH of them are
+ * waiting.  A frame that finds the transmit ring full is dropped.
+ *
+ * Linux only.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_RING_H
+#define sr_RING_H
+
+#define SR_RING_BLOCK    (256 * 1024) /* receive block, a power of 2 pages */
+#define SR_RING_BLOCKS   16           /* receive blocks per interface */
+#define SR_RING_TIMEOUT  1            /* ms before a part full block is handed over */
+#define SR_RING_FRAME    2048         /* transmit slot, header included */
+#define SR_RING_SLOTS    512          /* transmit slots per interface */
+#define SR_RING_TXBATCH  64           /* frames waiting before a send() */
+
+struct sr_instance;
+
+int  sr_ring_open(struct sr_instance*, const char* file);
+void sr_ring_close(struct sr_instance*);
+
+#endif  /* --  sr_RING_H -- */
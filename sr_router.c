@@ -15,13 +15,19 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <signal.h>
 
 #include "sr_if.h"
 #include "sr_rt.h"
 #include "sr_router.h"
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
+#include "sr_timer.h"
 #include "sr_utils.h"
+#include "sr_snapshot.h"
+
+static void sr_processpacket(struct sr_instance* , uint8_t * , unsigned int ,
+        struct sr_if* );
 
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
@@ -33,11 +39,36 @@
 
 void sr_init(struct sr_instance* sr)
 {
+    int restored;
+
     /* REQUIRES */
     assert(sr);
 
     /* Initialize cache and cache cleanup thread */
     sr_arpcache_init(&(sr->cache));
+    sr->cache.single = sr->event_loop;
+
+    /* Start from the neighbors known when the router last stopped */
+    if(sr->arp_file)
+    {
+        restored = sr_arpcache_restore(&(sr->cache), sr->arp_file);
+        if(restored > 0)
+        {
+            printf("Restored %d ARP entries from %s\n", restored,
+                   sr->arp_file);
+        }
+        sr_arpcache_autosave(&(sr->cache), sr->arp_file, sr->arp_save_ms);
+    }
+
+    /* SIGHUP is only ever taken by the reload thread's sigwait(), and so
+       are SIGTERM and SIGINT when the ARP cache is to be saved on exit */
+    sigset_t sigs;
+    sr_rt_signals(sr, &sigs);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    /* The event loop runs the timers and takes the signals itself */
+    if(sr->event_loop)
+    { return; }
 
     pthread_attr_init(&(sr->attr));
     pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
@@ -46,11 +77,52 @@ void sr_init(struct sr_instance* sr)
     pthread_t thread;
 
     pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
+    pthread_create(&thread, &(sr->attr), sr_rt_reload_thread, sr);
     
     /* Add initialization code here! */
 
 } /* -- sr_init -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_interfaces_ready(..)
+ * Scope:  Global
+ *
+ * Called once the interfaces are known, from the VNS server's hwinfo or
+ * the TAP config file: bind the routing table to them and start
+ * resolving the neighbors.  Returns 0, or -1 if the routing table does
+ * not fit the interfaces.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_interfaces_ready(struct sr_instance* sr)
+{
+    int ret;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if(sr_snapshot_confirm(sr) != 0)
+    {
+        fprintf(stderr,"Error loading routing table\n");
+        return -1;
+    }
+    pthread_mutex_lock(&(sr->rt_lock));
+    /* -- packets are only handled on the thread calling this, so the
+     *    table can be bound to the interfaces in place -- */
+    sr_rt_bind(sr, sr->routing_table);
+    ret = sr_verify_routing_table(sr);
+    pthread_mutex_unlock(&(sr->rt_lock));
+    if(ret != 0)
+    {
+        fprintf(stderr,"Routing table not consistent with hardware\n");
+        return -1;
+    }
+    sr_arpcache_warm(sr);
+    printf(" <-- Ready to process packets --> \n");
+
+    return 0;
+} /* -- sr_interfaces_ready -- */
+
 /*---------------------------------------------------------------------
  * Method: sr_handlepacket(uint8_t* p,char* interface)
  * Scope:  Global
@@ -72,6 +144,8 @@ void sr_handlepacket(struct sr_instance* sr,
         unsigned int len,
         char* interface/* lent */)
 {
+  struct sr_if* iface;
+
   /* REQUIRES */
   assert(sr);
   assert(packet);
@@ -79,6 +153,90 @@ void sr_handlepacket(struct sr_instance* sr,
 
   printf("*** -> Received packet of length %d \n",len);
 
+  /* The only lookup by name; from here on interfaces are records */
+  iface = sr_get_interface(sr, interface);
+  if(!iface) {
+    fprintf(stderr, "Dropping packet from unknown interface %s.\n", interface);
+    return;
+  }
+
+  /* One clock read per packet, for the ARP cache's timestamps */
+  sr_clock_update();
+
+  /* The FIB may be replaced while we run; keep the one we see alive */
+  sr_rcu_read_lock(&(sr->rcu), SR_RCU_FORWARDER);
+  sr_processpacket(sr, packet, len, iface);
+  sr_rcu_read_unlock(&(sr->rcu), SR_RCU_FORWARDER);
+
+}/* end sr_handlepacket */
+
+/*---------------------------------------------------------------------
+ * Method: sr_save_arpcache(..)
+ * Scope:  Global
+ *
+ * Save the ARP cache to the file it is kept in, as the router stops.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_save_arpcache(struct sr_instance* sr)
+{
+    int saved = sr_arpcache_save(&(sr->cache), sr->arp_file);
+
+    if(saved < 0)
+    { fprintf(stderr,"Error saving the ARP cache to %s\n", sr->arp_file); }
+    else
+    { printf("Saved %d ARP entries to %s\n", saved, sr->arp_file); }
+} /* -- sr_save_arpcache -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_arp_learn(..)
+ * Scope:  Local
+ *
+ * Cache a neighbor's IP->MAC mapping, learned on iface, and send the
+ * packets that were waiting for it.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_arp_learn(struct sr_instance* sr, unsigned char* mac,
+        uint32_t ip, struct sr_if* iface)
+{
+  struct sr_arpreq* ar_req = sr_arpcache_insert(&(sr->cache), mac, ip, iface);
+  struct sr_packet* tmp_pkt;
+
+  if(!ar_req)
+    return;
+
+  /* Send outstanding packets, oldest first */
+  for(tmp_pkt = ar_req->packets; tmp_pkt; tmp_pkt = tmp_pkt->next) {
+    sr_ethernet_hdr_t* eth_ptr = (sr_ethernet_hdr_t*) tmp_pkt->buf;
+    struct sr_if* out = sr_get_interface_index(sr, tmp_pkt->ifindex);
+
+    if(!out)
+      continue;
+    memcpy(eth_ptr->ether_dhost, mac, sizeof(uint8_t)*ETHER_ADDR_LEN);
+    memcpy(eth_ptr->ether_shost, out->addr, sizeof(uint8_t)*ETHER_ADDR_LEN);
+
+    sr_send_packet_if(sr, tmp_pkt->buf, tmp_pkt->len, out);
+  }
+
+  sr_arpreq_destroy(&(sr->cache), ar_req);
+} /* -- sr_arp_learn -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_processpacket(uint8_t* p,struct sr_if* iface)
+ * Scope:  Local
+ *
+ * Does the work of sr_handlepacket inside the rcu read section.  iface is
+ * the receiving interface.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_processpacket(struct sr_instance* sr,
+        uint8_t * packet/* lent */,
+        unsigned int len,
+        struct sr_if* iface)
+{
+
   /* fill in code here */
 
   /* Handle ARP packet */
@@ -93,15 +251,8 @@ void sr_handlepacket(struct sr_instance* sr,
     sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*) packet;
     sr_arp_hdr_t* ar_hdr = 
       (sr_arp_hdr_t*) (packet + sizeof(sr_ethernet_hdr_t));
-    struct sr_if* iface = sr_get_interface(sr, interface);
 
-    struct sr_if* if_ptr, *if_i;
-    for(if_i = sr_get_interface(sr, interface); if_i; if_i = if_i->next) {
-      if(if_i->ip == ar_hdr->ar_tip) {
-        if_ptr = if_i;
-        break;
-      }
-    }
+    struct sr_if* if_ptr = sr_get_interface_ip(sr, ar_hdr->ar_tip);
 
     if(!if_ptr) {
       fprintf(stderr, "ARP packet not for me.\n");
@@ -110,6 +261,10 @@ void sr_handlepacket(struct sr_instance* sr,
 
     /* Handle ARP Request */
     if(ntohs(ar_hdr->ar_op) == arp_op_request) {
+      /* The sender will talk to us next, learn it before replying */
+      if(ar_hdr->ar_sip != 0)
+        sr_arp_learn(sr, ar_hdr->ar_sha, ar_hdr->ar_sip, iface);
+
       memset(eth_hdr->ether_dhost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
       memcpy(eth_hdr->ether_dhost, eth_hdr->ether_shost, sizeof(uint8_t)*ETHER_ADDR_LEN);
       memset(eth_hdr->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
@@ -124,28 +279,12 @@ void sr_handlepacket(struct sr_instance* sr,
       memcpy(ar_hdr->ar_sha, iface->addr, sizeof(unsigned char)*ETHER_ADDR_LEN);
 
       ar_hdr->ar_op = htons(arp_op_reply);
-      sr_send_packet(sr, packet, len, iface->name);
+      sr_send_packet_if(sr, packet, len, iface);
     }
 
     /* Handle ARP Reply */
     else if(ntohs(ar_hdr->ar_op) == arp_op_reply) {
-      struct sr_arpreq* ar_req = 
-        sr_arpcache_insert(&(sr->cache), ar_hdr->ar_sha, ar_hdr->ar_sip);
-      
-      /* Send outstanding packets */
-      struct sr_packet* tmp_pkt = ar_req->packets;
-      while(tmp_pkt) {
-        sr_ethernet_hdr_t* eth_ptr = (sr_ethernet_hdr_t*) tmp_pkt->buf;
-        memset(eth_ptr->ether_dhost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
-        memcpy(eth_ptr->ether_dhost, eth_hdr->ether_shost, sizeof(uint8_t)*ETHER_ADDR_LEN);
-        memset(eth_ptr->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
-        memcpy(eth_ptr->ether_shost, iface->addr, sizeof(uint8_t)*ETHER_ADDR_LEN);
-
-        sr_send_packet(sr, tmp_pkt->buf, tmp_pkt->len, iface->name);
-        tmp_pkt = tmp_pkt->next;
-      }
-
-      sr_arpreq_destroy(&(sr->cache), ar_req);
+      sr_arp_learn(sr, ar_hdr->ar_sha, ar_hdr->ar_sip, iface);
     }
   }
 
@@ -171,20 +310,12 @@ void sr_handlepacket(struct sr_instance* sr,
       return;
     }
     
-    /* Check if package mailed to correct address */
-    struct sr_if* if_ptr = NULL, *if_i; 
-    for(if_i = sr_get_interface(sr, interface); if_i; if_i = if_i->next) {
-      if(if_i->ip == ip_hdr->ip_dst) {
-        if_ptr = if_i;
-        break;
-      }
-    }
+    /* Check if package mailed to any of my addresses */
+    struct sr_if* if_ptr = sr_get_interface_ip(sr, ip_hdr->ip_dst);
 
     /* It is for me */
     if(if_ptr) {
       
-      struct sr_if* iface = sr_get_interface(sr, interface);
-      
       if(ip_hdr->ip_p != ip_protocol_icmp) {
         fprintf(stderr, "Dropping bad IP packet: non-ICMP.\n");
         size_t out_len = sizeof(sr_ethernet_hdr_t) +
@@ -230,7 +361,7 @@ void sr_handlepacket(struct sr_instance* sr,
         
         out_icmp->icmp_sum = cksum(out_icmp, sizeof(sr_icmp_t11_hdr_t));
 
-        sr_send_packet(sr, out_pkt, out_len, iface->name);
+        sr_send_packet_if(sr, out_pkt, out_len, iface);
         return;
       }
 
@@ -261,7 +392,7 @@ void sr_handlepacket(struct sr_instance* sr,
         icmp_hdr->icmp_sum = cksum(icmp_hdr, 
           ntohs(ip_hdr->ip_len) - sizeof(sr_ip_hdr_t));
         
-        sr_send_packet(sr, packet, len, iface->name);
+        sr_send_packet_if(sr, packet, len, iface);
       }
     }
 
@@ -269,49 +400,35 @@ void sr_handlepacket(struct sr_instance* sr,
     else {
       /* Check for expiring IP packet */
       if(ip_hdr->ip_ttl > 1) {
-        struct sr_rt* rt_mask = NULL;
-        uint32_t n_mask = 0x0;
-
-        struct sr_rt* rt_i;
-        for(rt_i = sr->routing_table; rt_i; rt_i = rt_i->next) {
-          if((rt_i->dest.s_addr & rt_i->mask.s_addr) ==
-             (ip_hdr->ip_dst & rt_i->mask.s_addr)) {
-            if(rt_i->mask.s_addr > n_mask) {
-              rt_mask = rt_i;
-              n_mask = (ip_hdr->ip_dst & rt_i->mask.s_addr);
-            }
-          }
-        }
-        
-        /* LPM found */
-        if(rt_mask) {
+        struct sr_if* out = NULL;
+        uint32_t gw = 0;
+        struct sr_rt* rt_mask =
+          sr_dstcache_route(sr, ip_hdr->ip_dst,
+            flow_hash((uint8_t*)ip_hdr, len - sizeof(sr_ethernet_hdr_t)),
+            &out, &gw);
+
+        /* LPM found, next hop picked per flow for multipath routes */
+        if(rt_mask && out) {
+          /* Directly connected, the destination is the next hop */
+          if(gw == 0)
+            gw = ip_hdr->ip_dst;
+
           ip_hdr->ip_ttl--;
           ip_hdr->ip_sum = 0x00;
           ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
           
-          struct sr_arpentry* entry =
-            sr_arpcache_lookup(&(sr->cache), rt_mask->gw.s_addr);
-
-          struct sr_if* iface = sr_get_interface(sr, rt_mask->interface);
-          
-          /* ARP entry found */
-          if(entry) {
-            memset(eth_hdr->ether_dhost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
-            memcpy(eth_hdr->ether_dhost, entry->mac, sizeof(uint8_t)*ETHER_ADDR_LEN);
-            
+          /* ARP entry found, the MAC goes straight into the frame */
+          if(sr_arpcache_lookup(&(sr->cache), gw, eth_hdr->ether_dhost)) {
             memset(eth_hdr->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
-            memcpy(eth_hdr->ether_shost, iface->addr, sizeof(uint8_t)*ETHER_ADDR_LEN);
-
-            /*ip_hdr->ip_src = iface->ip;
-            ip_hdr->ip_dst = entry->ip;*/
+            memcpy(eth_hdr->ether_shost, out->addr, sizeof(uint8_t)*ETHER_ADDR_LEN);
 
-            sr_send_packet(sr, packet, len, rt_mask->interface);
+            sr_send_packet_if(sr, packet, len, out);
           }
 
-          /* ARP entry not found */
+          /* ARP entry not found, ask for it now */
           else {
-            sr_arpcache_queuereq(&(sr->cache), rt_mask->gw.s_addr, packet,
-              len, rt_mask->interface);
+            sr_arpcache_resolve(sr, gw, packet, len, out->index,
+              iface->index);
           }
         }
 
@@ -328,8 +445,6 @@ void sr_handlepacket(struct sr_instance* sr,
             (sr_icmp_t11_hdr_t*) (out_pkt+sizeof(sr_ethernet_hdr_t)
             +sizeof(sr_ip_hdr_t));
 
-          struct sr_if* iface = sr_get_interface(sr, interface);
-
           memset(out_eth->ether_dhost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
           memcpy(out_eth->ether_dhost, eth_hdr->ether_shost, sizeof(uint8_t)*ETHER_ADDR_LEN);
           memset(out_eth->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
@@ -362,7 +477,7 @@ void sr_handlepacket(struct sr_instance* sr,
           
           out_icmp->icmp_sum = cksum(out_icmp, sizeof(sr_icmp_t11_hdr_t));
 
-          sr_send_packet(sr, out_pkt, out_len, iface->name);
+          sr_send_packet_if(sr, out_pkt, out_len, iface);
         }
       }
 
@@ -379,8 +494,6 @@ void sr_handlepacket(struct sr_instance* sr,
           (sr_icmp_t11_hdr_t*) (out_pkt+sizeof(sr_ethernet_hdr_t)
           +sizeof(sr_ip_hdr_t));
 
-        struct sr_if* iface = sr_get_interface(sr, interface);
-
         memset(out_eth->ether_dhost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
         memcpy(out_eth->ether_dhost, eth_hdr->ether_shost, sizeof(uint8_t)*ETHER_ADDR_LEN);
         memset(out_eth->ether_shost, 0, sizeof(uint8_t)*ETHER_ADDR_LEN);
@@ -411,9 +524,9 @@ void sr_handlepacket(struct sr_instance* sr,
 
         out_icmp->icmp_sum = cksum(out_icmp, sizeof(sr_icmp_t11_hdr_t));
 
-        sr_send_packet(sr, out_pkt, out_len, iface->name);
+        sr_send_packet_if(sr, out_pkt, out_len, iface);
       }
     }
   }
 
-}/* end sr_ForwardPacket */
+}/* end sr_processpacket */
@@ -11,10 +11,14 @@
 
 #include <netinet/in.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <stdio.h>
 
 #include "sr_protocol.h"
+#include "vnscommand.h"
 #include "sr_arpcache.h"
+#include "sr_dstcache.h"
+#include "sr_rcu.h"
 
 /* we dont like this debug , but what to do for varargs ? */
 #ifdef _DEBUG_
@@ -33,6 +37,67 @@
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_fib;
+struct sr_snapshot;
+struct sr_io;
+struct sr_tap;
+struct sr_ring;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_vns_rx
+ *
+ * The VNS stream as received: commands are handled where they lie in buf,
+ * and the bytes from start to end are the part not handled yet, at most
+ * one incomplete command once the complete ones are drained.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_VNS_RXBUF  (256 * 1024)
+#define SR_VNS_MAXCMD 10000   /* longest command the server sends */
+
+struct sr_vns_rx
+{
+    unsigned char* buf;       /* SR_VNS_RXBUF bytes, allocated on first use */
+    unsigned int start, end;
+    unsigned long reads;      /* recv() calls */
+    unsigned long cmds;       /* commands handled */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_vns_tx
+ *
+ * Frames sent while sr_read_from_server() drains a burst, written with one
+ * sendmsg() when it is done.  Frames still in the receive ring are sent
+ * from there; the rest are copied to data, since their buffers may not
+ * outlive the send call.  Only the thread reading from the server
+ * batches; frames from other threads are written at once.
+ *
+ * In the event loop the socket is non-blocking.  What it will not take
+ * is held, and later frames queue behind it until the loop sees the
+ * socket writable again; past SR_VNS_TXHELD bytes new frames are dropped.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_VNS_TXBATCH 64          /* frames per sendmsg() */
+#define SR_VNS_TXDATA  (64 * 1024) /* bytes of copied frames */
+#define SR_VNS_TXHELD  (1024 * 1024) /* bytes held for a full socket */
+
+struct sr_vns_tx
+{
+    int batch;                /* 0 writes every frame at once */
+    int batching;             /* a burst is being drained */
+    pthread_t owner;          /* by this thread */
+    unsigned int n;           /* frames waiting */
+    unsigned int used;        /* bytes of data they use */
+    unsigned char* data;      /* allocated on first use */
+    struct iovec iov[2 * SR_VNS_TXBATCH];       /* header, frame */
+    c_packet_header hdr[SR_VNS_TXBATCH];
+    unsigned char* held;      /* not taken by the socket yet */
+    size_t held_start, held_len, held_size;
+    unsigned long writes;     /* sendmsg() calls */
+    unsigned long frames;
+    unsigned long dropped;    /* frames refused with too much held */
+};
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -43,14 +108,36 @@ struct sr_rt;
 
 struct sr_instance
 {
+    const struct sr_io* io; /* where frames come from and go to */
     int  sockfd;   /* socket to server */
     char user[32]; /* user name */
     char host[32]; /* host name */ 
     char template[30]; /* template name if any */
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
+    struct sr_vns_rx rx; /* received from the server */
+    struct sr_vns_tx tx; /* to be sent to it */
+    struct sr_tap* tap; /* TAP devices instead, or 0 */
+    struct sr_ring* ring; /* AF_PACKET rings instead, or 0 */
     struct sr_if* if_list; /* list of interfaces */
-    struct sr_rt* routing_table; /* routing table */
+    struct sr_if** ifs; /* the same, by index */
+    unsigned int nifs;
+    struct sr_if** local; /* interfaces by IP address, open addressed */
+    unsigned int local_bits; /* log2 of its slots */
+    struct sr_rt* routing_table; /* routing table, read under rt_lock */
+    struct sr_fib* fib; /* lookup index over routing_table, read under rcu */
+    pthread_mutex_t rt_lock; /* routing table writers and control readers */
+    struct sr_rcu rcu;
+    const char* rtable; /* file reloaded on SIGHUP */
+    unsigned int reloads; /* SIGHUP reloads not yet done, see sr_rt_signal() */
+    const char* mrt; /* MRT dump imported on top of rtable, or 0 */
+    const char* snapshot; /* compiled routing table kept up to date, or 0 */
+    struct sr_snapshot* snap; /* loaded snapshot awaiting hwinfo, or 0 */
+    const char* arp_file; /* ARP cache kept across restarts, or 0 */
+    unsigned int arp_save_ms; /* how often it is saved, 0 only at exit */
+    int fib_mode; /* SR_FIB_* lookup structure */
+    int event_loop; /* -E: one thread runs everything, see sr_loop.c */
+    struct sr_dstcache dstcache; /* recent FIB lookups */
     struct sr_arpcache cache;   /* ARP cache */
     pthread_attr_t attr;
     FILE* logfile;
@@ -59,19 +146,29 @@ struct sr_instance
 /* -- sr_main.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
 
-/* -- sr_vns_comm.c -- */
+/* -- sr_io.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_if(struct sr_instance* , uint8_t* , unsigned int ,
+                      struct sr_if*);
+int sr_flush_packets(struct sr_instance* , int more);
+
+/* -- sr_vns_comm.c -- */
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
+int sr_poll_server(struct sr_instance* );
+int sr_write_held(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
+int sr_interfaces_ready(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+void sr_save_arpcache(struct sr_instance* );
 
 /* -- sr_if.c -- */
 void sr_add_interface(struct sr_instance* , const char* );
 void sr_set_ether_ip(struct sr_instance* , uint32_t );
 void sr_set_ether_addr(struct sr_instance* , const unsigned char* );
+void sr_set_ether_speed(struct sr_instance* , uint32_t );
 void sr_print_if_list(struct sr_instance* );
 
 #endif /* SR_ROUTER_H */
@@ -12,7 +12,12 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -20,71 +25,906 @@
 #include <arpa/inet.h>
 
 #include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_mrt.h"
 #include "sr_router.h"
+#include "sr_if.h"
+#include "sr_slab.h"
+
+static struct sr_rt* sr_rt_new(struct in_addr, struct in_addr, struct in_addr,
+                               const char*, struct sr_slab*);
+static void sr_rt_index(struct sr_fib*, struct sr_rt**, struct sr_rt*);
+static void sr_rt_link(struct sr_rt**, struct sr_rt*);
+static void sr_rt_unlink(struct sr_rt**, struct sr_rt*);
+static void sr_rt_bind_entry(struct sr_instance*, struct sr_rt*);
+static int sr_rt_parse(struct sr_instance*, const char*, struct sr_rt**,
+                       struct sr_fib**);
 
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_rt_parse_ip(..)
+ * Scope:  Local
+ *
+ * Parse a dotted quad starting at p into *ip_nbo.  Returns the character
+ * after it, or 0 if p does not start with one that ends at whitespace.
  *
  *---------------------------------------------------------------------*/
 
-int sr_load_rt(struct sr_instance* sr,const char* filename)
+static const char* sr_rt_parse_ip(const char* p, const char* end,
+                                  uint32_t* ip_nbo)
+{
+    uint32_t addr = 0;
+    int i;
+
+    for(i = 0; i < 4; i++)
+    {
+        unsigned int octet = 0;
+        const char* start;
+
+        if(i > 0)
+        {
+            if(p == end || *p != '.')
+            { return 0; }
+            p++;
+        }
+
+        start = p;
+        while(p < end && p - start < 3 && *p >= '0' && *p <= '9')
+        { octet = octet * 10 + (*p++ - '0'); }
+        if(p == start || octet > 255)
+        { return 0; }
+
+        addr = (addr << 8) | octet;
+    }
+
+    if(p < end && *p != ' ' && *p != '\t' && *p != '\r')
+    { return 0; }
+
+    *ip_nbo = htonl(addr);
+    return p;
+} /* -- sr_rt_parse_ip -- */
+
+/* -- skip blanks, return the start of the next field or end -- */
+static const char* sr_rt_field(const char* p, const char* end)
+{
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    { p++; }
+    return p;
+}
+
+static const char* sr_rt_field_end(const char* p, const char* end)
+{
+    while(p < end && *p != ' ' && *p != '\t' && *p != '\r')
+    { p++; }
+    return p;
+}
+
+/* -- sort key for sr_rt_sort() -- */
+struct sr_rt_key
+{
+    uint32_t dest;                  /* host byte order */
+    struct sr_rt* rt;
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_sort(..)
+ * Scope:  Local
+ *
+ * Stable radix sort of n entries by destination.  Inserting routes into
+ * the FIB in address order keeps the nodes each insert walks in cache,
+ * which is several times faster than file order for large tables.  The
+ * keys travel with the pointers so the passes never touch the entries.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_rt_sort(struct sr_rt_key* v, unsigned int n)
+{
+    struct sr_rt_key* tmp;
+    unsigned int* count;
+    unsigned int i, shift, sum;
+
+    tmp = (struct sr_rt_key*)malloc(n * sizeof(struct sr_rt_key));
+    count = (unsigned int*)malloc(65536 * sizeof(unsigned int));
+    assert(tmp && count);
+
+    for(shift = 0; shift < 32; shift += 16)
+    {
+        memset(count, 0, 65536 * sizeof(unsigned int));
+        for(i = 0; i < n; i++)
+        { count[(v[i].dest >> shift) & 0xffff]++; }
+        for(i = 0, sum = 0; i < 65536; i++)
+        {
+            unsigned int c = count[i];
+            count[i] = sum;
+            sum += c;
+        }
+        for(i = 0; i < n; i++)
+        { tmp[count[(v[i].dest >> shift) & 0xffff]++] = v[i]; }
+        memcpy(v, tmp, n * sizeof(struct sr_rt_key));
+    }
+
+    free(tmp);
+    free(count);
+} /* -- sr_rt_sort -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_parse(..)
+ * Scope:  Local
+ *
+ * Read a routing table file with lines of the form
+ *
+ *   destination gateway mask interface
+ *
+ * into a new list and FIB that nothing else can see yet.  The file is
+ * mapped and scanned in place, and the entries are indexed in address
+ * order, so parsing is linear in the size of the file.  The entries and
+ * the trie are allocated from slabs sized by the line count, not one
+ * malloc per object.  Blank lines and lines starting with # are skipped.
+ * A file without routes leaves both at 0.  On error the offending line is reported and -1 returned.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_parse(struct sr_instance* sr, const char* filename,
+                       struct sr_rt** rt_out, struct sr_fib** fib_out)
 {
-    FILE* fp;
-    char  line[BUFSIZ];
-    char  dest[32];
-    char  gw[32];
-    char  mask[32];
-    char  iface[32];
+    const char* base;
+    const char* end;
+    const char* p;
+    struct stat st;
     struct in_addr dest_addr;
     struct in_addr gw_addr;
     struct in_addr mask_addr;
-    int clear_routing_table = 0;
+    char iface[sr_IFACE_NAMELEN];
+    struct sr_rt* rt_list = 0;
+    struct sr_rt* rt_tail = 0;
+    struct sr_rt_key* order = 0;
+    struct sr_fib* fib = 0;
+    struct sr_slab* slab;
+    unsigned int line = 0, lines = 1, n = 0, i;
+    int fd, err = 0;
 
     /* -- REQUIRES -- */
     assert(filename);
-    if( access(filename,R_OK) != 0)
+
+    *rt_out = 0;
+    *fib_out = 0;
+
+    if((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
     {
-        perror("access");
+        perror(filename);
+        if(fd >= 0)
+        { close(fd); }
         return -1;
     }
 
-    fp = fopen(filename,"r");
+    if(st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
 
-    while( fgets(line,BUFSIZ,fp) != 0)
+    base = (const char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == (const char*)MAP_FAILED)
     {
-        sscanf(line,"%s %s %s %s",dest,gw,mask,iface);
-        if(inet_aton(dest,&dest_addr) == 0)
-        { 
-            fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    dest);
-            return -1; 
+        perror("mmap");
+        return -1;
+    }
+    madvise((void*)base, st.st_size, MADV_SEQUENTIAL);
+    end = base + st.st_size;
+
+    /* -- every line holds at most one route: size everything once -- */
+    for(p = base; (p = (const char*)memchr(p, '\n', end - p)) != 0; p++)
+    { lines++; }
+    order = (struct sr_rt_key*)malloc(lines * sizeof(struct sr_rt_key));
+    assert(order);
+    slab = sr_slab_create(sizeof(struct sr_rt), lines);
+    fib = sr_fib_create(sr->fib_mode);
+    sr_fib_reserve(fib, lines);
+
+    for(p = base; p < end; p++)
+    {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        const char* field[4];
+        uint32_t addr[3];
+        const char* q;
+
+        if(eol == 0)
+        { eol = end; }
+        line++;
+
+        q = sr_rt_field(p, eol);
+        if(q == eol || *q == '#')
+        {
+            p = eol;
+            continue;
         }
-        if(inet_aton(gw,&gw_addr) == 0)
-        { 
-            fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    gw);
-            return -1; 
+
+        for(i = 0; i < 4; i++)
+        {
+            if(q == eol)
+            { break; }
+            field[i] = q;
+            q = sr_rt_field(sr_rt_field_end(q, eol), eol);
         }
-        if(inet_aton(mask,&mask_addr) == 0)
-        { 
-            fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    mask);
-            return -1; 
+        if(i < 4)
+        {
+            fprintf(stderr, "Error loading routing table, line %u: "
+                    "expected destination gateway mask interface\n", line);
+            err = 1;
+            break;
         }
-        if( clear_routing_table == 0 ){
-            printf("Loading routing table from server, clear local routing table.\n");
-            sr->routing_table = 0;
-            clear_routing_table = 1;
+
+        for(i = 0; i < 3; i++)
+        {
+            if(sr_rt_parse_ip(field[i], eol, &addr[i]) == 0)
+            { break; }
         }
-        sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
-    } /* -- while -- */
+        if(i < 3)
+        {
+            fprintf(stderr, "Error loading routing table, line %u: "
+                    "cannot convert %.*s to valid IP\n", line,
+                    (int)(sr_rt_field_end(field[i], eol) - field[i]), field[i]);
+            err = 1;
+            break;
+        }
+        dest_addr.s_addr = addr[0];
+        gw_addr.s_addr = addr[1];
+        mask_addr.s_addr = addr[2];
+
+        q = sr_rt_field_end(field[3], eol);
+        if(q - field[3] >= sr_IFACE_NAMELEN)
+        {
+            fprintf(stderr, "Error loading routing table, line %u: "
+                    "interface name %.*s too long\n", line,
+                    (int)(q - field[3]), field[3]);
+            err = 1;
+            break;
+        }
+        memcpy(iface, field[3], q - field[3]);
+        iface[q - field[3]] = 0;
+
+        if(rt_tail)
+        {
+            rt_tail->next = sr_rt_new(dest_addr,gw_addr,mask_addr,iface,
+                                      slab);
+            rt_tail->next->prev = rt_tail;
+            rt_tail = rt_tail->next;
+        }
+        else
+        {
+            rt_list = rt_tail = sr_rt_new(dest_addr,gw_addr,mask_addr,iface,
+                                          slab);
+        }
+
+        order[n].dest = ntohl(dest_addr.s_addr);
+        order[n++].rt = rt_tail;
+
+        p = eol;
+    } /* -- for -- */
+
+    munmap((void*)base, st.st_size);
+    sr_slab_seal(slab);
+
+    if(err)
+    {
+        sr_fib_destroy(fib);
+        sr_rt_free_list(rt_list);
+        free(order);
+        return -1;
+    }
+
+    if(rt_list == 0)
+    {
+        sr_fib_destroy(fib);
+        return 0;
+    }
+
+    /* -- the sort is stable, so multipath next hops keep their order -- */
+    sr_rt_sort(order, n);
+    for(i = 0; i < n; i++)
+    { sr_rt_index(fib, &rt_list, order[i].rt); }
+    free(order);
+
+    *rt_out = rt_list;
+    *fib_out = fib;
+    return 0; /* -- success -- */
+} /* -- sr_rt_parse -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_load_rt(..)
+ * Scope:  Global
+ *
+ * Load a routing table file, see sr_rt_parse(), and make it the routing
+ * table.  On error, or if the file has no routes, the current routing
+ * table is kept.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_rt(struct sr_instance* sr,const char* filename)
+{
+    struct sr_rt* rt_list;
+    struct sr_fib* fib;
+
+    if(sr_rt_parse(sr, filename, &rt_list, &fib) != 0)
+    { return -1; }
+    if(fib == 0)
+    { return 0; }
+
+    printf("Loading routing table from server, clear local routing table.\n");
+    sr_fib_commit(fib, rt_list);
+    sr_rt_publish(sr, rt_list, fib);
 
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_rt_reload(..)
+ * Scope:  Global
+ *
+ * Reload the routing table file and merge the routes of the MRT file, if
+ * any, into it before it is published, so the forwarding path goes from
+ * the old table to the complete new one in a single step.  On error
+ * nothing is published.  Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_reload(struct sr_instance* sr)
+{
+    struct sr_rt* rt_list;
+    struct sr_fib* fib;
+    struct sr_rt_update* updates = 0;
+    struct sr_rt* rt;
+    unsigned int n = 0, i;
+
+    if(sr->rtable == 0 || sr_rt_parse(sr, sr->rtable, &rt_list, &fib) != 0)
+    { return -1; }
+    if(fib == 0)
+    { return 0; }
+
+    /* -- next hops resolve against the new table, which no one else sees -- */
+    if(sr->mrt && sr_mrt_read(sr, sr->mrt, fib, &updates, &n) != 0)
+    {
+        sr_fib_destroy(fib);
+        sr_rt_free_list(rt_list);
+        return -1;
+    }
+    for(i = 0; i < n; i++)
+    {
+        rt = sr_rt_new(updates[i].dest, updates[i].gw, updates[i].mask,
+                       updates[i].interface, 0);
+        sr_rt_link(&rt_list, rt);
+        sr_rt_index(fib, &rt_list, rt);
+    }
+    free(updates);
+
+    printf("Loading routing table from server, clear local routing table.\n");
+    sr_fib_commit(fib, rt_list);
+    sr_rt_publish(sr, rt_list, fib);
+
+    return 0;
+} /* -- sr_rt_reload -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_publish(..)
+ * Scope:  Global
+ *
+ * Replace the routing table and its FIB with a completely built new pair,
+ * binding its routes to the interfaces.  The forwarding path switches
+ * over with a single pointer store and never waits; the old pair is freed once no reader can be using it any more.
+ * rt_lock is held until then so writers never overlap.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_publish(struct sr_instance* sr, struct sr_rt* rt_list,
+                   struct sr_fib* fib)
+{
+    struct sr_rt* old_list;
+    struct sr_fib* old_fib;
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    sr_rt_bind(sr, rt_list);
+    old_list = sr->routing_table;
+    old_fib = sr->fib;
+    sr->routing_table = rt_list;
+    sr_rcu_assign(sr->fib, fib);
+
+    sr_rcu_synchronize(&(sr->rcu));
+
+    sr_fib_destroy(old_fib);
+    sr_rt_free_list(old_list);
+    pthread_mutex_unlock(&(sr->rt_lock));
+} /* -- sr_rt_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_apply(..)
+ * Scope:  Global
+ *
+ * Apply a batch of incremental updates atomically: the forwarding path
+ * sees either none or all of them.  The changes are made to a clone of
+ * the current FIB which is published like a reloaded one, so only the
+ * trie nodes along the changed prefixes are copied.
+ *
+ * RETURN VALUES:
+ *
+ *  n on success
+ *  the index of the first update that could not be applied otherwise, in
+ *  which case nothing was changed
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_rt_apply(struct sr_instance* sr,
+                         const struct sr_rt_update* updates, unsigned int n)
+{
+    struct sr_rt** added;
+    struct sr_rt** removed;
+    struct sr_fib* old;
+    struct sr_fib* fib;
+    unsigned int i, j;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(updates || n == 0);
+
+    added = (struct sr_rt**)calloc(n + 1, sizeof(struct sr_rt*));
+    removed = (struct sr_rt**)calloc(n + 1, sizeof(struct sr_rt*));
+    assert(added && removed);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+
+    old = sr->fib;
+    fib = old ? sr_fib_clone(old) : sr_fib_create(sr->fib_mode);
+
+    for(i = 0; i < n; i++)
+    {
+        const struct sr_rt_update* u = &updates[i];
+
+        if(u->op == SR_RT_DEL)
+        {
+            removed[i] = sr_fib_remove(fib, u->dest.s_addr, u->mask.s_addr);
+            if(removed[i] == 0)
+            { break; }
+            continue;
+        }
+
+        /* -- an add must not replace anything, a replace must -- */
+        added[i] = sr_rt_new(u->dest, u->gw, u->mask, u->interface, 0);
+        sr_rt_bind_entry(sr, added[i]);
+        if(sr_fib_insert(fib, added[i], &removed[i]) != 0 ||
+           (u->op == SR_RT_ADD) != (removed[i] == 0))
+        { break; }
+    }
+
+    if(i < n)
+    {
+        sr_fib_abort(fib);
+        pthread_mutex_unlock(&(sr->rt_lock));
+        for(j = 0; j <= i; j++)
+        { sr_rt_free(added[j]); }
+        free(added);
+        free(removed);
+        return i;
+    }
+
+    /* -- replay the batch on the list in the same order -- */
+    for(i = 0; i < n; i++)
+    {
+        if(removed[i])
+        {
+            sr_rt_unlink(&(sr->routing_table), removed[i]);
+            sr_fib_defer_free(fib, removed[i]);
+        }
+        if(added[i])
+        { sr_rt_link(&(sr->routing_table), added[i]); }
+    }
+
+    sr_fib_commit(fib, sr->routing_table);
+    sr_rcu_assign(sr->fib, fib);
+
+    if(old)
+    {
+        sr_rcu_synchronize(&(sr->rcu));
+        sr_fib_reclaim(old, fib);
+    }
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    free(added);
+    free(removed);
+
+    return n;
+} /* -- sr_rt_apply -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_reload_worker(..)
+ * Scope:  Local
+ *
+ * Reload the routing table for SIGHUP, again while more of them arrived
+ * during the last reload.  sr->reloads counts the ones not yet served.
+ *
+ *---------------------------------------------------------------------*/
+
+static void* sr_rt_reload_worker(void* sr_ptr)
+{
+    struct sr_instance* sr = (struct sr_instance*)sr_ptr;
+    unsigned int n;
+
+    do
+    {
+        n = __atomic_load_n(&(sr->reloads), __ATOMIC_SEQ_CST);
+
+        printf("Reloading routing table from %s\n", sr->rtable);
+        if(sr_rt_reload(sr) != 0)
+        {
+            fprintf(stderr,"Error reloading routing table from %s, "
+                    "keeping the current one\n", sr->rtable);
+            continue;
+        }
+
+        pthread_mutex_lock(&(sr->rt_lock));
+        sr_fib_print_stats(sr->fib);
+        if(sr_verify_routing_table(sr) != 0)
+        { fprintf(stderr,"Routing table not consistent with hardware\n"); }
+        pthread_mutex_unlock(&(sr->rt_lock));
+    }
+    while(__atomic_sub_fetch(&(sr->reloads), n, __ATOMIC_SEQ_CST) != 0);
+
+    return 0;
+} /* -- sr_rt_reload_worker -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_signals(..) / sr_rt_signal(..)
+ * Scope:  Global
+ *
+ * The signals the router takes itself: SIGHUP reloads the routing table
+ * file and, if the ARP cache is kept in a file, SIGTERM and SIGINT save
+ * it and exit.  They must be blocked in every thread; whoever waits for
+ * them hands each one to sr_rt_signal().  For the event loop a reload
+ * runs on a thread of its own, so forwarding goes on meanwhile.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_signals(const struct sr_instance* sr, sigset_t* sigs)
+{
+    sigemptyset(sigs);
+    sigaddset(sigs, SIGHUP);
+    if(sr->arp_file)
+    {
+        sigaddset(sigs, SIGTERM);
+        sigaddset(sigs, SIGINT);
+    }
+} /* -- sr_rt_signals -- */
+
+void sr_rt_signal(struct sr_instance* sr, int sig)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if(sig != SIGHUP)
+    {
+        sr_save_arpcache(sr);
+        exit(0);
+    }
+    if(sr->rtable == 0)
+    { return; }
+
+    /* -- a worker already running picks this one up when it is done -- */
+    if(__atomic_fetch_add(&(sr->reloads), 1, __ATOMIC_SEQ_CST) != 0)
+    { return; }
+
+    /* -- the reload thread can afford to wait, the event loop cannot -- */
+    if(sr->event_loop == 0)
+    {
+        sr_rt_reload_worker(sr);
+        return;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(pthread_create(&thread, &attr, sr_rt_reload_worker, sr) != 0)
+    {
+        fprintf(stderr, "Error starting a thread to reload %s\n", sr->rtable);
+        __atomic_store_n(&(sr->reloads), 0, __ATOMIC_SEQ_CST);
+    }
+    pthread_attr_destroy(&attr);
+} /* -- sr_rt_signal -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_reload_thread(..)
+ * Scope:  Global
+ *
+ * Wait for the signals of sr_rt_signals() and act on them, unless the
+ * event loop does.
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_rt_reload_thread(void* sr_ptr)
+{
+    struct sr_instance* sr = (struct sr_instance*)sr_ptr;
+    sigset_t sigs;
+    int sig;
+
+    sr_rt_signals(sr, &sigs);
+
+    while(1)
+    {
+        if(sigwait(&sigs, &sig) == 0)
+        { sr_rt_signal(sr, sig); }
+    }
+
+    return 0;
+} /* -- sr_rt_reload_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_new(..)
+ * Scope:  Local
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_rt* sr_rt_new(struct in_addr dest, struct in_addr gw,
+                               struct in_addr mask, const char* if_name,
+                               struct sr_slab* slab)
+{
+    struct sr_rt* entry;
+
+    if(slab)
+    { entry = (struct sr_rt*)sr_slab_alloc(slab); }
+    else
+    { entry = (struct sr_rt*)malloc(sizeof(struct sr_rt)); }
+    assert(entry);
+    entry->slab = slab;
+    entry->next = 0;
+    entry->prev = 0;
+    entry->nhops = 1;
+    entry->hops = 0;
+    entry->dest = dest;
+    entry->gw   = gw;
+    entry->mask = mask;
+    strncpy(entry->interface,if_name,sr_IFACE_NAMELEN);
+    entry->ifindex = SR_IF_NONE;
+
+    return entry;
+} /* -- sr_rt_new -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_free(..) / sr_rt_free_list(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_free(struct sr_rt* entry)
+{
+    if(entry == 0)
+    { return; }
+
+    free(entry->hops);
+    if(entry->slab)
+    { sr_slab_put(entry->slab); }
+    else
+    { free(entry); }
+} /* -- sr_rt_free -- */
+
+void sr_rt_free_list(struct sr_rt* rt_list)
+{
+    struct sr_rt* next;
+
+    for(; rt_list; rt_list = next)
+    {
+        next = rt_list->next;
+        sr_rt_free(rt_list);
+    }
+} /* -- sr_rt_free_list -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_add_hop(..)
+ * Scope:  Global
+ *
+ * Add a next hop to an entry that is not published yet, turning it into
+ * a multipath route.  The hops get equal weights until sr_rt_bind().
+ * Returns 0, or -1 if the entry already has this next hop or
+ * SR_RT_MAXHOPS of them.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_add_hop(struct sr_rt* entry, struct in_addr gw, const char* if_name)
+{
+    struct sr_rt_hop* hops;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(entry);
+    assert(if_name);
+
+    if(entry->hops == 0 && entry->gw.s_addr == gw.s_addr &&
+       strncmp(entry->interface, if_name, sr_IFACE_NAMELEN) == 0)
+    { return -1; }
+    for(i = 0; entry->hops && i < entry->nhops; i++)
+    {
+        if(entry->hops[i].gw.s_addr == gw.s_addr &&
+           strncmp(entry->hops[i].interface, if_name, sr_IFACE_NAMELEN) == 0)
+        { return -1; }
+    }
+    if(entry->nhops >= SR_RT_MAXHOPS)
+    { return -1; }
+
+    hops = (struct sr_rt_hop*)realloc(entry->hops, (entry->nhops + 1) *
+                                      sizeof(struct sr_rt_hop));
+    assert(hops);
+    if(entry->hops == 0)
+    {
+        hops[0].gw = entry->gw;
+        memcpy(hops[0].interface, entry->interface, sr_IFACE_NAMELEN);
+        hops[0].ifindex = entry->ifindex;
+        hops[0].bound = 1;
+    }
+
+    hops[entry->nhops].gw = gw;
+    strncpy(hops[entry->nhops].interface, if_name, sr_IFACE_NAMELEN);
+    hops[entry->nhops].ifindex = SR_IF_NONE;
+    hops[entry->nhops].bound = entry->nhops + 1;
+    entry->hops = hops;
+    entry->nhops++;
+
+    return 0;
+} /* -- sr_rt_add_hop -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_bind_entry(..) / sr_rt_bind(..)
+ * Scope:  Local / Global
+ *
+ * Resolve the routes in rt_list and the next hops of the multipath ones
+ * to interface indices, and weight the next hops by interface speed.  If
+ * any of a route's interfaces has no known speed its next hops are
+ * weighted equally.
+ *
+ * rt_list must not be published yet, or the caller must be the
+ * forwarding thread holding rt_lock: bounds are changed in place.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_rt_bind_entry(struct sr_instance* sr, struct sr_rt* rt)
+{
+    struct sr_if* iface = sr_get_interface(sr, rt->interface);
+    uint32_t total = 0;
+    int weighted = 1;
+    unsigned int i;
+
+    rt->ifindex = iface ? iface->index : SR_IF_NONE;
+    if(rt->hops == 0)
+    { return; }
+
+    for(i = 0; i < rt->nhops; i++)
+    {
+        iface = sr_get_interface(sr, rt->hops[i].interface);
+        rt->hops[i].ifindex = iface ? iface->index : SR_IF_NONE;
+        if(iface == 0 || iface->speed == 0)
+        { weighted = 0; }
+    }
+
+    /* -- capped so the total of SR_RT_MAXHOPS weights cannot wrap -- */
+    for(i = 0; i < rt->nhops; i++)
+    {
+        if(weighted)
+        {
+            uint32_t speed =
+                sr_get_interface_index(sr, rt->hops[i].ifindex)->speed;
+            total += speed < (1U << 24) ? speed : (1U << 24);
+        }
+        else
+        { total++; }
+        rt->hops[i].bound = total;
+    }
+} /* -- sr_rt_bind_entry -- */
+
+void sr_rt_bind(struct sr_instance* sr, struct sr_rt* rt_list)
+{
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    for(; rt_list; rt_list = rt_list->next)
+    { sr_rt_bind_entry(sr, rt_list); }
+} /* -- sr_rt_bind -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_select(..)
+ * Scope:  Global
+ *
+ * Pick the next hop of a multipath route for a flow hash, in proportion
+ * to the hop weights.  Returns 0 for a single path route, whose next hop
+ * is rt->gw on rt->interface.
+ *
+ *---------------------------------------------------------------------*/
+
+const struct sr_rt_hop* sr_rt_select(const struct sr_rt* rt, uint32_t flow)
+{
+    const struct sr_rt_hop* hop;
+    uint32_t pick;
+
+    if(rt->hops == 0)
+    { return 0; }
+
+    pick = flow % rt->hops[rt->nhops - 1].bound;
+    for(hop = rt->hops; pick >= hop->bound; hop++)
+        ;
+
+    return hop;
+} /* -- sr_rt_select -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_link(..) / sr_rt_unlink(..)
+ * Scope:  Local
+ *
+ * O(1) insertion at the head of / removal from a routing table list.
+ * For sr->routing_table the caller holds rt_lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_rt_link(struct sr_rt** rt_list, struct sr_rt* entry)
+{
+    entry->prev = 0;
+    entry->next = *rt_list;
+    if(entry->next)
+    { entry->next->prev = entry; }
+    *rt_list = entry;
+} /* -- sr_rt_link -- */
+
+static void sr_rt_unlink(struct sr_rt** rt_list, struct sr_rt* entry)
+{
+    if(entry->prev)
+    { entry->prev->next = entry->next; }
+    else
+    { *rt_list = entry->next; }
+    if(entry->next)
+    { entry->next->prev = entry->prev; }
+    entry->next = entry->prev = 0;
+} /* -- sr_rt_unlink -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_index(..)
+ * Scope:  Local
+ *
+ * Index a freshly added routing table entry in a FIB.  An older entry for
+ * the same prefix is merged into it as a multipath route, the older next
+ * hops first, and dropped from rt_list to keep the list and the FIB
+ * holding the same routes.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_rt_index(struct sr_fib* fib, struct sr_rt** rt_list,
+                        struct sr_rt* entry)
+{
+    struct sr_rt* old = 0;
+
+    if(sr_fib_insert(fib, entry, &old) != 0)
+    {
+        fprintf(stderr, "Route to %s has a non-contiguous mask, ",
+                inet_ntoa(entry->dest));
+        fprintf(stderr, "not used for forwarding\n");
+        return;
+    }
+
+    if(old)
+    {
+        struct in_addr gw = entry->gw;
+        char iface[sr_IFACE_NAMELEN];
+
+        memcpy(iface, entry->interface, sr_IFACE_NAMELEN);
+        entry->gw = old->gw;
+        memcpy(entry->interface, old->interface, sr_IFACE_NAMELEN);
+        entry->ifindex = old->ifindex;
+        entry->nhops = old->nhops;
+        entry->hops = old->hops;
+        old->hops = 0;
+
+        if(sr_rt_add_hop(entry, gw, iface) != 0)
+        {
+            fprintf(stderr, "Route to %s: ", inet_ntoa(entry->dest));
+            fprintf(stderr, "next hop %s on %s is a duplicate or one too "
+                    "many, ignored\n", inet_ntoa(gw), iface);
+        }
+        sr_rt_unlink(rt_list, old);
+        sr_rt_free(old);
+    }
+} /* -- sr_rt_index -- */
+
 /*---------------------------------------------------------------------
  * Method:
  *
@@ -93,43 +933,101 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
 void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
 struct in_addr gw, struct in_addr mask,char* if_name)
 {
-    struct sr_rt* rt_walker = 0;
+    struct sr_rt* entry = 0;
 
     /* -- REQUIRES -- */
     assert(if_name);
     assert(sr);
 
-    /* -- empty list special case -- */
-    if(sr->routing_table == 0)
-    {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+    if(sr->fib == 0)
+    { sr->fib = sr_fib_create(sr->fib_mode); }
 
-        return;
+    /* -- prepend in O(1); lookups do not depend on the list order -- */
+    entry = sr_rt_new(dest, gw, mask, if_name, 0);
+    sr_rt_link(&(sr->routing_table), entry);
+    sr_rt_index(sr->fib, &(sr->routing_table), entry);
+    sr_rt_bind_entry(sr, entry);
+
+} /* -- sr_add_entry -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_prefix_len(..)
+ * Scope:  Global
+ *
+ * Number of leading one bits in a netmask, or -1 if the mask is not
+ * contiguous.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_prefix_len(struct in_addr netmask)
+{
+    uint32_t mask = ntohl(netmask.s_addr);
+    int len = __builtin_popcount(mask);
+
+    /* -- contiguous iff the len one bits are all at the top -- */
+    if(len < 32 && (mask << len) != 0)
+    { return -1; }
+
+    return len;
+} /* -- sr_rt_prefix_len -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_verify_routing_table(..)
+ * Scope:  Global
+ *
+ * make sure the routing table is consistent with the interface list by
+ * verifying that all interfaces used in the routing table actually exist
+ * in the hardware.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  something other than zero on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_if* if_walker = 0;
+    unsigned int i;
+    int ret = 0;
+
+    /* -- REQUIRES --*/
+    assert(sr);
+
+    /* -- callers hold sr->rt_lock once the reload thread is running -- */
+    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    {
+        return 999; /* doh! */
     }
 
-    /* -- find the end of the list -- */
     rt_walker = sr->routing_table;
-    while(rt_walker->next){
-      rt_walker = rt_walker->next; 
-    }
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+    while(rt_walker)
+    {
+        /* -- check to see if the interface of every next hop exists -- */
+        for(i = 0; i < rt_walker->nhops; i++)
+        {
+            const char* name = rt_walker->hops ?
+                rt_walker->hops[i].interface : rt_walker->interface;
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+            if_walker = sr->if_list;
+            while(if_walker)
+            {
+                if( strncmp(if_walker->name,name,sr_IFACE_NAMELEN) == 0)
+                { break; }
+                if_walker = if_walker->next;
+            }
+            if(if_walker == 0)
+            { ret++; } /* -- interface not found! -- */
+        }
 
-} /* -- sr_add_entry -- */
+        rt_walker = rt_walker->next;
+    } /* -- while -- */
+
+    return ret;
+} /* -- sr_verify_routing_table -- */
 
 /*---------------------------------------------------------------------
  * Method:
@@ -166,13 +1064,19 @@ void sr_print_routing_table(struct sr_instance* sr)
 
 void sr_print_routing_entry(struct sr_rt* entry)
 {
+    unsigned int i;
+
     /* -- REQUIRES --*/
     assert(entry);
     assert(entry->interface);
 
-    printf("%s\t\t",inet_ntoa(entry->dest));
-    printf("%s\t",inet_ntoa(entry->gw));
-    printf("%s\t",inet_ntoa(entry->mask));
-    printf("%s\n",entry->interface);
+    /* -- a multipath route prints one line per next hop, like the file -- */
+    for(i = 0; i < entry->nhops; i++)
+    {
+        printf("%s\t\t",inet_ntoa(entry->dest));
+        printf("%s\t",inet_ntoa(entry->hops ? entry->hops[i].gw : entry->gw));
+        printf("%s\t",inet_ntoa(entry->mask));
+        printf("%s\n",entry->hops ? entry->hops[i].interface : entry->interface);
+    }
 
 } /* -- sr_print_routing_entry -- */
@@ -17,29 +17,98 @@
 #endif
 
 #include <netinet/in.h>
+#include <signal.h>
 
 #include "sr_if.h"
 
+#define SR_RT_MAXHOPS 16              /* next hops of one multipath route */
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_hop
+ *
+ * One of the equal cost next hops of a multipath route.  ifindex and
+ * bound are filled in by sr_rt_bind(); bound is the running total of the
+ * hop weights up to and including this hop.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_rt_hop
+{
+    struct in_addr gw;
+    char   interface[sr_IFACE_NAMELEN];
+    unsigned int ifindex;             /* SR_IF_NONE until bound */
+    uint32_t bound;
+};
+
 /* ----------------------------------------------------------------------------
  * struct sr_rt
  *
- * Node in the routing table 
+ * Node in the routing table.  A prefix listed more than once in the
+ * routing table file is a multipath route: hops then holds all nhops next
+ * hops in file order, and gw/interface are a copy of the first one.
+ * interface names the outgoing interface as configured; the forwarding
+ * path uses ifindex, bound to it by sr_rt_bind() once the interfaces are
+ * known.  Entries of a loaded table come from one slab, see sr_slab.h.
  *
  * -------------------------------------------------------------------------- */
 
+struct sr_slab;
+
 struct sr_rt
 {
     struct in_addr dest;
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    unsigned int ifindex;             /* SR_IF_NONE until bound */
     struct sr_rt* next;
+    struct sr_rt* prev;
+    unsigned int nhops;
+    struct sr_rt_hop* hops;           /* 0 unless nhops > 1 */
+    struct sr_slab* slab;             /* 0 if the entry was malloc'd */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_update
+ *
+ * One incremental change for sr_rt_apply().  SR_RT_ADD requires that no
+ * route for dest/mask exists, SR_RT_DEL and SR_RT_REPLACE that one does;
+ * gw and interface are unused by SR_RT_DEL.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_RT_ADD     0
+#define SR_RT_DEL     1
+#define SR_RT_REPLACE 2
+
+struct sr_rt_update
+{
+    int op;
+    struct in_addr dest;
+    struct in_addr gw;
+    struct in_addr mask;
+    char   interface[sr_IFACE_NAMELEN];
 };
 
 
+struct sr_fib;
+
 int sr_load_rt(struct sr_instance*,const char*);
+int sr_rt_reload(struct sr_instance*);
+void sr_rt_publish(struct sr_instance*, struct sr_rt*, struct sr_fib*);
+unsigned int sr_rt_apply(struct sr_instance*, const struct sr_rt_update*,
+                         unsigned int);
+void sr_rt_signals(const struct sr_instance*, sigset_t*);
+void sr_rt_signal(struct sr_instance*, int sig);
+void* sr_rt_reload_thread(void*);
+void sr_rt_free(struct sr_rt*);
+void sr_rt_free_list(struct sr_rt*);
+int sr_rt_add_hop(struct sr_rt*, struct in_addr gw, const char* if_name);
+void sr_rt_bind(struct sr_instance*, struct sr_rt*);
+const struct sr_rt_hop* sr_rt_select(const struct sr_rt*, uint32_t flow);
 void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
+int sr_rt_prefix_len(struct in_addr mask);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 
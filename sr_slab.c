@@ -0,0 +1,114 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_slab.c
+ *
+ * Description:
+ *
+ * Chunked object slabs.  Objects are never recycled inside a slab: a load
+ * sizes it from the number of routes it is about to create, so the first
+ * chunk normally holds everything, and objects freed later only count the
+ * slab down.  Chunks are calloc'd, so pages no object ever reached cost
+ * address space only.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "sr_slab.h"
+
+#define SR_SLAB_ALIGN 16
+
+struct sr_slab_chunk
+{
+    struct sr_slab_chunk* next;
+    unsigned char pad[SR_SLAB_ALIGN - sizeof(struct sr_slab_chunk*)];
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_slab_create(..)
+ * Scope:  Global
+ *
+ * A slab of objects of size bytes, allocated count at a time.  The slab
+ * holds a reference of its own until sr_slab_seal(), so it survives
+ * every object being put back while the load is still allocating.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_slab* sr_slab_create(size_t size, unsigned int count)
+{
+    struct sr_slab* slab;
+
+    /* -- REQUIRES -- */
+    assert(size > 0);
+
+    slab = (struct sr_slab*)calloc(1, sizeof(struct sr_slab));
+    assert(slab);
+    slab->size = (size + SR_SLAB_ALIGN - 1) & ~(size_t)(SR_SLAB_ALIGN - 1);
+    slab->count = count ? count : 1;
+    slab->used = slab->count;         /* -- first alloc adds a chunk -- */
+    slab->refs = 1;
+
+    return slab;
+} /* -- sr_slab_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_slab_alloc(..)
+ * Scope:  Global
+ *
+ * A zeroed object holding a reference on slab.  Only the thread loading
+ * the table allocates, and only before sr_slab_seal().
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_slab_alloc(struct sr_slab* slab)
+{
+    unsigned char* obj;
+
+    if(slab->used == slab->count)
+    {
+        struct sr_slab_chunk* chunk;
+
+        chunk = (struct sr_slab_chunk*)calloc(1, sizeof(struct sr_slab_chunk) +
+                                              slab->count * slab->size);
+        assert(chunk);
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        slab->used = 0;
+    }
+
+    obj = (unsigned char*)(slab->chunks + 1) + slab->used++ * slab->size;
+    __atomic_add_fetch(&(slab->refs), 1, __ATOMIC_RELAXED);
+
+    return obj;
+} /* -- sr_slab_alloc -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_slab_seal(..) / sr_slab_put(..)
+ * Scope:  Global
+ *
+ * sr_slab_seal() ends the load and drops the slab's own reference;
+ * sr_slab_put() gives one object back.  Whichever drops the last
+ * reference frees every chunk.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_slab_seal(struct sr_slab* slab)
+{
+    if(slab)
+    { sr_slab_put(slab); }
+} /* -- sr_slab_seal -- */
+
+void sr_slab_put(struct sr_slab* slab)
+{
+    struct sr_slab_chunk* next;
+
+    if(__atomic_sub_fetch(&(slab->refs), 1, __ATOMIC_ACQ_REL) != 0)
+    { return; }
+
+    for(; slab->chunks; slab->chunks = next)
+    {
+        next = slab->chunks->next;
+        free(slab->chunks);
+    }
+    free(slab);
+} /* -- sr_slab_put -- */
@@ -0,0 +1,35 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_slab.h
+ *
+ * Description:
+ *
+ * Bulk allocation of equally sized objects for table loads.  A slab hands
+ * out zeroed objects from large chunks instead of one malloc each; every
+ * object holds a reference on its slab and is given back with
+ * sr_slab_put(), in any order and from any thread.  The memory is freed
+ * when the last object is put back after the slab has been sealed.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_SLAB_H
+#define sr_SLAB_H
+
+#include <stddef.h>
+
+struct sr_slab_chunk;
+
+struct sr_slab
+{
+    size_t size;                      /* bytes per object, aligned */
+    unsigned int count;               /* objects per chunk */
+    unsigned int used;                /* objects taken from the newest chunk */
+    unsigned long refs;               /* live objects, +1 until sealed */
+    struct sr_slab_chunk* chunks;
+};
+
+struct sr_slab* sr_slab_create(size_t size, unsigned int count);
+void* sr_slab_alloc(struct sr_slab*);
+void sr_slab_seal(struct sr_slab*);
+void sr_slab_put(struct sr_slab*);
+
+#endif  /* --  sr_SLAB_H -- */
@@ -0,0 +1,899 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snapshot.c
+ *
+ * Description:
+ *
+ * Writing and mapping routing table snapshots.  Loading a snapshot builds
+ * the sr_rt list from the route records and hands the mapped trie and,
+ * for a DIR-24-8 FIB, the mapped tables to the FIB as they are.  The
+ * first incremental update copies the trie to the heap.
+ *
+ * A snapshot is only used if the rtable and MRT files it was compiled
+ * from are unchanged, and only kept once the interfaces in the server's
+ * hwinfo turn out to be the ones it was compiled with.  Otherwise the
+ * routing table is loaded from text as usual.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_snapshot.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_if.h"
+#include "sr_fib.h"
+#include "sr_dir248.h"
+#include "sr_slab.h"
+
+#define SR_SNAPSHOT_CHUNK 65536       /* table entries written at a time */
+
+/* -- slot of the table mapping entries to their first route record -- */
+struct sr_snapshot_ref
+{
+    const struct sr_rt* rt;
+    uint32_t index;                   /* of the route record */
+};
+
+static double sr_snapshot_ms(const struct timeval* start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, 0);
+    return ((now.tv_sec - start->tv_sec) * 1000000 +
+            (now.tv_usec - start->tv_usec)) / 1000.0;
+}
+
+/* -- Fletcher style sum over 32 bit words -- */
+void sr_snapshot_sum(const void* buf, size_t len, uint32_t* a,
+                            uint32_t* b)
+{
+    const uint32_t* w = (const uint32_t*)buf;
+    uint32_t sa = *a, sb = *b;
+    size_t i;
+
+    for(i = 0; i < len / 4; i++)
+    {
+        sa += w[i];
+        sb += sa;
+    }
+    *a = sa;
+    *b = sb;
+}
+
+/* -- size and mtime of a source file, 0 if there is none -- */
+static void sr_snapshot_stamp(const char* file, uint32_t* size,
+                              uint32_t* mtime)
+{
+    struct stat st;
+
+    *size = *mtime = 0;
+    if(file && stat(file, &st) == 0)
+    {
+        *size = (uint32_t)st.st_size;
+        *mtime = (uint32_t)st.st_mtime;
+    }
+}
+
+static size_t sr_snapshot_align(size_t off)
+{
+    return (off + SR_SNAPSHOT_ALIGN - 1) & ~(size_t)(SR_SNAPSHOT_ALIGN - 1);
+}
+
+/* -- offsets of the trie nodes, the end of the natives and the tables -- */
+static size_t sr_snapshot_trie(const struct sr_snapshot_hdr* hdr)
+{
+    return sr_snapshot_align(sizeof(struct sr_snapshot_hdr) +
+                 (size_t)hdr->nifs * sizeof(struct sr_snapshot_if) +
+                 (size_t)hdr->nroutes * sizeof(struct sr_snapshot_rt));
+}
+
+static size_t sr_snapshot_trie_end(const struct sr_snapshot_hdr* hdr)
+{
+    return sr_snapshot_trie(hdr) +
+           (size_t)hdr->nodes * sizeof(struct sr_fib_inode) +
+           (size_t)hdr->natives * SR_FIB_NATIVE * sizeof(uint32_t);
+}
+
+static size_t sr_snapshot_tables(const struct sr_snapshot_hdr* hdr)
+{
+    return sr_snapshot_align(sr_snapshot_trie_end(hdr));
+}
+
+static int sr_snapshot_cmp(const void* a, const void* b)
+{
+    const struct sr_rt* x = *(const struct sr_rt* const*)a;
+    const struct sr_rt* y = *(const struct sr_rt* const*)b;
+    uint32_t dx = ntohl(x->dest.s_addr), dy = ntohl(y->dest.s_addr);
+    uint32_t mx = ntohl(x->mask.s_addr), my = ntohl(y->mask.s_addr);
+
+    if(dx != dy)
+    { return dx < dy ? -1 : 1; }
+    return mx < my ? -1 : (mx > my);
+}
+
+static size_t sr_snapshot_hash(const struct sr_rt* rt)
+{
+    unsigned long x = (unsigned long)rt >> 4;
+
+    x ^= x >> 16;
+    x *= 0x45d9f3bUL;
+    x ^= x >> 16;
+    return (size_t)x;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_index(..)
+ * Scope:  Local
+ *
+ * 1 + the index of the first route record of entry rt, looked up in the
+ * open addressing table refs of mask + 1 slots; 0 if rt is 0.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint32_t sr_snapshot_index(const struct sr_snapshot_ref* refs,
+                                  size_t mask, const struct sr_rt* rt)
+{
+    size_t h;
+
+    if(rt == 0)
+    { return 0; }
+
+    for(h = sr_snapshot_hash(rt) & mask; refs[h].rt != rt; h = (h + 1) & mask)
+    { assert(refs[h].rt); }
+
+    return refs[h].index + 1;
+} /* -- sr_snapshot_index -- */
+
+static const char* sr_snapshot_hop_if(const struct sr_rt* rt, unsigned int i)
+{
+    return rt->hops ? rt->hops[i].interface : rt->interface;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_ifindex(..)
+ * Scope:  Local
+ *
+ * Index of the interface record for name, starting the search at last,
+ * appending a record with just the name if there is none.
+ *
+ *---------------------------------------------------------------------*/
+
+static unsigned int sr_snapshot_ifindex(struct sr_snapshot_if* ifs,
+                                        uint32_t* nifs, unsigned int last,
+                                        const char* name)
+{
+    unsigned int i;
+
+    if(last < *nifs && strncmp(ifs[last].name, name, sr_IFACE_NAMELEN) == 0)
+    { return last; }
+
+    for(i = 0; i < *nifs; i++)
+    {
+        if(strncmp(ifs[i].name, name, sr_IFACE_NAMELEN) == 0)
+        { return i; }
+    }
+
+    memcpy(ifs[i].name, name, sr_IFACE_NAMELEN);
+    (*nifs)++;
+
+    return i;
+} /* -- sr_snapshot_ifindex -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_put(..)
+ * Scope:  Local
+ *
+ * Append len bytes, a multiple of 4, to the snapshot being written and
+ * to its checksum.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_snapshot_put(FILE* fp, struct sr_snapshot_hdr* hdr,
+                           const void* buf, size_t len)
+{
+    sr_snapshot_sum(buf, len, &(hdr->sum_a), &(hdr->sum_b));
+    return fwrite(buf, 1, len, fp) == len ? 0 : -1;
+} /* -- sr_snapshot_put -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_put_table(..)
+ * Scope:  Local
+ *
+ * Append n DIR-24-8 table entries, renumbered from the FIB's route order
+ * to the order of the route records.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_snapshot_put_table(FILE* fp, struct sr_snapshot_hdr* hdr,
+                                 const uint32_t* tbl, size_t n,
+                                 const uint32_t* renumber)
+{
+    uint32_t* buf;
+    size_t i, j, len;
+    int err = 0;
+
+    buf = (uint32_t*)malloc(SR_SNAPSHOT_CHUNK * sizeof(uint32_t));
+    assert(buf);
+
+    for(i = 0; i < n && err == 0; i += len)
+    {
+        len = n - i < SR_SNAPSHOT_CHUNK ? n - i : SR_SNAPSHOT_CHUNK;
+        for(j = 0; j < len; j++)
+        {
+            uint32_t entry = tbl[i + j];
+
+            if(entry != 0 && (entry & SR_DIR248_LONG) == 0)
+            { entry = renumber[entry - 1] + 1; }
+            buf[j] = entry;
+        }
+        err = sr_snapshot_put(fp, hdr, buf, len * sizeof(uint32_t));
+    }
+
+    free(buf);
+
+    return err;
+} /* -- sr_snapshot_put_table -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_put_trie(..)
+ * Scope:  Local
+ *
+ * Append the trie of fib in index form: the nodes breadth first, so
+ * every child follows its parent, then their native arrays in the same
+ * order.  Sets the node and native counts in hdr.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_snapshot_put_trie(FILE* fp, struct sr_snapshot_hdr* hdr,
+                                const struct sr_fib* fib,
+                                const struct sr_snapshot_ref* refs,
+                                size_t mask)
+{
+    const struct sr_fib_node** queue;
+    struct sr_fib_inode node;
+    uint32_t native[SR_FIB_NATIVE];
+    unsigned int head, tail = 1, max = 1024, natives = 0, i;
+    int err = 0;
+
+    queue = (const struct sr_fib_node**)malloc(max *
+                                               sizeof(struct sr_fib_node*));
+    assert(queue);
+    queue[0] = fib->root;
+
+    for(head = 0; head < tail && err == 0; head++)
+    {
+        const struct sr_fib_node* n = queue[head];
+
+        memset(&node, 0, sizeof(node));
+        node.key = n->key;
+        node.mask = n->mask;
+        node.pos = n->pos;
+        node.native = n->native ? ++natives : 0;
+        for(i = 0; i < SR_FIB_FANOUT; i++)
+        {
+            node.e[i].rt = sr_snapshot_index(refs, mask, n->e[i].rt);
+            if(n->e[i].child == 0)
+            { continue; }
+
+            if(tail == max)
+            {
+                max *= 2;
+                queue = (const struct sr_fib_node**)realloc(queue,
+                            max * sizeof(struct sr_fib_node*));
+                assert(queue);
+            }
+            queue[tail] = n->e[i].child;
+            node.e[i].child = tail++;
+        }
+        err = sr_snapshot_put(fp, hdr, &node, sizeof(node));
+    }
+
+    for(head = 0; head < tail && err == 0; head++)
+    {
+        if(queue[head]->native == 0)
+        { continue; }
+        for(i = 0; i < SR_FIB_NATIVE; i++)
+        { native[i] = sr_snapshot_index(refs, mask, queue[head]->native[i]); }
+        err = sr_snapshot_put(fp, hdr, native, sizeof(native));
+    }
+
+    hdr->nodes = tail;
+    hdr->natives = natives;
+    free(queue);
+
+    return err;
+} /* -- sr_snapshot_put_trie -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_write(..)
+ * Scope:  Global
+ *
+ * Compile the current routing table into a snapshot.  The file is written
+ * next to its final name and renamed into place, so a crash never leaves
+ * a half written snapshot behind.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_snapshot_write(struct sr_instance* sr, const char* file)
+{
+    struct sr_snapshot_hdr hdr;
+    struct sr_snapshot_if* ifs = 0;
+    struct sr_snapshot_rt rec;
+    struct sr_snapshot_ref* refs = 0;
+    const struct sr_rt** sorted = 0;
+    uint32_t* renumber = 0;
+    const struct sr_dir248* dir;
+    struct sr_fib* trie;
+    const struct sr_rt* rt;
+    const struct sr_if* iface;
+    struct timeval start;
+    char tmp[1024];
+    FILE* fp;
+    unsigned int n = 0, nifs = 0, i, j, last = 0;
+    static const uint32_t zero[SR_SNAPSHOT_ALIGN / 4];
+    size_t off, mask;
+    int err = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(file);
+
+    gettimeofday(&start, 0);
+
+    if(strlen(file) + 5 > sizeof(tmp))
+    {
+        fprintf(stderr, "Snapshot file name %s is too long\n", file);
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", file);
+
+    if((fp = fopen(tmp, "wb")) == 0)
+    {
+        perror(tmp);
+        return -1;
+    }
+
+    pthread_mutex_lock(&(sr->rt_lock));
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SR_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SR_SNAPSHOT_VERSION;
+    sr_snapshot_stamp(sr->rtable, &hdr.rtable_size, &hdr.rtable_mtime);
+    sr_snapshot_stamp(sr->mrt, &hdr.mrt_size, &hdr.mrt_mtime);
+
+    for(rt = sr->routing_table; rt; rt = rt->next)
+    {
+        n++;
+        hdr.nroutes += rt->nhops;
+    }
+    for(iface = sr->if_list; iface; iface = iface->next)
+    { nifs++; }
+
+    /* -- interfaces from hwinfo if it came, otherwise just the names
+     *    the routes use -- */
+    ifs = (struct sr_snapshot_if*)calloc(nifs + hdr.nroutes + 1,
+                                         sizeof(struct sr_snapshot_if));
+    sorted = (const struct sr_rt**)malloc((n + 1) * sizeof(struct sr_rt*));
+    assert(ifs && sorted);
+
+    for(iface = sr->if_list, i = 0; iface; iface = iface->next, i++)
+    {
+        memcpy(ifs[i].name, iface->name, sr_IFACE_NAMELEN);
+        ifs[i].ip = iface->ip;
+        memcpy(ifs[i].addr, iface->addr, ETHER_ADDR_LEN);
+    }
+    if(nifs)
+    { hdr.flags |= SR_SNAPSHOT_BOUND; }
+
+    for(rt = sr->routing_table, i = 0; rt; rt = rt->next)
+    { sorted[i++] = rt; }
+    qsort(sorted, n, sizeof(struct sr_rt*), sr_snapshot_cmp);
+
+    hdr.nifs = nifs;
+    for(i = 0; i < n; i++)
+    {
+        for(j = 0; j < sorted[i]->nhops; j++)
+        {
+            last = sr_snapshot_ifindex(ifs, &hdr.nifs, last,
+                                       sr_snapshot_hop_if(sorted[i], j));
+        }
+    }
+
+    /* -- the trie and the tables point at entries, the records are in
+     *    destination order -- */
+    mask = 1;
+    while(mask < 2 * (size_t)n)
+    { mask <<= 1; }
+    refs = (struct sr_snapshot_ref*)calloc(mask,
+                                           sizeof(struct sr_snapshot_ref));
+    assert(refs);
+    mask--;
+    for(i = 0, j = 0; i < n; j += sorted[i]->nhops, i++)
+    {
+        size_t h = sr_snapshot_hash(sorted[i]) & mask;
+
+        while(refs[h].rt)
+        { h = (h + 1) & mask; }
+        refs[h].rt = sorted[i];
+        refs[h].index = j;
+    }
+
+    /* -- a mapped trie is written from a heap copy -- */
+    trie = sr->fib ? sr_fib_clone(sr->fib) : sr_fib_create(SR_FIB_TRIE);
+    hdr.routes = trie->routes;
+    hdr.default_rt = sr_snapshot_index(refs, mask, trie->default_rt);
+
+    dir = sr->fib ? sr->fib->dir : 0;
+    if(dir)
+    {
+        renumber = (uint32_t*)malloc((dir->nrts + 1) * sizeof(uint32_t));
+        assert(renumber);
+        for(i = 0; i < dir->nrts; i++)
+        { renumber[i] = sr_snapshot_index(refs, mask, dir->rts[i]) - 1; }
+
+        hdr.flags |= SR_SNAPSHOT_DIR248;
+        hdr.blocks = dir->blocks;
+    }
+
+    /* -- the header is rewritten with the checksum at the end -- */
+    err |= fwrite(&hdr, 1, sizeof(hdr), fp) != sizeof(hdr);
+    err |= sr_snapshot_put(fp, &hdr, ifs,
+                           hdr.nifs * sizeof(struct sr_snapshot_if));
+
+    /* -- a multipath route is one record per next hop, in order -- */
+    for(i = 0, last = 0; i < n && err == 0; i++)
+    {
+        for(j = 0; j < sorted[i]->nhops; j++)
+        {
+            last = sr_snapshot_ifindex(ifs, &hdr.nifs, last,
+                                       sr_snapshot_hop_if(sorted[i], j));
+            rec.dest = sorted[i]->dest.s_addr;
+            rec.gw = sorted[i]->hops ? sorted[i]->hops[j].gw.s_addr :
+                                       sorted[i]->gw.s_addr;
+            rec.mask = sorted[i]->mask.s_addr;
+            rec.ifindex = last;
+            err |= sr_snapshot_put(fp, &hdr, &rec, sizeof(rec));
+        }
+    }
+
+    if(err == 0)
+    {
+        off = sizeof(hdr) + hdr.nifs * sizeof(struct sr_snapshot_if) +
+              (size_t)hdr.nroutes * sizeof(struct sr_snapshot_rt);
+        err |= sr_snapshot_put(fp, &hdr, zero, sr_snapshot_trie(&hdr) - off);
+        err |= sr_snapshot_put_trie(fp, &hdr, trie, refs, mask);
+    }
+
+    if(dir && err == 0)
+    {
+        off = sr_snapshot_trie_end(&hdr);
+        err |= sr_snapshot_put(fp, &hdr, zero, sr_snapshot_tables(&hdr) - off);
+        err |= sr_snapshot_put_table(fp, &hdr, dir->tbl24,
+                                     SR_DIR248_TBL24_SZ, renumber);
+        err |= sr_snapshot_put_table(fp, &hdr, dir->tbllong,
+                                     (size_t)dir->blocks * SR_DIR248_BLOCK_SZ,
+                                     renumber);
+    }
+
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    sr_fib_abort(trie);
+    free(ifs);
+    free(sorted);
+    free(refs);
+    free(renumber);
+
+    if(err == 0)
+    {
+        err |= fseek(fp, 0, SEEK_SET) != 0;
+        err |= fwrite(&hdr, 1, sizeof(hdr), fp) != sizeof(hdr);
+        err |= fflush(fp) != 0;
+        err |= fsync(fileno(fp)) != 0;
+    }
+    err |= fclose(fp) != 0;
+
+    if(err || rename(tmp, file) != 0)
+    {
+        perror(file);
+        unlink(tmp);
+        return -1;
+    }
+
+    printf("Wrote snapshot of %u routes to %s in %.1f ms\n", n, file,
+           sr_snapshot_ms(&start));
+
+    return 0;
+} /* -- sr_snapshot_write -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_check_trie(..)
+ * Scope:  Local
+ *
+ * Returns why the trie of a snapshot cannot be walked safely, or 0.
+ * Children must follow their parent, which also rules out loops.
+ *
+ *---------------------------------------------------------------------*/
+
+static const char* sr_snapshot_check_trie(const struct sr_snapshot_hdr* hdr)
+{
+    const struct sr_fib_inode* nodes;
+    const uint32_t* natives;
+    size_t i, n;
+    unsigned int j;
+
+    nodes = (const struct sr_fib_inode*)((const char*)hdr +
+                                         sr_snapshot_trie(hdr));
+    natives = (const uint32_t*)(nodes + hdr->nodes);
+
+    if(hdr->default_rt > hdr->nroutes)
+    { return "bad default route"; }
+
+    for(i = 0; i < hdr->nodes; i++)
+    {
+        if(nodes[i].pos > 32 - SR_FIB_STRIDE || nodes[i].native > hdr->natives)
+        { return "bad trie node"; }
+        for(j = 0; j < SR_FIB_FANOUT; j++)
+        {
+            if(nodes[i].e[j].rt > hdr->nroutes ||
+               (nodes[i].e[j].child && (nodes[i].e[j].child <= i ||
+                                        nodes[i].e[j].child >= hdr->nodes)))
+            { return "bad trie node"; }
+        }
+    }
+
+    n = (size_t)hdr->natives * SR_FIB_NATIVE;
+    for(i = 0; i < n; i++)
+    {
+        if(natives[i] > hdr->nroutes)
+        { return "bad trie route"; }
+    }
+
+    return 0;
+} /* -- sr_snapshot_check_trie -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_map_trie(..) / sr_snapshot_map_dir(..)
+ * Scope:  Local
+ *
+ * Wrap the trie of a mapped snapshot in a map the FIB takes over along
+ * with the mapping, and the tables in a DIR-24-8 FIB that borrows them
+ * and the map's rts[].  rts holds the route records' entries in order.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_fib_map* sr_snapshot_map_trie(const struct sr_snapshot_hdr* hdr,
+                                               size_t len, struct sr_rt** rts)
+{
+    struct sr_fib_map* map;
+
+    map = (struct sr_fib_map*)calloc(1, sizeof(struct sr_fib_map));
+    assert(map);
+
+    map->nodes = (const struct sr_fib_inode*)((const char*)hdr +
+                                              sr_snapshot_trie(hdr));
+    map->nnodes = hdr->nodes;
+    map->natives = (const uint32_t*)(map->nodes + hdr->nodes);
+    map->nnatives = hdr->natives;
+    map->rts = rts;
+    map->nrts = hdr->nroutes;
+    map->default_rt = hdr->default_rt ? rts[hdr->default_rt - 1] : 0;
+    map->routes = hdr->routes;
+    map->base = (void*)hdr;
+    map->len = len;
+
+    return map;
+} /* -- sr_snapshot_map_trie -- */
+
+static struct sr_dir248* sr_snapshot_map_dir(const struct sr_snapshot_hdr* hdr,
+                                             const struct sr_fib_map* map)
+{
+    struct sr_dir248* dir;
+
+    dir = (struct sr_dir248*)calloc(1, sizeof(struct sr_dir248));
+    assert(dir);
+
+    dir->tbl24 = (uint32_t*)((char*)hdr + sr_snapshot_tables(hdr));
+    dir->tbllong = dir->tbl24 + SR_DIR248_TBL24_SZ;
+    dir->blocks = dir->blocks_max = hdr->blocks;
+    dir->rts = map->rts;
+    dir->nrts = map->nrts;
+    dir->default_rt = map->default_rt;
+    dir->mapped = 1;
+
+    return dir;
+} /* -- sr_snapshot_map_dir -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_load(..)
+ * Scope:  Global
+ *
+ * Replace the routing table with the one in a snapshot.  sr->rtable and
+ * sr->mrt must name the files the snapshot is expected to be compiled
+ * from.  On error the current routing table is kept.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  -1 if the snapshot is missing, damaged or out of date
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_snapshot_load(struct sr_instance* sr, const char* file)
+{
+    const struct sr_snapshot_hdr* hdr;
+    const struct sr_snapshot_if* ifs;
+    const struct sr_snapshot_rt* recs;
+    struct sr_snapshot* snap;
+    struct sr_rt** rts;
+    struct sr_rt* rt_list = 0;
+    struct sr_rt* rt_tail = 0;
+    struct sr_fib* fib;
+    struct sr_fib_map* map;
+    struct sr_slab* slab;
+    struct timeval start;
+    struct stat st;
+    uint32_t sum_a = 0, sum_b = 0, size, mtime;
+    size_t len;
+    unsigned int i;
+    int fd, use_dir;
+    const char* why = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(file);
+
+    gettimeofday(&start, 0);
+
+    if((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) != 0)
+    {
+        perror(file);
+        if(fd >= 0)
+        { close(fd); }
+        return -1;
+    }
+    len = st.st_size;
+    if(len < sizeof(struct sr_snapshot_hdr))
+    {
+        fprintf(stderr, "Snapshot %s: not a routing table snapshot\n", file);
+        close(fd);
+        return -1;
+    }
+
+    hdr = (const struct sr_snapshot_hdr*)mmap(0, len, PROT_READ, MAP_PRIVATE,
+                                              fd, 0);
+    close(fd);
+    if(hdr == (const struct sr_snapshot_hdr*)MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    madvise((void*)hdr, len, MADV_WILLNEED);
+
+    if(memcmp(hdr->magic, SR_SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0)
+    { why = "not a routing table snapshot"; }
+    else if(hdr->version != SR_SNAPSHOT_VERSION)
+    { why = "unsupported version"; }
+    else if(hdr->nroutes > len / sizeof(struct sr_snapshot_rt) ||
+            hdr->nifs > len / sizeof(struct sr_snapshot_if) ||
+            hdr->nodes == 0 ||
+            hdr->nodes > len / sizeof(struct sr_fib_inode) ||
+            hdr->natives > len / (SR_FIB_NATIVE * sizeof(uint32_t)) ||
+            hdr->blocks > len / (SR_DIR248_BLOCK_SZ * sizeof(uint32_t)) ||
+            len != ((hdr->flags & SR_SNAPSHOT_DIR248) ?
+                    sr_snapshot_tables(hdr) + ((size_t)SR_DIR248_TBL24_SZ +
+                    (size_t)hdr->blocks * SR_DIR248_BLOCK_SZ) *
+                    sizeof(uint32_t) :
+                    sr_snapshot_trie_end(hdr)))
+    { why = "truncated"; }
+
+    if(why == 0)
+    {
+        sr_snapshot_stamp(sr->rtable, &size, &mtime);
+        if(size != hdr->rtable_size || mtime != hdr->rtable_mtime)
+        { why = "routing table file changed since it was written"; }
+        sr_snapshot_stamp(sr->mrt, &size, &mtime);
+        if(size != hdr->mrt_size || mtime != hdr->mrt_mtime)
+        { why = "MRT file changed since it was written"; }
+    }
+
+    if(why == 0)
+    {
+        sr_snapshot_sum(hdr + 1, len - sizeof(struct sr_snapshot_hdr),
+                        &sum_a, &sum_b);
+        if(sum_a != hdr->sum_a || sum_b != hdr->sum_b)
+        { why = "checksum mismatch"; }
+    }
+
+    ifs = (const struct sr_snapshot_if*)(hdr + 1);
+    recs = 0;
+    if(why == 0)
+    {
+        recs = (const struct sr_snapshot_rt*)(ifs + hdr->nifs);
+        for(i = 0; i < hdr->nroutes && why == 0; i++)
+        {
+            if(recs[i].ifindex >= hdr->nifs)
+            { why = "bad interface index"; }
+        }
+    }
+    if(why == 0)
+    { why = sr_snapshot_check_trie(hdr); }
+
+    if(why)
+    {
+        fprintf(stderr, "Snapshot %s: %s\n", file, why);
+        munmap((void*)hdr, len);
+        return -1;
+    }
+
+    /* -- only the list is built, from one slab; the trie is used mapped -- */
+    slab = sr_slab_create(sizeof(struct sr_rt), hdr->nroutes);
+    rts = (struct sr_rt**)malloc((hdr->nroutes + 1) * sizeof(struct sr_rt*));
+    assert(rts);
+
+    for(i = 0; i < hdr->nroutes; i++)
+    {
+        const char* name = ifs[recs[i].ifindex].name;
+        struct sr_rt* entry;
+
+        /* -- further next hops of a multipath route -- */
+        if(rt_tail && rt_tail->dest.s_addr == recs[i].dest &&
+           rt_tail->mask.s_addr == recs[i].mask)
+        {
+            struct in_addr gw;
+
+            gw.s_addr = recs[i].gw;
+            sr_rt_add_hop(rt_tail, gw, name);
+            rts[i] = rt_tail;
+            continue;
+        }
+
+        entry = (struct sr_rt*)sr_slab_alloc(slab);
+        entry->dest.s_addr = recs[i].dest;
+        entry->gw.s_addr = recs[i].gw;
+        entry->mask.s_addr = recs[i].mask;
+        memcpy(entry->interface, name, sr_IFACE_NAMELEN);
+        entry->interface[sr_IFACE_NAMELEN - 1] = 0;
+        entry->ifindex = SR_IF_NONE;
+        entry->nhops = 1;
+        entry->slab = slab;
+        entry->prev = rt_tail;
+        if(rt_tail)
+        { rt_tail->next = entry; }
+        else
+        { rt_list = entry; }
+        rt_tail = entry;
+        rts[i] = entry;
+    }
+    sr_slab_seal(slab);
+
+    snap = (struct sr_snapshot*)malloc(sizeof(struct sr_snapshot));
+    assert(snap);
+    snap->flags = hdr->flags;
+    snap->nifs = hdr->nifs;
+    snap->ifs = (struct sr_snapshot_if*)malloc((hdr->nifs + 1) *
+                                               sizeof(struct sr_snapshot_if));
+    assert(snap->ifs);
+    memcpy(snap->ifs, ifs, hdr->nifs * sizeof(struct sr_snapshot_if));
+
+    use_dir = sr->fib_mode == SR_FIB_DIR248 &&
+              (hdr->flags & SR_SNAPSHOT_DIR248);
+    printf("Loading routing table from snapshot %s\n", file);
+    map = sr_snapshot_map_trie(hdr, len, rts);
+    fib = sr_fib_create(sr->fib_mode);
+    sr_fib_commit_map(fib, map);
+    if(use_dir)
+    { sr_fib_commit_dir(fib, sr_snapshot_map_dir(hdr, map)); }
+    else
+    { sr_fib_commit(fib, rt_list); }
+
+    sr_rt_publish(sr, rt_list, fib);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    if(sr->snap)
+    {
+        free(sr->snap->ifs);
+        free(sr->snap);
+    }
+    sr->snap = snap;
+    printf("Loaded %u routes in %.1f ms\n", sr->fib->routes,
+           sr_snapshot_ms(&start));
+    sr_fib_print_stats(sr->fib);
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    return 0;
+} /* -- sr_snapshot_load -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_match(..)
+ * Scope:  Local
+ *
+ * Returns 0 if the interfaces from hwinfo are the ones the snapshot was
+ * compiled with.  Snapshots compiled offline only know interface names.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_snapshot_match(struct sr_instance* sr,
+                             const struct sr_snapshot* snap)
+{
+    const struct sr_if* iface;
+    unsigned int n = 0, i;
+
+    for(iface = sr->if_list; iface; iface = iface->next)
+    { n++; }
+    if((snap->flags & SR_SNAPSHOT_BOUND) && n != snap->nifs)
+    { return -1; }
+
+    for(i = 0; i < snap->nifs; i++)
+    {
+        iface = sr_get_interface(sr, snap->ifs[i].name);
+        if(iface == 0)
+        { return -1; }
+        if((snap->flags & SR_SNAPSHOT_BOUND) &&
+           (iface->ip != snap->ifs[i].ip ||
+            memcmp(iface->addr, snap->ifs[i].addr, ETHER_ADDR_LEN) != 0))
+        { return -1; }
+    }
+
+    return 0;
+} /* -- sr_snapshot_match -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_snapshot_confirm(..)
+ * Scope:  Global
+ *
+ * Called once hwinfo has arrived.  A routing table loaded from a snapshot
+ * that does not match the hardware is replaced by one loaded from text;
+ * a routing table loaded from text is written to sr->snapshot, if set,
+ * for the next start.  Returns 0, or -1 if the fallback failed.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_snapshot_confirm(struct sr_instance* sr)
+{
+    struct sr_snapshot* snap;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    snap = sr->snap;
+    sr->snap = 0;
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    if(snap)
+    {
+        int match = sr_snapshot_match(sr, snap);
+
+        free(snap->ifs);
+        free(snap);
+        if(match == 0)
+        { return 0; }
+
+        fprintf(stderr, "Snapshot does not match the hardware, loading "
+                "routing table from %s\n", sr->rtable ? sr->rtable : "text");
+        if(sr_rt_reload(sr) != 0)
+        { return -1; }
+    }
+
+    if(sr->snapshot)
+    { sr_snapshot_write(sr, sr->snapshot); }
+
+    return 0;
+} /* -- sr_snapshot_confirm -- */
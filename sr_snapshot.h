@@ -0,0 +1,104 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_snapshot.h
+ *
+ * Description:
+ *
+ * Compiled routing table snapshots.  A snapshot holds the routes of a
+ * built FIB, the interfaces they were bound to, the trie in index form
+ * (struct sr_fib_inode) and, for DIR-24-8 FIBs, the lookup tables
+ * themselves.  A restarted router maps it and forwards from the mapped
+ * trie or tables as they are; only the sr_rt list is built, from one
+ * slab.
+ *
+ * The file is machine specific: host byte order, host struct layout.
+ *
+ *   header | interfaces | routes | pad to 4KB | trie nodes | natives
+ *          | pad to 4KB | tbl24 | tbllong
+ *
+ * Routes are sorted by destination and the trie and tables index them
+ * directly; a multipath route is one record per next hop, the indexes
+ * point at the first.
+ * The checksum covers everything after the header.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_SNAPSHOT_H
+#define sr_SNAPSHOT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+#define SR_SNAPSHOT_MAGIC   "srfibsnp"
+#define SR_SNAPSHOT_VERSION 3
+#define SR_SNAPSHOT_ALIGN   4096
+
+/* -- header flags -- */
+#define SR_SNAPSHOT_DIR248  0x1     /* DIR-24-8 tables follow the routes */
+#define SR_SNAPSHOT_BOUND   0x2     /* interface addresses were known */
+
+struct sr_instance;
+
+struct sr_snapshot_hdr
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t nifs;
+    uint32_t nroutes;
+    uint32_t blocks;                  /* tbllong blocks */
+    uint32_t sum_a, sum_b;            /* checksum of the rest of the file */
+    uint32_t rtable_size;             /* the text files compiled in */
+    uint32_t rtable_mtime;
+    uint32_t mrt_size;
+    uint32_t mrt_mtime;
+    uint32_t routes;                  /* prefixes in the FIB */
+    uint32_t default_rt;              /* 1 + route record index, or 0 */
+    uint32_t nodes;                   /* trie nodes, the root first */
+    uint32_t natives;                 /* native arrays of the nodes */
+    uint32_t reserved[3];
+};
+
+struct sr_snapshot_if
+{
+    char name[sr_IFACE_NAMELEN];
+    uint32_t ip;
+    unsigned char addr[ETHER_ADDR_LEN];
+    unsigned char pad[2];
+};
+
+struct sr_snapshot_rt
+{
+    uint32_t dest;                    /* network byte order */
+    uint32_t gw;
+    uint32_t mask;
+    uint32_t ifindex;                 /* into the interface records */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_snapshot
+ *
+ * What sr_snapshot_load() keeps until the server's hwinfo has been checked
+ * against the interfaces the snapshot was compiled with.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_snapshot
+{
+    uint32_t flags;
+    unsigned int nifs;
+    struct sr_snapshot_if* ifs;
+};
+
+int sr_snapshot_write(struct sr_instance*, const char* file);
+int sr_snapshot_load(struct sr_instance*, const char* file);
+int sr_snapshot_confirm(struct sr_instance*);
+void sr_snapshot_sum(const void* buf, size_t len, uint32_t* a, uint32_t* b);
+
+#endif  /* --  sr_SNAPSHOT_H -- */
@@ -0,0 +1,314 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_tap.c
+ *
+ * Description:
+ *
+ * TAP device backend, see sr_tap.h.  The devices are kept by interface
+ * index; every read or write on one moves exactly one frame.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef _LINUX_
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif /* _LINUX_ */
+
+#include "sr_tap.h"
+#include "sr_io.h"
+#include "sr_if.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+
+#ifdef _LINUX_
+
+struct sr_tap
+{
+    int* fds;                   /* by interface index */
+    struct pollfd* pfds;        /* the same, for poll() */
+    unsigned int n;
+    unsigned char* buf;         /* SR_TAP_FRAME bytes, the frame read last */
+    unsigned long frames_in;    /* read, for the router or not */
+    unsigned long frames_out;
+    unsigned long dropped;      /* the device had no room */
+};
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_attach(..)
+ * Scope:  Local
+ *
+ * Open the TAP device dev, creating it if need be, and bring it up.
+ * Returns a non-blocking fd for it, or -1.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_attach(const char* dev)
+{
+    struct ifreq ifr;
+    int fd, s;
+
+    if((fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK)) < 0)
+    {
+        perror("open(..):sr_tap.c::sr_tap_attach(..) /dev/net/tun");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+    if(ioctl(fd, TUNSETIFF, &ifr) < 0)
+    {
+        fprintf(stderr, "Error attaching to TAP device %s: %s\n", dev,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    /* -- a device that stays down drops every frame written to it -- */
+    if((s = socket(AF_INET, SOCK_DGRAM, 0)) >= 0)
+    {
+        if(ioctl(s, SIOCGIFFLAGS, &ifr) == 0 && !(ifr.ifr_flags & IFF_UP))
+        {
+            ifr.ifr_flags |= IFF_UP;
+            if(ioctl(s, SIOCSIFFLAGS, &ifr) < 0)
+            { fprintf(stderr, "Warning: could not bring %s up\n", dev); }
+        }
+        close(s);
+    }
+
+    return fd;
+} /* -- sr_tap_attach -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_drain(..)
+ * Scope:  Local
+ *
+ * Handle up to SR_TAP_BURST frames waiting on the device of interface
+ * index, so one busy device cannot starve the others.  Returns 0, or -1
+ * if the device failed.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_tap_drain(struct sr_instance* sr, unsigned int index)
+{
+    struct sr_tap* tap = sr->tap;
+    struct sr_if* iface = sr->ifs[index];
+    ssize_t len;
+    int n;
+
+    for(n = 0; n < SR_TAP_BURST; n++)
+    {
+        len = read(tap->fds[index], tap->buf, SR_TAP_FRAME);
+        if(len < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            { break; }
+            perror("read(..):sr_tap.c::sr_tap_drain(..)");
+            return -1;
+        }
+
+        tap->frames_in++;
+        if(sr_frame_for_us(iface, tap->buf, len))
+        { sr_receive_packet(sr, tap->buf, len, iface); }
+    }
+
+    return 0;
+} /* -- sr_tap_drain -- */
+
+/* -- wait until a device has frames, then handle a burst from each -- */
+static int sr_tap_read(struct sr_instance* sr)
+{
+    struct sr_tap* tap = sr->tap;
+    unsigned int i;
+
+    if(poll(tap->pfds, tap->n, -1) < 0)
+    {
+        if(errno == EINTR)
+        { return 1; }
+        perror("poll(..):sr_tap.c::sr_tap_read(..)");
+        return -1;
+    }
+
+    for(i = 0; i < tap->n; i++)
+    {
+        if(tap->pfds[i].revents & (POLLERR | POLLNVAL))
+        {
+            fprintf(stderr, "Error: TAP device of %s failed\n",
+                    sr->ifs[i]->name);
+            return -1;
+        }
+        if((tap->pfds[i].revents & POLLIN) && sr_tap_drain(sr, i) != 0)
+        { return -1; }
+    }
+
+    return 1;
+} /* -- sr_tap_read -- */
+
+static int sr_tap_poll(struct sr_instance* sr, int fd)
+{
+    struct sr_tap* tap = sr->tap;
+    unsigned int i;
+
+    for(i = 0; i < tap->n; i++)
+    {
+        if(tap->fds[i] == fd)
+        { return sr_tap_drain(sr, i) == 0 ? 1 : -1; }
+    }
+
+    return 1;
+} /* -- sr_tap_poll -- */
+
+static int sr_tap_fds(struct sr_instance* sr, int* fds, int max)
+{
+    struct sr_tap* tap = sr->tap;
+    int i;
+
+    for(i = 0; i < (int)tap->n && i < max; i++)
+    { fds[i] = tap->fds[i]; }
+    return i;
+} /* -- sr_tap_fds -- */
+
+static int sr_tap_send(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                       struct sr_if* iface)
+{
+    struct sr_tap* tap = sr->tap;
+    ssize_t ret;
+
+    do
+    { ret = write(tap->fds[iface->index], buf, len); }
+    while(ret < 0 && errno == EINTR);
+
+    if(ret < 0)
+    {
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+        { __atomic_add_fetch(&(tap->dropped), 1, __ATOMIC_RELAXED); }
+        else
+        { perror("write(..):sr_tap.c::sr_tap_send(..)"); }
+        return -1;
+    }
+
+    __atomic_add_fetch(&(tap->frames_out), 1, __ATOMIC_RELAXED);
+    return 0;
+} /* -- sr_tap_send -- */
+
+const struct sr_io sr_io_tap =
+{
+    "tap",
+    sr_tap_read,
+    sr_tap_poll,
+    sr_tap_fds,
+    sr_tap_send,
+    0
+};
+
+/* -- open the device of iface, kept at its index -- */
+static int sr_tap_add(struct sr_instance* sr, struct sr_if* iface,
+                      const char* dev)
+{
+    struct sr_tap* tap = sr->tap;
+    int fd;
+
+    if((fd = sr_tap_attach(dev)) < 0)
+    { return -1; }
+
+    tap->fds = (int*)realloc(tap->fds, sr->nifs * sizeof(int));
+    assert(tap->fds);
+    tap->fds[iface->index] = fd;
+    tap->n = sr->nifs;
+    return 0;
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_open(..)
+ * Scope:  Global
+ *
+ * Add the interfaces listed in file, attach each to its TAP device and
+ * make the router do its I/O on them.  Returns 0, or -1 if the file is
+ * bad or a device could not be opened.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_tap_open(struct sr_instance* sr, const char* file)
+{
+    struct sr_tap* tap;
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(file);
+
+    tap = (struct sr_tap*)calloc(1, sizeof(struct sr_tap));
+    assert(tap);
+    tap->buf = (unsigned char*)malloc(SR_TAP_FRAME);
+    assert(tap->buf);
+    sr->tap = tap;
+
+    if(sr_io_config(sr, file, sr_tap_add) != 0)
+    { return -1; }
+
+    tap->pfds = (struct pollfd*)calloc(tap->n, sizeof(struct pollfd));
+    assert(tap->pfds);
+    for(i = 0; i < tap->n; i++)
+    {
+        tap->pfds[i].fd = tap->fds[i];
+        tap->pfds[i].events = POLLIN;
+    }
+
+    sr->io = &sr_io_tap;
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    return 0;
+} /* -- sr_tap_open -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_tap_close(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_tap_close(struct sr_instance* sr)
+{
+    struct sr_tap* tap = sr->tap;
+    unsigned int i;
+
+    if(tap == 0)
+    { return; }
+
+    printf("TAP: %lu frames in, %lu out, %lu dropped with a device full\n",
+           tap->frames_in, tap->frames_out, tap->dropped);
+
+    for(i = 0; i < tap->n; i++)
+    { close(tap->fds[i]); }
+    free(tap->fds);
+    free(tap->pfds);
+    free(tap->buf);
+    free(tap);
+    sr->tap = 0;
+} /* -- sr_tap_close -- */
+
+#else
+
+int sr_tap_open(struct sr_instance* sr, const char* file)
+{
+    fprintf(stderr, "TAP devices are only supported on Linux\n");
+    return -1;
+} /* -- sr_tap_open -- */
+
+void sr_tap_close(struct sr_instance* sr)
+{ }
+
+#endif /* _LINUX_ */
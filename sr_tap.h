@@ -0,0 +1,30 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_tap.h
+ *
+ * Description:
+ *
+ * TAP device backend, sr -i file.  Each interface of the router is a
+ * Linux TAP device, so it can be run against local interfaces, network
+ * namespaces and veth pairs instead of the VNS server.  The interfaces
+ * come from the config file, in the format of sr_io.h.  A device is
+ * created if it does not exist; the router's MAC is its own, not the one
+ * the kernel gave the device.
+ *
+ * The devices are non-blocking.  Frames to other unicast or multicast
+ * addresses, as a bridge floods them, are dropped on the way in; a frame
+ * the device has no room for is dropped on the way out.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_TAP_H
+#define sr_TAP_H
+
+#define SR_TAP_FRAME  (64 * 1024)   /* largest frame a device hands over */
+#define SR_TAP_BURST  64            /* frames read from one device in turn */
+
+struct sr_instance;
+
+int  sr_tap_open(struct sr_instance*, const char* file);
+void sr_tap_close(struct sr_instance*);
+
+#endif  /* --  sr_TAP_H -- */
@@ -0,0 +1,291 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.c
+ *
+ * Description:
+ *
+ * Timing wheel after Varghese and Lauck's hierarchical scheme: a timer
+ * sits in the lowest level whose span covers its remaining time, and the
+ * slots of a higher level are moved down as the level below turns over.
+ * Slot lists are circular with the slot itself as the head, so a timer
+ * can be unlinked or moved without knowing where it is.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <time.h>
+
+#include "sr_timer.h"
+
+static volatile uint64_t sr_clock_cached;
+
+/*---------------------------------------------------------------------
+ * Method: sr_clock_ms(..) / sr_clock_update(..)
+ * Scope:  Global
+ *
+ * Milliseconds on the monotonic clock as of the last sr_clock_update().
+ * The forwarding path and the timer thread update it once per packet and
+ * per wakeup; everything else just reads it.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_clock_ms(void)
+{
+    return __atomic_load_n(&sr_clock_cached, __ATOMIC_RELAXED);
+}
+
+uint64_t sr_clock_update(void)
+{
+    struct timespec ts;
+    uint64_t now;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    __atomic_store_n(&sr_clock_cached, now, __ATOMIC_RELAXED);
+    return now;
+} /* -- sr_clock_update -- */
+
+static void sr_timer_link(struct sr_timer* head, struct sr_timer* t)
+{
+    t->next = head;
+    t->prev = head->prev;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void sr_timer_unlink(struct sr_timer* t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = 0;
+}
+
+static void sr_timer_head(struct sr_timer* head)
+{ head->next = head->prev = head; }
+
+/* -- move the timers of a slot to list, the slot can be refilled while
+      they are handled -- */
+static void sr_timer_take(struct sr_timer* head, struct sr_timer* list)
+{
+    list->next = head->next;
+    list->prev = head->prev;
+    list->next->prev = list;
+    list->prev->next = list;
+    sr_timer_head(head);
+}
+
+void sr_timer_init(struct sr_timer_wheel* w, uint64_t now)
+{
+    int i, j;
+
+    w->now = now;
+    w->pending = 0;
+    for(i = 0; i < SR_TIMER_SLOTS0; i++)
+    { sr_timer_head(&(w->slot0[i])); }
+    for(i = 0; i < SR_TIMER_LEVELS; i++)
+    {
+        for(j = 0; j < SR_TIMER_SLOTSN; j++)
+        { sr_timer_head(&(w->slotn[i][j])); }
+    }
+} /* -- sr_timer_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_place(..)
+ * Scope:  Local
+ *
+ * Link t into the slot for its expiry time.  Timers already due go in the
+ * slot about to run; timers beyond the last level wait in its furthest
+ * slot.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_timer_place(struct sr_timer_wheel* w, struct sr_timer* t)
+{
+    uint64_t when = t->expires < w->now ? w->now : t->expires;
+    uint64_t delta = when - w->now;
+    int level, shift = SR_TIMER_BITS0;
+
+    if(delta < SR_TIMER_SLOTS0)
+    {
+        sr_timer_link(&(w->slot0[when & (SR_TIMER_SLOTS0 - 1)]), t);
+        return;
+    }
+
+    for(level = 0; level < SR_TIMER_LEVELS - 1; level++)
+    {
+        if(delta < (uint64_t)1 << (shift + SR_TIMER_BITSN))
+        { break; }
+        shift += SR_TIMER_BITSN;
+    }
+    if(delta >= (uint64_t)1 << (shift + SR_TIMER_BITSN))
+    { when = w->now + ((uint64_t)1 << (shift + SR_TIMER_BITSN)) - 1; }
+
+    sr_timer_link(&(w->slotn[level][(when >> shift) & (SR_TIMER_SLOTSN - 1)]),
+                  t);
+} /* -- sr_timer_place -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_add(..)
+ * Scope:  Global
+ *
+ * Arm t to fire at expires, rearming it if it is already pending.
+ * t->fn must be set.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_add(struct sr_timer_wheel* w, struct sr_timer* t,
+                  uint64_t expires)
+{
+    /* -- REQUIRES -- */
+    assert(w);
+    assert(t && t->fn);
+
+    if(sr_timer_pending(t))
+    { sr_timer_unlink(t); }
+    else
+    { w->pending++; }
+
+    t->expires = expires;
+    sr_timer_place(w, t);
+} /* -- sr_timer_add -- */
+
+void sr_timer_del(struct sr_timer_wheel* w, struct sr_timer* t)
+{
+    if(sr_timer_pending(t))
+    {
+        sr_timer_unlink(t);
+        w->pending--;
+    }
+} /* -- sr_timer_del -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_moved(..)
+ * Scope:  Global
+ *
+ * t was copied from a pending timer: make its neighbours point at the
+ * copy.  The original must not be used as a timer afterwards.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_timer_moved(struct sr_timer* t)
+{
+    if(sr_timer_pending(t))
+    {
+        t->next->prev = t;
+        t->prev->next = t;
+    }
+} /* -- sr_timer_moved -- */
+
+/* -- move the timers of a higher level slot down, returns its index -- */
+static int sr_timer_cascade(struct sr_timer_wheel* w, int level)
+{
+    int shift = SR_TIMER_BITS0 + level * SR_TIMER_BITSN;
+    int index = (w->now >> shift) & (SR_TIMER_SLOTSN - 1);
+    struct sr_timer* head = &(w->slotn[level][index]);
+    struct sr_timer list;
+
+    if(head->next == head)
+    { return index; }
+
+    sr_timer_take(head, &list);
+
+    while(list.next != &list)
+    {
+        struct sr_timer* t = list.next;
+
+        sr_timer_unlink(t);
+        sr_timer_place(w, t);
+    }
+
+    return index;
+} /* -- sr_timer_cascade -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_run(..)
+ * Scope:  Global
+ *
+ * Advance the wheel through now, calling fn(t, arg) for every timer that
+ * expired.  A callback may add or delete any timer, including its own.
+ * Returns the number of timers that fired.
+ *
+ *---------------------------------------------------------------------*/
+
+unsigned int sr_timer_run(struct sr_timer_wheel* w, uint64_t now, void* arg)
+{
+    unsigned int fired = 0;
+
+    /* -- REQUIRES -- */
+    assert(w);
+
+    while(w->now <= now)
+    {
+        int index = w->now & (SR_TIMER_SLOTS0 - 1);
+        struct sr_timer* head = &(w->slot0[index]);
+        struct sr_timer list;
+        int level;
+
+        if(w->pending == 0)
+        {
+            w->now = now + 1;
+            break;
+        }
+
+        if(index == 0)
+        {
+            for(level = 0; level < SR_TIMER_LEVELS; level++)
+            {
+                if(sr_timer_cascade(w, level) != 0)
+                { break; }
+            }
+        }
+
+        /* -- the tick is over before callbacks run: timers they add that
+              are already due go in the next slot, not this one -- */
+        w->now++;
+        if(head->next == head)
+        { continue; }
+
+        sr_timer_take(head, &list);
+        while(list.next != &list)
+        {
+            struct sr_timer* t = list.next;
+
+            sr_timer_unlink(t);
+            w->pending--;
+            fired++;
+            t->fn(t, arg);
+        }
+    }
+
+    return fired;
+} /* -- sr_timer_run -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_next(..)
+ * Scope:  Global
+ *
+ * The earliest tick at which sr_timer_run() can have anything to do: the
+ * first busy level 0 slot, or else the next time level 0 turns over and
+ * timers move down.  (uint64_t)-1 if no timer is pending.
+ *
+ *---------------------------------------------------------------------*/
+
+uint64_t sr_timer_next(const struct sr_timer_wheel* w)
+{
+    uint64_t t;
+
+    /* -- REQUIRES -- */
+    assert(w);
+
+    if(w->pending == 0)
+    { return (uint64_t)-1; }
+
+    for(t = w->now; ; t++)
+    {
+        const struct sr_timer* head = &(w->slot0[t & (SR_TIMER_SLOTS0 - 1)]);
+
+        if(head->next != head)
+        { return t; }
+        if(((t + 1) & (SR_TIMER_SLOTS0 - 1)) == 0)
+        { return t + 1; }
+    }
+} /* -- sr_timer_next -- */
@@ -0,0 +1,73 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.h
+ *
+ * Description:
+ *
+ * Hierarchical timing wheel with millisecond ticks, and the cached
+ * monotonic clock it runs on.  Level 0 has a slot per millisecond for the
+ * next 256 ms; each higher level has 64 slots, each covering a whole turn
+ * of the level below, so four levels reach about 18 hours.  Timers further
+ * out wait in the last level and are placed again when it turns.
+ *
+ * Adding or removing a timer is O(1).  Running the wheel costs one slot
+ * per elapsed millisecond plus the timers that fire, and a timer is moved
+ * down at most once per level on the way.
+ *
+ * Timers are intrusive: the caller embeds a struct sr_timer and owns the
+ * locking.  A pending timer that is copied elsewhere must be handed to
+ * sr_timer_moved() before its old copy is reused.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef sr_TIMER_H
+#define sr_TIMER_H
+
+#include <stddef.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_TIMER_BITS0   8
+#define SR_TIMER_BITSN   6
+#define SR_TIMER_SLOTS0  (1 << SR_TIMER_BITS0)
+#define SR_TIMER_SLOTSN  (1 << SR_TIMER_BITSN)
+#define SR_TIMER_LEVELS  3        /* above level 0 */
+
+/* -- the structure holding the embedded timer t -- */
+#define sr_timer_owner(t, type, member) \
+    ((type*)((char*)(t) - offsetof(type, member)))
+
+struct sr_timer
+{
+    struct sr_timer* next;        /* 0 while not pending */
+    struct sr_timer* prev;
+    uint64_t expires;             /* on sr_clock_ms() */
+    void (*fn)(struct sr_timer*, void* arg);
+};
+
+struct sr_timer_wheel
+{
+    uint64_t now;                 /* next tick to run */
+    unsigned int pending;
+    struct sr_timer slot0[SR_TIMER_SLOTS0];     /* list heads */
+    struct sr_timer slotn[SR_TIMER_LEVELS][SR_TIMER_SLOTSN];
+};
+
+uint64_t sr_clock_ms(void);
+uint64_t sr_clock_update(void);
+
+void sr_timer_init(struct sr_timer_wheel*, uint64_t now);
+void sr_timer_add(struct sr_timer_wheel*, struct sr_timer*, uint64_t expires);
+void sr_timer_del(struct sr_timer_wheel*, struct sr_timer*);
+void sr_timer_moved(struct sr_timer*);
+unsigned int sr_timer_run(struct sr_timer_wheel*, uint64_t now, void* arg);
+uint64_t sr_timer_next(const struct sr_timer_wheel*);
+
+#define sr_timer_pending(t) ((t)->next != 0)
+
+#endif  /* --  sr_TIMER_H -- */
@@ -30,6 +30,25 @@ uint8_t ip_protocol(uint8_t *buf) {
   return iphdr->ip_p;
 }
 
+/* Hashes the 5-tuple of the IP packet in buf, so every packet of a flow
+   gets the same value.  Fragments and protocols without ports hash on
+   addresses and protocol only, otherwise a fragmented flow would be
+   split across paths. */
+uint32_t flow_hash(const uint8_t *buf, unsigned int len) {
+  const sr_ip_hdr_t *iphdr = (const sr_ip_hdr_t *)buf;
+  unsigned int hl = iphdr->ip_hl * 4;
+  uint32_t ports = 0, h;
+
+  if ((iphdr->ip_p == ip_protocol_tcp || iphdr->ip_p == ip_protocol_udp) &&
+      (ntohs(iphdr->ip_off) & (IP_MF | IP_OFFMASK)) == 0 && len >= hl + 4)
+    memcpy(&ports, buf + hl, 4);
+
+  h = iphdr->ip_src * 0x9e3779b1U;
+  h = (h ^ iphdr->ip_dst) * 0x85ebca6bU;
+  h = (h ^ ports ^ iphdr->ip_p) * 0xc2b2ae35U;
+  return h ^ (h >> 16);
+}
+
 
 /* Prints out formatted Ethernet address, e.g. 00:11:22:33:44:55 */
 void print_addr_eth(uint8_t *addr) {
@@ -32,6 +32,7 @@ uint16_t cksum(const void *_data, int len);
 
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
+uint32_t flow_hash(const uint8_t *buf, unsigned int len);
 
 void print_addr_eth(uint8_t *addr);
 void print_addr_ip(struct in_addr address);
@@ -31,24 +31,27 @@
 #include <netdb.h>
 #include <errno.h>
 
+#include <pthread.h>
+
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
 
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_if.h"
+#include "sr_rt.h"
 #include "sr_protocol.h"
+#include "sr_snapshot.h"
+#include "sr_io.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
-static int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                                  uint8_t * packet /* lent */,
-                                  unsigned int len,
-                                  char* interface  /* lent */);
+static int sr_vns_flush(struct sr_instance* , int );
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
 
 /*-----------------------------------------------------------------------------
@@ -81,6 +84,7 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
     c_open_template ot;
     char* buf;
     uint32_t buf_len;
+    int nodelay = 1;
 
     /* REQUIRES */
     assert(sr);
@@ -121,6 +125,12 @@ int sr_connect_to_server(struct sr_instance* sr,unsigned short port,
         return -1;
     }
 
+    /* -- frames are batched here, Nagle would only hold the last of a
+     *    burst back waiting for an ACK -- */
+    if (setsockopt(sr->sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                   sizeof(nodelay)) < 0)
+    { perror("setsockopt(..):sr_client.c::sr_connect_to_server(..)"); }
+
     /* wait for authentication to be completed (server sends the first message) */
     if(sr_read_from_server_expect(sr, VNS_AUTH_REQUEST)!= 1 ||
        sr_read_from_server_expect(sr, VNS_AUTH_STATUS) != 1)
@@ -201,6 +211,8 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWSPEED:
                 /* Debug("Speed: %d\n",
                         ntohl(*((unsigned int*)hwinfo->mHWInfo[i].value))); */
+                sr_set_ether_speed(sr,
+                        ntohl(*((uint32_t*)hwinfo->mHWInfo[i].value)));
                 break;
             case HWSUBNET:
                 /* Debug("Subnet: %s\n",inet_ntoa(
@@ -318,97 +330,173 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
     return status->auth_ok;
 }
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_fill(..)
+ * Scope: Local
+ *
+ * recv() as much of the stream as fits behind the unhandled bytes, moving
+ * them to the front first if an incomplete command might not fit.  Returns
+ * the number of bytes received, 0 if a non-blocking socket had none, or
+ * -1 on error or if the server closed the connection.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_fill(struct sr_instance* sr)
+{
+    struct sr_vns_rx* rx = &(sr->rx);
+    int ret;
+
+    if(rx->buf == 0)
+    {
+        if((rx->buf = (unsigned char*)malloc(SR_VNS_RXBUF)) == 0)
+        {
+            fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+            return -1;
+        }
+        rx->start = rx->end = 0;
+    }
+
+    if(SR_VNS_RXBUF - rx->end < SR_VNS_MAXCMD)
+    {
+        memmove(rx->buf, rx->buf + rx->start, rx->end - rx->start);
+        rx->end -= rx->start;
+        rx->start = 0;
+    }
+
+    do
+    { /* -- just in case SIGALRM breaks recv -- */
+        ret = recv(sr->sockfd, rx->buf + rx->end, SR_VNS_RXBUF - rx->end, 0);
+    } while(ret == -1 && errno == EINTR);
+    rx->reads++;
+
+    if(ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    { return 0; }
+    if(ret == -1)
+    {
+        perror("recv(..):sr_client.c::sr_read_from_server");
+        return -1;
+    }
+    if(ret == 0)
+    {
+        fprintf(stderr,"Error: VNS server closed the connection\n");
+        return -1;
+    }
+
+    rx->end += ret;
+    return ret;
+} /* -- sr_vns_fill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_next(..)
+ * Scope: Local
+ *
+ * The length of the next complete command at rx->buf + rx->start, 0 if
+ * only part of it has been received, or -1 if the length is bad.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_next(struct sr_instance* sr)
+{
+    struct sr_vns_rx* rx = &(sr->rx);
+    uint32_t len;
+
+    if(rx->end - rx->start < sizeof(c_base))
+    { return 0; }
+
+    memcpy(&len, rx->buf + rx->start, sizeof(len));
+    len = ntohl(len);
+
+    if ( len > SR_VNS_MAXCMD || len < sizeof(c_base) )
+    {
+        fprintf(stderr,"Error: command length to large %u\n",len);
+        close(sr->sockfd);
+        return -1;
+    }
+
+    return rx->end - rx->start < len ? 0 : (int)len;
+} /* -- sr_vns_next -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_read_from_server(..)
  * Scope: global
  *
  * Houses main while loop for communicating with the virtual router server.
+ * Handles the next command and every complete one the same recv() brought
+ * with it, then sends the frames they produced together.
  *
  *---------------------------------------------------------------------------*/
 
 int sr_read_from_server(struct sr_instance* sr /* borrowed */)
 {
-    return sr_read_from_server_expect(sr, 0);
+    int ret;
+
+    /* -- the replies wait for the end of the burst; the ring is not
+     *    refilled before then, so frames in it can be sent from there -- */
+    sr->tx.owner = pthread_self();
+    sr->tx.batching = sr->tx.batch;
+
+    do
+    { ret = sr_read_from_server_expect(sr, 0); }
+    while(ret == 1 && sr_vns_next(sr) > 0);
+
+    sr->tx.batching = 0;
+    sr_vns_flush(sr, 0);
+
+    return ret;
 }
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_poll_server(..)
+ * Scope: global
+ *
+ * sr_read_from_server() for the event loop: take what a non-blocking
+ * socket has and handle the complete commands in it, never waiting for
+ * the rest of one.  Returns 1 to go on, 0 or -1 like sr_read_from_server().
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_poll_server(struct sr_instance* sr /* borrowed */)
+{
+    int len;
+
+    if(sr_vns_fill(sr) < 0)
+    { return -1; }
+    if((len = sr_vns_next(sr)) <= 0)
+    { return len == 0 ? 1 : -1; }
+
+    return sr_read_from_server(sr);
+} /* -- sr_poll_server -- */
+
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
 {
     int command, len;
     unsigned char *buf = 0;
     c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    struct sr_if* iface;
+    int ret = 0;
 
     /* REQUIRES */
     assert(sr);
 
     /*---------------------------------------------------------------------------
-      Read a command from the server
+      Read a command from the server, unless the last read already did
       -------------------------------------------------------------------------*/
 
-    bytes_read = 0;
-
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
+    while((len = sr_vns_next(sr)) == 0)
     {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
+        if(sr_vns_fill(sr) < 0)
+        { return -1; }
     }
+    if(len < 0)
+    { return -1; }
 
-    len = ntohl(len);
-
-    if ( len > 10000 || len < 0 )
-    {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
-    }
-
-    if((buf = malloc(len)) == 0)
-    {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
-    }
-
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
-
-    bytes_read = 0;
-
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
-    {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
+    /* -- the command is handled in place, its bytes are free after -- */
+    buf = sr->rx.buf + sr->rx.start;
+    sr->rx.start += len;
+    sr->rx.cmds++;
 
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    memcpy(&command, buf + sizeof(uint32_t), sizeof(command));
+    command = ntohl(command);
 
     /* make sure the command is what we expected if we were expecting something */
     if(expected_cmd && command!=expected_cmd) {
@@ -426,24 +514,18 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNSPACKET:
             sr_pkt = (c_packet_ethernet_header *)buf;
 
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
-
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+            iface = sr_get_interface(sr, sr_pkt->mInterfaceName);
+            if ( iface == 0 ){
+                fprintf(stderr, "Dropping packet from unknown interface %s.\n",
+                        sr_pkt->mInterfaceName);
+                break;
+            }
 
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
+            sr_receive_packet(sr,
                     (buf+sizeof(c_packet_header)),
                     len - sizeof(c_packet_ethernet_header) +
                     sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+                    iface);
 
             break;
 
@@ -453,9 +535,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -469,12 +548,8 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
         case VNSHWINFO:
             sr_handle_hwinfo(sr,(c_hwinfo*)buf);
-            if(sr_verify_routing_table(sr) != 0)
-            {
-                fprintf(stderr,"Routing table not consistent with hardware\n");
-                return -1;
-            }
-            printf(" <-- Ready to process packets --> \n");
+            if(sr_interfaces_ready(sr) != 0)
+            { return -1; }
             break;
 
             /* ---------------- VNS_RTABLE ---------------- */
@@ -501,167 +576,277 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
 }/* -- sr_read_from_server -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_ether_addrs_match_interface(..)
+ * Method: sr_vns_hold(..)
  * Scope: Local
  *
- * Make sure ethernet addresses are sane so we don't muck uo the system.
+ * Copy n buffers, headers and frames in pairs, behind what is already
+ * held for the socket.  Frames none of which went out yet are dropped if
+ * too much is held; the rest of a write that started is always kept, or
+ * the stream would break off in the middle of a command.
  *
- *----------------------------------------------------------------------------*/
+ *---------------------------------------------------------------------------*/
 
-static int
-sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
-                                uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+static int sr_vns_hold(struct sr_instance* sr, const struct iovec* iov, int n,
+                       int started)
 {
-    struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
-
-    /* -- REQUIRES -- */
-    assert(sr);
-    assert(buf);
-    assert(name);
+    struct sr_vns_tx* tx = &(sr->tx);
+    unsigned char* held;
+    size_t len = 0, size;
+    int i;
 
-    ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
+    for(i = 0; i < n; i++)
+    { len += iov[i].iov_len; }
 
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
+    if(!started && tx->held_len + len > SR_VNS_TXHELD)
+    {
+        tx->dropped += n / 2;
+        return -1;
     }
 
-    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
-        return 0;
+    if(tx->held_start + tx->held_len + len > tx->held_size)
+    {
+        if(tx->held_start > 0)
+        {
+            memmove(tx->held, tx->held + tx->held_start, tx->held_len);
+            tx->held_start = 0;
+        }
+        size = tx->held_size ? tx->held_size : SR_VNS_TXDATA;
+        while(size < tx->held_len + len)
+        { size *= 2; }
+        if(size != tx->held_size)
+        {
+            if((held = (unsigned char*)realloc(tx->held, size)) == 0)
+            {
+                fprintf(stderr,"Error: out of memory (sr_send_packet)\n");
+                tx->dropped += n / 2;
+                return -1;
+            }
+            tx->held = held;
+            tx->held_size = size;
+        }
     }
 
-    /* TODO */
-    /* Check destination, hardware address.  If it is private (i.e. destined
-     * to a virtual interface) ensure it is going to the correct topology
-     * Note: This check should really be done server side ...
-     */
-
-    return 1;
+    held = tx->held + tx->held_start + tx->held_len;
+    for(i = 0; i < n; i++)
+    {
+        memcpy(held, iov[i].iov_base, iov[i].iov_len);
+        held += iov[i].iov_len;
+    }
+    tx->held_len += len;
 
-} /* -- sr_ether_addrs_match_interface -- */
+    return 0;
+} /* -- sr_vns_hold -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_send_packet(..)
- * Scope: Global
+ * Method: sr_vns_writev(..)
+ * Scope: Local
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * Write n buffers to the server with as few sendmsg() calls as it takes,
+ * continuing where a short write stopped.  The iovecs are used up.  On a
+ * non-blocking socket whatever it does not take is held, see
+ * sr_vns_hold().
  *
  *---------------------------------------------------------------------------*/
 
-int sr_send_packet(struct sr_instance* sr /* borrowed */,
-                         uint8_t* buf /* borrowed */ ,
-                         unsigned int len,
-                         const char* iface /* borrowed */)
+static int sr_vns_writev(struct sr_instance* sr, struct iovec* iov, int n,
+                         int more)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct msghdr msg;
+    ssize_t ret;
+    int started = 0;
 
-    /* REQUIRES */
-    assert(sr);
-    assert(buf);
-    assert(iface);
+    /* -- nothing overtakes the frames already held -- */
+    if(sr->tx.held_len > 0)
+    { return sr_vns_hold(sr, iov, n, 0); }
 
-    /* don't waste my time ... */
-    if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
-        return -1;
+    memset(&msg, 0, sizeof(msg));
+    while(n > 0)
+    {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ret = sendmsg(sr->sockfd, &msg, more ? MSG_MORE : 0);
+        __atomic_add_fetch(&(sr->tx.writes), 1, __ATOMIC_RELAXED);
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            { return sr_vns_hold(sr, iov, n, started); }
+            fprintf(stderr, "Error writing packet\n");
+            return -1;
+        }
+        started = 1;
+
+        while(n > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if(n > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    return 0;
+} /* -- sr_vns_writev -- */
 
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send(..)
+ * Scope: Local
+ *
+ * Send a frame that passed sr_send_packet_if()'s checks to the server, to
+ * be injected onto the wire.  While sr_read_from_server() drains a burst,
+ * frames from its thread are only queued; see struct sr_vns_tx.
+ *
+ *---------------------------------------------------------------------------*/
 
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
-        return -1;
+static int sr_vns_send(struct sr_instance* sr /* borrowed */,
+                       uint8_t* buf /* borrowed */ ,
+                       unsigned int len,
+                       struct sr_if* iface /* borrowed */)
+{
+    struct sr_vns_tx* tx = &(sr->tx);
+    c_packet_header one;
+    c_packet_header *sr_pkt;
+    struct iovec iov[2];
+    uint8_t* frame = buf;
+
+    __atomic_add_fetch(&(tx->frames), 1, __ATOMIC_RELAXED);
+
+    if ( !tx->batching || !pthread_equal(tx->owner, pthread_self()) ||
+         len > SR_VNS_TXDATA ){
+        /* -- the header goes out in front of the caller's buffer -- */
+        one.mLen  = htonl(len + sizeof(c_packet_header));
+        one.mType = htonl(VNSPACKET);
+        strncpy(one.mInterfaceName,iface->name,16);
+        iov[0].iov_base = &one;
+        iov[0].iov_len = sizeof(c_packet_header);
+        iov[1].iov_base = buf;
+        iov[1].iov_len = len;
+        return sr_vns_writev(sr, iov, 2, 0);
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        return -1;
+    /* -- a frame still in the receive ring stays put until the flush -- */
+    if ( !(sr->rx.buf && buf >= sr->rx.buf &&
+           buf + len <= sr->rx.buf + SR_VNS_RXBUF) ){
+        if ( tx->data == 0 &&
+             (tx->data = (unsigned char*)malloc(SR_VNS_TXDATA)) == 0 ){
+            fprintf(stderr,"Error: out of memory (sr_send_packet)\n");
+            return -1;
+        }
+        if ( tx->used + len > SR_VNS_TXDATA )
+        { sr_vns_flush(sr, 1); }
+        frame = tx->data + tx->used;
+        memcpy(frame, buf, len);
+        tx->used += len;
     }
 
-    free(sr_pkt);
+    sr_pkt = &(tx->hdr[tx->n]);
+    sr_pkt->mLen  = htonl(len + sizeof(c_packet_header));
+    sr_pkt->mType = htonl(VNSPACKET);
+    strncpy(sr_pkt->mInterfaceName,iface->name,16);
+    tx->iov[2 * tx->n].iov_base = sr_pkt;
+    tx->iov[2 * tx->n].iov_len = sizeof(c_packet_header);
+    tx->iov[2 * tx->n + 1].iov_base = frame;
+    tx->iov[2 * tx->n + 1].iov_len = len;
+
+    if ( ++tx->n == SR_VNS_TXBATCH )
+    { return sr_vns_flush(sr, 1); }
 
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_vns_send -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_log_packet()
+ * Method: sr_vns_flush(..)
  * Scope: Local
  *
+ * Write the frames batched so far in one sendmsg().  more is set while the
+ * burst goes on, so TCP holds a partial segment back for what follows, as
+ * TCP_CORK would; the flush at the end of the burst clears it and pushes
+ * everything out.  Returns 0, or -1 if the write failed.
+ *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+static int sr_vns_flush(struct sr_instance* sr, int more)
 {
-    struct pcap_pkthdr h;
-    int size;
+    struct sr_vns_tx* tx = &(sr->tx);
+    int ret;
 
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
-    {return; }
-
-    size = min(PACKET_DUMP_SIZE, len);
+    if(tx->n == 0)
+    { return 0; }
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+    ret = sr_vns_writev(sr, tx->iov, 2 * tx->n, more);
+    tx->n = 0;
+    tx->used = 0;
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
-} /* -- sr_log_packet -- */
+    return ret;
+} /* -- sr_vns_flush -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_arp_req_not_for_us()
- * Scope: Local
+ * Method: sr_write_held(..)
+ * Scope: Global
+ *
+ * Write as much of what the non-blocking socket would not take before as
+ * it takes now.  Returns 0, or -1 if the write failed; anything left is
+ * still in sr->tx.held.
  *
  *---------------------------------------------------------------------------*/
 
-int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                           uint8_t * packet /* lent */,
-                           unsigned int len,
-                           char* interface  /* lent */)
+int sr_write_held(struct sr_instance* sr)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
-    struct sr_ethernet_hdr* e_hdr = 0;
-    struct sr_arp_hdr*       a_hdr = 0;
+    struct sr_vns_tx* tx = &(sr->tx);
+    ssize_t ret;
 
-    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
-    { return 0; }
+    /* REQUIRES */
+    assert(sr);
 
-    assert(iface);
+    while(tx->held_len > 0)
+    {
+        ret = send(sr->sockfd, tx->held + tx->held_start, tx->held_len, 0);
+        __atomic_add_fetch(&(tx->writes), 1, __ATOMIC_RELAXED);
+        if(ret < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            { return 0; }
+            fprintf(stderr, "Error writing packet\n");
+            return -1;
+        }
+        tx->held_start += ret;
+        tx->held_len -= ret;
+    }
+    tx->held_start = 0;
 
-    e_hdr = (struct sr_ethernet_hdr*)packet;
-    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+    return 0;
+} /* -- sr_write_held -- */
 
-    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
-            (a_hdr->ar_op      == htons(arp_op_request))   &&
-            (a_hdr->ar_tip     != iface->ip ) )
-    { return 1; }
+/* -- the socket is the only fd -- */
+static int sr_vns_poll(struct sr_instance* sr, int fd)
+{ return sr_poll_server(sr); }
 
-    return 0;
-} /* -- sr_arp_req_not_for_us -- */
+static int sr_vns_fds(struct sr_instance* sr, int* fds, int max)
+{
+    fds[0] = sr->sockfd;
+    return 1;
+}
+
+const struct sr_io sr_io_vns =
+{
+    "vns",
+    sr_read_from_server,
+    sr_vns_poll,
+    sr_vns_fds,
+    sr_vns_send,
+    sr_vns_flush
+};